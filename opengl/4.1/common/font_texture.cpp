@@ -4,6 +4,7 @@
 
 // OpenGL utilities header
 #include "font_texture.h"
+#include "shader.h"
 
 
 /**
@@ -87,7 +88,7 @@ void FontTexture::initGL()
 {
    glGenTextures(1, &_id);
    
-   glBindTexture(GL_TEXTURE_2D, _id);
+   GL::State::current().bindTexture(GL_TEXTURE_2D, _id);
    //   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
    //   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
    
@@ -103,7 +104,7 @@ void FontTexture::initGL()
  */
 void FontTexture::freeGL()
 {
-   glDeleteTextures(1, &_id);
+   GL::State::current().deleteTextures(1, &_id);
 }
 
 /*
@@ -443,7 +444,7 @@ void FontTexture::createBitmap(const std::string& text)
 void FontTexture::update()
 {
    createBitmap(_text);
-   glBindTexture(GL_TEXTURE_2D, _id);
+   GL::State::current().bindTexture(GL_TEXTURE_2D, _id);
    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, _texWidth, _texHeight, 0, GL_RGBA, GL_UNSIGNED_BYTE, _data);
 
    _texSize = glm::vec2((float)_texWidth, (float)_texHeight);
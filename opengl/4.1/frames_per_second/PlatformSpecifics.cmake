@@ -147,3 +147,10 @@ else(APPLE)
   )
 
 endif(APPLE)
+
+# OpenMP is optional, the procedural shapes are generated serially without it
+find_package(OpenMP)
+if(OPENMP_FOUND)
+  set(CMAKE_C_FLAGS "${CMAKE_C_FLAGS} ${OpenMP_C_FLAGS}")
+  set(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} ${OpenMP_CXX_FLAGS}")
+endif(OPENMP_FOUND)
@@ -3,12 +3,15 @@
 //
 // Author: Jeff Bowles <jbowles@riskybacon.com>
 
+#include <stddef.h>
+#include <stdlib.h>
 #include <iostream>
 #include <fstream>
 #include <vector>
 #include <sstream>
 #include <iomanip>
 #include <utility>
+#include <algorithm>
 
 #define _USE_MATH_DEFINES
 #include <math.h>
@@ -40,6 +43,7 @@ using std::make_pair;
 #include <shader.h>
 #include <font_texture.h>
 #include <GLFW/glfw3.h>
+#include "procedural.h"
 #include "config.h"
 
 // Global variables have an underscore prefix.
@@ -64,8 +68,6 @@ enum BUFFER_OBJECTS
    QUAD_NORMAL,
    QUAD_TC,
    TORUS_POS,
-   TORUS_NORMAL,
-   TORUS_TC,
    TORUS_TRI_IDX,
    TORUS_LINES_IDX,
    NUM_BUFFER_OBJECTS
@@ -86,6 +88,25 @@ std::vector<GLsizei> _vaoElements; //< Number of elements to draw in a VAO
 GL::Program* _shadowProgram;       //< Shader program that performs shadow mapping
 GL::Program* _flatProgram;         //< Shader program that performs no shading - all fragment get the same color
 GL::Program* _texProgram;          //< Shader program that performs texture mapping - no shading
+GL::State&   _state = GL::State::current(); //< Skips binds and state changes that are already current
+
+// Uniform locations, looked up once the programs have linked
+struct FlatUniforms
+{
+   GL::Uniform<mat4>  mvp;
+};
+
+struct ShadowUniforms
+{
+   GL::Uniform<mat4>  mvp;
+   GL::Uniform<mat4>  toShadowTex;
+   GL::Uniform<GLint> depthMap;
+   GL::Uniform<vec2>  texmapScale;
+};
+
+FlatUniforms   _flatUniforms;      //< Uniforms of _flatProgram
+ShadowUniforms _shadowUniforms;    //< Uniforms of _shadowProgram
+FlatUniforms   _texUniforms;       //< Uniforms of _texProgram
 
 glm::mat4    _projection;          //< Camera projection matrix
 
@@ -133,6 +154,18 @@ FontTexture* _fontTexture;         //< Font texture that has the FPS
 
 glm::vec2    _dpi;                 //< Dots per inch for the screen.
 
+// Benchmark mode, see runBenchmark()
+struct BenchmarkOptions
+{
+   vector<int> tessellations;      //< Torus resolutions, numc = numt
+   vector<int> shadowMapSizes;     //< Shadow map widths and heights
+   int         frames;             //< Frames timed per configuration
+   int         warmup;             //< Frames drawn first and not timed
+   std::string csvFile;            //< Where the results go, stdout if empty
+};
+bool         _benchmark;           //< True to sweep configurations instead of running interactively
+bool         _serialPrograms;      //< True to build each program in turn, waiting for each
+
 // Log file
 std::ofstream _log;	//< Log file
 
@@ -161,9 +194,9 @@ void logException(const std::runtime_error& exception)
  */
 void terminate(int exitCode)
 {
-   glDeleteVertexArrays(NUM_VAO_OBJECTS, &_vao[0]);
+   _state.deleteVertexArrays(NUM_VAO_OBJECTS, &_vao[0]);
    glDeleteBuffers(NUM_BUFFER_OBJECTS, &_buffers[0]);
-   glDeleteTextures(NUM_FBO_TEXTURES, &_fboTextures[0]);
+   _state.deleteTextures(NUM_FBO_TEXTURES, &_fboTextures[0]);
    glfwTerminate();
    
    exit(exitCode);
@@ -224,14 +257,17 @@ void fboStatus(void)
 /**
  * Create an FBO that has an RGBA 32-bit floating point texture
  * and a texture for holding depth values
+ *
+ * @param size
+ *    Width and height of the shadow map
  */
-void createFBO(void)
+void createFBO(int size = 512)
 {
    GL_ERR_CHECK();
    try
    {
-      _fboWidth = 512;
-      _fboHeight = 512;
+      _fboWidth = size;
+      _fboHeight = size;
       
       _texmapScale = vec2(1.0f / _fboWidth, 1.0f / _fboHeight);
       
@@ -249,7 +285,7 @@ void createFBO(void)
       //------------------------------------------------------------------------------------------
       // Set up the texture to hold depth data
       //------------------------------------------------------------------------------------------
-      glBindTexture(GL_TEXTURE_2D, _fboTextures[DEPTH]);
+      _state.bindTexture(GL_TEXTURE_2D, _fboTextures[DEPTH]);
       glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, _fboWidth, _fboHeight, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
       glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
       glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
@@ -263,7 +299,7 @@ void createFBO(void)
       // Create the frame buffer object
       //------------------------------------------------------------------------------------------
       glGenFramebuffers(1, &_fbo);
-      glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
+      _state.bindFramebuffer(GL_FRAMEBUFFER, _fbo);
       GL_ERR_CHECK();
       
       //------------------------------------------------------------------------------------------
@@ -280,8 +316,8 @@ void createFBO(void)
       GL_ERR_CHECK();
       
       // Return to default OpenGL state
-      glBindFramebuffer(GL_FRAMEBUFFER, 0);
-      glBindTexture(GL_TEXTURE_2D, 0);
+      _state.bindFramebuffer(GL_FRAMEBUFFER, 0);
+      _state.bindTexture(GL_TEXTURE_2D, 0);
       // Set the drawing buffer
       glDrawBuffer(GL_BACK);
       // Set the reading buffer
@@ -296,6 +332,17 @@ void createFBO(void)
    GL_ERR_CHECK();
 }
 
+/**
+ * Delete the FBO and its textures, so createFBO() can make them again
+ * at another size
+ */
+void deleteFBO(void)
+{
+   _state.deleteFramebuffers(1, &_fbo);
+   _state.deleteTextures(NUM_FBO_TEXTURES, _fboTextures);
+   _fbo = 0;
+}
+
 
 /**
  * Create torus vertex array object
@@ -311,188 +358,93 @@ void createFBO(void)
  */
 void createTorus(int numc, int numt, double radiusInner = 2, double radiusOuter = 2.3)
 {
-   int i, j;
-   
-   // Radius of the circles
-   double radiusMiddle = abs((radiusOuter - radiusInner) * 0.5);
-   // Distance from center of torus to the center of the circles
-   double distToMiddle = radiusInner + radiusMiddle;
-   
-   // First step is to create a single circle and translate it out along
-   // the x-axis
-   vector<vec4> circlePos;
-   circlePos.reserve(numc);
-
-   vector<vec4> circleNormal;
-   circleNormal.reserve(numc);
-   
-   for(int i = 0; i < numt; i++)
-   {
-      double theta = i * 2 * M_PI / numc;
-      double y = sin(theta) * radiusMiddle;
-      double x = cos(theta) * radiusMiddle + distToMiddle;
-      
-      vec4 pos4(x,y,0,1);
-      vec3 normal3 = normalize(vec3(x,y,0));
-      vec4 normal4(normal3.x, normal3.y, normal3.z, 0);
-      
-      circlePos.push_back(pos4);
-      circleNormal.push_back(normal4);
-   }
-
-   // After the initial circle is created, make numc copies of the circle, but
-   // rotate them about the y-axis
-   vector<vec4> pos;
-   vector<vec4> normals;
-   vector<vec2> tc;
-   pos.reserve(numc * numt);
-   normals.reserve(numc * numt);
-   tc.reserve(numc * numt);
+   double start = glfwGetTime();
 
-   for(int j = 0; j < numc; j++)
+   // Generate the vertices straight into the buffer, interleaved
+   GLuint numVertices = Procedural::numVertices(numc, numt);
+   GLsizeiptr size = numVertices * sizeof(Procedural::Vertex);
+   glBindBuffer(GL_ARRAY_BUFFER, _buffers[TORUS_POS]);
+   glBufferData(GL_ARRAY_BUFFER, size, NULL, GL_STATIC_DRAW);
+   Procedural::Vertex* vertices = (Procedural::Vertex*)
+      glMapBufferRange(GL_ARRAY_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+   if(!vertices)
    {
-      float t = j / float(numc);
-      
-      quat rot(vec3(0.0f, t * 2 * M_PI, 0.0f));
-      
-      for(unsigned int i = 0; i < circlePos.size(); i++)
-      {
-         float s = i / float(circlePos.size());
-         
-         vec4 vPos = circlePos.at(i);
-         vec4 vNormal = circleNormal.at(i);
-         
-         pos.push_back(rot * vPos);
-         normals.push_back(normalize(rot * vNormal));
-         tc.push_back(vec2(s,t));
-      }
+      throw std::runtime_error("Could not map the torus vertex buffer");
    }
-   
-   // Now that the points, normals and texture coordinates have been created, set up the element indices
-   // to draw the points in the proper order. There are different orders for wireframe and triangle meshes.
-   
-   vector<GLuint> triIdx;
-   vector<GLuint> linesIdx;
-   
-   for(i = 0; i < numc; i++)
-   {
-      int nextCol = i + 1;
-      if(nextCol >= numc)
-      {
-         nextCol = 0;
-      }
+   Procedural::torus(numc, numt, GLfloat(radiusInner), GLfloat(radiusOuter), vertices);
+   glUnmapBuffer(GL_ARRAY_BUFFER);
 
-      for(j = 0; j <= numt; j++)
-      {
-         // Need to identify the four elements / indices that make
-         // up the quad at this point
-
-         
-         int nextRow = j + 1;
-         if(nextRow >= numt)
-         {
-            nextRow = 0;
-         }
-
-         GLuint ll = numc * i       + j;       // Lower left index
-         GLuint ul = numc * i       + nextRow; // Upper left index
-         GLuint lr = numc * nextCol + j;       // Lower right index
-         GLuint ur = numc * nextCol + nextRow; // Upper right index
-         
-         triIdx.push_back(ul);
-         triIdx.push_back(ll);
-         triIdx.push_back(lr);
-         
-         triIdx.push_back(lr);
-         triIdx.push_back(ur);
-         triIdx.push_back(ul);
-         
-         
-         linesIdx.push_back(ll);
-         linesIdx.push_back(ul);
-
-         linesIdx.push_back(ul);
-         linesIdx.push_back(lr);
-
-         linesIdx.push_back(lr);
-         linesIdx.push_back(ll);
-         
-      }
-   }
-   
-   //
-   // Set up torus buffers for position, normals, texture coordinates, and element array indices
-   // for wireframe and triangles
-   //
-   glBindBuffer(GL_ARRAY_BUFFER, _buffers[TORUS_POS]);
-   glBufferData(GL_ARRAY_BUFFER, pos.size() * sizeof(glm::vec4), &pos[0], GL_STATIC_DRAW);
-
-   glBindBuffer(GL_ARRAY_BUFFER, _buffers[TORUS_NORMAL]);
-   glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(glm::vec4), &normals[0], GL_STATIC_DRAW);
-
-   glBindBuffer(GL_ARRAY_BUFFER, _buffers[TORUS_TC]);
-   glBufferData(GL_ARRAY_BUFFER, tc.size() * sizeof(glm::vec2), &tc[0], GL_STATIC_DRAW);
+   // Every torus of this resolution shares these
+   const Procedural::Indices& indices = Procedural::indices(numc, numt);
 
    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _buffers[TORUS_TRI_IDX]);
-   glBufferData(GL_ELEMENT_ARRAY_BUFFER, triIdx.size() * sizeof(GLuint), &triIdx[0], GL_STATIC_DRAW);
+   glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.triangles.size() * sizeof(GLuint), &indices.triangles[0],
+                GL_STATIC_DRAW);
 
    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _buffers[TORUS_LINES_IDX]);
-   glBufferData(GL_ELEMENT_ARRAY_BUFFER, linesIdx.size() * sizeof(GLuint), &linesIdx[0], GL_STATIC_DRAW);
+   glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.lines.size() * sizeof(GLuint), &indices.lines[0], GL_STATIC_DRAW);
+   GL_ERR_CHECK();
+
+   std::cout << "Torus " << numc << " x " << numt << ": " << numVertices << " vertices, "
+             << indices.triangles.size() / 3 << " triangles in " << 1e3 * (glfwGetTime() - start) << " ms"
+             << std::endl;
+
+   GLsizei stride = sizeof(Procedural::Vertex);
+   const GLvoid* position = (const GLvoid*) offsetof(Procedural::Vertex, position);
+   const GLvoid* normal   = (const GLvoid*) offsetof(Procedural::Vertex, normal);
+   const GLvoid* texcoord = (const GLvoid*) offsetof(Procedural::Vertex, texcoord);
 
-   
    //
    // Point cloud torus
    //
-   glBindVertexArray(_vao[TORUS_POINTS]);
+   _state.bindVertexArray(_vao[TORUS_POINTS]);
    glBindBuffer(GL_ARRAY_BUFFER, _buffers[TORUS_POS]);
-   glVertexAttribPointer(_flatProgram->getAttribLocation("vertex"), 4, GL_FLOAT, GL_FALSE, 0, 0);
+   glVertexAttribPointer(_flatProgram->getAttribLocation("vertex"), 3, GL_FLOAT, GL_FALSE, stride, position);
    glEnableVertexAttribArray(_flatProgram->getAttribLocation("vertex"));
-   _vaoElements[TORUS_POINTS] = pos.size();
+   _vaoElements[TORUS_POINTS] = numVertices;
    
    //
    // Wireframe torus
    //
-   glBindVertexArray(_vao[TORUS_LINES]);
+   _state.bindVertexArray(_vao[TORUS_LINES]);
 
    glBindBuffer(GL_ARRAY_BUFFER, _buffers[TORUS_POS]);
-   glVertexAttribPointer(_flatProgram->getAttribLocation("vertex"), 4, GL_FLOAT, GL_FALSE, 0, 0);
+   glVertexAttribPointer(_flatProgram->getAttribLocation("vertex"), 3, GL_FLOAT, GL_FALSE, stride, position);
    glEnableVertexAttribArray(_flatProgram->getAttribLocation("vertex"));
    
    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _buffers[TORUS_LINES_IDX]);
-   _vaoElements[TORUS_LINES] = linesIdx.size();
+   _vaoElements[TORUS_LINES] = indices.lines.size();
    
 
    //
    // Shaded torus
    //
-   glBindVertexArray(_vao[TORUS_SHADED]);
+   _state.bindVertexArray(_vao[TORUS_SHADED]);
    
    glBindBuffer(GL_ARRAY_BUFFER, _buffers[TORUS_POS]);
-   glVertexAttribPointer(_shadowProgram->getAttribLocation("vertex"), 4, GL_FLOAT, GL_FALSE, 0, 0);
+   glVertexAttribPointer(_shadowProgram->getAttribLocation("vertex"), 3, GL_FLOAT, GL_FALSE, stride, position);
    glEnableVertexAttribArray(_shadowProgram->getAttribLocation("vertex"));
    
-   glBindBuffer(GL_ARRAY_BUFFER, _buffers[TORUS_NORMAL]);
-   glVertexAttribPointer(_shadowProgram->getAttribLocation("normal"), 4, GL_FLOAT, GL_FALSE, 0, 0);
+   glVertexAttribPointer(_shadowProgram->getAttribLocation("normal"), 3, GL_FLOAT, GL_FALSE, stride, normal);
    glEnableVertexAttribArray(_shadowProgram->getAttribLocation("normal"));
    
-   glBindBuffer(GL_ARRAY_BUFFER, _buffers[TORUS_TC]);
-   glVertexAttribPointer(_shadowProgram->getAttribLocation("tc"), 2, GL_FLOAT, GL_FALSE, 0, 0);
+   glVertexAttribPointer(_shadowProgram->getAttribLocation("tc"), 2, GL_FLOAT, GL_FALSE, stride, texcoord);
    glEnableVertexAttribArray(_shadowProgram->getAttribLocation("tc"));
    
    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _buffers[TORUS_TRI_IDX]);
-   _vaoElements[TORUS_SHADED] = triIdx.size();
+   _vaoElements[TORUS_SHADED] = indices.triangles.size();
    
    //
    // Flat shaded torus
    //
-   glBindVertexArray(_vao[TORUS_FLAT]);
+   _state.bindVertexArray(_vao[TORUS_FLAT]);
    
    glBindBuffer(GL_ARRAY_BUFFER, _buffers[TORUS_POS]);
-   glVertexAttribPointer(_flatProgram->getAttribLocation("vertex"), 4, GL_FLOAT, GL_FALSE, 0, 0);
+   glVertexAttribPointer(_flatProgram->getAttribLocation("vertex"), 3, GL_FLOAT, GL_FALSE, stride, position);
    glEnableVertexAttribArray(_flatProgram->getAttribLocation("vertex"));
    
    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _buffers[TORUS_TRI_IDX]);
-   _vaoElements[TORUS_FLAT] = triIdx.size();
+   _vaoElements[TORUS_FLAT] = indices.triangles.size();
 }
 
 /**
@@ -548,7 +500,7 @@ void createQuad()
       //
       // Set up VAO for shaded quads, with texture coords and normals
       //
-      glBindVertexArray(_vao[vao.first]);
+      _state.bindVertexArray(_vao[vao.first]);
    
       attribLoc = vao.second->getAttribLocation("vertex");
       if(attribLoc >= 0)
@@ -578,6 +530,20 @@ void createQuad()
    }
 }
 
+/**
+ * Look up the uniforms render() sets, so it sets them without names
+ */
+void lookupUniforms(void)
+{
+   _flatUniforms.mvp = _flatProgram->getUniform<mat4>("mvp");
+   _texUniforms.mvp  = _texProgram->getUniform<mat4>("mvp");
+
+   _shadowUniforms.mvp         = _shadowProgram->getUniform<mat4>("mvp");
+   _shadowUniforms.toShadowTex = _shadowProgram->getUniform<mat4>("toShadowTex");
+   _shadowUniforms.depthMap    = _shadowProgram->getUniform<GLint>("depthMap");
+   _shadowUniforms.texmapScale = _shadowProgram->getUniform<vec2>("texmapScale");
+}
+
 /**
  * Load font texture map
  */
@@ -634,11 +600,6 @@ void init(void)
    try
    {
       initGLEW();
-      createFBO();
-      loadFontTexture();
-      
-      _occluderRot = quat(vec3(0, 0, 0));
-      _receiverRot = quat(vec3(M_PI / 2, 0, 0));
       
       // Load the shader programs
       _shadowVertexFile = std::string(SOURCE_DIR) + "/shadow.vsh";
@@ -650,9 +611,34 @@ void init(void)
       _texVertFile      = std::string(SOURCE_DIR) + "/texture.vsh";
       _texFragFile      = std::string(SOURCE_DIR) + "/texture.fsh";
       
-      _shadowProgram = new GL::Program(_shadowVertexFile, _shadowFragFile);
-      _flatProgram   = new GL::Program(_flatVertFile,     _flatFragFile);
-      _texProgram    = new GL::Program(_texVertFile, _texFragFile);
+      // After the first run the programs load from binaries kept here
+      GL::Program::setBinaryCache(std::string(PROJECT_BINARY_DIR) + "/program_cache");
+      if(_serialPrograms)
+      {
+         _shadowProgram = new GL::Program(_shadowVertexFile, _shadowFragFile);
+         _flatProgram   = new GL::Program(_flatVertFile,     _flatFragFile);
+         _texProgram    = new GL::Program(_texVertFile, _texFragFile);
+      }
+      else
+      {
+         // Submitted first, so the driver compiles them while the font
+         // and the meshes load. Each is waited for at its first use:
+         // the flat and shadow programs when createQuad() and
+         // createTorus() look up attributes, the texture program in
+         // lookupUniforms().
+         GL::ProgramBatch programs;
+         _shadowProgram = programs.add(_shadowVertexFile, _shadowFragFile);
+         _flatProgram   = programs.add(_flatVertFile,     _flatFragFile);
+         _texProgram    = programs.add(_texVertFile, _texFragFile);
+         std::cout << "Programs submitted, " << (GL::ProgramBatch::parallel() ? "" : "no ")
+                   << "parallel shader compile" << std::endl;
+      }
+      
+      createFBO();
+      loadFontTexture();
+      
+      _occluderRot = quat(vec3(0, 0, 0));
+      _receiverRot = quat(vec3(M_PI / 2, 0, 0));
       
       // Generate handles for vertex array objects
       _vao.resize(NUM_VAO_OBJECTS, 0);
@@ -665,6 +651,7 @@ void init(void)
       
       createQuad();
       createTorus(50,50,1, 1.5);
+      lookupUniforms();
       
       // Set the clear color
       glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
@@ -673,7 +660,7 @@ void init(void)
       glClearDepth(1.0f);
       
       // Enable depth test
-      glEnable(GL_DEPTH_TEST);
+      _state.enable(GL_DEPTH_TEST);
       GL_ERR_CHECK();
    }
    catch (std::runtime_error exception)
@@ -695,7 +682,7 @@ void resize(GLFWwindow* window, int width, int height)
    {
       // Set the affine transform of (x,y) from normalized device coordinates to
       // window coordinates. In this case, (-1,1) -> (0, width) and (-1,1) -> (0, height)
-      glViewport(0, 0, width, height);
+      _state.viewport(0, 0, width, height);
       GL_ERR_CHECK();
       
       _winWidth = width;
@@ -843,6 +830,7 @@ void updateFPS(double time)
       
       _fontTexture->setText(ss.str());
       _fontTexture->update();
+      std::cout << ss.str() << ", " << _state.report() << std::endl;
    }
 
 }
@@ -871,18 +859,17 @@ void drawSceneInfo(double time)
    GL_ERR_CHECK();
    
    // Set the MVP uniform
-   program->setUniform("mvp", mvp);
+   _texUniforms.mvp.set(mvp);
    
-   glActiveTexture(GL_TEXTURE0);
-   glBindTexture(GL_TEXTURE_2D, _fontTexture->getID());
+   _state.bindTexture(0, GL_TEXTURE_2D, _fontTexture->getID());
    GL_ERR_CHECK();
    
    // Draw the triangles
-   glEnable(GL_BLEND);
-   glBlendFunc(GL_SRC_ALPHA,GL_ONE_MINUS_SRC_ALPHA);
-   glBindVertexArray(_vao[QUAD_TEXTURED]);
+   _state.enable(GL_BLEND);
+   _state.blendFunc(GL_SRC_ALPHA,GL_ONE_MINUS_SRC_ALPHA);
+   _state.bindVertexArray(_vao[QUAD_TEXTURED]);
    glDrawArrays(GL_TRIANGLE_STRIP, 0, 4); //_vaoElements[QUAD_SHADED]);
-   glDisable(GL_BLEND);
+   _state.disable(GL_BLEND);
    GL_ERR_CHECK();
 
 }
@@ -911,8 +898,8 @@ int render(double time)
       //----------------------------------------------------------------------------------------------------
       // Draw depth pass from light's point of view.
       //----------------------------------------------------------------------------------------------------
-      glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
-      glViewport(0, 0, _fboWidth, _fboHeight);
+      _state.bindFramebuffer(GL_FRAMEBUFFER, _fbo);
+      _state.viewport(0, 0, _fboWidth, _fboHeight);
       
       // Clear the framebuffer
       glClearColor(0, 0, 0, 0);
@@ -942,10 +929,10 @@ int render(double time)
       
       // Bind the flat shader program. No need for a fancy shader on this pass, just need the depth
       _flatProgram->bind();
-      _flatProgram->setUniform("mvp",      mvp);
+      _flatUniforms.mvp.set(mvp);
       
       // Draw the occluding surface
-      glBindVertexArray(_vao[TORUS_FLAT]);
+      _state.bindVertexArray(_vao[TORUS_FLAT]);
       glDrawElements(GL_TRIANGLES, _vaoElements[TORUS_FLAT], GL_UNSIGNED_INT, NULL);
       GL_ERR_CHECK();
       
@@ -960,19 +947,19 @@ int render(double time)
       // in the render pass where the shadows are drawn
       toShadowTex1 = clipToTexture * mvp;
       
-      _flatProgram->setUniform("mvp",      mvp);
+      _flatUniforms.mvp.set(mvp);
       
       // Draw occluding surface. Use the same vertex array object as the previous surface - they're both
       // the same shape, just different position, rotation and scale
-      glBindVertexArray(_vao[QUAD_FLAT]);
+      _state.bindVertexArray(_vao[QUAD_FLAT]);
       glDrawArrays(GL_TRIANGLE_STRIP, 0, _vaoElements[QUAD_FLAT]);
       GL_ERR_CHECK();
 
       //----------------------------------------------------------------------------------------------------
       // Draw pass from camera's point of view
       //----------------------------------------------------------------------------------------------------
-      glBindFramebuffer(GL_FRAMEBUFFER, 0);
-      glViewport(0, 0, _winWidth, _winHeight);
+      _state.bindFramebuffer(GL_FRAMEBUFFER, 0);
+      _state.viewport(0, 0, _winWidth, _winHeight);
       glClearColor(0.3f, 0.4f, 0.95f, 1.0f);
       glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
       GL_ERR_CHECK();
@@ -985,18 +972,17 @@ int render(double time)
       // Set up model, view, projection matrix for occluding surface
       mvp        = _projection * view * modelOccluder;
       
-      glActiveTexture(GL_TEXTURE0);
-      glBindTexture(GL_TEXTURE_2D, _fboTextures[DEPTH]);
+      _state.bindTexture(0, GL_TEXTURE_2D, _fboTextures[DEPTH]);
       glGenerateMipmap(GL_TEXTURE_2D);
       
       // Bind the shader program that will draw the shadows and do some simple shading
       _shadowProgram->bind();
-      _shadowProgram->setUniform("mvp",           mvp);
-      _shadowProgram->setUniform("depthMap",      0);
-      _shadowProgram->setUniform("toShadowTex",   toShadowTex0);
-      _shadowProgram->setUniform("texmapScale",   _texmapScale);
+      _shadowUniforms.mvp.set(mvp);
+      _shadowUniforms.depthMap.set(0);
+      _shadowUniforms.toShadowTex.set(toShadowTex0);
+      _shadowUniforms.texmapScale.set(_texmapScale);
       
-      glBindVertexArray(_vao[TORUS_SHADED]);
+      _state.bindVertexArray(_vao[TORUS_SHADED]);
       glDrawElements(GL_TRIANGLES, _vaoElements[TORUS_SHADED], GL_UNSIGNED_INT, NULL);
 
       GL_ERR_CHECK();
@@ -1004,15 +990,21 @@ int render(double time)
       mvp        = _projection * view * modelReceiver;
 
       _shadowProgram->bind();
-      _shadowProgram->setUniform("mvp",         mvp);
-      _shadowProgram->setUniform("toShadowTex", toShadowTex1);
+      _shadowUniforms.mvp.set(mvp);
+      _shadowUniforms.toShadowTex.set(toShadowTex1);
       
       // Draw the receiving surface
-      glBindVertexArray(_vao[QUAD_SHADED]);
+      _state.bindVertexArray(_vao[QUAD_SHADED]);
       glDrawArrays(GL_TRIANGLE_STRIP, 0, _vaoElements[QUAD_SHADED]);
       GL_ERR_CHECK();
 
-      drawSceneInfo(time);
+      // The text texture is updated every few seconds, which would
+      // show up in the frame times
+      if(!_benchmark)
+      {
+         drawSceneInfo(time);
+      }
+      _state.endFrame();
    }
    catch (std::runtime_error exception)
    {
@@ -1039,6 +1031,169 @@ void getMonitorMetrics()
    _dpi = vec2(vidmode->width * 25.4 / width , vidmode->height * 25.4 / height);
 }
 
+/**
+ * Parse a comma separated list of numbers
+ *
+ * @param list
+ *    For example "50,100,200"
+ * @return the numbers
+ */
+vector<int> parseList(const std::string& list)
+{
+   vector<int> values;
+   std::stringstream ss(list);
+   std::string item;
+   while(std::getline(ss, item, ','))
+   {
+      int value = atoi(item.c_str());
+      if(value > 0)
+      {
+         values.push_back(value);
+      }
+   }
+   return values;
+}
+
+/**
+ * Draw every combination of torus tessellation and shadow map size for
+ * a number of frames and write the frame time percentiles as CSV. Each
+ * frame ends with glFinish(), so the time covers the GPU work as well.
+ * Small shadow maps and dense tori show vertex cost, large shadow maps
+ * and coarse tori show fill cost.
+ *
+ * @param window
+ *    The window, hidden in benchmark mode
+ * @param options
+ *    The grid to sweep
+ */
+void runBenchmark(GLFWwindow* window, const BenchmarkOptions& options)
+{
+   std::ofstream file;
+   if(!options.csvFile.empty())
+   {
+      file.open(options.csvFile.c_str());
+      if(!file)
+      {
+         throw std::runtime_error("Could not open " + options.csvFile);
+      }
+   }
+   std::ostream& csv = options.csvFile.empty() ? std::cout : file;
+
+   std::cerr << "Renderer: " << glGetString(GL_RENDERER) << std::endl;
+   csv << "tessellation,triangles,shadow_map,frames,mean_ms,min_ms,p50_ms,p90_ms,p95_ms,p99_ms,max_ms" << std::endl;
+
+   vector<double> times(options.frames);
+   for(size_t t = 0; t < options.tessellations.size(); ++t)
+   {
+      int numc = options.tessellations[t];
+      createTorus(numc, numc, 1, 1.5);
+
+      for(size_t m = 0; m < options.shadowMapSizes.size() && !glfwWindowShouldClose(window); ++m)
+      {
+         deleteFBO();
+         createFBO(options.shadowMapSizes[m]);
+
+         for(int f = 0; f < options.warmup; ++f)
+         {
+            render(glfwGetTime());
+            glFinish();
+         }
+
+         double sum = 0.0;
+         for(int f = 0; f < options.frames; ++f)
+         {
+            double start = glfwGetTime();
+            render(start);
+            glFinish();
+            times[f] = glfwGetTime() - start;
+            sum += times[f];
+            glfwPollEvents();
+         }
+
+         // Nearest rank percentiles, in milliseconds
+         std::sort(times.begin(), times.end());
+         size_t last = times.size() - 1;
+         const double ranks[4] = { 0.5, 0.9, 0.95, 0.99 };
+         double percentiles[4];
+         for(int p = 0; p < 4; ++p)
+         {
+            percentiles[p] = 1e3 * times[size_t(ranks[p] * last + 0.5)];
+         }
+
+         csv << numc << "," << _vaoElements[TORUS_SHADED] / 3 << "," << options.shadowMapSizes[m] << ","
+             << options.frames << "," << 1e3 * sum / options.frames << "," << 1e3 * times[0] << ","
+             << percentiles[0] << "," << percentiles[1] << "," << percentiles[2] << "," << percentiles[3] << ","
+             << 1e3 * times[last] << std::endl;
+
+         std::cerr << "Torus " << numc << " x " << numc << ", shadow map " << options.shadowMapSizes[m]
+                   << ": " << percentiles[0] << " ms median" << std::endl;
+      }
+   }
+}
+
+/**
+ * Time the program binds and uniform calls of a frame of render(),
+ * set by name and through the handles, without drawing
+ *
+ * @param frames
+ *    Number of frames of calls to time each way
+ */
+void runUniformBenchmark(int frames)
+{
+   mat4 mvp(1.0f);
+   mat4 toShadowTex(0.5f);
+   double names = 0.0;
+   double handles = 0.0;
+
+   // Alternate, so that both see the same clocks and caches
+   for(int round = 0; round < 10; ++round)
+   {
+      double start = glfwGetTime();
+      for(int f = 0; f < frames / 10; ++f)
+      {
+         _flatProgram->bind();
+         _flatProgram->setUniform("mvp", mvp);
+         _flatProgram->setUniform("mvp", mvp);
+         _shadowProgram->bind();
+         _shadowProgram->setUniform("mvp", mvp);
+         _shadowProgram->setUniform("depthMap", 0);
+         _shadowProgram->setUniform("toShadowTex", toShadowTex);
+         _shadowProgram->setUniform("texmapScale", _texmapScale);
+         _shadowProgram->bind();
+         _shadowProgram->setUniform("mvp", mvp);
+         _shadowProgram->setUniform("toShadowTex", toShadowTex);
+         _texProgram->bind();
+         _texProgram->setUniform("mvp", mvp);
+      }
+      names += glfwGetTime() - start;
+
+      start = glfwGetTime();
+      for(int f = 0; f < frames / 10; ++f)
+      {
+         _flatProgram->bind();
+         _flatUniforms.mvp.set(mvp);
+         _flatUniforms.mvp.set(mvp);
+         _shadowProgram->bind();
+         _shadowUniforms.mvp.set(mvp);
+         _shadowUniforms.depthMap.set(0);
+         _shadowUniforms.toShadowTex.set(toShadowTex);
+         _shadowUniforms.texmapScale.set(_texmapScale);
+         _shadowProgram->bind();
+         _shadowUniforms.mvp.set(mvp);
+         _shadowUniforms.toShadowTex.set(toShadowTex);
+         _texProgram->bind();
+         _texUniforms.mvp.set(mvp);
+      }
+      handles += glfwGetTime() - start;
+   }
+   glFinish();
+
+   int timed = frames / 10 * 10;
+   std::cout << "Uniforms, 4 binds and 9 sets per frame, " << timed << " frames: "
+             << 1e6 * names / timed << " us by name, "
+             << 1e6 * handles / timed << " us by handle" << std::endl;
+}
+
 /**
  * Program entry point
  */
@@ -1051,6 +1206,52 @@ int main(int argc, char* argv[])
    _eye = vec4(0.0f, 0.0f, 2.0f, 1.0f);
    _fps = 0;
    _lastFPSUpdate = 0;
+
+   // --benchmark sweeps torus tessellations and shadow map sizes in a
+   // hidden window and writes frame times as CSV. --tessellation=,
+   // --shadowmap=, --frames= and --csv= change the sweep.
+   BenchmarkOptions benchmark;
+   benchmark.tessellations = parseList("25,50,100,200,400,800");
+   benchmark.shadowMapSizes = parseList("256,512,1024,2048,4096");
+   benchmark.frames = 100;
+   benchmark.warmup = 10;
+   _benchmark = false;
+   _serialPrograms = false;
+   bool uniformBenchmark = false;
+   for(int i = 1; i < argc; ++i)
+   {
+      std::string arg(argv[i]);
+      std::string value = arg.substr(arg.find('=') + 1);
+      if(arg == "--benchmark")
+      {
+         _benchmark = true;
+      }
+      else if(arg == "--uniform-benchmark")
+      {
+         uniformBenchmark = true;
+      }
+      else if(arg.find("--tessellation=") == 0)
+      {
+         benchmark.tessellations = parseList(value);
+      }
+      else if(arg.find("--shadowmap=") == 0)
+      {
+         benchmark.shadowMapSizes = parseList(value);
+      }
+      else if(arg.find("--frames=") == 0)
+      {
+         benchmark.frames = std::max(atoi(value.c_str()), 1);
+      }
+      else if(arg.find("--csv=") == 0)
+      {
+         benchmark.csvFile = value;
+      }
+      else if(arg == "--serial-programs")
+      {
+         _serialPrograms = true;
+      }
+   }
+
    // Open up the log file
    std::string logFile = std::string(PROJECT_BINARY_DIR) + "/log.txt";
    _log.open(logFile.c_str());
@@ -1075,6 +1276,13 @@ int main(int argc, char* argv[])
    glfwWindowHint(GLFW_GREEN_BITS,            32);
    glfwWindowHint(GLFW_BLUE_BITS,             32);
    glfwWindowHint(GLFW_ALPHA_BITS,            32);
+   if(_benchmark || uniformBenchmark)
+   {
+      // Nothing needs to be seen, and multisampling would only add a
+      // cost the sweep doesn't vary
+      glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+      glfwWindowHint(GLFW_SAMPLES, 0);
+   }
    
 #ifdef __APPLE__
    // This should never be needed and it is recommended to never set this bit,
@@ -1101,8 +1309,32 @@ int main(int argc, char* argv[])
    
    printf("GL Version: %s\n", glGetString(GL_VERSION));
    
+   // Time to first frame covers init(), which loads the shaders,
+   // font and meshes, and the first frame, which waits for whatever
+   // of that the driver hasn't finished
+   double startup = glfwGetTime();
    init();
    resize(window, width, height);
+
+   if(uniformBenchmark)
+   {
+      runUniformBenchmark(100000);
+      terminate(EXIT_SUCCESS);
+   }
+
+   if(_benchmark)
+   {
+      try
+      {
+         runBenchmark(window, benchmark);
+      }
+      catch(std::runtime_error exception)
+      {
+         logException(exception);
+         terminate(EXIT_FAILURE);
+      }
+      terminate(EXIT_SUCCESS);
+   }
    
    // Loop until the user closes the window
    while(!glfwWindowShouldClose(window))
@@ -1112,6 +1344,13 @@ int main(int argc, char* argv[])
       
       // Swap front and back buffers
       glfwSwapBuffers(window);
+      if(startup >= 0.0)
+      {
+         glFinish();
+         std::cout << "First frame after " << 1e3 * (glfwGetTime() - startup) << " ms" << std::endl;
+         std::cout << GL::Program::cacheReport() << std::endl;
+         startup = -1.0;
+      }
       
       // Poll for and process events
       glfwPollEvents();
@@ -0,0 +1,320 @@
+//----------------------------------------------------------------------
+// meshlet.cpp
+//
+// Cluster building, bounds and per frame culling
+//----------------------------------------------------------------------
+
+#include <math.h>
+#include "meshlet.h"
+
+namespace
+{
+   const GLuint none = ~0u;
+
+   inline const GLfloat* element(const GLfloat* base, GLsizei stride, GLuint i)
+   {
+      return reinterpret_cast<const GLfloat*>(
+         reinterpret_cast<const char*>(base) + size_t(i) * stride);
+   }
+
+   //-------------------------------------------------------------------
+   // Bounding sphere and normal cone of the last cluster built
+   //-------------------------------------------------------------------
+   void computeBounds(const GLfloat* positions, GLsizei stride,
+                      const std::vector<GLuint>& vertices,
+                      const GLuint* indices, Meshlet::Cluster& cluster)
+   {
+      // Sphere around the center of the bounding box
+      const GLfloat* first = element(positions, stride, vertices[0]);
+      GLfloat lo[3] = { first[0], first[1], first[2] };
+      GLfloat hi[3] = { first[0], first[1], first[2] };
+      for(size_t i = 1; i < vertices.size(); ++i)
+      {
+         const GLfloat* p = element(positions, stride, vertices[i]);
+         for(int k = 0; k < 3; ++k)
+         {
+            lo[k] = p[k] < lo[k] ? p[k] : lo[k];
+            hi[k] = p[k] > hi[k] ? p[k] : hi[k];
+         }
+      }
+
+      GLfloat radius2 = 0.0f;
+      for(int k = 0; k < 3; ++k)
+      {
+         cluster.center[k] = 0.5f * (lo[k] + hi[k]);
+      }
+      for(size_t i = 0; i < vertices.size(); ++i)
+      {
+         const GLfloat* p = element(positions, stride, vertices[i]);
+         GLfloat dx = p[0] - cluster.center[0];
+         GLfloat dy = p[1] - cluster.center[1];
+         GLfloat dz = p[2] - cluster.center[2];
+         GLfloat d2 = dx * dx + dy * dy + dz * dz;
+         radius2 = d2 > radius2 ? d2 : radius2;
+      }
+      cluster.radius = sqrtf(radius2);
+
+      // The cone axis is the area weighted average normal, the cutoff
+      // comes from the triangle that faces furthest from it
+      std::vector<double> normals(3 * cluster.numTriangles);
+      double axis[3] = { 0.0, 0.0, 0.0 };
+      for(GLuint t = 0; t < cluster.numTriangles; ++t)
+      {
+         const GLfloat* p0 = element(positions, stride, indices[3 * t + 0]);
+         const GLfloat* p1 = element(positions, stride, indices[3 * t + 1]);
+         const GLfloat* p2 = element(positions, stride, indices[3 * t + 2]);
+         double e1[3] = { double(p1[0]) - p0[0], double(p1[1]) - p0[1], double(p1[2]) - p0[2] };
+         double e2[3] = { double(p2[0]) - p0[0], double(p2[1]) - p0[1], double(p2[2]) - p0[2] };
+         double* n = &normals[3 * t];
+         n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+         n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+         n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+         axis[0] += n[0];
+         axis[1] += n[1];
+         axis[2] += n[2];
+      }
+
+      double length = sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+      double minDot = length > 0.0 ? 1.0 : -1.0;
+      for(GLuint t = 0; t < cluster.numTriangles && minDot > 0.0; ++t)
+      {
+         const double* n = &normals[3 * t];
+         double nl = sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+         if(nl > 0.0)
+         {
+            double d = (n[0] * axis[0] + n[1] * axis[1] + n[2] * axis[2]) / (nl * length);
+            minDot = d < minDot ? d : minDot;
+         }
+      }
+
+      for(int k = 0; k < 3; ++k)
+      {
+         cluster.coneAxis[k] = length > 0.0 ? GLfloat(axis[k] / length) : 0.0f;
+      }
+
+      // A cone wider than a hemisphere can't be culled
+      cluster.coneCutoff = minDot > 0.0 ? GLfloat(sqrt(1.0 - minDot * minDot)) : 1.0f;
+   }
+}
+
+void Meshlet::build(const GLfloat* positions, GLsizei stride, GLuint numVertices,
+                    const std::vector<GLuint>& indices, Clusters& out,
+                    GLuint maxVertices, GLuint maxTriangles)
+{
+   GLuint numTriangles = GLuint(indices.size() / 3);
+   out.clusters.clear();
+   out.indices.clear();
+   out.indices.reserve(indices.size());
+
+   // Triangles around each vertex
+   std::vector<GLuint> offsets(numVertices + 1, 0);
+   for(size_t i = 0; i < indices.size(); ++i)
+   {
+      offsets[indices[i] + 1]++;
+   }
+   for(GLuint v = 0; v < numVertices; ++v)
+   {
+      offsets[v + 1] += offsets[v];
+   }
+   std::vector<GLuint> adjacency(indices.size());
+   {
+      std::vector<GLuint> fill(offsets.begin(), offsets.end() - 1);
+      for(size_t i = 0; i < indices.size(); ++i)
+      {
+         adjacency[fill[indices[i]]++] = GLuint(i / 3);
+      }
+   }
+
+   // Cluster each vertex and triangle was last added to
+   std::vector<GLuint> vertexCluster(numVertices, none);
+   std::vector<GLuint> candidateCluster(numTriangles, none);
+   std::vector<bool>   used(numTriangles, false);
+
+   std::vector<GLuint> candidates;
+   std::vector<GLuint> vertices;
+   GLuint scan = 0;
+   GLuint remaining = numTriangles;
+
+   while(remaining)
+   {
+      GLuint id = GLuint(out.clusters.size());
+      Cluster cluster;
+      cluster.firstIndex = GLuint(out.indices.size());
+      cluster.numTriangles = 0;
+      cluster.numVertices = 0;
+      vertices.clear();
+
+      // Start next to the last cluster if possible, so clusters stay
+      // compact, otherwise at the first triangle left
+      GLuint triangle = none;
+      for(size_t i = 0; i < candidates.size() && triangle == none; ++i)
+      {
+         triangle = used[candidates[i]] ? none : candidates[i];
+      }
+      if(triangle == none)
+      {
+         while(used[scan])
+         {
+            scan++;
+         }
+         triangle = scan;
+      }
+      candidates.clear();
+
+      while(triangle != none)
+      {
+         // Add the triangle and queue up its neighbours
+         used[triangle] = true;
+         remaining--;
+         cluster.numTriangles++;
+         for(int k = 0; k < 3; ++k)
+         {
+            GLuint v = indices[3 * triangle + k];
+            out.indices.push_back(v);
+            if(vertexCluster[v] == id)
+            {
+               continue;
+            }
+
+            vertexCluster[v] = id;
+            vertices.push_back(v);
+            cluster.numVertices++;
+            for(GLuint i = offsets[v]; i < offsets[v + 1]; ++i)
+            {
+               GLuint t = adjacency[i];
+               if(!used[t] && candidateCluster[t] != id)
+               {
+                  candidateCluster[t] = id;
+                  candidates.push_back(t);
+               }
+            }
+         }
+
+         if(cluster.numTriangles == maxTriangles)
+         {
+            break;
+         }
+
+         // Next, the neighbour that adds the fewest vertices
+         triangle = none;
+         GLuint fewest = 4;
+         for(size_t i = 0; i < candidates.size(); )
+         {
+            GLuint t = candidates[i];
+            if(used[t])
+            {
+               candidates[i] = candidates.back();
+               candidates.pop_back();
+               continue;
+            }
+
+            GLuint added = 0;
+            for(int k = 0; k < 3; ++k)
+            {
+               added += vertexCluster[indices[3 * t + k]] == id ? 0 : 1;
+            }
+            if(added < fewest)
+            {
+               fewest = added;
+               triangle = t;
+               if(added == 0)
+               {
+                  break;
+               }
+            }
+            ++i;
+         }
+
+         if(triangle != none && cluster.numVertices + fewest > maxVertices)
+         {
+            triangle = none;
+         }
+      }
+
+      computeBounds(positions, stride, vertices, &out.indices[cluster.firstIndex], cluster);
+      out.clusters.push_back(cluster);
+   }
+}
+
+Meshlet::CullStats Meshlet::cull(const Clusters& clusters, const GLfloat* mvp, const GLfloat* eye,
+                                 GLuint baseIndex, DrawList& list)
+{
+   // Frustum planes in model space, from the rows of the matrix
+   // (Gribb and Hartmann), pointing in
+   GLfloat planes[6][4];
+   for(int p = 0; p < 6; ++p)
+   {
+      int row = p / 2;
+      GLfloat sign = p % 2 ? -1.0f : 1.0f;
+      for(int k = 0; k < 4; ++k)
+      {
+         planes[p][k] = mvp[4 * k + 3] + sign * mvp[4 * k + row];
+      }
+      GLfloat length = sqrtf(planes[p][0] * planes[p][0] + planes[p][1] * planes[p][1] +
+                             planes[p][2] * planes[p][2]);
+      for(int k = 0; k < 4; ++k)
+      {
+         planes[p][k] /= length;
+      }
+   }
+
+   CullStats stats = { GLuint(clusters.clusters.size()), 0, 0, 0, 0, 0 };
+   list.counts.clear();
+   list.offsets.clear();
+   GLuint end = none;
+
+   for(size_t i = 0; i < clusters.clusters.size(); ++i)
+   {
+      const Cluster& cluster = clusters.clusters[i];
+      const GLfloat* c = cluster.center;
+      stats.triangles += cluster.numTriangles;
+
+      bool outside = false;
+      for(int p = 0; p < 6 && !outside; ++p)
+      {
+         outside = planes[p][0] * c[0] + planes[p][1] * c[1] + planes[p][2] * c[2] + planes[p][3]
+                 < -cluster.radius;
+      }
+      if(outside)
+      {
+         stats.frustumCulled += cluster.numTriangles;
+         continue;
+      }
+
+      // Every triangle faces away if the eye is outside the cone's
+      // mirror image, widened by the sphere
+      GLfloat d[3] = { c[0] - eye[0], c[1] - eye[1], c[2] - eye[2] };
+      GLfloat distance = sqrtf(d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+      GLfloat facing = d[0] * cluster.coneAxis[0] + d[1] * cluster.coneAxis[1] + d[2] * cluster.coneAxis[2];
+      if(facing >= cluster.coneCutoff * distance + cluster.radius)
+      {
+         stats.backfaceCulled += cluster.numTriangles;
+         continue;
+      }
+
+      stats.visibleClusters++;
+      GLsizei count = GLsizei(3 * cluster.numTriangles);
+      if(end == cluster.firstIndex)
+      {
+         list.counts.back() += count;
+      }
+      else
+      {
+         list.counts.push_back(count);
+         list.offsets.push_back((const GLvoid*) (size_t(baseIndex + cluster.firstIndex) * sizeof(GLuint)));
+      }
+      end = cluster.firstIndex + count;
+   }
+
+   stats.ranges = GLuint(list.counts.size());
+   return stats;
+}
+
+void Meshlet::DrawList::draw(void) const
+{
+   if(!counts.empty())
+   {
+      glMultiDrawElements(GL_TRIANGLES, &counts[0], GL_UNSIGNED_INT, &offsets[0],
+                          GLsizei(counts.size()));
+   }
+}
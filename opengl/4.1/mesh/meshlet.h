@@ -0,0 +1,129 @@
+//----------------------------------------------------------------------
+// meshlet.h
+//
+// Splits indexed triangle meshes into small clusters with a bounding
+// sphere and a normal cone each, so whole clusters can be skipped on
+// the CPU when they are outside the view or facing away from it.
+//
+// Author: Jeff Bowles <jbowles@riskybacon.com>
+//----------------------------------------------------------------------
+
+#ifndef _meshlet_h
+#define _meshlet_h
+
+#include <vector>
+
+#if defined(__APPLE_CC__)
+#include <OpenGL/gl3.h>
+#else
+#include <GL/glew.h>
+#include <GL/gl.h>
+#endif
+
+namespace Meshlet
+{
+   //-------------------------------------------------------------------
+   /// A run of triangles in Clusters::indices and its culling data
+   //-------------------------------------------------------------------
+   struct Cluster
+   {
+      /// First index of the cluster
+      GLuint firstIndex;
+
+      GLuint numTriangles;
+
+      /// Number of distinct vertices the triangles use
+      GLuint numVertices;
+
+      /// Bounding sphere
+      GLfloat center[3];
+      GLfloat radius;
+
+      /// Average facing of the triangles, unit length
+      GLfloat coneAxis[3];
+
+      /// Sine of the largest angle between the axis and a triangle
+      /// normal, 1 if the triangles face too many ways to cull
+      GLfloat coneCutoff;
+   };
+
+   //-------------------------------------------------------------------
+   /// A mesh split into clusters. The indices are the mesh's triangles
+   /// reordered so that each cluster is contiguous.
+   //-------------------------------------------------------------------
+   struct Clusters
+   {
+      std::vector<Cluster> clusters;
+      std::vector<GLuint>  indices;
+   };
+
+   //-------------------------------------------------------------------
+   /// Counts from one call to cull()
+   //-------------------------------------------------------------------
+   struct CullStats
+   {
+      GLuint clusters;
+      GLuint visibleClusters;
+      GLuint triangles;
+
+      /// Triangles in clusters outside the view frustum
+      GLuint frustumCulled;
+
+      /// Triangles in clusters facing away from the eye
+      GLuint backfaceCulled;
+
+      /// Number of ranges handed to glMultiDrawElements()
+      GLuint ranges;
+
+      GLuint culled(void) const { return frustumCulled + backfaceCulled; }
+   };
+
+   //-------------------------------------------------------------------
+   /// The visible clusters as ranges of the index buffer, neighbours
+   /// merged, ready for glMultiDrawElements()
+   //-------------------------------------------------------------------
+   struct DrawList
+   {
+      std::vector<GLsizei>       counts;
+      std::vector<const GLvoid*> offsets;
+
+      ///
+      /// Draw the ranges from the bound vertex array object, whose
+      /// element buffer holds the indices as GLuint
+      ///
+      void draw(void) const;
+   };
+
+   ///
+   /// Split a mesh into clusters. Triangles are added to a cluster
+   /// while they share vertices with it, preferring those that add the
+   /// fewest new vertices, until either limit is reached.
+   ///
+   /// \param positions First position, 3 floats
+   /// \param stride Bytes from one position to the next
+   /// \param numVertices Number of vertices
+   /// \param indices Three indices per triangle
+   /// \param maxVertices Most vertices in a cluster
+   /// \param maxTriangles Most triangles in a cluster
+   /// \param out Filled in with the clusters and reordered indices
+   ///
+   void build(const GLfloat* positions, GLsizei stride, GLuint numVertices,
+              const std::vector<GLuint>& indices, Clusters& out,
+              GLuint maxVertices = 64, GLuint maxTriangles = 126);
+
+   ///
+   /// Find the clusters that may be visible
+   ///
+   /// \param clusters Clusters from build()
+   /// \param mvp Model, view, projection matrix, 16 floats, column major
+   /// \param eye Eye position in model space, 3 floats
+   /// \param baseIndex Where clusters.indices starts in the element
+   ///                  buffer, in indices
+   /// \param list Filled in with the ranges to draw
+   /// \return the counts
+   ///
+   CullStats cull(const Clusters& clusters, const GLfloat* mvp, const GLfloat* eye,
+                  GLuint baseIndex, DrawList& list);
+}
+
+#endif
@@ -0,0 +1,244 @@
+//----------------------------------------------------------------------
+// procedural.cpp
+//
+// Shape generators and the index cache
+//----------------------------------------------------------------------
+
+#define _USE_MATH_DEFINES
+#include <math.h>
+#include <stdint.h>
+#include <map>
+#include "procedural.h"
+
+namespace
+{
+   typedef std::map<uint64_t, Procedural::Indices> IndexCache;
+
+   IndexCache& cache(void)
+   {
+      static IndexCache indices;
+      return indices;
+   }
+
+   //-------------------------------------------------------------------
+   // Sine and cosine of count + 1 angles from start to start + range,
+   // the last exactly at the end so closed shapes meet
+   //-------------------------------------------------------------------
+   void angles(GLuint count, double start, double range,
+               std::vector<GLfloat>& sines, std::vector<GLfloat>& cosines)
+   {
+      sines.resize(count + 1);
+      cosines.resize(count + 1);
+      for(GLuint i = 0; i <= count; ++i)
+      {
+         double angle = start + range * (i == count ? 1.0 : double(i) / count);
+         sines[i] = GLfloat(sin(angle));
+         cosines[i] = GLfloat(cos(angle));
+      }
+   }
+
+   inline void set(Procedural::Vertex& v, GLfloat x, GLfloat y, GLfloat z,
+                   GLfloat nx, GLfloat ny, GLfloat nz, GLfloat s, GLfloat t)
+   {
+      v.position[0] = x;
+      v.position[1] = y;
+      v.position[2] = z;
+      v.normal[0] = nx;
+      v.normal[1] = ny;
+      v.normal[2] = nz;
+      v.texcoord[0] = s;
+      v.texcoord[1] = t;
+   }
+
+   //-------------------------------------------------------------------
+   // A flat grid from origin along u and v, see Procedural::plane()
+   //-------------------------------------------------------------------
+   void grid(GLuint numc, GLuint numt, const GLfloat* origin, const GLfloat* u,
+             const GLfloat* v, const GLfloat* normal, Procedural::Vertex* vertices)
+   {
+      int rows = int(numc);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+      for(int i = 0; i <= rows; ++i)
+      {
+         GLfloat s = GLfloat(i) / numc;
+         Procedural::Vertex* row = vertices + size_t(i) * (numt + 1);
+         for(GLuint j = 0; j <= numt; ++j)
+         {
+            GLfloat t = GLfloat(j) / numt;
+            set(row[j],
+                origin[0] + s * u[0] + t * v[0],
+                origin[1] + s * u[1] + t * v[1],
+                origin[2] + s * u[2] + t * v[2],
+                normal[0], normal[1], normal[2], s, t);
+         }
+      }
+   }
+}
+
+namespace Procedural
+{
+   const Indices& indices(GLuint numc, GLuint numt, GLuint faces)
+   {
+      uint64_t key = (uint64_t(numc) << 40) ^ (uint64_t(numt) << 16) ^ faces;
+      IndexCache::iterator found = cache().find(key);
+      if(found != cache().end())
+      {
+         return found->second;
+      }
+
+      Indices& out = cache()[key];
+      GLuint quadsPerFace = numc * numt;
+      out.triangles.resize(size_t(faces) * quadsPerFace * 6);
+      out.lines.resize(size_t(faces) * quadsPerFace * 6);
+
+      // Every quad writes its own six triangle and six line indices, so
+      // the rows are independent
+      int rows = int(faces * numc);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+      for(int row = 0; row < rows; ++row)
+      {
+         GLuint face = GLuint(row) / numc;
+         GLuint i = GLuint(row) % numc;
+         GLuint base = face * (numc + 1) * (numt + 1);
+         GLuint* tri = &out.triangles[size_t(row) * numt * 6];
+         GLuint* line = &out.lines[size_t(row) * numt * 6];
+         for(GLuint j = 0; j < numt; ++j)
+         {
+            GLuint ll = base + i * (numt + 1) + j;       // Lower left
+            GLuint ul = ll + 1;                          // Upper left
+            GLuint lr = base + (i + 1) * (numt + 1) + j; // Lower right
+            GLuint ur = lr + 1;                          // Upper right
+
+            tri[0] = ul;
+            tri[1] = ll;
+            tri[2] = lr;
+            tri[3] = lr;
+            tri[4] = ur;
+            tri[5] = ul;
+            tri += 6;
+
+            line[0] = ll;
+            line[1] = ul;
+            line[2] = ul;
+            line[3] = lr;
+            line[4] = lr;
+            line[5] = ll;
+            line += 6;
+         }
+      }
+      return out;
+   }
+
+   void clearCache(void)
+   {
+      cache().clear();
+   }
+
+   void torus(GLuint numc, GLuint numt, GLfloat radiusInner, GLfloat radiusOuter,
+              Vertex* vertices)
+   {
+      // Radius of the circles and distance from the axis to their centers
+      GLfloat radiusMiddle = GLfloat(fabs((radiusOuter - radiusInner) * 0.5));
+      GLfloat distToMiddle = radiusInner + radiusMiddle;
+
+      // Each circle is the first one, in the xy plane, turned about
+      // the y axis. The angles are the same for every circle.
+      std::vector<GLfloat> circleSin, circleCos;
+      angles(numt, 0.0, 2.0 * M_PI, circleSin, circleCos);
+
+      int rings = int(numc);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+      for(int i = 0; i <= rings; ++i)
+      {
+         double turn = i == rings ? 2.0 * M_PI : 2.0 * M_PI * i / numc;
+         GLfloat sinTurn = GLfloat(sin(turn));
+         GLfloat cosTurn = GLfloat(cos(turn));
+         GLfloat t = GLfloat(i) / numc;
+
+         Vertex* ring = vertices + size_t(i) * (numt + 1);
+         for(GLuint j = 0; j <= numt; ++j)
+         {
+            // Normal of the circle, then the point on it
+            GLfloat nx = circleCos[j];
+            GLfloat ny = circleSin[j];
+            GLfloat x = nx * radiusMiddle + distToMiddle;
+            GLfloat y = ny * radiusMiddle;
+            set(ring[j], x * cosTurn, y, -x * sinTurn,
+                nx * cosTurn, ny, -nx * sinTurn, GLfloat(j) / numt, t);
+         }
+      }
+   }
+
+   void sphere(GLuint numc, GLuint numt, GLfloat radius, Vertex* vertices)
+   {
+      // Latitudes from the south pole up, the same for every longitude
+      std::vector<GLfloat> latSin, latCos;
+      angles(numt, -0.5 * M_PI, M_PI, latSin, latCos);
+
+      int rings = int(numc);
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+      for(int i = 0; i <= rings; ++i)
+      {
+         double turn = i == rings ? 2.0 * M_PI : 2.0 * M_PI * i / numc;
+         GLfloat sinTurn = GLfloat(sin(turn));
+         GLfloat cosTurn = GLfloat(cos(turn));
+         GLfloat s = GLfloat(i) / numc;
+
+         Vertex* ring = vertices + size_t(i) * (numt + 1);
+         for(GLuint j = 0; j <= numt; ++j)
+         {
+            GLfloat nx = latCos[j] * cosTurn;
+            GLfloat ny = latSin[j];
+            GLfloat nz = -latCos[j] * sinTurn;
+            set(ring[j], nx * radius, ny * radius, nz * radius,
+                nx, ny, nz, s, GLfloat(j) / numt);
+         }
+      }
+   }
+
+   void plane(GLuint numc, GLuint numt, Vertex* vertices)
+   {
+      const GLfloat origin[3] = { -1.0f, -1.0f, 0.0f };
+      const GLfloat u[3]      = { 2.0f, 0.0f, 0.0f };
+      const GLfloat v[3]      = { 0.0f, 2.0f, 0.0f };
+      const GLfloat normal[3] = { 0.0f, 0.0f, 1.0f };
+      grid(numc, numt, origin, u, v, normal, vertices);
+   }
+
+   void cube(GLuint n, Vertex* vertices)
+   {
+      // Each face is a plane with u x v along its normal, so the
+      // triangles wind counter clockwise seen from outside
+      static const GLfloat faces[6][3][3] =
+      {
+         // normal           u                   v
+         { {  1,  0,  0 }, {  0,  0, -1 }, { 0,  1,  0 } },
+         { { -1,  0,  0 }, {  0,  0,  1 }, { 0,  1,  0 } },
+         { {  0,  1,  0 }, {  1,  0,  0 }, { 0,  0, -1 } },
+         { {  0, -1,  0 }, {  1,  0,  0 }, { 0,  0,  1 } },
+         { {  0,  0,  1 }, {  1,  0,  0 }, { 0,  1,  0 } },
+         { {  0,  0, -1 }, { -1,  0,  0 }, { 0,  1,  0 } }
+      };
+
+      for(int f = 0; f < 6; ++f)
+      {
+         const GLfloat* normal = faces[f][0];
+         GLfloat origin[3], u[3], v[3];
+         for(int k = 0; k < 3; ++k)
+         {
+            origin[k] = normal[k] - faces[f][1][k] - faces[f][2][k];
+            u[k] = 2.0f * faces[f][1][k];
+            v[k] = 2.0f * faces[f][2][k];
+         }
+         grid(n, n, origin, u, v, normal, vertices + size_t(f) * numVertices(n, n));
+      }
+   }
+}
@@ -0,0 +1,120 @@
+//----------------------------------------------------------------------
+// procedural.h
+//
+// Torus, sphere, plane and cube generated straight into interleaved
+// vertex buffers. Every shape is a grid of quads, so meshes of one
+// resolution share their index buffers, which are built once and
+// cached.
+//
+// Author: Jeff Bowles <jbowles@riskybacon.com>
+//----------------------------------------------------------------------
+
+#ifndef _procedural_h
+#define _procedural_h
+
+#include <vector>
+
+#if defined(__APPLE_CC__)
+#include <OpenGL/gl3.h>
+#else
+#include <GL/glew.h>
+#include <GL/gl.h>
+#endif
+
+namespace Procedural
+{
+   //-------------------------------------------------------------------
+   /// Interleaved vertex, 32 bytes. The vertex shaders read vec4
+   /// attributes, GL fills in w = 1 for the position; the normal is
+   /// used as .xyz.
+   //-------------------------------------------------------------------
+   struct Vertex
+   {
+      GLfloat position[3];
+      GLfloat normal[3];
+      GLfloat texcoord[2];
+   };
+
+   //-------------------------------------------------------------------
+   /// Indices of a grid of numc x numt quads on (numc + 1) x (numt + 1)
+   /// vertices, repeated for each face. Vertex (i, j) of face f is
+   /// f * (numc + 1) * (numt + 1) + i * (numt + 1) + j. The first and
+   /// last row and column are separate vertices even where a shape
+   /// closes, so texture coordinates run from 0 to 1 without a seam.
+   //-------------------------------------------------------------------
+   struct Indices
+   {
+      /// Two counter clockwise triangles per quad
+      std::vector<GLuint> triangles;
+
+      /// Both sides and the diagonal of each quad
+      std::vector<GLuint> lines;
+   };
+
+   ///
+   /// \return the number of vertices the shapes write for a resolution
+   ///
+   inline GLuint numVertices(GLuint numc, GLuint numt, GLuint faces = 1)
+   {
+      return faces * (numc + 1) * (numt + 1);
+   }
+
+   ///
+   /// Indices for a resolution, built on first use. The reference stays
+   /// valid until clearCache(). Not thread safe.
+   ///
+   /// \param numc Quads along i
+   /// \param numt Quads along j
+   /// \param faces Number of grids
+   ///
+   const Indices& indices(GLuint numc, GLuint numt, GLuint faces = 1);
+
+   ///
+   /// Release every cached index buffer
+   ///
+   void clearCache(void);
+
+   ///
+   /// A torus around the y axis: numc circles of numt quads each. Texture
+   /// coordinates are (around the circle, around the y axis).
+   ///
+   /// \param numc Number of circles
+   /// \param numt Divisions of each circle
+   /// \param radiusInner Distance from the axis to the inside of the torus
+   /// \param radiusOuter Distance from the axis to the outside of the torus
+   /// \param vertices numVertices(numc, numt) vertices to write, such as
+   ///                 a mapped buffer
+   ///
+   void torus(GLuint numc, GLuint numt, GLfloat radiusInner, GLfloat radiusOuter,
+              Vertex* vertices);
+
+   ///
+   /// A sphere around the origin with its poles on the y axis
+   ///
+   /// \param numc Divisions around the y axis
+   /// \param numt Divisions from the south pole to the north pole
+   /// \param radius Radius
+   /// \param vertices numVertices(numc, numt) vertices to write
+   ///
+   void sphere(GLuint numc, GLuint numt, GLfloat radius, Vertex* vertices);
+
+   ///
+   /// The square from (-1, -1, 0) to (1, 1, 0), facing +z
+   ///
+   /// \param numc Divisions along x
+   /// \param numt Divisions along y
+   /// \param vertices numVertices(numc, numt) vertices to write
+   ///
+   void plane(GLuint numc, GLuint numt, Vertex* vertices);
+
+   ///
+   /// The cube from (-1, -1, -1) to (1, 1, 1), six faces of n x n quads
+   /// in the order +x, -x, +y, -y, +z, -z
+   ///
+   /// \param n Divisions along each edge
+   /// \param vertices numVertices(n, n, 6) vertices to write
+   ///
+   void cube(GLuint n, Vertex* vertices);
+}
+
+#endif
@@ -0,0 +1,391 @@
+//----------------------------------------------------------------------
+// quantize.cpp
+//
+// Vertex quantisation and the matching CPU decode used to measure the
+// error
+//----------------------------------------------------------------------
+
+#include <math.h>
+#include <string.h>
+#include "quantize.h"
+
+namespace
+{
+   const float radiansToDegrees = 57.2957795f;
+
+   /// Largest value of a signed 16 bit normal component
+   const float snorm16 = 32767.0f;
+
+   /// Largest value of a signed 10 bit normal component
+   const float snorm10 = 511.0f;
+
+   /// Largest quantised position
+   const float unorm16 = 65535.0f;
+
+   inline float clampUnit(float x)
+   {
+      return x < -1.0f ? -1.0f : (x > 1.0f ? 1.0f : x);
+   }
+
+   inline float signNotZero(float x)
+   {
+      return x < 0.0f ? -1.0f : 1.0f;
+   }
+
+   inline const GLfloat* element(const GLfloat* base, GLsizei stride, GLuint i)
+   {
+      return reinterpret_cast<const GLfloat*>(
+         reinterpret_cast<const char*>(base) + size_t(i) * stride);
+   }
+
+   /// Angle between two vectors in degrees. atan2 of the cross and dot
+   /// products stays accurate for the tiny angles being measured,
+   /// acos of the dot product doesn't.
+   float angleDegrees(const GLfloat* a, const GLfloat* b)
+   {
+      double cx = double(a[1]) * b[2] - double(a[2]) * b[1];
+      double cy = double(a[2]) * b[0] - double(a[0]) * b[2];
+      double cz = double(a[0]) * b[1] - double(a[1]) * b[0];
+      double d = double(a[0]) * b[0] + double(a[1]) * b[1] + double(a[2]) * b[2];
+      return float(atan2(sqrt(cx * cx + cy * cy + cz * cz), d) * radiansToDegrees);
+   }
+}
+
+void Quantize::encodeOctahedral(const GLfloat* normal, GLshort* out)
+{
+   // Project onto the octahedron |x| + |y| + |z| = 1, then fold the
+   // lower half over the upper
+   float l1 = fabsf(normal[0]) + fabsf(normal[1]) + fabsf(normal[2]);
+   if(l1 == 0.0f)
+   {
+      out[0] = 0;
+      out[1] = 0;
+      return;
+   }
+
+   float u = normal[0] / l1;
+   float v = normal[1] / l1;
+   if(normal[2] < 0.0f)
+   {
+      float fu = (1.0f - fabsf(v)) * signNotZero(u);
+      float fv = (1.0f - fabsf(u)) * signNotZero(v);
+      u = fu;
+      v = fv;
+   }
+
+   // Of the four roundings around (u, v), keep the one that decodes
+   // closest to the normal
+   float bu = floorf(clampUnit(u) * snorm16);
+   float bv = floorf(clampUnit(v) * snorm16);
+   float best = -2.0f;
+   for(int i = 0; i < 4; ++i)
+   {
+      GLshort candidate[2];
+      candidate[0] = GLshort(clampUnit((bu + (i & 1)) / snorm16) * snorm16);
+      candidate[1] = GLshort(clampUnit((bv + (i >> 1)) / snorm16) * snorm16);
+
+      GLfloat decoded[3];
+      decodeOctahedral(candidate, decoded);
+      float d = decoded[0] * normal[0] + decoded[1] * normal[1] + decoded[2] * normal[2];
+      if(d > best)
+      {
+         best = d;
+         out[0] = candidate[0];
+         out[1] = candidate[1];
+      }
+   }
+}
+
+void Quantize::decodeOctahedral(const GLshort* in, GLfloat* normal)
+{
+   float u = in[0] / snorm16;
+   float v = in[1] / snorm16;
+   float z = 1.0f - fabsf(u) - fabsf(v);
+   if(z < 0.0f)
+   {
+      float fu = (1.0f - fabsf(v)) * signNotZero(u);
+      float fv = (1.0f - fabsf(u)) * signNotZero(v);
+      u = fu;
+      v = fv;
+   }
+
+   float l = sqrtf(u * u + v * v + z * z);
+   normal[0] = u / l;
+   normal[1] = v / l;
+   normal[2] = z / l;
+}
+
+GLuint Quantize::encode1010102(const GLfloat* normal)
+{
+   GLuint packed = 0;
+   for(int i = 0; i < 3; ++i)
+   {
+      int c = int(floorf(clampUnit(normal[i]) * snorm10 + 0.5f));
+      packed |= (GLuint(c) & 0x3ff) << (10 * i);
+   }
+   return packed;
+}
+
+void Quantize::decode1010102(GLuint packed, GLfloat* normal)
+{
+   float l = 0.0f;
+   for(int i = 0; i < 3; ++i)
+   {
+      // Sign extend the 10 bit field
+      int c = int((packed >> (10 * i)) & 0x3ff);
+      c = c >= 512 ? c - 1024 : c;
+      normal[i] = c / snorm10;
+      l += normal[i] * normal[i];
+   }
+
+   l = sqrtf(l);
+   for(int i = 0; i < 3 && l > 0.0f; ++i)
+   {
+      normal[i] /= l;
+   }
+}
+
+GLushort Quantize::floatToHalf(GLfloat f)
+{
+   uint32_t x;
+   memcpy(&x, &f, sizeof(x));
+
+   uint32_t sign = (x >> 16) & 0x8000;
+   uint32_t biased = (x >> 23) & 0xff;
+   uint32_t mantissa = x & 0x7fffff;
+
+   // Infinity and NaN
+   if(biased == 0xff)
+   {
+      return GLushort(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+   }
+
+   int exponent = int(biased) - 127 + 15;
+   if(exponent >= 31)
+   {
+      return GLushort(sign | 0x7c00);
+   }
+
+   if(exponent <= 0)
+   {
+      // Denormal half, or too small and rounds to zero
+      if(exponent < -10)
+      {
+         return GLushort(sign);
+      }
+      mantissa |= 0x800000;
+      uint32_t shift = uint32_t(14 - exponent);
+      uint32_t half = mantissa >> shift;
+      uint32_t rest = mantissa & ((1u << shift) - 1);
+      uint32_t halfway = 1u << (shift - 1);
+      if(rest > halfway || (rest == halfway && (half & 1)))
+      {
+         half++;
+      }
+      return GLushort(sign | half);
+   }
+
+   // A carry out of the mantissa correctly bumps the exponent, up to
+   // infinity
+   uint32_t half = (uint32_t(exponent) << 10) | (mantissa >> 13);
+   uint32_t rest = mantissa & 0x1fff;
+   if(rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+   {
+      half++;
+   }
+   return GLushort(sign | half);
+}
+
+GLfloat Quantize::halfToFloat(GLushort h)
+{
+   uint32_t sign = uint32_t(h & 0x8000) << 16;
+   uint32_t exponent = (h >> 10) & 0x1f;
+   uint32_t mantissa = h & 0x3ff;
+   uint32_t x;
+
+   if(exponent == 0)
+   {
+      if(mantissa == 0)
+      {
+         x = sign;
+      }
+      else
+      {
+         // Renormalize a denormal half
+         exponent = 127 - 15 + 1;
+         while(!(mantissa & 0x400))
+         {
+            mantissa <<= 1;
+            exponent--;
+         }
+         x = sign | (exponent << 23) | ((mantissa & 0x3ff) << 13);
+      }
+   }
+   else if(exponent == 0x1f)
+   {
+      x = sign | 0x7f800000 | (mantissa << 13);
+   }
+   else
+   {
+      x = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+   }
+
+   GLfloat f;
+   memcpy(&f, &x, sizeof(f));
+   return f;
+}
+
+void Quantize::quantize(const GLfloat* positions, GLsizei positionStride,
+                        const GLfloat* normals, GLsizei normalStride,
+                        const GLfloat* texcoords, GLsizei texcoordStride,
+                        GLuint count, NormalEncoding encoding, Vertices& out)
+{
+   GLuint i;
+   GLuint j;
+
+   out.numVertices = count;
+   out.normalEncoding = normals ? encoding : NORMAL_FLOAT;
+   out.stride = 4 * sizeof(GLushort);
+   out.normalOffset = -1;
+   out.texcoordOffset = -1;
+   if(normals)
+   {
+      out.normalOffset = out.stride;
+      out.stride += encoding == NORMAL_FLOAT ? 3 * sizeof(GLfloat) : 4;
+   }
+   if(texcoords)
+   {
+      out.texcoordOffset = out.stride;
+      out.stride += 2 * sizeof(GLushort);
+   }
+
+   // Bounding box of the positions
+   float lo[3] = { 0.0f, 0.0f, 0.0f };
+   float hi[3] = { 0.0f, 0.0f, 0.0f };
+   for(i = 0; i < count; ++i)
+   {
+      const GLfloat* p = element(positions, positionStride, i);
+      for(j = 0; j < 3; ++j)
+      {
+         lo[j] = (i == 0 || p[j] < lo[j]) ? p[j] : lo[j];
+         hi[j] = (i == 0 || p[j] > hi[j]) ? p[j] : hi[j];
+      }
+   }
+
+   float inverse[3];
+   float diagonal = 0.0f;
+   for(j = 0; j < 3; ++j)
+   {
+      float extent = hi[j] - lo[j];
+      out.positionOffset[j] = lo[j];
+      out.positionScale[j] = extent / unorm16;
+      inverse[j] = extent > 0.0f ? unorm16 / extent : 0.0f;
+      diagonal += extent * extent;
+   }
+   diagonal = sqrtf(diagonal);
+
+   out.data.assign(size_t(count) * out.stride, 0);
+   out.error.position = 0.0f;
+   out.error.normalDegrees = 0.0f;
+   out.error.texcoord = 0.0f;
+
+   for(i = 0; i < count; ++i)
+   {
+      GLubyte* vertex = &out.data[size_t(i) * out.stride];
+
+      const GLfloat* p = element(positions, positionStride, i);
+      GLushort* q = reinterpret_cast<GLushort*>(vertex);
+      float error = 0.0f;
+      for(j = 0; j < 3; ++j)
+      {
+         float scaled = (p[j] - lo[j]) * inverse[j] + 0.5f;
+         q[j] = GLushort(scaled > unorm16 ? unorm16 : scaled);
+         float d = q[j] * out.positionScale[j] + out.positionOffset[j] - p[j];
+         error += d * d;
+      }
+      error = sqrtf(error);
+      out.error.position = error > out.error.position ? error : out.error.position;
+
+      if(normals)
+      {
+         const GLfloat* n = element(normals, normalStride, i);
+         GLubyte* target = vertex + out.normalOffset;
+         GLfloat decoded[3];
+
+         switch(out.normalEncoding)
+         {
+            case NORMAL_OCTAHEDRAL:
+            {
+               GLshort e[2];
+               encodeOctahedral(n, e);
+               memcpy(target, e, sizeof(e));
+               decodeOctahedral(e, decoded);
+               break;
+            }
+            case NORMAL_10_10_10_2:
+            {
+               GLuint packed = encode1010102(n);
+               memcpy(target, &packed, sizeof(packed));
+               decode1010102(packed, decoded);
+               break;
+            }
+            default:
+               memcpy(target, n, 3 * sizeof(GLfloat));
+               memcpy(decoded, n, 3 * sizeof(GLfloat));
+               break;
+         }
+
+         float angle = angleDegrees(n, decoded);
+         out.error.normalDegrees = angle > out.error.normalDegrees ? angle : out.error.normalDegrees;
+      }
+
+      if(texcoords)
+      {
+         const GLfloat* t = element(texcoords, texcoordStride, i);
+         GLushort* h = reinterpret_cast<GLushort*>(vertex + out.texcoordOffset);
+         for(j = 0; j < 2; ++j)
+         {
+            h[j] = floatToHalf(t[j]);
+            float d = fabsf(halfToFloat(h[j]) - t[j]);
+            out.error.texcoord = d > out.error.texcoord ? d : out.error.texcoord;
+         }
+      }
+   }
+
+   out.error.positionRelative = diagonal > 0.0f ? out.error.position / diagonal : 0.0f;
+}
+
+void Quantize::Vertices::setAttributes(GLint vertex, GLint normal, GLint texcoord) const
+{
+   const char* base = NULL;
+
+   if(vertex >= 0)
+   {
+      glVertexAttribPointer(vertex, 3, GL_UNSIGNED_SHORT, GL_FALSE, stride, base);
+      glEnableVertexAttribArray(vertex);
+   }
+
+   if(normal >= 0 && normalOffset >= 0)
+   {
+      switch(normalEncoding)
+      {
+         case NORMAL_OCTAHEDRAL:
+            glVertexAttribPointer(normal, 2, GL_SHORT, GL_FALSE, stride, base + normalOffset);
+            break;
+         case NORMAL_10_10_10_2:
+            glVertexAttribPointer(normal, 4, GL_INT_2_10_10_10_REV, GL_FALSE, stride,
+                                  base + normalOffset);
+            break;
+         default:
+            glVertexAttribPointer(normal, 3, GL_FLOAT, GL_FALSE, stride, base + normalOffset);
+            break;
+      }
+      glEnableVertexAttribArray(normal);
+   }
+
+   if(texcoord >= 0 && texcoordOffset >= 0)
+   {
+      glVertexAttribPointer(texcoord, 2, GL_HALF_FLOAT, GL_FALSE, stride, base + texcoordOffset);
+      glEnableVertexAttribArray(texcoord);
+   }
+}
@@ -0,0 +1,145 @@
+//----------------------------------------------------------------------
+// quantize.h
+//
+// Compact vertex formats: 16 bit positions relative to the bounding
+// box, octahedral or 10_10_10_2 normals and half float texture
+// coordinates. The vertex shaders undo the encoding, see the
+// positionScale, positionOffset and normalEncoding uniforms in
+// shadow.vsh.
+//
+// Author: Jeff Bowles <jbowles@riskybacon.com>
+//----------------------------------------------------------------------
+
+#ifndef _quantize_h
+#define _quantize_h
+
+#include <stdint.h>
+#include <vector>
+
+#if defined(__APPLE_CC__)
+#include <OpenGL/gl3.h>
+#else
+#include <GL/glew.h>
+#include <GL/gl.h>
+#endif
+
+namespace Quantize
+{
+   ///
+   /// How normals are stored. The values match the normalEncoding
+   /// uniform in the vertex shaders.
+   ///
+   enum NormalEncoding
+   {
+      NORMAL_FLOAT = 0,      ///< 3 floats, 12 bytes
+      NORMAL_OCTAHEDRAL = 1, ///< Octahedral map in 2 shorts, 4 bytes
+      NORMAL_10_10_10_2 = 2  ///< GL_INT_2_10_10_10_REV, 4 bytes
+   };
+
+   //-------------------------------------------------------------------
+   /// Largest differences between the original and decoded vertices
+   //-------------------------------------------------------------------
+   struct Error
+   {
+      /// Largest distance between a position and its decoded value
+      float position;
+
+      /// position as a fraction of the bounding box diagonal
+      float positionRelative;
+
+      /// Largest angle between a normal and its decoded value, degrees
+      float normalDegrees;
+
+      /// Largest difference in a texture coordinate
+      float texcoord;
+   };
+
+   //-------------------------------------------------------------------
+   /// Interleaved quantised vertices. Positions are 3 unsigned shorts
+   /// padded to 8 bytes, followed by the normal (4 bytes) and texture
+   /// coordinate (2 half floats) when present.
+   ///
+   /// Nothing is normalized by GL, the vertex shader decodes:
+   ///    position = vertex.xyz * positionScale + positionOffset
+   ///    normal   = per normalEncoding
+   //-------------------------------------------------------------------
+   struct Vertices
+   {
+      std::vector<GLubyte> data;
+      GLuint  numVertices;
+      GLsizei stride;
+
+      /// Byte offset of the normal, -1 if there are none
+      GLint normalOffset;
+
+      /// Byte offset of the texture coordinate, -1 if there are none
+      GLint texcoordOffset;
+
+      NormalEncoding normalEncoding;
+
+      /// Position decode, see above
+      GLfloat positionScale[3];
+      GLfloat positionOffset[3];
+
+      /// Measured by quantize()
+      Error error;
+
+      ///
+      /// Point vertex attributes at the buffer bound to GL_ARRAY_BUFFER,
+      /// which holds data. Locations below 0 are skipped.
+      ///
+      void setAttributes(GLint vertex, GLint normal, GLint texcoord) const;
+   };
+
+   ///
+   /// Quantise vertices. The inputs are strided so they can come from
+   /// interleaved arrays or arrays of glm::vec4.
+   ///
+   /// \param positions First position, 3 floats
+   /// \param positionStride Bytes from one position to the next
+   /// \param normals First normal, 3 floats, or NULL
+   /// \param normalStride Bytes from one normal to the next
+   /// \param texcoords First texture coordinate, 2 floats, or NULL
+   /// \param texcoordStride Bytes from one texture coordinate to the next
+   /// \param count Number of vertices
+   /// \param encoding How to store the normals
+   /// \param out Filled in with the vertices, decode values and error
+   ///
+   void quantize(const GLfloat* positions, GLsizei positionStride,
+                 const GLfloat* normals, GLsizei normalStride,
+                 const GLfloat* texcoords, GLsizei texcoordStride,
+                 GLuint count, NormalEncoding encoding, Vertices& out);
+
+   ///
+   /// Encode a unit vector with the octahedral map into two snorm16
+   /// values, picking the rounding with the smallest angular error
+   ///
+   void encodeOctahedral(const GLfloat* normal, GLshort* out);
+
+   ///
+   /// Decode an octahedral normal, as the vertex shader does
+   ///
+   void decodeOctahedral(const GLshort* in, GLfloat* normal);
+
+   ///
+   /// Pack a unit vector into GL_INT_2_10_10_10_REV
+   ///
+   GLuint encode1010102(const GLfloat* normal);
+
+   ///
+   /// Unpack GL_INT_2_10_10_10_REV, as the vertex shader does
+   ///
+   void decode1010102(GLuint packed, GLfloat* normal);
+
+   ///
+   /// \return f as a half float, rounded to nearest even
+   ///
+   GLushort floatToHalf(GLfloat f);
+
+   ///
+   /// \return the half float h as a float
+   ///
+   GLfloat halfToFloat(GLushort h);
+}
+
+#endif
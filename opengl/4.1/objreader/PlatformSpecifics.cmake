@@ -144,3 +144,14 @@ else(APPLE)
   )
 
 endif(APPLE)
+
+# OpenMP is optional, the glm routines run serially without it
+find_package(OpenMP)
+if(OPENMP_FOUND)
+  set(CMAKE_C_FLAGS "${CMAKE_C_FLAGS} ${OpenMP_C_FLAGS}")
+  set(CMAKE_CXX_FLAGS "${CMAKE_CXX_FLAGS} ${OpenMP_CXX_FLAGS}")
+endif(OPENMP_FOUND)
+
+# The viewer reloads the model on a thread of its own
+find_package(Threads)
+set(LIBRARIES ${LIBRARIES} ${CMAKE_THREAD_LIBS_INIT})
@@ -0,0 +1,2440 @@
+//----------------------------------------------------------------------
+// benchmark.cpp
+//
+// Timing harness for the glm OBJ routines. Runs headless, no OpenGL
+// context is created.
+//
+// Usage:
+//    objbench [benchmark] [obj files...]
+//
+// With no obj files the benchmarks run on bunny.obj and a couple of
+// synthetic meshes written to the build directory.
+//
+// Author: Jeff Bowles <jbowles@riskybacon.com>
+//----------------------------------------------------------------------
+
+#include <float.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "config.h"
+#include "objmodel.h"
+#include "vertexcache.h"
+#include "meshcache.h"
+#include "objstream.h"
+#include "quantize.h"
+#include "simplify.h"
+#include "meshlet.h"
+#include "bvh.h"
+
+using std::cout;
+using std::endl;
+using std::string;
+using std::vector;
+
+/**
+ * @return the current time in seconds
+ */
+double now(void)
+{
+   using namespace std::chrono;
+   return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * @return the size of a file in bytes
+ */
+double fileSize(const string& filename)
+{
+   std::ifstream in(filename.c_str(), std::ios::binary | std::ios::ate);
+   return double(in.tellg());
+}
+
+/**
+ * Write a synthetic mesh: a sphere tessellated into res x res quads,
+ * each split into two triangles. Produces (res + 1)^2 vertices and
+ * 2 * res^2 triangles.
+ *
+ * @param filename
+ *    Name of the OBJ file to write
+ * @param res
+ *    Number of divisions in each direction
+ */
+void writeSphere(const string& filename, int res)
+{
+   FILE* file = fopen(filename.c_str(), "w");
+   if(!file)
+   {
+      std::cerr << "Could not open " << filename << " for writing" << endl;
+      exit(EXIT_FAILURE);
+   }
+
+   fprintf(file, "# synthetic sphere, %d x %d\n", res, res);
+   for(int j = 0; j <= res; ++j)
+   {
+      double phi = M_PI * j / res;
+      for(int i = 0; i <= res; ++i)
+      {
+         double theta = 2.0 * M_PI * i / res;
+         fprintf(file, "v %f %f %f\n",
+                 sin(phi) * cos(theta), cos(phi), sin(phi) * sin(theta));
+      }
+   }
+
+   for(int j = 0; j < res; ++j)
+   {
+      for(int i = 0; i < res; ++i)
+      {
+         int ll = j * (res + 1) + i + 1;
+         int lr = ll + 1;
+         int ul = ll + res + 1;
+         int ur = ul + 1;
+         fprintf(file, "f %d %d %d\n", ll, lr, ur);
+         fprintf(file, "f %d %d %d\n", ll, ur, ul);
+      }
+   }
+
+   fclose(file);
+}
+
+/**
+ * @return the name of a synthetic sphere in the build directory,
+ * written on first use
+ */
+string spherePath(int res)
+{
+   std::stringstream ss;
+   ss << PROJECT_BINARY_DIR << "/sphere_" << res << ".obj";
+   std::ifstream exists(ss.str().c_str());
+   if(!exists.good())
+   {
+      cout << "Writing " << ss.str() << endl;
+      writeSphere(ss.str(), res);
+   }
+   return ss.str();
+}
+
+/**
+ * @return the list of files to benchmark: bunny.obj and synthetic
+ * spheres at a few resolutions
+ */
+vector<string> defaultFiles(void)
+{
+   vector<string> files;
+   files.push_back(BUNNY_OBJ);
+
+   files.push_back(spherePath(256));
+   files.push_back(spherePath(1024));
+   return files;
+}
+
+/**
+ * Time a model reader, keeping the best of several runs
+ *
+ * @param reader
+ *    glmReadOBJ or one of its variants
+ * @param filename
+ *    The OBJ file to read
+ * @param triangles
+ *    Set to the number of triangles read
+ * @return the fastest run in seconds
+ */
+double timeReader(GLMmodel* (*reader)(const char*), const string& filename, GLuint& triangles)
+{
+   double best = 1e30;
+   for(int run = 0; run < 3; ++run)
+   {
+      double start = now();
+      GLMmodel* model = reader(filename.c_str());
+      double elapsed = now() - start;
+
+      triangles = model->numtriangles;
+      glmDelete(model);
+      best = elapsed < best ? elapsed : best;
+   }
+   return best;
+}
+
+/**
+ * @return true if two models hold exactly the same vertices, normals,
+ * texcoords, triangles and groups
+ */
+bool sameModel(const GLMmodel* a, const GLMmodel* b)
+{
+   if(a->numvertices  != b->numvertices  ||
+      a->numnormals   != b->numnormals   ||
+      a->numtexcoords != b->numtexcoords ||
+      a->numtriangles != b->numtriangles ||
+      a->numgroups    != b->numgroups    ||
+      a->nummaterials != b->nummaterials)
+   {
+      return false;
+   }
+
+   if(memcmp(a->vertices + 3, b->vertices + 3, sizeof(GLfloat) * 3 * a->numvertices) ||
+      (a->numnormals &&
+       memcmp(a->normals + 3, b->normals + 3, sizeof(GLfloat) * 3 * a->numnormals)) ||
+      (a->numtexcoords &&
+       memcmp(a->texcoords + 2, b->texcoords + 2, sizeof(GLfloat) * 2 * a->numtexcoords)))
+   {
+      return false;
+   }
+
+   // The two pass reader leaves normal and texcoord indices unset when
+   // the file has none, so only the ones in use are compared
+   for(GLuint i = 0; i < a->numtriangles; ++i)
+   {
+      const GLMtriangle& ta = a->triangles[i];
+      const GLMtriangle& tb = b->triangles[i];
+      if(memcmp(ta.vindices, tb.vindices, sizeof(ta.vindices)) ||
+         (a->numnormals && memcmp(ta.nindices, tb.nindices, sizeof(ta.nindices))) ||
+         (a->numtexcoords && memcmp(ta.tindices, tb.tindices, sizeof(ta.tindices))))
+      {
+         return false;
+      }
+   }
+
+   // The two pass reader keeps the blank after "g" in group names
+   const GLMgroup* ga = a->groups;
+   const GLMgroup* gb = b->groups;
+   for(; ga && gb; ga = ga->next, gb = gb->next)
+   {
+      const char* na = ga->name + strspn(ga->name, " \t");
+      const char* nb = gb->name + strspn(gb->name, " \t");
+      if(strcmp(na, nb) ||
+         ga->material != gb->material ||
+         ga->numtriangles != gb->numtriangles ||
+         memcmp(ga->triangles, gb->triangles, sizeof(GLuint) * ga->numtriangles))
+      {
+         return false;
+      }
+   }
+   return true;
+}
+
+/**
+ * Compare glmReadOBJ against the original two pass reader, checking
+ * that both read the same model
+ *
+ * @return true if every check passed
+ */
+bool benchmarkLoad(const vector<string>& files)
+{
+   bool passed = true;
+
+   cout << std::left << std::setw(48) << "file"
+        << std::right << std::setw(12) << "triangles"
+        << std::setw(14) << "two pass (s)"
+        << std::setw(14) << "mmap (s)"
+        << std::setw(12) << "MB/s"
+        << std::setw(10) << "speedup"
+        << std::setw(12) << "identical" << endl;
+
+   for(size_t i = 0; i < files.size(); ++i)
+   {
+      GLuint triangles;
+      double twoPass = timeReader(glmReadOBJTwoPass, files[i], triangles);
+      double mapped  = timeReader(glmReadOBJ,        files[i], triangles);
+      double mb      = fileSize(files[i]) / (1024.0 * 1024.0);
+
+      GLMmodel* reference = glmReadOBJTwoPass(files[i].c_str());
+      GLMmodel* model = glmReadOBJ(files[i].c_str());
+      bool same = sameModel(reference, model);
+      passed = passed && same;
+      glmDelete(model);
+      glmDelete(reference);
+
+      cout << std::left << std::setw(48) << files[i]
+           << std::right << std::setw(12) << triangles
+           << std::setw(14) << std::fixed << std::setprecision(4) << twoPass
+           << std::setw(14) << mapped
+           << std::setw(12) << std::setprecision(1) << mb / mapped
+           << std::setw(10) << std::setprecision(2) << twoPass / mapped
+           << std::setw(12) << (same ? "yes" : "NO") << endl;
+   }
+
+   cout << (passed ? "All load checks passed" : "Some load checks FAILED") << endl;
+   return passed;
+}
+
+/**
+ * Time glmReadOBJThreaded, keeping the best of several runs
+ *
+ * @param filename
+ *    The OBJ file to read
+ * @param threads
+ *    Number of threads to parse with
+ * @param serial
+ *    Model read with glmReadOBJ to check the result against
+ * @param same
+ *    Set to true if the result matches the serial model
+ * @return the fastest run in seconds
+ */
+double timeThreaded(const string& filename, GLuint threads,
+                    const GLMmodel* serial, bool& same)
+{
+   double best = 1e30;
+   same = true;
+   for(int run = 0; run < 3; ++run)
+   {
+      double start = now();
+      GLMmodel* model = glmReadOBJThreaded(filename.c_str(), threads);
+      double elapsed = now() - start;
+
+      same = same && sameModel(serial, model);
+      glmDelete(model);
+      best = elapsed < best ? elapsed : best;
+   }
+   return best;
+}
+
+/**
+ * Scaling of glmReadOBJThreaded from 1 thread up to the number of
+ * hardware threads, checked against the serial reader
+ *
+ * @return true if every thread count read the same model
+ */
+bool benchmarkThreads(const vector<string>& files)
+{
+   bool passed = true;
+
+   GLuint maxThreads = std::thread::hardware_concurrency();
+   maxThreads = maxThreads ? maxThreads : 1;
+
+   vector<GLuint> counts;
+   for(GLuint threads = 1; threads < maxThreads; threads *= 2)
+   {
+      counts.push_back(threads);
+   }
+   counts.push_back(maxThreads);
+
+   cout << std::left << std::setw(48) << "file"
+        << std::right << std::setw(10) << "threads"
+        << std::setw(14) << "time (s)"
+        << std::setw(12) << "MB/s"
+        << std::setw(10) << "speedup"
+        << std::setw(12) << "identical" << endl;
+
+   for(size_t i = 0; i < files.size(); ++i)
+   {
+      GLMmodel* serial = glmReadOBJ(files[i].c_str());
+      double mb = fileSize(files[i]) / (1024.0 * 1024.0);
+      double base = 0;
+
+      for(size_t j = 0; j < counts.size(); ++j)
+      {
+         bool same;
+         double elapsed = timeThreaded(files[i], counts[j], serial, same);
+         base = j == 0 ? elapsed : base;
+         passed = passed && same;
+
+         cout << std::left << std::setw(48) << files[i]
+              << std::right << std::setw(10) << counts[j]
+              << std::setw(14) << std::fixed << std::setprecision(4) << elapsed
+              << std::setw(12) << std::setprecision(1) << mb / elapsed
+              << std::setw(10) << std::setprecision(2) << base / elapsed
+              << std::setw(12) << (same ? "yes" : "NO") << endl;
+      }
+      glmDelete(serial);
+   }
+
+   cout << (passed ? "All thread checks passed" : "Some thread checks FAILED") << endl;
+   return passed;
+}
+
+/**
+ * Time a welding routine, keeping the best of several runs. The model
+ * is read again before each run as welding changes it.
+ *
+ * @param weld
+ *    glmWeld or glmWeldBruteForce
+ * @param filename
+ *    The OBJ file to read
+ * @param epsilon
+ *    Maximum difference between vertices
+ * @param vertices
+ *    Set to the number of vertices left after welding
+ * @param triangles
+ *    Set to the triangles after welding
+ * @return the fastest run in seconds
+ */
+double timeWeld(GLvoid (*weld)(GLMmodel*, GLfloat), const string& filename,
+                GLfloat epsilon, GLuint& vertices, vector<GLMtriangle>& triangles)
+{
+   double best = 1e30;
+   for(int run = 0; run < 3; ++run)
+   {
+      GLMmodel* model = glmReadOBJ(filename.c_str());
+      double start = now();
+      weld(model, epsilon);
+      double elapsed = now() - start;
+
+      vertices = model->numvertices;
+      triangles.assign(model->triangles, model->triangles + model->numtriangles);
+      glmDelete(model);
+      best = elapsed < best ? elapsed : best;
+   }
+   return best;
+}
+
+/**
+ * Compare the spatial hash glmWeld against the brute force welder on
+ * spheres of increasing size to find the crossover, then on the given
+ * files. The brute force welder is skipped on large models.
+ *
+ * @return true if both welders gave the same result wherever both ran
+ */
+bool benchmarkWeld(const vector<string>& files)
+{
+   const GLfloat epsilon = 0.00001f;
+   const GLuint bruteForceLimit = 100000;
+
+   bool passed = true;
+
+   vector<string> models;
+   int res[] = { 4, 8, 16, 32, 64, 128, 256 };
+   for(int i = 0; i < 7; ++i)
+   {
+      models.push_back(spherePath(res[i]));
+   }
+   for(size_t i = 0; i < files.size(); ++i)
+   {
+      if(std::find(models.begin(), models.end(), files[i]) == models.end())
+      {
+         models.push_back(files[i]);
+      }
+   }
+
+   cout << std::left << std::setw(48) << "file"
+        << std::right << std::setw(12) << "vertices"
+        << std::setw(12) << "welded"
+        << std::setw(16) << "brute force (s)"
+        << std::setw(14) << "hash (s)"
+        << std::setw(10) << "speedup"
+        << std::setw(12) << "identical" << endl;
+
+   for(size_t i = 0; i < models.size(); ++i)
+   {
+      GLMmodel* model = glmReadOBJ(models[i].c_str());
+      GLuint vertices = model->numvertices;
+      glmDelete(model);
+
+      GLuint hashVertices;
+      vector<GLMtriangle> hashTriangles;
+      double hash = timeWeld(glmWeld, models[i], epsilon, hashVertices, hashTriangles);
+
+      cout << std::left << std::setw(48) << models[i]
+           << std::right << std::setw(12) << vertices
+           << std::setw(12) << hashVertices;
+
+      if(vertices > bruteForceLimit)
+      {
+         cout << std::setw(16) << "-"
+              << std::setw(14) << std::fixed << std::setprecision(6) << hash
+              << std::setw(10) << "-"
+              << std::setw(12) << "-" << endl;
+         continue;
+      }
+
+      GLuint bruteVertices;
+      vector<GLMtriangle> bruteTriangles;
+      double brute = timeWeld(glmWeldBruteForce, models[i], epsilon, bruteVertices, bruteTriangles);
+
+      bool same = bruteVertices == hashVertices &&
+         memcmp(&bruteTriangles[0], &hashTriangles[0],
+                sizeof(GLMtriangle) * hashTriangles.size()) == 0;
+      passed = passed && same;
+
+      cout << std::setw(16) << std::fixed << std::setprecision(6) << brute
+           << std::setw(14) << hash
+           << std::setw(10) << std::setprecision(2) << brute / hash
+           << std::setw(12) << (same ? "yes" : "NO") << endl;
+   }
+
+   cout << (passed ? "All weld checks passed" : "Some weld checks FAILED") << endl;
+   return passed;
+}
+
+/**
+ * Build a sphere like writeSphere() does, directly in memory. Used
+ * for meshes too big to be worth writing out as OBJ files.
+ *
+ * @param res
+ *    Number of divisions in each direction
+ * @return a model to be deleted with glmDelete()
+ */
+GLMmodel* sphereModel(int res)
+{
+   GLMmodel* model = (GLMmodel*)calloc(1, sizeof(GLMmodel));
+   model->pathname = strdup("sphere");
+
+   model->numvertices = (res + 1) * (res + 1);
+   model->vertices = (GLfloat*)malloc(sizeof(GLfloat) * 3 * (model->numvertices + 1));
+   GLfloat* v = &model->vertices[3];
+   for(int j = 0; j <= res; ++j)
+   {
+      double phi = M_PI * j / res;
+      for(int i = 0; i <= res; ++i)
+      {
+         double theta = 2.0 * M_PI * i / res;
+         *v++ = GLfloat(sin(phi) * cos(theta));
+         *v++ = GLfloat(cos(phi));
+         *v++ = GLfloat(sin(phi) * sin(theta));
+      }
+   }
+
+   model->numtriangles = 2 * res * res;
+   model->triangles = (GLMtriangle*)calloc(model->numtriangles, sizeof(GLMtriangle));
+   GLMtriangle* t = model->triangles;
+   for(int j = 0; j < res; ++j)
+   {
+      for(int i = 0; i < res; ++i)
+      {
+         GLuint ll = j * (res + 1) + i + 1;
+         GLuint lr = ll + 1;
+         GLuint ul = ll + res + 1;
+         GLuint ur = ul + 1;
+         t->vindices[0] = ll; t->vindices[1] = lr; t->vindices[2] = ur; ++t;
+         t->vindices[0] = ll; t->vindices[1] = ur; t->vindices[2] = ul; ++t;
+      }
+   }
+   return model;
+}
+
+/**
+ * Time facet normals with the scalar and batched code, building the
+ * vertex to triangle adjacency and smooth vertex normals with and
+ * without a prebuilt adjacency
+ *
+ * @param name
+ *    What to call the model in the output
+ * @param model
+ *    The model, its normals are replaced
+ * @return true if the batched facet normals match the scalar ones
+ */
+bool timeNormals(const string& name, GLMmodel* model)
+{
+   const GLfloat angle = 90.0f;
+   const int runs = 3;
+
+   // Both compute in float, in a different order
+   const double maxError = 1e-5;
+
+   double scalar = 1e30;
+   double batched = 1e30;
+   double adjacency = 1e30;
+   double vertex = 1e30;
+   double reuse = 1e30;
+   double error = 0;
+
+   for(int run = 0; run < runs; ++run)
+   {
+      double start = now();
+      glmFacetNormalsScalar(model);
+      scalar = std::min(scalar, now() - start);
+
+      vector<GLfloat> reference(model->facetnorms + 3,
+                                model->facetnorms + 3 * (model->numfacetnorms + 1));
+
+      start = now();
+      glmFacetNormals(model);
+      batched = std::min(batched, now() - start);
+
+      for(size_t i = 0; i < reference.size(); ++i)
+      {
+         double e = fabs(reference[i] - model->facetnorms[i + 3]);
+         error = e > error ? e : error;
+      }
+
+      start = now();
+      glmVertexNormals(model, angle);
+      vertex = std::min(vertex, now() - start);
+
+      GLMadjacency adj;
+      start = now();
+      glmBuildAdjacency(model, &adj);
+      adjacency = std::min(adjacency, now() - start);
+
+      start = now();
+      glmVertexNormalsAdjacency(model, angle, &adj);
+      reuse = std::min(reuse, now() - start);
+      glmDeleteAdjacency(&adj);
+   }
+
+   cout << std::left << std::setw(48) << name
+        << std::right << std::setw(12) << model->numtriangles
+        << std::setw(12) << std::fixed << std::setprecision(4) << scalar
+        << std::setw(12) << batched
+        << std::setw(10) << std::setprecision(2) << scalar / batched
+        << std::setw(12) << std::scientific << std::setprecision(1) << error
+        << std::setw(16) << std::fixed << std::setprecision(4) << adjacency
+        << std::setw(14) << vertex
+        << std::setw(18) << reuse
+        << std::setw(8) << (error <= maxError ? "ok" : "FAIL") << endl;
+   return error <= maxError;
+}
+
+/**
+ * Normal generation on the given files and on a 10M triangle sphere
+ *
+ * @return true if every check passed
+ */
+bool benchmarkNormals(const vector<string>& files)
+{
+   bool passed = true;
+
+   cout << std::left << std::setw(48) << "file"
+        << std::right << std::setw(12) << "triangles"
+        << std::setw(12) << "scalar (s)"
+        << std::setw(12) << "batched (s)"
+        << std::setw(10) << "speedup"
+        << std::setw(12) << "max error"
+        << std::setw(16) << "adjacency (s)"
+        << std::setw(14) << "vertex (s)"
+        << std::setw(18) << "vertex reuse (s)"
+        << std::setw(8) << "check" << endl;
+
+   for(size_t i = 0; i < files.size(); ++i)
+   {
+      GLMmodel* model = glmReadOBJ(files[i].c_str());
+      passed = timeNormals(files[i], model) && passed;
+      glmDelete(model);
+   }
+
+   // 2 * 2237^2 is just over 10 million triangles
+   GLMmodel* model = sphereModel(2237);
+   passed = timeNormals("sphere, 10M triangles (in memory)", model) && passed;
+   glmDelete(model);
+
+   cout << (passed ? "All normal checks passed" : "Some normal checks FAILED") << endl;
+   return passed;
+}
+
+/**
+ * Compare the unshared buffers from OBJModel::createBuffers with the
+ * indexed buffers from OBJModel::createIndexedBuffers: build time,
+ * vertices and bytes that would be uploaded
+ */
+void benchmarkIndexed(const vector<string>& files)
+{
+   cout << std::left << std::setw(48) << "file"
+        << std::right << std::setw(12) << "triangles"
+        << std::setw(12) << "unique"
+        << std::setw(10) << "ratio"
+        << std::setw(8) << "index"
+        << std::setw(14) << "arrays (s)"
+        << std::setw(14) << "indexed (s)"
+        << std::setw(14) << "arrays (MB)"
+        << std::setw(14) << "indexed (MB)" << endl;
+
+   for(size_t i = 0; i < files.size(); ++i)
+   {
+      OBJModel model(files[i]);
+      model.facetNormals();
+      model.vertexNormals(90.0f);
+
+      vector<glm::vec4> vertices;
+      vector<glm::vec4> normals;
+      vector<glm::vec2> texcoords;
+      OBJIndexedBuffers buffers;
+
+      double arrays = 1e30;
+      double indexed = 1e30;
+      for(int run = 0; run < 3; ++run)
+      {
+         double start = now();
+         model.createBuffers(GLM_SMOOTH, vertices, normals, texcoords);
+         arrays = std::min(arrays, now() - start);
+
+         start = now();
+         model.createIndexedBuffers(GLM_SMOOTH, buffers);
+         indexed = std::min(indexed, now() - start);
+      }
+
+      double arrayBytes = vertices.size() * sizeof(glm::vec4)
+                        + normals.size() * sizeof(glm::vec4)
+                        + texcoords.size() * sizeof(glm::vec2);
+      double indexedBytes = buffers.vertices.size() * sizeof(GLfloat)
+                          + buffers.indices.size();
+
+      cout << std::left << std::setw(48) << files[i]
+           << std::right << std::setw(12) << buffers.numIndices / 3
+           << std::setw(12) << buffers.numVertices
+           << std::setw(10) << std::fixed << std::setprecision(2) << buffers.dedupRatio()
+           << std::setw(8) << 8 * buffers.indexSize()
+           << std::setw(14) << std::setprecision(4) << arrays
+           << std::setw(14) << indexed
+           << std::setw(14) << std::setprecision(2) << arrayBytes / (1024.0 * 1024.0)
+           << std::setw(14) << indexedBytes / (1024.0 * 1024.0) << endl;
+   }
+}
+
+/**
+ * Print the simulated FIFO and LRU miss ratios of an index buffer
+ */
+void printCacheStats(const string& name, const string& order,
+                     const vector<GLuint>& indices, GLuint numVertices,
+                     GLuint cacheSize, double seconds)
+{
+   VertexCache::Stats fifo = VertexCache::simulate(indices, numVertices, cacheSize,
+                                                   VertexCache::FIFO);
+   VertexCache::Stats lru = VertexCache::simulate(indices, numVertices, cacheSize,
+                                                  VertexCache::LRU);
+
+   cout << std::left << std::setw(48) << name
+        << std::setw(12) << order
+        << std::right << std::setw(12) << indices.size() / 3
+        << std::setw(12) << std::fixed << std::setprecision(3) << fifo.acmr
+        << std::setw(12) << fifo.atvr
+        << std::setw(12) << lru.acmr
+        << std::setw(12) << lru.atvr
+        << std::setw(12) << std::setprecision(4) << seconds << endl;
+}
+
+/**
+ * Vertex cache miss ratios of indexed buffers as read, with the
+ * triangles shuffled, and after optimisation of each
+ */
+void benchmarkVertexCache(const vector<string>& files)
+{
+   const GLuint cacheSize = 32;
+
+   cout << "Simulated " << cacheSize << " entry vertex cache" << endl;
+   cout << std::left << std::setw(48) << "file"
+        << std::setw(12) << "order"
+        << std::right << std::setw(12) << "triangles"
+        << std::setw(12) << "FIFO ACMR"
+        << std::setw(12) << "FIFO ATVR"
+        << std::setw(12) << "LRU ACMR"
+        << std::setw(12) << "LRU ATVR"
+        << std::setw(12) << "time (s)" << endl;
+
+   for(size_t i = 0; i < files.size(); ++i)
+   {
+      OBJModel model(files[i]);
+      model.facetNormals();
+      model.vertexNormals(90.0f);
+
+      OBJIndexedBuffers buffers;
+      model.createIndexedBuffers(GLM_SMOOTH, buffers);
+      GLuint floats = buffers.stride / sizeof(GLfloat);
+
+      vector<GLuint> indices;
+      buffers.getIndices(indices);
+      printCacheStats(files[i], "file", indices, buffers.numVertices, cacheSize, 0.0);
+
+      vector<GLuint> optimized = indices;
+      vector<GLfloat> vertices = buffers.vertices;
+      double start = now();
+      VertexCache::optimize(optimized, buffers.numVertices, cacheSize);
+      VertexCache::reorderVertices(optimized, vertices, floats);
+      printCacheStats(files[i], "optimized", optimized, buffers.numVertices,
+                      cacheSize, now() - start);
+
+      // A worst case for the cache: triangles in random order
+      GLuint numTriangles = GLuint(indices.size() / 3);
+      srand(1);
+      for(GLuint t = numTriangles; t > 1; --t)
+      {
+         GLuint r = GLuint(rand()) % t;
+         std::swap_ranges(&indices[3 * (t - 1)], &indices[3 * t], &indices[3 * r]);
+      }
+      printCacheStats(files[i], "shuffled", indices, buffers.numVertices, cacheSize, 0.0);
+
+      vertices = buffers.vertices;
+      start = now();
+      VertexCache::optimize(indices, buffers.numVertices, cacheSize);
+      VertexCache::reorderVertices(indices, vertices, floats);
+      printCacheStats(files[i], "reoptimized", indices, buffers.numVertices,
+                      cacheSize, now() - start);
+   }
+}
+
+/**
+ * Time OBJModel::load() with an empty mesh cache, which reads, welds,
+ * generates normals, optimises and writes the entry, and again once the
+ * entry exists and is only mapped. The mapped entry must match what
+ * the cold load built byte for byte.
+ *
+ * @return true if every check passed
+ */
+bool benchmarkCache(const vector<string>& files)
+{
+   string cacheDir = string(PROJECT_BINARY_DIR) + "/meshcache";
+   OBJMeshOptions options;
+   options.weldEpsilon = 0.00001f;
+
+   bool passed = true;
+
+   cout << std::left << std::setw(48) << "file"
+        << std::right << std::setw(12) << "triangles"
+        << std::setw(12) << "cold (s)"
+        << std::setw(12) << "warm (s)"
+        << std::setw(10) << "speedup"
+        << std::setw(14) << "OBJ (MB)"
+        << std::setw(14) << "cache (MB)"
+        << std::setw(12) << "identical" << endl;
+
+   for(size_t i = 0; i < files.size(); ++i)
+   {
+      MeshCache cache(cacheDir);
+      uint64_t key;
+      MeshCache::key(files[i], options.hash(), key);
+      remove(cache.path(key).c_str());
+
+      double start = now();
+      CachedMesh* built = OBJModel::load(files[i], options, cacheDir);
+      double cold = now() - start;
+
+      CachedMesh* mesh = NULL;
+
+      double warm = 1e30;
+      for(int run = 0; run < 3; ++run)
+      {
+         start = now();
+         mesh = OBJModel::load(files[i], options, cacheDir);
+
+         // Touch every page, as glBufferData would
+         const char* data = mesh->data();
+         volatile char sum = 0;
+         for(size_t b = 0; b < mesh->size(); b += 4096)
+         {
+            sum += data[b];
+         }
+         warm = std::min(warm, now() - start);
+
+         if(run < 2)
+         {
+            delete mesh;
+         }
+      }
+
+      bool same = mesh->size() == built->size() &&
+                  memcmp(mesh->data(), built->data(), mesh->size()) == 0;
+      passed = passed && same;
+      delete built;
+
+      cout << std::left << std::setw(48) << files[i]
+           << std::right << std::setw(12) << mesh->numIndices() / 3
+           << std::setw(12) << std::fixed << std::setprecision(4) << cold
+           << std::setw(12) << warm
+           << std::setw(10) << std::setprecision(1) << cold / warm
+           << std::setw(14) << std::setprecision(2) << fileSize(files[i]) / (1024.0 * 1024.0)
+           << std::setw(14) << mesh->size() / (1024.0 * 1024.0)
+           << std::setw(12) << (same ? "yes" : "NO") << endl;
+      delete mesh;
+   }
+
+   cout << (passed ? "All cache checks passed" : "Some cache checks FAILED") << endl;
+   return passed;
+}
+
+/**
+ * Sink for the streaming parser that checks each batch against a model
+ * read by glmReadOBJ
+ */
+class CheckSink : public OBJStreamSink
+{
+public:
+   CheckSink(const GLMmodel* model) : model(model), batches(0), mismatches(0) {}
+
+   virtual void consume(const OBJStreamBatch& batch)
+   {
+      batches++;
+      if(batch.type == OBJStreamBatch::VERTICES)
+      {
+         const GLfloat* v = static_cast<const GLfloat*>(batch.data);
+         for(GLuint i = 0; i < 3 * batch.count; ++i)
+         {
+            mismatches += v[i] != model->vertices[3 * (batch.first + 1) + i];
+         }
+      }
+      else
+      {
+         const GLuint* index = static_cast<const GLuint*>(batch.data);
+         for(GLuint i = 0; i < batch.count; ++i)
+         {
+            GLuint corner = batch.first + i;
+            mismatches += index[i] + 1 != model->triangles[corner / 3].vindices[corner % 3];
+         }
+      }
+   }
+
+   const GLMmodel* model;
+   GLuint batches;
+   GLuint mismatches;
+};
+
+/**
+ * Streaming parser throughput at several memory budgets, checked
+ * against glmReadOBJ
+ *
+ * @return true if every budget streamed the same model
+ */
+bool benchmarkStream(const vector<string>& files)
+{
+   const size_t budgets[] = { 64 << 10, 1 << 20, 16 << 20 };
+
+   bool passed = true;
+
+   cout << std::left << std::setw(48) << "file"
+        << std::right << std::setw(12) << "budget (KB)"
+        << std::setw(10) << "batches"
+        << std::setw(12) << "count (s)"
+        << std::setw(12) << "run (s)"
+        << std::setw(10) << "MB/s"
+        << std::setw(14) << "glm (MB)"
+        << std::setw(12) << "mismatches" << endl;
+
+   for(size_t i = 0; i < files.size(); ++i)
+   {
+      GLMmodel* model = glmReadOBJ(files[i].c_str());
+      double modelBytes = model->numvertices * 3.0 * sizeof(GLfloat)
+                        + model->numnormals * 3.0 * sizeof(GLfloat)
+                        + model->numtexcoords * 2.0 * sizeof(GLfloat)
+                        + model->numtriangles * double(sizeof(GLMtriangle));
+
+      for(size_t b = 0; b < sizeof(budgets) / sizeof(budgets[0]); ++b)
+      {
+         OBJStreamProducer producer(files[i], budgets[b]);
+         GLuint numVertices;
+         GLuint numIndices;
+
+         double start = now();
+         producer.count(numVertices, numIndices);
+         double counted = now() - start;
+
+         CheckSink sink(model);
+         start = now();
+         producer.run(sink);
+         double run = now() - start;
+
+         if(numVertices != model->numvertices || numIndices != 3 * model->numtriangles)
+         {
+            sink.mismatches++;
+         }
+         passed = passed && sink.mismatches == 0;
+
+         cout << std::left << std::setw(48) << files[i]
+              << std::right << std::setw(12) << producer.bytes() / 1024
+              << std::setw(10) << sink.batches
+              << std::setw(12) << std::fixed << std::setprecision(4) << counted
+              << std::setw(12) << run
+              << std::setw(10) << std::setprecision(1) << fileSize(files[i]) / (1024.0 * 1024.0) / run
+              << std::setw(14) << std::setprecision(2) << modelBytes / (1024.0 * 1024.0)
+              << std::setw(12) << sink.mismatches << endl;
+      }
+      glmDelete(model);
+   }
+
+   cout << (passed ? "All stream checks passed" : "Some stream checks FAILED") << endl;
+   return passed;
+}
+
+/**
+ * Quantise the indexed buffers with each normal encoding: vertex
+ * bytes before and after, time and the largest errors
+ */
+void benchmarkQuantize(const vector<string>& files)
+{
+   const Quantize::NormalEncoding encodings[] = { Quantize::NORMAL_OCTAHEDRAL, Quantize::NORMAL_10_10_10_2 };
+   const char* names[] = { "oct16", "1010102" };
+
+   cout << std::left << std::setw(48) << "file"
+        << std::right << std::setw(10) << "normals"
+        << std::setw(12) << "vertices"
+        << std::setw(12) << "float (MB)"
+        << std::setw(12) << "quant (MB)"
+        << std::setw(10) << "time (s)"
+        << std::setw(14) << "position"
+        << std::setw(12) << "relative"
+        << std::setw(14) << "normal (deg)"
+        << std::setw(12) << "texcoord" << endl;
+
+   for(size_t i = 0; i < files.size(); ++i)
+   {
+      OBJModel model(files[i]);
+      model.facetNormals();
+      model.vertexNormals(90.0f);
+
+      OBJIndexedBuffers buffers;
+      model.createIndexedBuffers(GLM_SMOOTH, buffers);
+
+      const GLfloat* base = &buffers.vertices[0];
+      const GLfloat* normals = buffers.normalOffset >= 0 ? base + buffers.normalOffset / sizeof(GLfloat) : NULL;
+      const GLfloat* texcoords = buffers.texcoordOffset >= 0 ? base + buffers.texcoordOffset / sizeof(GLfloat) : NULL;
+
+      for(size_t e = 0; e < sizeof(encodings) / sizeof(encodings[0]); ++e)
+      {
+         Quantize::Vertices quantized;
+         double start = now();
+         Quantize::quantize(base, buffers.stride, normals, buffers.stride, texcoords, buffers.stride,
+                            buffers.numVertices, encodings[e], quantized);
+         double seconds = now() - start;
+
+         const Quantize::Error& error = quantized.error;
+         cout << std::left << std::setw(48) << files[i]
+              << std::right << std::setw(10) << names[e]
+              << std::setw(12) << buffers.numVertices
+              << std::setw(12) << std::fixed << std::setprecision(2)
+              << buffers.vertices.size() * sizeof(GLfloat) / (1024.0 * 1024.0)
+              << std::setw(12) << quantized.data.size() / (1024.0 * 1024.0)
+              << std::setw(10) << std::setprecision(4) << seconds
+              << std::setw(14) << std::scientific << std::setprecision(2) << error.position
+              << std::setw(12) << error.positionRelative
+              << std::setw(14) << std::fixed << std::setprecision(4) << error.normalDegrees
+              << std::setw(12) << std::scientific << std::setprecision(2) << error.texcoord
+              << std::fixed << endl;
+      }
+   }
+}
+
+/**
+ * Number each distinct position, so that copies of a vertex on a seam
+ * share a number
+ *
+ * @param buffers
+ *    Indexed buffers
+ * @param ids
+ *    Set to the position number of each vertex
+ */
+void positionIds(const OBJIndexedBuffers& buffers, vector<GLuint>& ids)
+{
+   GLuint floats = buffers.stride / sizeof(GLfloat);
+   vector<GLuint> order(buffers.numVertices);
+   for(GLuint v = 0; v < buffers.numVertices; ++v)
+   {
+      order[v] = v;
+   }
+   const GLfloat* base = &buffers.vertices[0];
+   std::sort(order.begin(), order.end(), [base, floats](GLuint a, GLuint b)
+             {
+                return std::lexicographical_compare(base + a * floats, base + a * floats + 3,
+                                                    base + b * floats, base + b * floats + 3);
+             });
+
+   ids.resize(buffers.numVertices);
+   GLuint id = 0;
+   for(GLuint i = 0; i < buffers.numVertices; ++i)
+   {
+      if(i > 0 && !std::equal(base + order[i] * floats, base + order[i] * floats + 3,
+                              base + order[i - 1] * floats))
+      {
+         id++;
+      }
+      ids[order[i]] = id;
+   }
+}
+
+/**
+ * @return the number of edges with a triangle on one side only,
+ * comparing positions so that seams don't count
+ */
+size_t openEdges(const vector<GLuint>& indices, size_t first, size_t count, const vector<GLuint>& ids)
+{
+   vector<uint64_t> edges(count);
+   for(size_t i = 0; i < count; ++i)
+   {
+      size_t next = i % 3 == 2 ? i - 2 : i + 1;
+      edges[i] = (uint64_t(ids[indices[first + i]]) << 32) | ids[indices[first + next]];
+   }
+   std::sort(edges.begin(), edges.end());
+
+   size_t open = 0;
+   for(size_t i = 0; i < count; ++i)
+   {
+      uint64_t reverse = (edges[i] << 32) | (edges[i] >> 32);
+      open += std::binary_search(edges.begin(), edges.end(), reverse) ? 0 : 1;
+   }
+   return open;
+}
+
+/**
+ * Build LOD chains on welded meshes and on the same meshes unwelded,
+ * where every vertex shared by two faces with different normals or
+ * texture coordinates becomes a seam. Checks each level against its
+ * target triangle count, that the quadric error stays under the limit
+ * and that no cracks open along seams. Also shows the measured
+ * distance from the original vertices to each level, the error the
+ * chain stores for OBJLodChain::select(), next to the quadric estimate.
+ *
+ * @return true if every check passed
+ */
+bool benchmarkLod(const vector<string>& files)
+{
+   vector<GLfloat> ratios;
+   ratios.push_back(0.5f);
+   ratios.push_back(0.25f);
+   ratios.push_back(0.125f);
+
+   // Error limit, as a fraction of the bounding sphere radius
+   const GLfloat maxRelativeError = 0.02f;
+
+   bool passed = true;
+
+   cout << std::left << std::setw(48) << "file"
+        << std::right << std::setw(8) << "weld"
+        << std::setw(6) << "lod"
+        << std::setw(12) << "triangles"
+        << std::setw(12) << "target"
+        << std::setw(10) << "time (s)"
+        << std::setw(12) << "quadric"
+        << std::setw(12) << "measured"
+        << std::setw(8) << "open"
+        << std::setw(8) << "check" << endl;
+
+   for(size_t i = 0; i < files.size(); ++i)
+   {
+      for(int welded = 1; welded >= 0; --welded)
+      {
+         OBJMeshOptions options;
+         options.mode = GLM_SMOOTH;
+         options.weldEpsilon = welded ? 1e-6f : 0.0f;
+         options.smoothAngle = 90.0f;
+         options.optimize = false;
+
+         OBJIndexedBuffers buffers;
+         {
+            OBJModel model(files[i]);
+            model.process(options, buffers);
+         }
+
+         OBJLodChain chain;
+         double start = now();
+         OBJModel::createLodChain(buffers, ratios, chain, FLT_MAX);
+         double seconds = now() - start;
+
+         // Run the same collapses again, this time with an error limit, and
+         // measure how far each level is from the original vertices
+         GLfloat maxError = maxRelativeError * chain.radius;
+         vector<GLuint> indices;
+         buffers.getIndices(indices);
+         Simplifier simplifier(&buffers.vertices[0], buffers.stride, buffers.numVertices, indices);
+
+         vector<GLuint> ids;
+         positionIds(buffers, ids);
+         size_t open = openEdges(indices, 0, indices.size(), ids);
+
+         for(size_t l = 0; l < ratios.size(); ++l)
+         {
+            GLuint target = GLuint(buffers.numIndices / 3 * ratios[l]) * 3;
+            double levelStart = now();
+            GLuint count = simplifier.simplify(target, maxError);
+            double levelSeconds = now() - levelStart;
+            const vector<GLuint>& level = simplifier.indices();
+
+            GLfloat measured = simplifier.distance();
+
+            size_t levelOpen = openEdges(level, 0, level.size(), ids);
+
+            // Counts may stop short of the target only at the error limit
+            bool ok = simplifier.error() <= maxError
+                   && levelOpen <= open
+                   && (count <= target * 1.01 || simplifier.error() >= 0.5f * maxError);
+            passed = passed && ok;
+
+            cout << std::left << std::setw(48) << files[i]
+                 << std::right << std::setw(8) << (welded ? "yes" : "no")
+                 << std::setw(6) << l + 1
+                 << std::setw(12) << count / 3
+                 << std::setw(12) << target / 3
+                 << std::setw(10) << std::fixed << std::setprecision(4) << levelSeconds
+                 << std::setw(12) << std::scientific << std::setprecision(2) << simplifier.error()
+                 << std::setw(12) << measured
+                 << std::setw(8) << levelOpen
+                 << std::setw(8) << (ok ? "ok" : "FAIL")
+                 << std::fixed << endl;
+         }
+         cout << "Chain built in " << seconds << " s" << endl;
+      }
+   }
+
+   cout << (passed ? "All LOD checks passed" : "Some LOD checks FAILED") << endl;
+   return passed;
+}
+
+/**
+ * Build a view projection matrix looking at the origin
+ *
+ * @param eye
+ *    Eye position, 3 floats
+ * @param aspect
+ *    Width over height
+ * @param out
+ *    Set to the matrix, column major
+ */
+void lookAtOrigin(const double* eye, double aspect, GLfloat* out)
+{
+   // Eye space axes
+   double f[3] = { -eye[0], -eye[1], -eye[2] };
+   double fl = sqrt(f[0] * f[0] + f[1] * f[1] + f[2] * f[2]);
+   f[0] /= fl; f[1] /= fl; f[2] /= fl;
+   double up[3] = { 0.0, 1.0, 0.0 };
+   if(fabs(f[1]) > 0.99)
+   {
+      up[1] = 0.0;
+      up[2] = 1.0;
+   }
+   double r[3] = { f[1] * up[2] - f[2] * up[1], f[2] * up[0] - f[0] * up[2], f[0] * up[1] - f[1] * up[0] };
+   double rl = sqrt(r[0] * r[0] + r[1] * r[1] + r[2] * r[2]);
+   r[0] /= rl; r[1] /= rl; r[2] /= rl;
+   double u[3] = { r[1] * f[2] - r[2] * f[1], r[2] * f[0] - r[0] * f[2], r[0] * f[1] - r[1] * f[0] };
+
+   // 45 degree perspective, near 0.1, far 100
+   double s = 1.0 / tan(M_PI / 8.0);
+   double n = 0.1;
+   double fa = 100.0;
+   double a = (fa + n) / (n - fa);
+   double b = 2.0 * fa * n / (n - fa);
+
+   // Rows of the view matrix and their translations
+   const double* rows[3] = { r, u, f };
+   double t[3];
+   for(int i = 0; i < 3; ++i)
+   {
+      t[i] = -(rows[i][0] * eye[0] + rows[i][1] * eye[1] + rows[i][2] * eye[2]);
+   }
+
+   for(int c = 0; c < 4; ++c)
+   {
+      double x = c < 3 ? r[c] : t[0];
+      double y = c < 3 ? u[c] : t[1];
+      double z = c < 3 ? -f[c] : -t[2];
+      double w = c < 3 ? 0.0 : 1.0;
+      out[4 * c + 0] = GLfloat(s / aspect * x);
+      out[4 * c + 1] = GLfloat(s * y);
+      out[4 * c + 2] = GLfloat(a * z + b * w);
+      out[4 * c + 3] = GLfloat(-z);
+   }
+}
+
+/**
+ * Split each mesh into meshlets and cull them from views all around
+ * it. Checks that every triangle facing a view and inside its frustum
+ * is in a cluster that was kept.
+ *
+ * @return true if no visible triangle was culled
+ */
+bool benchmarkMeshlet(const vector<string>& files)
+{
+   const int views = 64;
+   bool passed = true;
+
+   cout << std::left << std::setw(48) << "file"
+        << std::right << std::setw(12) << "triangles"
+        << std::setw(10) << "clusters"
+        << std::setw(10) << "verts"
+        << std::setw(10) << "tris"
+        << std::setw(11) << "build (s)"
+        << std::setw(11) << "cull (us)"
+        << std::setw(10) << "frustum"
+        << std::setw(10) << "back"
+        << std::setw(10) << "ideal"
+        << std::setw(8) << "ranges"
+        << std::setw(8) << "check" << endl;
+
+   for(size_t i = 0; i < files.size(); ++i)
+   {
+      OBJMeshOptions options;
+      options.mode = GLM_SMOOTH;
+      options.unitize = true;
+
+      OBJIndexedBuffers buffers;
+      {
+         OBJModel model(files[i]);
+         model.process(options, buffers);
+      }
+      vector<GLuint> indices;
+      buffers.getIndices(indices);
+      const GLfloat* positions = &buffers.vertices[0];
+      GLuint floats = buffers.stride / sizeof(GLfloat);
+
+      Meshlet::Clusters clusters;
+      double start = now();
+      Meshlet::build(positions, buffers.stride, buffers.numVertices, indices, clusters);
+      double buildSeconds = now() - start;
+
+      double vertices = 0.0;
+      for(size_t c = 0; c < clusters.clusters.size(); ++c)
+      {
+         vertices += clusters.clusters[c].numVertices;
+      }
+
+      // Which cluster each reordered triangle belongs to
+      vector<GLuint> owner(clusters.indices.size() / 3);
+      for(size_t c = 0; c < clusters.clusters.size(); ++c)
+      {
+         const Meshlet::Cluster& cluster = clusters.clusters[c];
+         for(GLuint t = 0; t < cluster.numTriangles; ++t)
+         {
+            owner[cluster.firstIndex / 3 + t] = GLuint(c);
+         }
+      }
+
+      double cullSeconds = 0.0;
+      double frustum = 0.0;
+      double back = 0.0;
+      double ideal = 0.0;
+      double ranges = 0.0;
+      size_t missed = 0;
+      Meshlet::DrawList list;
+      vector<bool> kept(clusters.clusters.size());
+
+      for(int v = 0; v < views; ++v)
+      {
+         // Views spiral around the mesh, some close enough that part of
+         // it is off screen
+         double z = 1.0 - (2.0 * v + 1.0) / views;
+         double ring = sqrt(1.0 - z * z);
+         double angle = v * 2.39996;
+         double distance = v % 2 ? 2.5 : 0.9;
+         double eye[3] = { distance * ring * cos(angle), distance * z, distance * ring * sin(angle) };
+         GLfloat eyef[3] = { GLfloat(eye[0]), GLfloat(eye[1]), GLfloat(eye[2]) };
+         GLfloat mvp[16];
+         lookAtOrigin(eye, 4.0 / 3.0, mvp);
+
+         start = now();
+         Meshlet::CullStats stats = Meshlet::cull(clusters, mvp, eyef, 0, list);
+         cullSeconds += now() - start;
+         frustum += double(stats.frustumCulled) / stats.triangles;
+         back += double(stats.backfaceCulled) / stats.triangles;
+         ranges += stats.ranges;
+
+         // Kept clusters from the ranges
+         std::fill(kept.begin(), kept.end(), false);
+         for(size_t r = 0; r < list.counts.size(); ++r)
+         {
+            size_t first = size_t(list.offsets[r]) / sizeof(GLuint) / 3;
+            for(size_t t = first; t < first + list.counts[r] / 3; ++t)
+            {
+               kept[owner[t]] = true;
+            }
+         }
+
+         // Every triangle that faces the eye and isn't entirely outside
+         // one clip plane must be kept
+         size_t hidden = 0;
+         for(size_t t = 0; t < owner.size(); ++t)
+         {
+            const GLuint* tri = &clusters.indices[3 * t];
+            const GLfloat* p[3];
+            GLfloat clip[3][4];
+            for(int k = 0; k < 3; ++k)
+            {
+               p[k] = positions + tri[k] * floats;
+               for(int row = 0; row < 4; ++row)
+               {
+                  clip[k][row] = mvp[row] * p[k][0] + mvp[4 + row] * p[k][1] +
+                                 mvp[8 + row] * p[k][2] + mvp[12 + row];
+               }
+            }
+            bool outside = false;
+            for(int axis = 0; axis < 3 && !outside; ++axis)
+            {
+               outside = (clip[0][axis] > clip[0][3] && clip[1][axis] > clip[1][3] && clip[2][axis] > clip[2][3])
+                      || (clip[0][axis] < -clip[0][3] && clip[1][axis] < -clip[1][3] && clip[2][axis] < -clip[2][3]);
+            }
+
+            double e1[3], e2[3], toEye[3];
+            for(int k = 0; k < 3; ++k)
+            {
+               e1[k] = double(p[1][k]) - p[0][k];
+               e2[k] = double(p[2][k]) - p[0][k];
+               toEye[k] = eye[k] - p[0][k];
+            }
+            double n[3] = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };
+            bool facing = n[0] * toEye[0] + n[1] * toEye[1] + n[2] * toEye[2] > 0.0;
+
+            if(outside || !facing)
+            {
+               hidden++;
+            }
+            else if(!kept[owner[t]])
+            {
+               missed++;
+            }
+         }
+         ideal += double(hidden) / owner.size();
+      }
+
+      bool ok = missed == 0;
+      passed = passed && ok;
+
+      cout << std::left << std::setw(48) << files[i]
+           << std::right << std::setw(12) << owner.size()
+           << std::setw(10) << clusters.clusters.size()
+           << std::setw(10) << std::fixed << std::setprecision(1) << vertices / clusters.clusters.size()
+           << std::setw(10) << double(owner.size()) / clusters.clusters.size()
+           << std::setw(11) << std::setprecision(4) << buildSeconds
+           << std::setw(11) << std::setprecision(1) << 1e6 * cullSeconds / views
+           << std::setw(9) << 100.0 * frustum / views << "%"
+           << std::setw(9) << 100.0 * back / views << "%"
+           << std::setw(9) << 100.0 * ideal / views << "%"
+           << std::setw(8) << ranges / views
+           << std::setw(8) << (ok ? "ok" : "FAIL") << endl;
+      if(!ok)
+      {
+         cout << missed << " visible triangles were culled" << endl;
+      }
+   }
+
+   cout << "frustum and back are the average share of triangles culled per view, "
+        << "ideal the share a per triangle test would cull" << endl;
+   cout << (passed ? "All meshlet checks passed" : "Some meshlet checks FAILED") << endl;
+   return passed;
+}
+
+/**
+ * Closest hit along a ray by testing every triangle, the same way the
+ * BVH tests them
+ *
+ * @return the distance, tmax if nothing was hit
+ */
+GLfloat bruteForceHit(const OBJIndexedBuffers& buffers, const vector<GLuint>& indices,
+                      const BVH::Ray& ray)
+{
+   GLuint floats = buffers.stride / sizeof(GLfloat);
+   const GLfloat* d = ray.direction;
+   GLfloat best = ray.tmax;
+   for(size_t i = 0; i < indices.size(); i += 3)
+   {
+      const GLfloat* p0 = &buffers.vertices[indices[i] * floats];
+      const GLfloat* p1 = &buffers.vertices[indices[i + 1] * floats];
+      const GLfloat* p2 = &buffers.vertices[indices[i + 2] * floats];
+      GLfloat e1[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+      GLfloat e2[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+      GLfloat p[3] = { d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2], d[0] * e2[1] - d[1] * e2[0] };
+      GLfloat inv = 1.0f / (e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2]);
+      GLfloat s[3] = { ray.origin[0] - p0[0], ray.origin[1] - p0[1], ray.origin[2] - p0[2] };
+      GLfloat u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inv;
+      GLfloat q[3] = { s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2], s[0] * e1[1] - s[1] * e1[0] };
+      GLfloat v = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) * inv;
+      GLfloat t = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * inv;
+      if(u >= 0.0f && v >= 0.0f && u + v <= 1.0f && t > 0.0f && t < best)
+      {
+         best = t;
+      }
+   }
+   return best;
+}
+
+/**
+ * Rays from a camera looking at a sphere, in 4 x 2 pixel tiles so that
+ * each run of 4 rays covers 2 x 2 pixels and each run of 8 covers 4 x 2
+ *
+ * @param center
+ *    Center of the sphere
+ * @param radius
+ *    Radius of the sphere
+ * @param rays
+ *    Filled in with the rays
+ */
+void cameraRays(const GLfloat* center, GLfloat radius, vector<BVH::Ray>& rays)
+{
+   const int width = 512;
+   const int height = 384;
+   const double scale = tan(M_PI / 8.0) / (height / 2);
+
+   rays.clear();
+   for(int ty = 0; ty < height; ty += 2)
+   {
+      for(int tx = 0; tx < width; tx += 4)
+      {
+         for(int k = 0; k < 8; ++k)
+         {
+            int x = tx + (k & 1) + (k & 4 ? 2 : 0);
+            int y = ty + (k & 2 ? 1 : 0);
+            BVH::Ray ray;
+            ray.origin[0] = center[0];
+            ray.origin[1] = center[1] + 0.3f * radius;
+            ray.origin[2] = center[2] + 1.5f * radius;
+            ray.direction[0] = GLfloat((x + 0.5 - width / 2) * scale);
+            ray.direction[1] = GLfloat((height / 2 - y - 0.5) * scale - 0.2);
+            ray.direction[2] = -1.0f;
+            ray.tmax = FLT_MAX;
+            rays.push_back(ray);
+         }
+      }
+   }
+}
+
+/**
+ * Rays in random directions, from points on a sphere twice the size of
+ * the mesh's bounding sphere to random points inside it
+ */
+void randomRays(const GLfloat* center, GLfloat radius, size_t count, vector<BVH::Ray>& rays)
+{
+   rays.resize(count);
+   srand(7);
+   for(size_t i = 0; i < count; ++i)
+   {
+      double from[3];
+      double to[3];
+      double length;
+      do
+      {
+         for(int k = 0; k < 3; ++k)
+         {
+            from[k] = 2.0 * rand() / RAND_MAX - 1.0;
+            to[k] = 2.0 * rand() / RAND_MAX - 1.0;
+         }
+         length = sqrt(from[0] * from[0] + from[1] * from[1] + from[2] * from[2]);
+      } while(length < 1e-3 || to[0] * to[0] + to[1] * to[1] + to[2] * to[2] > 1.0);
+
+      for(int k = 0; k < 3; ++k)
+      {
+         rays[i].origin[k] = GLfloat(center[k] + 2.0 * radius * from[k] / length);
+         rays[i].direction[k] = GLfloat(center[k] + radius * to[k] - rays[i].origin[k]);
+      }
+      rays[i].tmax = FLT_MAX;
+   }
+}
+
+/**
+ * @return true if two hits are the same, allowing for triangles that
+ * meet at the hit point
+ */
+bool sameHit(const BVH::Hit& a, const BVH::Hit& b)
+{
+   if(a.triangle == BVH::miss || b.triangle == BVH::miss)
+   {
+      return a.triangle == b.triangle;
+   }
+   return a.triangle == b.triangle || fabs(a.t - b.t) <= 1e-5 * fabs(a.t);
+}
+
+/**
+ * Build a BVH over each mesh and trace camera and random rays through
+ * it, one at a time and in packets of 4 and 8, and shadow rays from the
+ * camera hits towards a light. Checks the packets and the parallel
+ * build against single rays, and single rays against testing every
+ * triangle for a sample of rays.
+ *
+ * @return true if every check passed
+ */
+bool benchmarkBvh(const vector<string>& files)
+{
+   GLuint maxThreads = std::thread::hardware_concurrency();
+   maxThreads = maxThreads ? maxThreads : 1;
+   bool passed = true;
+
+   for(size_t i = 0; i < files.size(); ++i)
+   {
+      OBJMeshOptions options;
+      options.mode = GLM_NONE;
+      options.unitize = true;
+      options.weldEpsilon = 1e-6f;
+
+      OBJIndexedBuffers buffers;
+      {
+         OBJModel model(files[i]);
+         model.process(options, buffers);
+      }
+      vector<GLuint> indices;
+      buffers.getIndices(indices);
+      const GLfloat* positions = &buffers.vertices[0];
+
+      double start = now();
+      BVH serial(positions, buffers.stride, indices, 1);
+      double serialSeconds = now() - start;
+
+      start = now();
+      BVH bvh(positions, buffers.stride, indices, maxThreads);
+      double parallelSeconds = now() - start;
+
+      size_t leaves = 0;
+      for(size_t n = 0; n < bvh.nodes().size(); ++n)
+      {
+         leaves += bvh.nodes()[n].count ? 1 : 0;
+      }
+
+      cout << files[i] << ": " << indices.size() / 3 << " triangles, built in "
+           << std::fixed << std::setprecision(4) << serialSeconds << " s on 1 thread, "
+           << parallelSeconds << " s on " << maxThreads << ", "
+           << bvh.nodes().size() << " nodes of " << sizeof(BVH::Node) << " bytes, "
+           << leaves << " leaves, depth " << bvh.depth() << ", SAH cost "
+           << std::setprecision(1) << bvh.cost() << endl;
+
+      // Bounding sphere of the unitized mesh
+      const GLfloat center[3] = { 0.0f, 0.0f, 0.0f };
+      const GLfloat radius = 1.8f;
+
+      cout << std::left << std::setw(10) << "rays"
+           << std::right << std::setw(10) << "count"
+           << std::setw(8) << "hit"
+           << std::setw(14) << "single"
+           << std::setw(14) << "packet 4"
+           << std::setw(14) << "packet 8"
+           << std::setw(14) << "shadow"
+           << std::setw(8) << "check" << endl;
+
+      for(int set = 0; set < 2; ++set)
+      {
+         vector<BVH::Ray> rays;
+         if(set == 0)
+         {
+            cameraRays(center, radius, rays);
+         }
+         else
+         {
+            randomRays(center, radius, 1 << 18, rays);
+         }
+         size_t count = rays.size();
+
+         vector<BVH::Hit> single(count);
+         vector<BVH::Hit> packet4(count);
+         vector<BVH::Hit> packet8(count);
+
+         start = now();
+         for(size_t r = 0; r < count; ++r)
+         {
+            bvh.intersect(rays[r], single[r]);
+         }
+         double singleSeconds = now() - start;
+
+         start = now();
+         for(size_t r = 0; r < count; r += 4)
+         {
+            bvh.intersect4(&rays[r], &packet4[r]);
+         }
+         double packet4Seconds = now() - start;
+
+         start = now();
+         for(size_t r = 0; r < count; r += 8)
+         {
+            bvh.intersect8(&rays[r], &packet8[r]);
+         }
+         double packet8Seconds = now() - start;
+
+         // Shadow rays from each hit towards a light above and to the
+         // side, stopping short of it
+         vector<BVH::Ray> shadows;
+         for(size_t r = 0; r < count; ++r)
+         {
+            if(single[r].triangle == BVH::miss)
+            {
+               continue;
+            }
+            BVH::Ray shadow;
+            for(int k = 0; k < 3; ++k)
+            {
+               GLfloat p = rays[r].origin[k] + single[r].t * rays[r].direction[k];
+               GLfloat light = center[k] + (k == 1 ? 4.0f : 2.0f) * radius;
+               shadow.origin[k] = p;
+               shadow.direction[k] = light - p;
+            }
+            // Start a little way off the surface
+            for(int k = 0; k < 3; ++k)
+            {
+               shadow.origin[k] += 1e-4f * shadow.direction[k];
+            }
+            shadow.tmax = 1.0f;
+            shadows.push_back(shadow);
+         }
+
+         size_t shadowed = 0;
+         start = now();
+         for(size_t r = 0; r < shadows.size(); ++r)
+         {
+            shadowed += bvh.occluded(shadows[r]) ? 1 : 0;
+         }
+         double shadowSeconds = now() - start;
+
+         // Packets and the serially built tree against single rays
+         size_t mismatches = 0;
+         size_t hits = 0;
+         for(size_t r = 0; r < count; ++r)
+         {
+            BVH::Hit check;
+            serial.intersect(rays[r], check);
+            hits += single[r].triangle != BVH::miss ? 1 : 0;
+            mismatches += sameHit(single[r], packet4[r]) && sameHit(single[r], packet8[r])
+                          && sameHit(single[r], check) ? 0 : 1;
+         }
+
+         // Occlusion against closest hits
+         size_t sample = std::min(shadows.size(), size_t(4096));
+         for(size_t r = 0; r < sample; ++r)
+         {
+            BVH::Hit hit;
+            mismatches += bvh.occluded(shadows[r]) == bvh.intersect(shadows[r], hit) ? 0 : 1;
+         }
+
+         // Single rays against every triangle
+         size_t step = std::max(count / 200, size_t(1));
+         for(size_t r = 0; r < count; r += step)
+         {
+            GLfloat t = bruteForceHit(buffers, indices, rays[r]);
+            bool hit = t < rays[r].tmax;
+            bool same = hit == (single[r].triangle != BVH::miss) && (!hit || t == single[r].t);
+            mismatches += same ? 0 : 1;
+         }
+
+         bool ok = mismatches == 0;
+         passed = passed && ok;
+
+         cout << std::left << std::setw(10) << (set == 0 ? "camera" : "random")
+              << std::right << std::setw(10) << count
+              << std::setw(7) << std::setprecision(1) << 100.0 * hits / count << "%"
+              << std::setw(14) << std::setprecision(2) << count / singleSeconds / 1e6
+              << std::setw(14) << count / packet4Seconds / 1e6
+              << std::setw(14) << count / packet8Seconds / 1e6
+              << std::setw(14) << shadows.size() / shadowSeconds / 1e6
+              << std::setw(8) << (ok ? "ok" : "FAIL") << endl;
+         if(!ok)
+         {
+            cout << mismatches << " rays disagree" << endl;
+         }
+      }
+      cout << endl;
+   }
+
+   cout << "Ray rates are in millions of rays a second on one thread" << endl;
+   cout << (passed ? "All BVH checks passed" : "Some BVH checks FAILED") << endl;
+   return passed;
+}
+
+/**
+ * Bounds of packed points, one branch per component as glmUnitize used
+ * to find them
+ */
+void referenceBounds(const GLfloat* points, GLuint count, GLfloat* lo, GLfloat* hi)
+{
+   for(int k = 0; k < 3; ++k)
+   {
+      lo[k] = hi[k] = points[k];
+   }
+   for(GLuint i = 0; i < count; ++i)
+   {
+      for(int k = 0; k < 3; ++k)
+      {
+         if(hi[k] < points[3 * i + k])
+         {
+            hi[k] = points[3 * i + k];
+         }
+         if(lo[k] > points[3 * i + k])
+         {
+            lo[k] = points[3 * i + k];
+         }
+      }
+   }
+}
+
+/**
+ * Unitize packed points the way glmUnitize used to: a bounds pass, a
+ * translate pass and a scale pass
+ */
+void referenceUnitize(GLfloat* points, GLuint count)
+{
+   GLfloat lo[3];
+   GLfloat hi[3];
+   referenceBounds(points, count, lo, hi);
+
+   GLfloat size[3];
+   GLfloat center[3];
+   for(int k = 0; k < 3; ++k)
+   {
+      size[k] = fabsf(hi[k]) + fabsf(lo[k]);
+      center[k] = (hi[k] + lo[k]) / 2.0f;
+   }
+   GLfloat scale = 2.0f / std::max(std::max(size[0], size[1]), size[2]);
+
+   for(GLuint i = 0; i < 3 * count; ++i)
+   {
+      points[i] -= center[i % 3];
+   }
+   for(GLuint i = 0; i < 3 * count; ++i)
+   {
+      points[i] *= scale;
+   }
+}
+
+/**
+ * Set the number of threads the glm sweeps use
+ */
+void setSweepThreads(GLuint threads)
+{
+#ifdef _OPENMP
+   omp_set_num_threads(int(threads));
+#else
+   (void) threads;
+#endif
+}
+
+/**
+ * Time the bounding box, bounding sphere and unitize sweeps against
+ * the branchy serial loops they replaced, on each mesh's vertices and
+ * a large random point cloud. Checks that the results are identical.
+ *
+ * @return true if every check passed
+ */
+bool benchmarkBounds(const vector<string>& files)
+{
+   GLuint maxThreads = std::thread::hardware_concurrency();
+   maxThreads = maxThreads ? maxThreads : 1;
+   const int runs = 5;
+   bool passed = true;
+
+   cout << std::left << std::setw(48) << "points"
+        << std::right << std::setw(10) << "count"
+        << std::setw(12) << "loop (ms)"
+        << std::setw(12) << "simd (ms)"
+        << std::setw(12) << "simd x" << std::setw(2) << maxThreads
+        << std::setw(12) << "sphere"
+        << std::setw(14) << "unitize old"
+        << std::setw(12) << "unitize"
+        << std::setw(8) << "check" << endl;
+
+   for(size_t i = 0; i <= files.size(); ++i)
+   {
+      // The meshes' vertices, then random points
+      string name;
+      vector<GLfloat> points;
+      if(i < files.size())
+      {
+         name = files[i];
+         GLMmodel* model = glmReadOBJ(files[i].c_str());
+         points.assign(model->vertices + 3, model->vertices + 3 * (model->numvertices + 1));
+         glmDelete(model);
+      }
+      else
+      {
+         name = "random points";
+         points.resize(3 * (1 << 22));
+         srand(11);
+         for(size_t k = 0; k < points.size(); ++k)
+         {
+            points[k] = GLfloat(rand()) / RAND_MAX * 200.0f - 50.0f;
+         }
+      }
+      GLuint count = GLuint(points.size() / 3);
+
+      GLfloat refLo[3], refHi[3];
+      GLfloat lo[3], hi[3];
+      GLfloat center[3];
+      GLfloat radius = 0.0f;
+      double loopSeconds = 1e30;
+      double simdSeconds = 1e30;
+      double threadSeconds = 1e30;
+      double sphereSeconds = 1e30;
+      bool ok = true;
+
+      for(int run = 0; run < runs; ++run)
+      {
+         double start = now();
+         referenceBounds(&points[0], count, refLo, refHi);
+         loopSeconds = std::min(loopSeconds, now() - start);
+
+         setSweepThreads(1);
+         start = now();
+         glmBounds(&points[0], 3, count, lo, hi);
+         simdSeconds = std::min(simdSeconds, now() - start);
+         ok = ok && memcmp(lo, refLo, sizeof(lo)) == 0 && memcmp(hi, refHi, sizeof(hi)) == 0;
+
+         setSweepThreads(maxThreads);
+         start = now();
+         glmBounds(&points[0], 3, count, lo, hi);
+         threadSeconds = std::min(threadSeconds, now() - start);
+         ok = ok && memcmp(lo, refLo, sizeof(lo)) == 0 && memcmp(hi, refHi, sizeof(hi)) == 0;
+
+         start = now();
+         radius = glmBoundingSphere(&points[0], 3, count, center);
+         sphereSeconds = std::min(sphereSeconds, now() - start);
+      }
+
+      // Every point inside the sphere, one of them on it
+      double farthest = 0.0;
+      for(GLuint v = 0; v < count; ++v)
+      {
+         double d2 = 0.0;
+         for(int k = 0; k < 3; ++k)
+         {
+            double d = double(points[3 * v + k]) - center[k];
+            d2 += d * d;
+         }
+         farthest = std::max(farthest, sqrt(d2));
+      }
+      ok = ok && farthest <= radius * (1.0 + 1e-6) && farthest >= radius * (1.0 - 1e-6);
+
+      // Unitize both ways on copies, which must come out the same
+      double oldSeconds = 1e30;
+      double newSeconds = 1e30;
+      vector<GLfloat> before(points);
+      vector<GLfloat> after(points);
+      for(int run = 0; run < runs; ++run)
+      {
+         before = points;
+         double start = now();
+         referenceUnitize(&before[0], count);
+         oldSeconds = std::min(oldSeconds, now() - start);
+
+         // glmUnitize works on a model, 1 based
+         GLMmodel model;
+         memset(&model, 0, sizeof(model));
+         after.resize(3);
+         after.insert(after.end(), points.begin(), points.end());
+         model.vertices = &after[0];
+         model.numvertices = count;
+         start = now();
+         glmUnitize(&model);
+         newSeconds = std::min(newSeconds, now() - start);
+         ok = ok && memcmp(&before[0], &after[3], sizeof(GLfloat) * points.size()) == 0;
+      }
+
+      passed = passed && ok;
+      cout << std::left << std::setw(48) << name
+           << std::right << std::setw(10) << count
+           << std::setw(12) << std::fixed << std::setprecision(3) << 1e3 * loopSeconds
+           << std::setw(12) << 1e3 * simdSeconds
+           << std::setw(14) << 1e3 * threadSeconds
+           << std::setw(12) << 1e3 * sphereSeconds
+           << std::setw(14) << 1e3 * oldSeconds
+           << std::setw(12) << 1e3 * newSeconds
+           << std::setw(8) << (ok ? "ok" : "FAIL") << endl;
+   }
+
+   setSweepThreads(maxThreads);
+   cout << (passed ? "All bounds checks passed" : "Some bounds checks FAILED") << endl;
+   return passed;
+}
+
+/**
+ * Write a sphere as writeSphere() does, split into a group per band of
+ * latitude with the materials used in turn, and a material library
+ * beside it
+ *
+ * @param filename
+ *    Name of the OBJ file to write, the library gets .mtl for .obj
+ * @param res
+ *    Number of divisions in each direction, and of groups
+ * @param materials
+ *    Number of materials
+ */
+void writeGroupedSphere(const string& filename, int res, int materials)
+{
+   string library = filename.substr(0, filename.size() - 4) + ".mtl";
+   FILE* file = fopen(library.c_str(), "w");
+   if(!file)
+   {
+      std::cerr << "Could not open " << library << " for writing" << endl;
+      exit(EXIT_FAILURE);
+   }
+   for(int m = 0; m < materials; ++m)
+   {
+      fprintf(file, "newmtl material%d\nKd %f %f %f\n", m,
+              (m % 3) / 2.0, ((m / 3) % 3) / 2.0, 1.0 - (m % 2));
+   }
+   fclose(file);
+
+   file = fopen(filename.c_str(), "w");
+   if(!file)
+   {
+      std::cerr << "Could not open " << filename << " for writing" << endl;
+      exit(EXIT_FAILURE);
+   }
+
+   fprintf(file, "# synthetic sphere, %d x %d, %d materials\n", res, res, materials);
+   fprintf(file, "mtllib %s\n", library.substr(library.find_last_of('/') + 1).c_str());
+   for(int j = 0; j <= res; ++j)
+   {
+      double phi = M_PI * j / res;
+      for(int i = 0; i <= res; ++i)
+      {
+         double theta = 2.0 * M_PI * i / res;
+         fprintf(file, "v %f %f %f\n",
+                 sin(phi) * cos(theta), cos(phi), sin(phi) * sin(theta));
+      }
+   }
+
+   for(int j = 0; j < res; ++j)
+   {
+      fprintf(file, "g band%d\nusemtl material%d\n", j, j % materials);
+      for(int i = 0; i < res; ++i)
+      {
+         int ll = j * (res + 1) + i + 1;
+         int lr = ll + 1;
+         int ul = ll + res + 1;
+         int ur = ul + 1;
+         fprintf(file, "f %d %d %d\n", ll, lr, ur);
+         fprintf(file, "f %d %d %d\n", ll, ur, ul);
+      }
+   }
+
+   fclose(file);
+}
+
+/**
+ * @return the name of a grouped sphere in the build directory, written
+ * on first use
+ */
+string groupedSpherePath(int res, int materials)
+{
+   std::stringstream ss;
+   ss << PROJECT_BINARY_DIR << "/grouped_sphere_" << res << "_" << materials << ".obj";
+   std::ifstream exists(ss.str().c_str());
+   if(!exists.good())
+   {
+      cout << "Writing " << ss.str() << endl;
+      writeGroupedSphere(ss.str(), res, materials);
+   }
+   return ss.str();
+}
+
+/// A triangle's corner positions, rotated so the smallest comes first
+typedef std::array<GLfloat, 9> TriangleKey;
+
+/**
+ * @return the key of a triangle from three corner positions
+ */
+TriangleKey triangleKey(const GLfloat* a, const GLfloat* b, const GLfloat* c)
+{
+   const GLfloat* corners[3] = { a, b, c };
+   int first = 0;
+   for(int k = 1; k < 3; ++k)
+   {
+      if(std::lexicographical_compare(corners[k], corners[k] + 3,
+                                      corners[first], corners[first] + 3))
+      {
+         first = k;
+      }
+   }
+
+   TriangleKey key;
+   for(int k = 0; k < 3; ++k)
+   {
+      std::copy(corners[(first + k) % 3], corners[(first + k) % 3] + 3, &key[3 * k]);
+   }
+   return key;
+}
+
+/**
+ * Compare drawing groups in file order, a material change wherever the
+ * material differs from the last group's, with the material batches.
+ * Checks that each batch holds exactly the triangles of its material's
+ * groups after the per batch vertex cache optimisation.
+ *
+ * @return true if every check passed
+ */
+bool benchmarkBatch(const vector<string>& files)
+{
+   vector<string> models(files);
+   models.push_back(groupedSpherePath(256, 4));
+   models.push_back(groupedSpherePath(512, 16));
+
+   bool passed = true;
+   vector<string> rows;
+   for(size_t f = 0; f < models.size(); ++f)
+   {
+      // The triangles of each material, straight from glm
+      GLMmodel* reference = glmReadOBJ(models[f].c_str());
+      vector<vector<TriangleKey> > expected(std::max(reference->nummaterials, GLuint(1)));
+      GLuint groups = 0;
+      GLuint changes = 0;
+      GLuint last = ~0u;
+      for(GLMgroup* group = reference->groups; group; group = group->next)
+      {
+         if(!group->numtriangles)
+         {
+            continue;
+         }
+         groups++;
+         changes += group->material != last ? 1 : 0;
+         last = group->material;
+         for(GLuint t = 0; t < group->numtriangles; ++t)
+         {
+            const GLMtriangle& triangle = reference->triangles[group->triangles[t]];
+            expected[group->material].push_back(
+               triangleKey(&reference->vertices[3 * triangle.vindices[0]],
+                           &reference->vertices[3 * triangle.vindices[1]],
+                           &reference->vertices[3 * triangle.vindices[2]]));
+         }
+      }
+      glmDelete(reference);
+
+      OBJModel model(models[f]);
+      model.facetNormals();
+      model.vertexNormals(90.0f);
+
+      // Groups in file order, optimised as one
+      double start = now();
+      OBJIndexedBuffers whole;
+      model.createIndexedBuffers(GLM_SMOOTH, whole);
+      OBJModel::optimizeIndexedBuffers(whole);
+      double wholeSeconds = now() - start;
+
+      // Sorted by material, optimised per batch
+      start = now();
+      OBJIndexedBuffers sorted;
+      vector<OBJBatch> batches;
+      model.createBatches(GLM_SMOOTH, sorted, batches);
+      OBJModel::optimizeIndexedBuffers(sorted, batches);
+      double batchSeconds = now() - start;
+
+      // The batches follow each other, cover every index and hold their
+      // material's triangles
+      bool ok = sorted.numIndices == whole.numIndices;
+      GLuint next = 0;
+      GLuint floats = sorted.stride / sizeof(GLfloat);
+      for(size_t b = 0; b < batches.size() && ok; ++b)
+      {
+         const OBJBatch& batch = batches[b];
+         ok = batch.firstIndex == next && batch.material < expected.size();
+         next = batch.firstIndex + batch.numIndices;
+
+         vector<TriangleKey> found;
+         for(GLuint i = batch.firstIndex; ok && i < next; i += 3)
+         {
+            found.push_back(triangleKey(&sorted.vertices[floats * sorted.index(i)],
+                                        &sorted.vertices[floats * sorted.index(i + 1)],
+                                        &sorted.vertices[floats * sorted.index(i + 2)]));
+         }
+         if(ok)
+         {
+            std::sort(found.begin(), found.end());
+            std::sort(expected[batch.material].begin(), expected[batch.material].end());
+            ok = found == expected[batch.material];
+            expected[batch.material].clear();
+         }
+      }
+      ok = ok && next == sorted.numIndices;
+      for(size_t m = 0; m < expected.size() && ok; ++m)
+      {
+         ok = expected[m].empty();
+      }
+      passed = passed && ok;
+
+      vector<GLuint> indices;
+      whole.getIndices(indices);
+      double wholeAcmr = VertexCache::simulate(indices, whole.numVertices, 32,
+                                               VertexCache::FIFO).acmr;
+      sorted.getIndices(indices);
+      double batchAcmr = VertexCache::simulate(indices, sorted.numVertices, 32,
+                                               VertexCache::FIFO).acmr;
+
+      std::stringstream row;
+      row << std::left << std::setw(48) << models[f]
+          << std::right << std::setw(10) << whole.numIndices / 3
+          << std::setw(8) << groups
+          << std::setw(10) << changes
+          << std::setw(10) << batches.size()
+          << std::setw(10) << std::fixed << std::setprecision(3) << wholeAcmr
+          << std::setw(10) << batchAcmr
+          << std::setw(12) << std::setprecision(2) << 1e3 * wholeSeconds
+          << std::setw(12) << 1e3 * batchSeconds
+          << std::setw(8) << (ok ? "ok" : "FAIL");
+      rows.push_back(row.str());
+   }
+
+   cout << std::left << std::setw(48) << "file"
+        << std::right << std::setw(10) << "triangles"
+        << std::setw(8) << "groups"
+        << std::setw(10) << "changes"
+        << std::setw(10) << "batches"
+        << std::setw(10) << "ACMR"
+        << std::setw(10) << "batched"
+        << std::setw(12) << "whole (ms)"
+        << std::setw(12) << "batch (ms)"
+        << std::setw(8) << "check" << endl;
+   for(size_t i = 0; i < rows.size(); ++i)
+   {
+      cout << rows[i] << endl;
+   }
+
+   cout << (passed ? "All batch checks passed" : "Some batch checks FAILED") << endl;
+   return passed;
+}
+
+/**
+ * Write a file with many small groups: each group statement is followed
+ * by a usemtl and one triangle, every group is named twice, and the
+ * materials are used in turn
+ *
+ * @param filename
+ *    Name of the OBJ file to write, the library gets .mtl for .obj
+ * @param groups
+ *    Number of distinct groups
+ * @param materials
+ *    Number of materials
+ * @param groupNames
+ *    Set to the group named by each statement, in order
+ * @param materialNames
+ *    Set to the material used by each statement, in order
+ */
+void writeManyGroups(const string& filename, int groups, int materials,
+                     vector<string>& groupNames, vector<string>& materialNames)
+{
+   string library = filename.substr(0, filename.size() - 4) + ".mtl";
+   FILE* file = fopen(library.c_str(), "w");
+   if(!file)
+   {
+      std::cerr << "Could not open " << library << " for writing" << endl;
+      exit(EXIT_FAILURE);
+   }
+   for(int m = 0; m < materials; ++m)
+   {
+      fprintf(file, "newmtl material_%d\nKd 0.5 0.5 0.5\n", m);
+   }
+   fclose(file);
+
+   file = fopen(filename.c_str(), "w");
+   if(!file)
+   {
+      std::cerr << "Could not open " << filename << " for writing" << endl;
+      exit(EXIT_FAILURE);
+   }
+   fprintf(file, "# %d groups, %d materials\n", groups, materials);
+   fprintf(file, "mtllib %s\n", library.substr(library.find_last_of('/') + 1).c_str());
+   fprintf(file, "v 0 0 0\nv 1 0 0\nv 0 1 0\n");
+
+   groupNames.clear();
+   materialNames.clear();
+   for(int k = 0; k < 2 * groups; ++k)
+   {
+      std::stringstream group;
+      group << "part_" << k % groups;
+      std::stringstream material;
+      material << "material_" << k % materials;
+      groupNames.push_back(group.str());
+      materialNames.push_back(material.str());
+      fprintf(file, "g %s\nusemtl %s\nf 1 2 3\n", group.str().c_str(), material.str().c_str());
+   }
+   fclose(file);
+}
+
+/**
+ * Parse times of files with many groups and materials, next to the time
+ * the linear name scans the lookups used to make would take for the
+ * same statements. Checks the groups come out in the same order with
+ * the same triangles and materials.
+ *
+ * @return true if every check passed
+ */
+bool benchmarkGroups(void)
+{
+   const int sizes[] = { 1000, 8000, 32000 };
+   bool passed = true;
+
+   cout << std::left << std::setw(48) << "file"
+        << std::right << std::setw(10) << "groups"
+        << std::setw(12) << "materials"
+        << std::setw(12) << "read (ms)"
+        << std::setw(14) << "per group"
+        << std::setw(14) << "scans (ms)"
+        << std::setw(8) << "check" << endl;
+
+   for(size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s)
+   {
+      int groups = sizes[s];
+      int materials = std::min(groups / 4, 1000);
+      std::stringstream ss;
+      ss << PROJECT_BINARY_DIR << "/groups_" << groups << ".obj";
+      vector<string> groupNames;
+      vector<string> materialNames;
+      writeManyGroups(ss.str(), groups, materials, groupNames, materialNames);
+
+      double read = 1e30;
+      GLMmodel* model = NULL;
+      for(int run = 0; run < 3; ++run)
+      {
+         if(model)
+         {
+            glmDelete(model);
+         }
+         double start = now();
+         model = glmReadOBJ(ss.str().c_str());
+         read = std::min(read, now() - start);
+      }
+
+      // What the old lookups cost: a strcmp down the list, newest
+      // first, for each group statement, and along the materials for
+      // each usemtl
+      double start = now();
+      vector<const char*> list;
+      list.push_back("default");
+      size_t found = 0;
+      for(size_t k = 0; k < groupNames.size(); ++k)
+      {
+         size_t i = list.size();
+         while(i > 0 && strcmp(list[i - 1], groupNames[k].c_str()))
+         {
+            --i;
+         }
+         if(i == 0)
+         {
+            list.push_back(groupNames[k].c_str());
+         }
+         found += i;
+
+         GLuint m = 0;
+         while(m < model->nummaterials && strcmp(model->materials[m].name, materialNames[k].c_str()))
+         {
+            ++m;
+         }
+         found += m;
+      }
+      double scans = now() - start;
+
+      // Newest first, each with its two triangles and the material of
+      // its second statement
+      bool ok = model->numgroups == GLuint(groups) + 1 && found > 0;
+      const GLMgroup* group = model->groups;
+      for(int g = groups - 1; g >= 0 && ok; --g, group = group->next)
+      {
+         const GLMmaterial& material = model->materials[group->material];
+         ok = group && groupNames[g] == group->name && group->numtriangles == 2 &&
+              materialNames[groups + g] == material.name &&
+              group->triangles[0] == GLuint(g) && group->triangles[1] == GLuint(groups + g);
+      }
+      ok = ok && group && string("default") == group->name && !group->next;
+      passed = passed && ok;
+      glmDelete(model);
+
+      cout << std::left << std::setw(48) << ss.str()
+           << std::right << std::setw(10) << groups
+           << std::setw(12) << materials
+           << std::setw(12) << std::fixed << std::setprecision(2) << 1e3 * read
+           << std::setw(11) << std::setprecision(3) << 1e6 * read / groups << " us"
+           << std::setw(14) << std::setprecision(2) << 1e3 * scans
+           << std::setw(8) << (ok ? "ok" : "FAIL") << endl;
+   }
+
+   cout << (passed ? "All group checks passed" : "Some group checks FAILED") << endl;
+   return passed;
+}
+
+/**
+ * Program entry point
+ */
+int main(int argc, char* argv[])
+{
+   string benchmark = argc > 1 ? argv[1] : "all";
+
+   vector<string> files;
+   for(int i = 2; i < argc; ++i)
+   {
+      files.push_back(argv[i]);
+   }
+   if(files.empty())
+   {
+      files = defaultFiles();
+   }
+
+   bool all = benchmark == "all";
+   bool ran = false;
+   bool failed = false;
+
+   if(all || benchmark == "load")
+   {
+      failed = !benchmarkLoad(files) || failed;
+      ran = true;
+   }
+
+   if(all || benchmark == "threads")
+   {
+      failed = !benchmarkThreads(files) || failed;
+      ran = true;
+   }
+
+   if(all || benchmark == "weld")
+   {
+      failed = !benchmarkWeld(files) || failed;
+      ran = true;
+   }
+
+   if(all || benchmark == "normals")
+   {
+      failed = !benchmarkNormals(files) || failed;
+      ran = true;
+   }
+
+   if(all || benchmark == "indexed")
+   {
+      benchmarkIndexed(files);
+      ran = true;
+   }
+
+   if(all || benchmark == "vcache")
+   {
+      benchmarkVertexCache(files);
+      ran = true;
+   }
+
+   if(all || benchmark == "cache")
+   {
+      failed = !benchmarkCache(files) || failed;
+      ran = true;
+   }
+
+   if(all || benchmark == "stream")
+   {
+      failed = !benchmarkStream(files) || failed;
+      ran = true;
+   }
+
+   if(all || benchmark == "quantize")
+   {
+      benchmarkQuantize(files);
+      ran = true;
+   }
+
+   if(all || benchmark == "lod")
+   {
+      failed = !benchmarkLod(files) || failed;
+      ran = true;
+   }
+
+   if(all || benchmark == "meshlet")
+   {
+      failed = !benchmarkMeshlet(files) || failed;
+      ran = true;
+   }
+
+   if(all || benchmark == "bvh")
+   {
+      failed = !benchmarkBvh(files) || failed;
+      ran = true;
+   }
+
+   if(all || benchmark == "bounds")
+   {
+      failed = !benchmarkBounds(files) || failed;
+      ran = true;
+   }
+
+   if(all || benchmark == "batch")
+   {
+      failed = !benchmarkBatch(files) || failed;
+      ran = true;
+   }
+
+   if(all || benchmark == "groups")
+   {
+      failed = !benchmarkGroups() || failed;
+      ran = true;
+   }
+
+   if(!ran)
+   {
+      std::cerr << "Unknown benchmark: " << benchmark << endl;
+      std::cerr << "Usage: " << argv[0] << " [all|load|threads|weld|normals|indexed|vcache|cache|stream|quantize|lod|meshlet|bvh|bounds|batch|groups] [obj files...]" << endl;
+      return EXIT_FAILURE;
+   }
+
+   return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
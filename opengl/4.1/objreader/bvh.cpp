@@ -0,0 +1,1112 @@
+//----------------------------------------------------------------------
+// bvh.cpp
+//
+// Building splits a node at the cheapest of the bin boundaries along
+// each axis, or makes it a leaf if that is cheaper. Splitting starts
+// breadth first, with every thread binning the same node, until there
+// are enough subtrees to keep the threads busy. Each subtree is then
+// built by one thread into its own node array and spliced into place.
+//
+// Traversal visits the nearer child first and keeps the other on a
+// stack. Packets test each node and triangle against all of their rays
+// at once and go down a node if any ray hits it.
+//----------------------------------------------------------------------
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "bvh.h"
+
+// BVH_NO_SIMD turns off the SSE and AVX packet code
+#if defined(__AVX__) && !defined(BVH_NO_SIMD)
+#define BVH_AVX 1
+#define BVH_SSE 1
+#include <immintrin.h>
+#elif defined(__SSE__) && !defined(BVH_NO_SIMD)
+#define BVH_SSE 1
+#include <xmmintrin.h>
+#endif
+
+namespace
+{
+   /// Number of bins along each axis
+   const int numBins = 16;
+
+   /// Most triangles in a leaf, unless they can't be split
+   const GLuint maxLeafSize = 8;
+
+   /// Cost of visiting a node relative to testing a triangle
+   const float traversalCost = 1.0f;
+
+   /// Below this depth splits are made at the median, which bounds the
+   /// depth for the traversal stack
+   const GLuint maxSahDepth = 64;
+
+   /// Deepest the traversal stack can get
+   const int stackSize = 128;
+
+   /// Nodes with fewer triangles are binned by a single thread
+   const GLuint parallelBinning = 1 << 14;
+
+   //-------------------------------------------------------------------
+   // Axis aligned box
+   //-------------------------------------------------------------------
+   struct Box
+   {
+      GLfloat lo[3];
+      GLfloat hi[3];
+
+      void clear(void)
+      {
+         lo[0] = lo[1] = lo[2] = FLT_MAX;
+         hi[0] = hi[1] = hi[2] = -FLT_MAX;
+      }
+
+      void grow(const GLfloat* p)
+      {
+         for(int k = 0; k < 3; ++k)
+         {
+            lo[k] = p[k] < lo[k] ? p[k] : lo[k];
+            hi[k] = p[k] > hi[k] ? p[k] : hi[k];
+         }
+      }
+
+      void grow(const Box& box)
+      {
+         for(int k = 0; k < 3; ++k)
+         {
+            lo[k] = box.lo[k] < lo[k] ? box.lo[k] : lo[k];
+            hi[k] = box.hi[k] > hi[k] ? box.hi[k] : hi[k];
+         }
+      }
+
+      /// Half the surface area, 0 if empty
+      float area(void) const
+      {
+         float x = hi[0] - lo[0];
+         float y = hi[1] - lo[1];
+         float z = hi[2] - lo[2];
+         return x < 0.0f ? 0.0f : x * y + y * z + z * x;
+      }
+   };
+
+   //-------------------------------------------------------------------
+   // A triangle being sorted into the hierarchy
+   //-------------------------------------------------------------------
+   struct Reference
+   {
+      Box     box;
+      GLfloat centroid[3];
+      GLuint  triangle;
+   };
+
+   //-------------------------------------------------------------------
+   // Orders references by centroid along an axis
+   //-------------------------------------------------------------------
+   struct CentroidLess
+   {
+      int axis;
+
+      CentroidLess(int a) : axis(a) {}
+
+      bool operator()(const Reference& a, const Reference& b) const
+      {
+         return a.centroid[axis] < b.centroid[axis];
+      }
+   };
+
+   //-------------------------------------------------------------------
+   // Bounds and counts of the triangles in each bin along each axis
+   //-------------------------------------------------------------------
+   struct Bins
+   {
+      Box    box[3][numBins];
+      GLuint count[3][numBins];
+
+      void clear(void)
+      {
+         for(int a = 0; a < 3; ++a)
+         {
+            for(int b = 0; b < numBins; ++b)
+            {
+               box[a][b].clear();
+               count[a][b] = 0;
+            }
+         }
+      }
+
+      void merge(const Bins& other)
+      {
+         for(int a = 0; a < 3; ++a)
+         {
+            for(int b = 0; b < numBins; ++b)
+            {
+               box[a][b].grow(other.box[a][b]);
+               count[a][b] += other.count[a][b];
+            }
+         }
+      }
+   };
+
+   //-------------------------------------------------------------------
+   // A range of references waiting to become the subtree under a node
+   //-------------------------------------------------------------------
+   struct Task
+   {
+      GLuint node;
+      GLuint begin;
+      GLuint end;
+      GLuint depth;
+   };
+
+   //-------------------------------------------------------------------
+   // Builds the nodes over a list of references
+   //-------------------------------------------------------------------
+   class Builder
+   {
+   public:
+      Builder(std::vector<Reference>& references, GLuint threads)
+         : _references(references), _threads(threads)
+      {
+      }
+
+      ///
+      /// Set a node's bounds and split it, or make it a leaf
+      ///
+      /// \return true if split, with the halves in left and right
+      ///
+      bool split(std::vector<BVH::Node>& nodes, const Task& task, Task& left, Task& right,
+                 bool parallel);
+
+      ///
+      /// Build the whole subtree under a task, on this thread
+      ///
+      /// \return the depth of the subtree
+      ///
+      GLuint build(std::vector<BVH::Node>& nodes, const Task& task);
+
+   private:
+      void bounds(GLuint begin, GLuint end, Box& box, Box& centroids, bool parallel) const;
+      void bin(GLuint begin, GLuint end, const Box& centroids, Bins& bins, bool parallel) const;
+
+      inline int binOf(const Reference& r, int axis, const Box& centroids, float scale) const
+      {
+         int b = int((r.centroid[axis] - centroids.lo[axis]) * scale);
+         return b < 0 ? 0 : (b >= numBins ? numBins - 1 : b);
+      }
+
+      std::vector<Reference>& _references;
+      GLuint _threads;
+   };
+
+   void Builder::bounds(GLuint begin, GLuint end, Box& box, Box& centroids, bool parallel) const
+   {
+      box.clear();
+      centroids.clear();
+
+#ifdef _OPENMP
+      if(parallel)
+      {
+#pragma omp parallel num_threads(_threads)
+         {
+            Box localBox;
+            Box localCentroids;
+            localBox.clear();
+            localCentroids.clear();
+
+#pragma omp for nowait
+            for(int i = int(begin); i < int(end); ++i)
+            {
+               localBox.grow(_references[i].box);
+               localCentroids.grow(_references[i].centroid);
+            }
+
+#pragma omp critical
+            {
+               box.grow(localBox);
+               centroids.grow(localCentroids);
+            }
+         }
+         return;
+      }
+#else
+      (void) parallel;
+#endif
+
+      for(GLuint i = begin; i < end; ++i)
+      {
+         box.grow(_references[i].box);
+         centroids.grow(_references[i].centroid);
+      }
+   }
+
+   void Builder::bin(GLuint begin, GLuint end, const Box& centroids, Bins& bins, bool parallel) const
+   {
+      float scale[3];
+      for(int a = 0; a < 3; ++a)
+      {
+         float extent = centroids.hi[a] - centroids.lo[a];
+         scale[a] = extent > 0.0f ? numBins / extent : 0.0f;
+      }
+
+      bins.clear();
+
+#ifdef _OPENMP
+      if(parallel)
+      {
+#pragma omp parallel num_threads(_threads)
+         {
+            Bins local;
+            local.clear();
+
+#pragma omp for nowait
+            for(int i = int(begin); i < int(end); ++i)
+            {
+               const Reference& r = _references[i];
+               for(int a = 0; a < 3; ++a)
+               {
+                  int b = binOf(r, a, centroids, scale[a]);
+                  local.box[a][b].grow(r.box);
+                  local.count[a][b]++;
+               }
+            }
+
+#pragma omp critical
+            bins.merge(local);
+         }
+         return;
+      }
+#else
+      (void) parallel;
+#endif
+
+      for(GLuint i = begin; i < end; ++i)
+      {
+         const Reference& r = _references[i];
+         for(int a = 0; a < 3; ++a)
+         {
+            int b = binOf(r, a, centroids, scale[a]);
+            bins.box[a][b].grow(r.box);
+            bins.count[a][b]++;
+         }
+      }
+   }
+
+   bool Builder::split(std::vector<BVH::Node>& nodes, const Task& task, Task& left, Task& right,
+                       bool parallel)
+   {
+      GLuint count = task.end - task.begin;
+      parallel = parallel && _threads > 1 && count >= parallelBinning;
+
+      Box box;
+      Box centroids;
+      bounds(task.begin, task.end, box, centroids, parallel);
+
+      BVH::Node& node = nodes[task.node];
+      memcpy(node.lo, box.lo, sizeof(node.lo));
+      memcpy(node.hi, box.hi, sizeof(node.hi));
+      node.offset = task.begin;
+      node.count = GLushort(count);
+      node.axis = 0;
+
+      if(count <= 1)
+      {
+         return false;
+      }
+
+      // Longest axis of the centroids, for median splits
+      int longest = 0;
+      for(int a = 1; a < 3; ++a)
+      {
+         if(centroids.hi[a] - centroids.lo[a] > centroids.hi[longest] - centroids.lo[longest])
+         {
+            longest = a;
+         }
+      }
+
+      int axis = -1;
+      int plane = 0;
+      GLuint mid = task.begin;
+
+      if(task.depth < maxSahDepth)
+      {
+         Bins bins;
+         bin(task.begin, task.end, centroids, bins, parallel);
+
+         // Sweep from the right for the right side areas, then from the
+         // left, costing each bin boundary
+         float best = FLT_MAX;
+         for(int a = 0; a < 3; ++a)
+         {
+            if(centroids.hi[a] <= centroids.lo[a])
+            {
+               continue;
+            }
+
+            float rightArea[numBins];
+            GLuint rightCount[numBins];
+            Box accumulated;
+            accumulated.clear();
+            GLuint n = 0;
+            for(int b = numBins - 1; b > 0; --b)
+            {
+               accumulated.grow(bins.box[a][b]);
+               n += bins.count[a][b];
+               rightArea[b] = accumulated.area();
+               rightCount[b] = n;
+            }
+
+            accumulated.clear();
+            n = 0;
+            for(int b = 0; b < numBins - 1; ++b)
+            {
+               accumulated.grow(bins.box[a][b]);
+               n += bins.count[a][b];
+               if(n == 0 || rightCount[b + 1] == 0)
+               {
+                  continue;
+               }
+               float cost = accumulated.area() * n + rightArea[b + 1] * rightCount[b + 1];
+               if(cost < best)
+               {
+                  best = cost;
+                  axis = a;
+                  plane = b + 1;
+               }
+            }
+         }
+
+         // A leaf costs one test per triangle
+         float area = box.area();
+         float splitCost = area > 0.0f ? traversalCost + best / area : FLT_MAX;
+         if((axis < 0 || splitCost >= float(count)) && count <= maxLeafSize)
+         {
+            return false;
+         }
+
+         if(axis >= 0)
+         {
+            float extent = centroids.hi[axis] - centroids.lo[axis];
+            float scale = numBins / extent;
+            Reference* first = &_references[0] + task.begin;
+            Reference* last = &_references[0] + task.end;
+            Reference* middle = first;
+            while(first != last)
+            {
+               if(binOf(*first, axis, centroids, scale) < plane)
+               {
+                  std::swap(*first, *middle);
+                  ++middle;
+               }
+               ++first;
+            }
+            mid = GLuint(middle - &_references[0]);
+         }
+      }
+
+      // Too deep, or the centroids all coincide: split at the median
+      if(axis < 0)
+      {
+         axis = longest;
+         mid = task.begin + count / 2;
+         Reference* base = &_references[0];
+         std::nth_element(base + task.begin, base + mid, base + task.end, CentroidLess(axis));
+      }
+
+      GLuint children = GLuint(nodes.size());
+      nodes.resize(nodes.size() + 2);
+
+      BVH::Node& parent = nodes[task.node];
+      parent.offset = children;
+      parent.count = 0;
+      parent.axis = GLushort(axis);
+
+      left.node = children;
+      left.begin = task.begin;
+      left.end = mid;
+      left.depth = task.depth + 1;
+
+      right.node = children + 1;
+      right.begin = mid;
+      right.end = task.end;
+      right.depth = task.depth + 1;
+      return true;
+   }
+
+   GLuint Builder::build(std::vector<BVH::Node>& nodes, const Task& task)
+   {
+      Task left;
+      Task right;
+      if(!split(nodes, task, left, right, false))
+      {
+         return 0;
+      }
+
+      GLuint l = build(nodes, left);
+      GLuint r = build(nodes, right);
+      return 1 + (l > r ? l : r);
+   }
+}
+
+namespace
+{
+   //-------------------------------------------------------------------
+   // One float for each ray of a packet. The lane types share their
+   // operations, so the packet traversal is written once. Comparisons
+   // give a Mask, bits() packs it into an int, one bit per ray.
+   //-------------------------------------------------------------------
+#ifdef BVH_SSE
+   struct Lanes4
+   {
+      enum { width = 4 };
+      typedef Lanes4 Mask;
+
+      __m128 v;
+
+      Lanes4(void) {}
+      Lanes4(__m128 x) : v(x) {}
+
+      static Lanes4 load(const GLfloat* p) { return _mm_loadu_ps(p); }
+      static Lanes4 set(GLfloat x)         { return _mm_set1_ps(x); }
+      void store(GLfloat* p) const         { _mm_storeu_ps(p, v); }
+   };
+
+   inline Lanes4 operator+(Lanes4 a, Lanes4 b)  { return _mm_add_ps(a.v, b.v); }
+   inline Lanes4 operator-(Lanes4 a, Lanes4 b)  { return _mm_sub_ps(a.v, b.v); }
+   inline Lanes4 operator*(Lanes4 a, Lanes4 b)  { return _mm_mul_ps(a.v, b.v); }
+   inline Lanes4 operator/(Lanes4 a, Lanes4 b)  { return _mm_div_ps(a.v, b.v); }
+   inline Lanes4 operator<(Lanes4 a, Lanes4 b)  { return _mm_cmplt_ps(a.v, b.v); }
+   inline Lanes4 operator<=(Lanes4 a, Lanes4 b) { return _mm_cmple_ps(a.v, b.v); }
+   inline Lanes4 operator>(Lanes4 a, Lanes4 b)  { return _mm_cmpgt_ps(a.v, b.v); }
+   inline Lanes4 operator>=(Lanes4 a, Lanes4 b) { return _mm_cmpge_ps(a.v, b.v); }
+   inline Lanes4 operator&(Lanes4 a, Lanes4 b)  { return _mm_and_ps(a.v, b.v); }
+   inline Lanes4 min(Lanes4 a, Lanes4 b)        { return _mm_min_ps(a.v, b.v); }
+   inline Lanes4 max(Lanes4 a, Lanes4 b)        { return _mm_max_ps(a.v, b.v); }
+   inline int bits(Lanes4 mask)                 { return _mm_movemask_ps(mask.v); }
+
+   inline Lanes4 select(Lanes4 mask, Lanes4 a, Lanes4 b)
+   {
+      return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v));
+   }
+#endif
+
+#ifdef BVH_AVX
+   struct Lanes8
+   {
+      enum { width = 8 };
+      typedef Lanes8 Mask;
+
+      __m256 v;
+
+      Lanes8(void) {}
+      Lanes8(__m256 x) : v(x) {}
+
+      static Lanes8 load(const GLfloat* p) { return _mm256_loadu_ps(p); }
+      static Lanes8 set(GLfloat x)         { return _mm256_set1_ps(x); }
+      void store(GLfloat* p) const         { _mm256_storeu_ps(p, v); }
+   };
+
+   inline Lanes8 operator+(Lanes8 a, Lanes8 b)  { return _mm256_add_ps(a.v, b.v); }
+   inline Lanes8 operator-(Lanes8 a, Lanes8 b)  { return _mm256_sub_ps(a.v, b.v); }
+   inline Lanes8 operator*(Lanes8 a, Lanes8 b)  { return _mm256_mul_ps(a.v, b.v); }
+   inline Lanes8 operator/(Lanes8 a, Lanes8 b)  { return _mm256_div_ps(a.v, b.v); }
+   inline Lanes8 operator<(Lanes8 a, Lanes8 b)  { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+   inline Lanes8 operator<=(Lanes8 a, Lanes8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ); }
+   inline Lanes8 operator>(Lanes8 a, Lanes8 b)  { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+   inline Lanes8 operator>=(Lanes8 a, Lanes8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ); }
+   inline Lanes8 operator&(Lanes8 a, Lanes8 b)  { return _mm256_and_ps(a.v, b.v); }
+   inline Lanes8 min(Lanes8 a, Lanes8 b)        { return _mm256_min_ps(a.v, b.v); }
+   inline Lanes8 max(Lanes8 a, Lanes8 b)        { return _mm256_max_ps(a.v, b.v); }
+   inline int bits(Lanes8 mask)                 { return _mm256_movemask_ps(mask.v); }
+
+   inline Lanes8 select(Lanes8 mask, Lanes8 a, Lanes8 b)
+   {
+      return _mm256_blendv_ps(b.v, a.v, mask.v);
+   }
+#endif
+
+   //-------------------------------------------------------------------
+   // Plain lanes, for packet widths without SIMD
+   //-------------------------------------------------------------------
+   template<int N>
+   struct MaskN
+   {
+      bool v[N];
+   };
+
+   template<int N>
+   struct LanesN
+   {
+      enum { width = N };
+      typedef MaskN<N> Mask;
+
+      GLfloat v[N];
+
+      static LanesN load(const GLfloat* p)
+      {
+         LanesN r;
+         memcpy(r.v, p, sizeof(r.v));
+         return r;
+      }
+
+      static LanesN set(GLfloat x)
+      {
+         LanesN r;
+         std::fill(r.v, r.v + N, x);
+         return r;
+      }
+
+      void store(GLfloat* p) const { memcpy(p, v, sizeof(v)); }
+   };
+
+#define BVH_LANES_OP(op, result, expr) \
+   template<int N> \
+   inline result<N> operator op(const LanesN<N>& a, const LanesN<N>& b) \
+   { \
+      result<N> r; \
+      for(int i = 0; i < N; ++i) r.v[i] = expr; \
+      return r; \
+   }
+
+   BVH_LANES_OP(+,  LanesN, a.v[i] + b.v[i])
+   BVH_LANES_OP(-,  LanesN, a.v[i] - b.v[i])
+   BVH_LANES_OP(*,  LanesN, a.v[i] * b.v[i])
+   BVH_LANES_OP(/,  LanesN, a.v[i] / b.v[i])
+   BVH_LANES_OP(<,  MaskN,  a.v[i] < b.v[i])
+   BVH_LANES_OP(<=, MaskN,  a.v[i] <= b.v[i])
+   BVH_LANES_OP(>,  MaskN,  a.v[i] > b.v[i])
+   BVH_LANES_OP(>=, MaskN,  a.v[i] >= b.v[i])
+#undef BVH_LANES_OP
+
+   template<int N>
+   inline MaskN<N> operator&(const MaskN<N>& a, const MaskN<N>& b)
+   {
+      MaskN<N> r;
+      for(int i = 0; i < N; ++i) r.v[i] = a.v[i] && b.v[i];
+      return r;
+   }
+
+   template<int N>
+   inline LanesN<N> min(const LanesN<N>& a, const LanesN<N>& b)
+   {
+      LanesN<N> r;
+      for(int i = 0; i < N; ++i) r.v[i] = a.v[i] < b.v[i] ? a.v[i] : b.v[i];
+      return r;
+   }
+
+   template<int N>
+   inline LanesN<N> max(const LanesN<N>& a, const LanesN<N>& b)
+   {
+      LanesN<N> r;
+      for(int i = 0; i < N; ++i) r.v[i] = a.v[i] > b.v[i] ? a.v[i] : b.v[i];
+      return r;
+   }
+
+   template<int N>
+   inline int bits(const MaskN<N>& mask)
+   {
+      int r = 0;
+      for(int i = 0; i < N; ++i) r |= mask.v[i] ? 1 << i : 0;
+      return r;
+   }
+
+   template<int N>
+   inline LanesN<N> select(const MaskN<N>& mask, const LanesN<N>& a, const LanesN<N>& b)
+   {
+      LanesN<N> r;
+      for(int i = 0; i < N; ++i) r.v[i] = mask.v[i] ? a.v[i] : b.v[i];
+      return r;
+   }
+
+#ifdef BVH_SSE
+   typedef Lanes4 Packet4;
+#else
+   typedef LanesN<4> Packet4;
+#endif
+
+#ifdef BVH_AVX
+   typedef Lanes8 Packet8;
+#else
+   typedef LanesN<8> Packet8;
+#endif
+
+   /// Reciprocal of a direction component, finite for 0
+   inline GLfloat inverse(GLfloat d)
+   {
+      return 1.0f / (fabsf(d) > 1e-20f ? d : (d < 0.0f ? -1e-20f : 1e-20f));
+   }
+
+   ///
+   /// Distance along a ray to a node's box
+   ///
+   /// \return the distance, FLT_MAX if the ray misses before tmax
+   ///
+   inline GLfloat slab(const BVH::Node& node, const GLfloat* origin, const GLfloat* inv, GLfloat tmax)
+   {
+      GLfloat x0 = (node.lo[0] - origin[0]) * inv[0];
+      GLfloat x1 = (node.hi[0] - origin[0]) * inv[0];
+      GLfloat y0 = (node.lo[1] - origin[1]) * inv[1];
+      GLfloat y1 = (node.hi[1] - origin[1]) * inv[1];
+      GLfloat z0 = (node.lo[2] - origin[2]) * inv[2];
+      GLfloat z1 = (node.hi[2] - origin[2]) * inv[2];
+      GLfloat nearT = std::max(std::max(std::min(x0, x1), std::min(y0, y1)), std::max(std::min(z0, z1), 0.0f));
+      GLfloat farT = std::min(std::min(std::max(x0, x1), std::max(y0, y1)), std::min(std::max(z0, z1), tmax));
+      return nearT <= farT ? nearT : FLT_MAX;
+   }
+
+   ///
+   /// Intersect a ray with a triangle (Moller and Trumbore)
+   ///
+   /// \return true for a hit closer than tmax, with t, u and v set
+   ///
+   inline bool intersectTriangle(const GLfloat* v0, const GLfloat* e1, const GLfloat* e2,
+                                 const GLfloat* origin, const GLfloat* direction, GLfloat tmax,
+                                 GLfloat& t, GLfloat& u, GLfloat& v)
+   {
+      const GLfloat* d = direction;
+      GLfloat p[3] = { d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2], d[0] * e2[1] - d[1] * e2[0] };
+      GLfloat det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+      GLfloat inv = 1.0f / det;
+      GLfloat s[3] = { origin[0] - v0[0], origin[1] - v0[1], origin[2] - v0[2] };
+      GLfloat hu = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inv;
+      GLfloat q[3] = { s[1] * e1[2] - s[2] * e1[1], s[2] * e1[0] - s[0] * e1[2], s[0] * e1[1] - s[1] * e1[0] };
+      GLfloat hv = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) * inv;
+      GLfloat ht = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) * inv;
+      if(hu >= 0.0f && hv >= 0.0f && hu + hv <= 1.0f && ht > 0.0f && ht < tmax)
+      {
+         t = ht;
+         u = hu;
+         v = hv;
+         return true;
+      }
+      return false;
+   }
+
+   //-------------------------------------------------------------------
+   // A node waiting on the traversal stack, and how far along the ray
+   // its box starts
+   //-------------------------------------------------------------------
+   struct StackEntry
+   {
+      GLuint  node;
+      GLfloat t;
+   };
+}
+
+const GLuint BVH::miss;
+
+BVH::BVH(const GLfloat* positions, GLsizei stride, const std::vector<GLuint>& indices,
+         GLuint threads)
+   : _depth(0)
+{
+#ifdef _OPENMP
+   if(threads == 0)
+   {
+      threads = omp_get_max_threads();
+   }
+#else
+   threads = 1;
+#endif
+
+   GLuint numTriangles = GLuint(indices.size() / 3);
+   if(numTriangles == 0)
+   {
+      return;
+   }
+
+   const char* base = reinterpret_cast<const char*>(positions);
+   std::vector<Reference> references(numTriangles);
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads)
+#endif
+   for(int i = 0; i < int(numTriangles); ++i)
+   {
+      Reference& r = references[i];
+      r.box.clear();
+      for(int k = 0; k < 3; ++k)
+      {
+         r.box.grow(reinterpret_cast<const GLfloat*>(base + size_t(indices[3 * i + k]) * stride));
+      }
+      for(int k = 0; k < 3; ++k)
+      {
+         r.centroid[k] = 0.5f * (r.box.lo[k] + r.box.hi[k]);
+      }
+      r.triangle = i;
+   }
+
+   Builder builder(references, threads);
+   _nodes.reserve(2 * numTriangles);
+   _nodes.resize(1);
+   Task root = { 0, 0, numTriangles, 0 };
+
+   if(threads == 1)
+   {
+      _depth = builder.build(_nodes, root);
+   }
+   else
+   {
+      // Split breadth first, all threads binning each node, until the
+      // ranges are small enough to share out
+      GLuint subtreeSize = std::max(numTriangles / (8 * threads), GLuint(1024));
+      std::vector<Task> tasks(1, root);
+      std::vector<Task> subtrees;
+      for(size_t next = 0; next < tasks.size(); ++next)
+      {
+         Task task = tasks[next];
+         if(task.end - task.begin <= subtreeSize)
+         {
+            subtrees.push_back(task);
+            continue;
+         }
+
+         Task left;
+         Task right;
+         if(builder.split(_nodes, task, left, right, true))
+         {
+            tasks.push_back(left);
+            tasks.push_back(right);
+         }
+         else
+         {
+            _depth = std::max(_depth, task.depth);
+         }
+      }
+
+      // Build the subtrees, one per thread, into their own arrays
+      std::vector<std::vector<Node> > local(subtrees.size());
+      std::vector<GLuint> depths(subtrees.size());
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) num_threads(threads)
+#endif
+      for(int i = 0; i < int(subtrees.size()); ++i)
+      {
+         Task task = subtrees[i];
+         task.node = 0;
+         local[i].reserve(2 * (task.end - task.begin));
+         local[i].resize(1);
+         depths[i] = task.depth + builder.build(local[i], task);
+      }
+
+      // Splice them in. Local node k > 0 goes to start + k - 1.
+      for(size_t i = 0; i < local.size(); ++i)
+      {
+         GLuint start = GLuint(_nodes.size());
+         for(size_t k = 0; k < local[i].size(); ++k)
+         {
+            Node node = local[i][k];
+            if(node.count == 0)
+            {
+               node.offset += start - 1;
+            }
+
+            if(k == 0)
+            {
+               _nodes[subtrees[i].node] = node;
+            }
+            else
+            {
+               _nodes.push_back(node);
+            }
+         }
+         _depth = std::max(_depth, depths[i]);
+      }
+   }
+
+   // Copy the triangles into leaf order
+   _triangles.resize(numTriangles);
+
+#ifdef _OPENMP
+#pragma omp parallel for num_threads(threads)
+#endif
+   for(int i = 0; i < int(numTriangles); ++i)
+   {
+      Triangle& t = _triangles[i];
+      t.id = references[i].triangle;
+      const GLuint* corner = &indices[3 * t.id];
+      const GLfloat* p0 = reinterpret_cast<const GLfloat*>(base + size_t(corner[0]) * stride);
+      const GLfloat* p1 = reinterpret_cast<const GLfloat*>(base + size_t(corner[1]) * stride);
+      const GLfloat* p2 = reinterpret_cast<const GLfloat*>(base + size_t(corner[2]) * stride);
+      for(int k = 0; k < 3; ++k)
+      {
+         t.v0[k] = p0[k];
+         t.e1[k] = p1[k] - p0[k];
+         t.e2[k] = p2[k] - p0[k];
+      }
+   }
+}
+
+bool BVH::intersect(const Ray& ray, Hit& hit) const
+{
+   hit.t = ray.tmax;
+   hit.u = 0.0f;
+   hit.v = 0.0f;
+   hit.triangle = miss;
+   if(_nodes.empty())
+   {
+      return false;
+   }
+
+   GLfloat inv[3] = { inverse(ray.direction[0]), inverse(ray.direction[1]), inverse(ray.direction[2]) };
+
+   StackEntry stack[stackSize];
+   int top = 0;
+   stack[top].node = 0;
+   stack[top].t = slab(_nodes[0], ray.origin, inv, hit.t);
+   top++;
+
+   while(top > 0)
+   {
+      // Skip nodes that start beyond the closest hit so far
+      --top;
+      if(stack[top].t >= hit.t)
+      {
+         continue;
+      }
+
+      GLuint index = stack[top].node;
+      for(;;)
+      {
+         const Node& node = _nodes[index];
+         if(node.count)
+         {
+            for(GLuint i = node.offset; i < node.offset + node.count; ++i)
+            {
+               const Triangle& tri = _triangles[i];
+               if(intersectTriangle(tri.v0, tri.e1, tri.e2, ray.origin, ray.direction, hit.t,
+                                    hit.t, hit.u, hit.v))
+               {
+                  hit.triangle = tri.id;
+               }
+            }
+            break;
+         }
+
+         // Go down the nearer child, keep the other for later
+         GLuint left = node.offset;
+         GLfloat leftT = slab(_nodes[left], ray.origin, inv, hit.t);
+         GLfloat rightT = slab(_nodes[left + 1], ray.origin, inv, hit.t);
+         if(leftT == FLT_MAX && rightT == FLT_MAX)
+         {
+            break;
+         }
+         else if(rightT == FLT_MAX)
+         {
+            index = left;
+         }
+         else if(leftT == FLT_MAX)
+         {
+            index = left + 1;
+         }
+         else
+         {
+            bool leftFirst = leftT <= rightT;
+            stack[top].node = leftFirst ? left + 1 : left;
+            stack[top].t = leftFirst ? rightT : leftT;
+            top++;
+            index = leftFirst ? left : left + 1;
+         }
+      }
+   }
+
+   return hit.triangle != miss;
+}
+
+bool BVH::occluded(const Ray& ray) const
+{
+   if(_nodes.empty())
+   {
+      return false;
+   }
+
+   GLfloat inv[3] = { inverse(ray.direction[0]), inverse(ray.direction[1]), inverse(ray.direction[2]) };
+   if(slab(_nodes[0], ray.origin, inv, ray.tmax) == FLT_MAX)
+   {
+      return false;
+   }
+
+   // Any hit will do, so the order doesn't matter
+   GLuint stack[stackSize];
+   int top = 0;
+   stack[top++] = 0;
+   while(top > 0)
+   {
+      const Node& node = _nodes[stack[--top]];
+      if(node.count)
+      {
+         for(GLuint i = node.offset; i < node.offset + node.count; ++i)
+         {
+            const Triangle& tri = _triangles[i];
+            GLfloat t, u, v;
+            if(intersectTriangle(tri.v0, tri.e1, tri.e2, ray.origin, ray.direction, ray.tmax, t, u, v))
+            {
+               return true;
+            }
+         }
+         continue;
+      }
+
+      for(GLuint child = node.offset; child < node.offset + 2; ++child)
+      {
+         if(slab(_nodes[child], ray.origin, inv, ray.tmax) != FLT_MAX)
+         {
+            stack[top++] = child;
+         }
+      }
+   }
+
+   return false;
+}
+
+template<class Lanes>
+void BVH::intersectPacket(const Ray* rays, Hit* hits) const
+{
+   typedef typename Lanes::Mask Mask;
+   const int width = Lanes::width;
+
+   // Rays in structure of arrays form
+   GLfloat buffer[width];
+   Lanes origin[3];
+   Lanes direction[3];
+   Lanes inv[3];
+   for(int k = 0; k < 3; ++k)
+   {
+      for(int i = 0; i < width; ++i) buffer[i] = rays[i].origin[k];
+      origin[k] = Lanes::load(buffer);
+      for(int i = 0; i < width; ++i) buffer[i] = rays[i].direction[k];
+      direction[k] = Lanes::load(buffer);
+      for(int i = 0; i < width; ++i) buffer[i] = inverse(rays[i].direction[k]);
+      inv[k] = Lanes::load(buffer);
+   }
+   for(int i = 0; i < width; ++i) buffer[i] = rays[i].tmax;
+   Lanes t = Lanes::load(buffer);
+   Lanes u = Lanes::set(0.0f);
+   Lanes v = Lanes::set(0.0f);
+   GLuint ids[width];
+   std::fill(ids, ids + width, miss);
+
+   const Lanes zero = Lanes::set(0.0f);
+   const Lanes one = Lanes::set(1.0f);
+
+   GLuint stack[stackSize];
+   int top = 0;
+   if(!_nodes.empty())
+   {
+      stack[top++] = 0;
+   }
+
+   while(top > 0)
+   {
+      const Node& node = _nodes[stack[--top]];
+
+      // Slab test for every ray, against each ray's closest hit so far
+      Lanes x0 = (Lanes::set(node.lo[0]) - origin[0]) * inv[0];
+      Lanes x1 = (Lanes::set(node.hi[0]) - origin[0]) * inv[0];
+      Lanes y0 = (Lanes::set(node.lo[1]) - origin[1]) * inv[1];
+      Lanes y1 = (Lanes::set(node.hi[1]) - origin[1]) * inv[1];
+      Lanes z0 = (Lanes::set(node.lo[2]) - origin[2]) * inv[2];
+      Lanes z1 = (Lanes::set(node.hi[2]) - origin[2]) * inv[2];
+      Lanes nearT = max(max(min(x0, x1), min(y0, y1)), max(min(z0, z1), zero));
+      Lanes farT = min(min(max(x0, x1), max(y0, y1)), min(max(z0, z1), t));
+      if(!bits(nearT <= farT))
+      {
+         continue;
+      }
+
+      if(node.count == 0)
+      {
+         // Nearer child on top, by the first ray's direction
+         GLuint left = node.offset;
+         bool leftFirst = rays[0].direction[node.axis] >= 0.0f;
+         stack[top++] = leftFirst ? left + 1 : left;
+         stack[top++] = leftFirst ? left : left + 1;
+         continue;
+      }
+
+      for(GLuint i = node.offset; i < node.offset + node.count; ++i)
+      {
+         const Triangle& tri = _triangles[i];
+         Lanes e1x = Lanes::set(tri.e1[0]), e1y = Lanes::set(tri.e1[1]), e1z = Lanes::set(tri.e1[2]);
+         Lanes e2x = Lanes::set(tri.e2[0]), e2y = Lanes::set(tri.e2[1]), e2z = Lanes::set(tri.e2[2]);
+
+         Lanes px = direction[1] * e2z - direction[2] * e2y;
+         Lanes py = direction[2] * e2x - direction[0] * e2z;
+         Lanes pz = direction[0] * e2y - direction[1] * e2x;
+         Lanes det = e1x * px + e1y * py + e1z * pz;
+         Lanes invDet = one / det;
+         Lanes sx = origin[0] - Lanes::set(tri.v0[0]);
+         Lanes sy = origin[1] - Lanes::set(tri.v0[1]);
+         Lanes sz = origin[2] - Lanes::set(tri.v0[2]);
+         Lanes hu = (sx * px + sy * py + sz * pz) * invDet;
+         Lanes qx = sy * e1z - sz * e1y;
+         Lanes qy = sz * e1x - sx * e1z;
+         Lanes qz = sx * e1y - sy * e1x;
+         Lanes hv = (direction[0] * qx + direction[1] * qy + direction[2] * qz) * invDet;
+         Lanes ht = (e2x * qx + e2y * qy + e2z * qz) * invDet;
+
+         Mask hit = (hu >= zero) & (hv >= zero) & (hu + hv <= one) & (ht > zero) & (ht < t);
+         int mask = bits(hit);
+         if(mask)
+         {
+            t = select(hit, ht, t);
+            u = select(hit, hu, u);
+            v = select(hit, hv, v);
+            for(int k = 0; k < width; ++k)
+            {
+               ids[k] = mask & (1 << k) ? tri.id : ids[k];
+            }
+         }
+      }
+   }
+
+   GLfloat ts[width];
+   GLfloat us[width];
+   GLfloat vs[width];
+   t.store(ts);
+   u.store(us);
+   v.store(vs);
+   for(int i = 0; i < width; ++i)
+   {
+      hits[i].t = ts[i];
+      hits[i].u = ids[i] == miss ? 0.0f : us[i];
+      hits[i].v = ids[i] == miss ? 0.0f : vs[i];
+      hits[i].triangle = ids[i];
+   }
+}
+
+void BVH::intersect4(const Ray* rays, Hit* hits) const
+{
+   intersectPacket<Packet4>(rays, hits);
+}
+
+void BVH::intersect8(const Ray* rays, Hit* hits) const
+{
+   intersectPacket<Packet8>(rays, hits);
+}
+
+double BVH::cost(void) const
+{
+   if(_nodes.empty())
+   {
+      return 0.0;
+   }
+
+   double total = 0.0;
+   double rootArea = 0.0;
+   for(size_t i = 0; i < _nodes.size(); ++i)
+   {
+      const Node& node = _nodes[i];
+      double x = node.hi[0] - node.lo[0];
+      double y = node.hi[1] - node.lo[1];
+      double z = node.hi[2] - node.lo[2];
+      double area = x * y + y * z + z * x;
+      rootArea = i == 0 ? area : rootArea;
+      total += area * (node.count ? node.count : traversalCost);
+   }
+
+   return rootArea > 0.0 ? total / rootArea : 0.0;
+}
@@ -0,0 +1,162 @@
+//----------------------------------------------------------------------
+// bvh.h
+//
+// Bounding volume hierarchy over indexed triangles, for ray queries:
+// picking, shadow rays and occlusion tests.
+//
+// Author: Jeff Bowles <jbowles@riskybacon.com>
+//----------------------------------------------------------------------
+
+#ifndef _bvh_h
+#define _bvh_h
+
+#include <float.h>
+#include <vector>
+
+#if defined(__APPLE_CC__)
+#include <OpenGL/gl3.h>
+#else
+#include <GL/glew.h>
+#include <GL/gl.h>
+#endif
+
+//----------------------------------------------------------------------
+/// Binary bounding volume hierarchy built with the surface area
+/// heuristic over binned centroids. The top levels are split with all
+/// threads working on each split, the subtrees below are then built one
+/// per thread. Triangles are copied into leaf order, so a leaf's
+/// triangles are contiguous in memory.
+///
+/// Packets trace 4 or 8 rays together, one ray per SIMD lane: SSE for
+/// 4, AVX for 8 when built with -mavx. Define BVH_NO_SIMD to use plain
+/// loops instead. Packets pay off when the rays are coherent, such as
+/// neighbouring pixels of a camera.
+///
+/// \code
+/// BVH bvh(vertices, stride, indices);
+/// BVH::Ray ray = { { 0, 0, 5 }, { 0, 0, -1 }, FLT_MAX };
+/// BVH::Hit hit;
+/// if(bvh.intersect(ray, hit)) ...hit.triangle, at ray.origin + hit.t * ray.direction
+/// \endcode
+//----------------------------------------------------------------------
+class BVH
+{
+public:
+   //-------------------------------------------------------------------
+   /// A node, 32 bytes, so two fit in a cache line. The two children of
+   /// an interior node are next to each other.
+   //-------------------------------------------------------------------
+   struct Node
+   {
+      GLfloat  lo[3];
+
+      /// First triangle of a leaf, or the first child of an interior
+      /// node; the second child follows it
+      GLuint   offset;
+
+      GLfloat  hi[3];
+
+      /// Triangles in a leaf, 0 for an interior node
+      GLushort count;
+
+      /// Axis the children were split along
+      GLushort axis;
+   };
+
+   //-------------------------------------------------------------------
+   /// A ray. Hits are reported in multiples of direction, which need
+   /// not be unit length, between 0 and tmax.
+   //-------------------------------------------------------------------
+   struct Ray
+   {
+      GLfloat origin[3];
+      GLfloat direction[3];
+      GLfloat tmax;
+   };
+
+   //-------------------------------------------------------------------
+   /// The closest hit along a ray
+   //-------------------------------------------------------------------
+   struct Hit
+   {
+      GLfloat t;
+
+      /// Barycentric coordinates of the second and third corners
+      GLfloat u;
+      GLfloat v;
+
+      /// Index of the triangle in the index buffer, divided by 3, or
+      /// BVH::miss
+      GLuint  triangle;
+   };
+
+   /// Hit::triangle when nothing was hit
+   static const GLuint miss = ~0u;
+
+   ///
+   /// Build the hierarchy
+   ///
+   /// \param positions First position, 3 floats
+   /// \param stride Bytes from one position to the next
+   /// \param indices Three indices per triangle
+   /// \param threads Number of threads to build with, 0 for all available
+   ///
+   BVH(const GLfloat* positions, GLsizei stride, const std::vector<GLuint>& indices,
+       GLuint threads = 0);
+
+   ///
+   /// Find the closest triangle along a ray
+   ///
+   /// \return true if a triangle was hit
+   ///
+   bool intersect(const Ray& ray, Hit& hit) const;
+
+   ///
+   /// \return true if any triangle is along a ray. Faster than
+   /// intersect(), for shadow and occlusion tests.
+   ///
+   bool occluded(const Ray& ray) const;
+
+   ///
+   /// Find the closest triangle along each of 4 rays
+   ///
+   void intersect4(const Ray* rays, Hit* hits) const;
+
+   ///
+   /// Find the closest triangle along each of 8 rays
+   ///
+   void intersect8(const Ray* rays, Hit* hits) const;
+
+   /// \return the nodes, the root first
+   const std::vector<Node>& nodes(void) const { return _nodes; }
+
+   /// \return the number of levels below the root
+   GLuint depth(void) const { return _depth; }
+
+   ///
+   /// \return the expected cost of tracing a ray through the hierarchy
+   /// by the surface area heuristic, in triangle tests
+   ///
+   double cost(void) const;
+
+private:
+   //-------------------------------------------------------------------
+   /// A triangle as one corner and two edges, ready for intersection
+   //-------------------------------------------------------------------
+   struct Triangle
+   {
+      GLfloat v0[3];
+      GLfloat e1[3];
+      GLfloat e2[3];
+      GLuint  id;
+   };
+
+   template<class Lanes>
+   void intersectPacket(const Ray* rays, Hit* hits) const;
+
+   std::vector<Node>     _nodes;
+   std::vector<Triangle> _triangles;
+   GLuint                _depth;
+};
+
+#endif
@@ -0,0 +1,224 @@
+//----------------------------------------------------------------------
+// filewatch.cpp
+//
+// inotify watches on Linux, modification time polling elsewhere
+//----------------------------------------------------------------------
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <thread>
+#include "filewatch.h"
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#endif
+
+namespace
+{
+   std::string directoryOf(const std::string& file)
+   {
+      size_t slash = file.find_last_of("/\\");
+      if(slash == std::string::npos)
+      {
+         return ".";
+      }
+      return file.substr(0, slash ? slash : 1);
+   }
+
+   std::string baseName(const std::string& file)
+   {
+      size_t slash = file.find_last_of("/\\");
+      return slash == std::string::npos ? file : file.substr(slash + 1);
+   }
+
+   //-------------------------------------------------------------------
+   // Modification time and size, empty if the file is missing
+   //-------------------------------------------------------------------
+   std::string stamp(const std::string& file)
+   {
+      struct stat info;
+      if(stat(file.c_str(), &info))
+      {
+         return std::string();
+      }
+      std::stringstream ss;
+      ss << info.st_mtime << " " << info.st_size;
+      return ss.str();
+   }
+}
+
+FileWatcher::FileWatcher(const std::vector<std::string>& files, double settle)
+   : _settle(settle), _stopped(false), _inotify(-1)
+{
+   _wake[0] = _wake[1] = -1;
+#ifdef __linux__
+   _inotify = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+   if(_inotify < 0 || pipe(_wake))
+   {
+      std::cerr << "inotify unavailable, polling instead: " << strerror(errno) << std::endl;
+      if(_inotify >= 0)
+      {
+         close(_inotify);
+         _inotify = -1;
+      }
+      _wake[0] = _wake[1] = -1;
+   }
+#endif
+   watch(files);
+}
+
+FileWatcher::~FileWatcher()
+{
+#ifdef __linux__
+   if(_inotify >= 0)
+   {
+      close(_inotify);
+      close(_wake[0]);
+      close(_wake[1]);
+   }
+#endif
+}
+
+void FileWatcher::watch(const std::vector<std::string>& files)
+{
+   _files = files;
+   _stamps.clear();
+   for(size_t i = 0; i < _files.size(); ++i)
+   {
+      _stamps.push_back(stamp(_files[i]));
+   }
+
+#ifdef __linux__
+   if(_inotify < 0)
+   {
+      return;
+   }
+
+   // Watch the directories rather than the files, a file saved by
+   // renaming a new one over it is a new inode
+   std::map<int, std::string>::iterator i;
+   for(i = _directories.begin(); i != _directories.end(); ++i)
+   {
+      inotify_rm_watch(_inotify, i->first);
+   }
+   _directories.clear();
+
+   for(size_t f = 0; f < _files.size(); ++f)
+   {
+      std::string directory = directoryOf(_files[f]);
+      int wd = inotify_add_watch(_inotify, directory.c_str(),
+                                 IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+      if(wd < 0)
+      {
+         std::cerr << "Can't watch " << directory << ": " << strerror(errno) << std::endl;
+         continue;
+      }
+      _directories[wd] = directory;
+   }
+#endif
+}
+
+bool FileWatcher::modified(void)
+{
+   bool changed = false;
+   for(size_t i = 0; i < _files.size(); ++i)
+   {
+      std::string now = stamp(_files[i]);
+      changed = changed || now != _stamps[i];
+      _stamps[i] = now;
+   }
+   return changed;
+}
+
+bool FileWatcher::poll(double timeout)
+{
+#ifdef __linux__
+   if(_inotify >= 0)
+   {
+      struct pollfd fds[2];
+      fds[0].fd = _inotify;
+      fds[0].events = POLLIN;
+      fds[1].fd = _wake[0];
+      fds[1].events = POLLIN;
+      if(::poll(fds, 2, timeout < 0.0 ? -1 : int(timeout * 1000.0)) <= 0 || _stopped)
+      {
+         return false;
+      }
+
+      // Drain every event, noting whether one names a watched file
+      bool touched = false;
+      char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+      ssize_t bytes;
+      while((bytes = read(_inotify, buffer, sizeof(buffer))) > 0)
+      {
+         for(char* p = buffer; p < buffer + bytes; )
+         {
+            const struct inotify_event* event = (const struct inotify_event*) p;
+            p += sizeof(struct inotify_event) + event->len;
+            if(!event->len)
+            {
+               continue;
+            }
+
+            std::map<int, std::string>::const_iterator directory = _directories.find(event->wd);
+            for(size_t f = 0; f < _files.size() && directory != _directories.end(); ++f)
+            {
+               touched = touched || (directory->second == directoryOf(_files[f]) &&
+                                     baseName(_files[f]) == event->name);
+            }
+         }
+      }
+      return touched;
+   }
+#endif
+
+   // Poll a few times a second
+   double step = timeout < 0.0 ? 0.25 : timeout;
+   std::this_thread::sleep_for(std::chrono::duration<double>(step));
+   return !_stopped && modified();
+}
+
+bool FileWatcher::wait(double& changed)
+{
+   while(!_stopped)
+   {
+      if(!poll(-1.0))
+      {
+         continue;
+      }
+
+      // Let the save finish
+      changed = now();
+      while(!_stopped && poll(_settle))
+      {
+      }
+      return !_stopped;
+   }
+   return false;
+}
+
+void FileWatcher::stop(void)
+{
+   _stopped = true;
+#ifdef __linux__
+   if(_wake[1] >= 0 && write(_wake[1], "", 1) < 0)
+   {
+      std::cerr << "Can't wake the file watcher: " << strerror(errno) << std::endl;
+   }
+#endif
+}
+
+double FileWatcher::now(void)
+{
+   using namespace std::chrono;
+   return duration<double>(steady_clock::now().time_since_epoch()).count();
+}
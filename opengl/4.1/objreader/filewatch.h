@@ -0,0 +1,100 @@
+//----------------------------------------------------------------------
+// filewatch.h
+//
+// Waits for files to change on disk, so models can be reloaded when
+// they are saved again.
+//
+// Author: Jeff Bowles <jbowles@riskybacon.com>
+//----------------------------------------------------------------------
+
+#ifndef _filewatch_h
+#define _filewatch_h
+
+#include <atomic>
+#include <map>
+#include <string>
+#include <vector>
+
+//----------------------------------------------------------------------
+/// Watches a set of files. On Linux the directories holding them are
+/// watched with inotify, so a file replaced by rename, as most editors
+/// and exporters save, is seen as well as one written in place.
+/// Elsewhere the modification times are polled.
+///
+/// A save usually arrives as several events: truncate, a few writes,
+/// close. wait() returns once the files have been quiet for the settle
+/// time, so the reload reads a complete file.
+///
+/// wait() blocks and is meant for a thread of its own; stop() may be
+/// called from any thread to wake it.
+///
+/// \code
+/// FileWatcher watcher(files);
+/// double saved;
+/// while(watcher.wait(saved)) ...reload
+/// \endcode
+//----------------------------------------------------------------------
+class FileWatcher
+{
+public:
+   ///
+   /// Constructor
+   ///
+   /// \param files Files to watch, which need not exist yet
+   /// \param settle Seconds without events before a change is reported
+   ///
+   FileWatcher(const std::vector<std::string>& files, double settle = 0.1);
+
+   ///
+   /// Destructor, stop() must have been called if a thread is waiting
+   ///
+   ~FileWatcher();
+
+   ///
+   /// Replace the files watched. Call from the thread that waits.
+   ///
+   void watch(const std::vector<std::string>& files);
+
+   ///
+   /// Block until a watched file changes and settles
+   ///
+   /// \param changed Set to the time of the first event of the change,
+   ///                in seconds on the clock of now()
+   /// \return true on a change, false once stop() was called
+   ///
+   bool wait(double& changed);
+
+   ///
+   /// Wake wait() and make it and every later call return false
+   ///
+   void stop(void);
+
+   ///
+   /// \return true if inotify is used, false if files are polled
+   ///
+   bool notified(void) const { return _inotify >= 0; }
+
+   ///
+   /// \return the current time in seconds, on a steady clock
+   ///
+   static double now(void);
+
+private:
+   /// \return true if a watched file's modification time moved
+   bool modified(void);
+
+   /// Wait up to timeout seconds for events
+   /// \return true if a watched file was touched
+   bool poll(double timeout);
+
+   std::vector<std::string> _files;
+   std::vector<std::string> _stamps;  ///< Modification time and size of each file, when polling
+   double                   _settle;
+   std::atomic<bool>        _stopped;
+
+   int                      _inotify; ///< inotify descriptor, -1 when polling
+   int                      _wake[2]; ///< Pipe that stop() writes to
+   std::map<int, std::string> _directories; ///< Directory of each watch descriptor
+};
+
+#endif
@@ -24,20 +24,33 @@
 #include <string.h>
 #include <assert.h>
 #include <errno.h>
+#include <stddef.h>
+#include <float.h>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define GLM_HAVE_MMAP 1
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+/* GLM_NO_SIMD turns off the SSE and AVX code paths */
+#if defined(__AVX__) && !defined(GLM_NO_SIMD)
+#define GLM_AVX 1
+#include <immintrin.h>
+#elif defined(__SSE__) && !defined(GLM_NO_SIMD)
+#define GLM_SSE 1
+#include <xmmintrin.h>
+#endif
 
 #include "glm.h"
 
 #define T(x) (model->triangles[(x)])
 
 
-/* _GLMnode: general purpose node */
-typedef struct _GLMnode {
-    GLuint index;
-    GLboolean averaged;
-    struct _GLMnode* next;
-} GLMnode;
-
-
 /* glmMax: returns the maximum of two floats */
 static GLfloat
 glmMax(GLfloat a, GLfloat b) 
@@ -121,16 +134,30 @@ glmEqual(GLfloat* u, GLfloat* v, GLfloat epsilon)
     return GL_FALSE;
 }
 
-/* glmWeldVectors: eliminate (weld) vectors that are within an
- * epsilon of each other.
+/* glmEqualN: like glmEqual, for vectors of 2 or 3 components */
+static GLboolean
+glmEqualN(GLfloat* u, GLfloat* v, GLuint size, GLfloat epsilon)
+{
+    GLuint i;
+    
+    for (i = 0; i < size; i++) {
+        if (!(glmAbs(u[i] - v[i]) < epsilon))
+            return GL_FALSE;
+    }
+    return GL_TRUE;
+}
+
+/* glmWeldVectorsBruteForce: eliminate (weld) vectors that are within
+ * an epsilon of each other by comparing every vector against every
+ * vector kept so far.  O(n^2), kept around to compare against.
  *
  * vectors     - array of GLfloat[3]'s to be welded
  * numvectors - number of GLfloat[3]'s in vectors
  * epsilon     - maximum difference between vectors 
  *
  */
-GLfloat*
-glmWeldVectors(GLfloat* vectors, GLuint* numvectors, GLfloat epsilon)
+static GLfloat*
+glmWeldVectorsBruteForce(GLfloat* vectors, GLuint* numvectors, GLfloat epsilon)
 {
     GLfloat* copies;
     GLuint copied;
@@ -141,7 +168,7 @@ glmWeldVectors(GLfloat* vectors, GLuint* numvectors, GLfloat epsilon)
     
     copied = 1;
     for (i = 1; i <= *numvectors; i++) {
-        for (j = 1; j <= copied; j++) {
+        for (j = 1; j < copied; j++) {
             if (glmEqual(&vectors[3 * i], &copies[3 * j], epsilon)) {
                 goto duplicate;
             }
@@ -164,65 +191,293 @@ duplicate:
     return copies;
 }
 
+/* glmWeldCell: grid cell of one component of a vector, cells are
+ * epsilon wide */
+static long long
+glmWeldCell(GLfloat f, GLfloat epsilon)
+{
+    double cell = floor((double)f / epsilon);
+    
+    /* keep far away vectors from overflowing, they only share a cell
+       with each other */
+    if (cell > 1e18)
+        cell = 1e18;
+    if (cell < -1e18)
+        cell = -1e18;
+    return (long long)cell;
+}
+
+/* glmWeldHash: hash of a grid cell */
+static GLuint
+glmWeldHash(long long* cell, GLuint size)
+{
+    static const unsigned long long primes[3] =
+        { 73856093ULL, 19349663ULL, 83492791ULL };
+    unsigned long long h = 0;
+    GLuint i;
+    
+    for (i = 0; i < size; i++)
+        h ^= (unsigned long long)cell[i] * primes[i];
+    return (GLuint)(h ^ (h >> 32));
+}
+
+/* glmWeldArray: eliminate (weld) vectors that are within an epsilon of
+ * each other.  Vectors are hashed into a grid of epsilon sized cells,
+ * so only the vectors in the neighbouring cells have to be compared,
+ * which takes expected linear time.  Each vector is welded to the
+ * first kept vector it matches, which gives the same result as
+ * comparing against every kept vector in turn.
+ *
+ * Returns the array of kept vectors, 1-based like the input.
+ *
+ * vectors    - 1-based array of vectors to be welded
+ * size       - number of components per vector, 2 or 3
+ * numvectors - number of vectors, set to the number kept on return
+ * epsilon    - maximum difference between vectors
+ * remap      - array of numvectors + 1 GLuints, set to the index of
+ *              the kept vector each vector was welded to
+ */
+static GLfloat*
+glmWeldArray(GLfloat* vectors, GLuint size, GLuint* numvectors,
+             GLfloat epsilon, GLuint* remap)
+{
+    GLfloat* copies;
+    GLuint* heads;
+    GLuint* next;
+    GLuint numbuckets;
+    GLuint copied;
+    long long cell[3], neighbour[3];
+    int dx, dy, dz, dzmax;
+    GLuint i, k, match, bucket;
+    
+    assert(size == 2 || size == 3);
+    
+    copies = (GLfloat*)malloc(sizeof(GLfloat) * size * (*numvectors + 1));
+    memcpy(copies, vectors, sizeof(GLfloat) * size);
+    remap[0] = 0;
+    
+    /* nothing is within a non-positive epsilon of anything else */
+    if (epsilon <= 0) {
+        memcpy(copies, vectors, sizeof(GLfloat) * size * (*numvectors + 1));
+        for (i = 1; i <= *numvectors; i++)
+            remap[i] = i;
+        return copies;
+    }
+    
+    numbuckets = 1;
+    while (numbuckets < 2 * *numvectors)
+        numbuckets <<= 1;
+    heads = (GLuint*)calloc(numbuckets, sizeof(GLuint));
+    next = (GLuint*)malloc(sizeof(GLuint) * (*numvectors + 1));
+    
+    dzmax = size == 3 ? 1 : 0;
+    neighbour[2] = cell[2] = 0;
+    copied = 0;
+    for (i = 1; i <= *numvectors; i++) {
+        GLfloat* v = &vectors[size * i];
+        
+        for (k = 0; k < size; k++)
+            cell[k] = glmWeldCell(v[k], epsilon);
+        
+        /* anything within epsilon is in this cell or a neighbour */
+        match = 0;
+        for (dz = -dzmax; dz <= dzmax; dz++) {
+            for (dy = -1; dy <= 1; dy++) {
+                for (dx = -1; dx <= 1; dx++) {
+                    neighbour[0] = cell[0] + dx;
+                    neighbour[1] = cell[1] + dy;
+                    neighbour[2] = cell[2] + dz;
+                    bucket = glmWeldHash(neighbour, size) & (numbuckets - 1);
+                    for (k = heads[bucket]; k; k = next[k]) {
+                        if ((!match || k < match) &&
+                            glmEqualN(v, &copies[size * k], size, epsilon))
+                            match = k;
+                    }
+                }
+            }
+        }
+        
+        /* must not be any duplicates -- add to the copies array */
+        if (!match) {
+            match = ++copied;
+            memcpy(&copies[size * copied], v, sizeof(GLfloat) * size);
+            bucket = glmWeldHash(cell, size) & (numbuckets - 1);
+            next[copied] = heads[bucket];
+            heads[bucket] = copied;
+        }
+        remap[i] = match;
+    }
+    
+    free(heads);
+    free(next);
+    
+    *numvectors = copied;
+    return copies;
+}
+
+/* glmWeldVectors: eliminate (weld) vectors that are within an
+ * epsilon of each other.
+ *
+ * vectors     - array of GLfloat[3]'s to be welded
+ * numvectors - number of GLfloat[3]'s in vectors
+ * epsilon     - maximum difference between vectors 
+ *
+ */
+GLfloat*
+glmWeldVectors(GLfloat* vectors, GLuint* numvectors, GLfloat epsilon)
+{
+    GLfloat* copies;
+    GLuint* remap;
+    GLuint n = *numvectors;
+    GLuint i;
+    
+    remap = (GLuint*)malloc(sizeof(GLuint) * (n + 1));
+    copies = glmWeldArray(vectors, 3, numvectors, epsilon, remap);
+    
+    /* set the first component of each vector to point at the correct
+       index into the new copies array */
+    for (i = 1; i <= n; i++)
+        vectors[3 * i + 0] = (GLfloat)remap[i];
+    
+    free(remap);
+    return copies;
+}
+
+static GLvoid* glmGrow(GLvoid* array, GLuint* capacity, GLuint needed, size_t size);
+
+/* glmHashName: FNV-1a hash of a name */
+static GLuint
+glmHashName(const char* name)
+{
+    GLuint hash = 2166136261u;
+    
+    while (*name) {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/* glmLookupName: index held for a name, or GLM_NO_NAME if the table
+ * doesn't have it */
+#define GLM_NO_NAME (~0u)
+static GLuint
+glmLookupName(const GLMnametable* table, const char* name, GLuint hash)
+{
+    GLuint i;
+    
+    if (!table->size)
+        return GLM_NO_NAME;
+    
+    for (i = hash & (table->size - 1); table->slots[i].name;
+         i = (i + 1) & (table->size - 1)) {
+        if (table->slots[i].hash == hash && !strcmp(table->slots[i].name, name))
+            return table->slots[i].index;
+    }
+    return GLM_NO_NAME;
+}
+
+/* glmInsertName: add a name the table doesn't have yet, doubling the
+ * table when it is half full */
+static GLvoid
+glmInsertName(GLMnametable* table, const char* name, GLuint hash, GLuint index)
+{
+    GLMname* old = table->slots;
+    GLuint oldsize = table->size;
+    GLuint i;
+    
+    if (2 * (table->count + 1) > table->size) {
+        table->size = table->size ? 2 * table->size : 64;
+        table->slots = (GLMname*)calloc(table->size, sizeof(GLMname));
+        table->count = 0;
+        for (i = 0; i < oldsize; i++) {
+            if (old[i].name)
+                glmInsertName(table, old[i].name, old[i].hash, old[i].index);
+        }
+        free(old);
+    }
+    
+    for (i = hash & (table->size - 1); table->slots[i].name;
+         i = (i + 1) & (table->size - 1))
+        ;
+    table->slots[i].name = name;
+    table->slots[i].hash = hash;
+    table->slots[i].index = index;
+    table->count++;
+}
+
+/* glmFreeNames: empty a name table */
+static GLvoid
+glmFreeNames(GLMnametable* table)
+{
+    free(table->slots);
+    table->slots = NULL;
+    table->size = table->count = 0;
+}
+
 /* glmFindGroup: Find a group in the model */
 GLMgroup*
 glmFindGroup(GLMmodel* model, const char* name)
 {
-    GLMgroup* group;
+    GLuint i;
     
     assert(model);
     
-    group = model->groups;
-    while(group) {
-        if (!strcmp(name, group->name))
-            break;
-        group = group->next;
-    }
-    
-    return group;
+    i = glmLookupName(&model->groupnames, name, glmHashName(name));
+    return i == GLM_NO_NAME ? NULL : &model->grouppool[i];
 }
 
-/* glmAddGroup: Add a group to the model */
+/* glmAddGroup: Add a group to the model.  The groups live in one
+ * array, so adding a group may move the others: a group pointer is
+ * only good until the next call. */
 GLMgroup*
 glmAddGroup(GLMmodel* model, const char* name)
 {
     GLMgroup* group;
-    
-    group = glmFindGroup(model, name);
-    if (!group) {
-        group = (GLMgroup*)malloc(sizeof(GLMgroup));
-        group->name = strdup(name);
-        group->material = 0;
-        group->numtriangles = 0;
-        group->triangles = NULL;
-        group->next = model->groups;
-        model->groups = group;
-        model->numgroups++;
-    }
+    GLMgroup* pool;
+    GLuint hash, i;
+    
+    hash = glmHashName(name);
+    i = glmLookupName(&model->groupnames, name, hash);
+    if (i != GLM_NO_NAME)
+        return &model->grouppool[i];
+    
+    /* relink the list if the array moved */
+    pool = model->grouppool;
+    model->grouppool = (GLMgroup*)glmGrow(model->grouppool, &model->maxgroups,
+        model->numgroups + 1, sizeof(GLMgroup));
+    if (model->grouppool != pool) {
+        for (i = 0; i < model->numgroups; i++)
+            model->grouppool[i].next = i ? &model->grouppool[i - 1] : NULL;
+    }
+    
+    group = &model->grouppool[model->numgroups];
+    group->name = strdup(name);
+    group->material = 0;
+    group->numtriangles = 0;
+    group->triangles = NULL;
+    group->next = model->numgroups ? &model->grouppool[model->numgroups - 1] : NULL;
+    glmInsertName(&model->groupnames, group->name, hash, model->numgroups);
+    model->groups = group;
+    model->numgroups++;
     
     return group;
 }
 
-/* glmFindGroup: Find a material in the model */
+/* glmFindMaterial: Find a material in the model */
 GLuint
 glmFindMaterial(GLMmodel* model, char* name)
 {
     GLuint i;
     
-    /* XXX doing a linear search on a string key'd list is pretty lame,
-    but it works and is fast enough for now. */
-    for (i = 0; i < model->nummaterials; i++) {
-        if (!strcmp(model->materials[i].name, name))
-            goto found;
-    }
+    i = glmLookupName(&model->materialnames, name, glmHashName(name));
+    if (i != GLM_NO_NAME)
+        return i;
     
     /* didn't find the name, so print a warning and return the default
     material (0). */
     printf("glmFindMaterial():  can't find material \"%s\".\n", name);
-    i = 0;
-    
-found:
-    return i;
+    return 0;
 }
 
 
@@ -376,6 +631,18 @@ glmReadMTL(GLMmodel* model, char* name)
     }
 
     fclose(file);
+    
+    /* index the names, the first of a repeated name wins */
+    glmFreeNames(&model->materialnames);
+    for (i = 0; i < model->nummaterials; i++) {
+        const char* material = model->materials[i].name;
+        GLuint hash;
+        if (!material)
+            continue;
+        hash = glmHashName(material);
+        if (glmLookupName(&model->materialnames, material, hash) == GLM_NO_NAME)
+            glmInsertName(&model->materialnames, material, hash, i);
+    }
 }
 
 /* glmWriteMTL: write a wavefront material library file
@@ -768,187 +1035,1325 @@ glmSecondPass(GLMmodel* model, FILE* file)
 }
 
 
-/* public functions */
-
+/* GLMfile: the contents of a file, either mapped into memory or read
+ * into a malloc()'d buffer on platforms without mmap().
+ */
+typedef struct _GLMfile {
+    const char* data;           /* first byte of the file */
+    size_t      size;           /* size of the file in bytes */
+    GLboolean   mapped;         /* GL_TRUE if data was mmap()'d */
+} GLMfile;
 
-/* glmUnitize: "unitize" a model by translating it to the origin and
- * scaling it to fit in a unit cube around the origin.   Returns the
- * scalefactor used.
+/* glmMapFile: map a file into memory.  Returns GL_FALSE if the file
+ * could not be opened.
  *
- * model - properly initialized GLMmodel structure 
+ * filename - name of the file
+ * file     - GLMfile structure to fill in
  */
-GLfloat
-glmUnitize(GLMmodel* model)
+static GLboolean
+glmMapFile(const char* filename, GLMfile* file)
 {
-    GLuint i;
-    GLfloat maxx, minx, maxy, miny, maxz, minz;
-    GLfloat cx, cy, cz, w, h, d;
-    GLfloat scale;
-    
-    assert(model);
-    assert(model->vertices);
-    
-    /* get the max/mins */
-    maxx = minx = model->vertices[3 + 0];
-    maxy = miny = model->vertices[3 + 1];
-    maxz = minz = model->vertices[3 + 2];
-    for (i = 1; i <= model->numvertices; i++) {
-        if (maxx < model->vertices[3 * i + 0])
-            maxx = model->vertices[3 * i + 0];
-        if (minx > model->vertices[3 * i + 0])
-            minx = model->vertices[3 * i + 0];
-        
-        if (maxy < model->vertices[3 * i + 1])
-            maxy = model->vertices[3 * i + 1];
-        if (miny > model->vertices[3 * i + 1])
-            miny = model->vertices[3 * i + 1];
-        
-        if (maxz < model->vertices[3 * i + 2])
-            maxz = model->vertices[3 * i + 2];
-        if (minz > model->vertices[3 * i + 2])
-            minz = model->vertices[3 * i + 2];
+#if GLM_HAVE_MMAP
+    struct stat st;
+    void* data;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return GL_FALSE;
+    if (fstat(fd, &st) < 0) {
+        close(fd);
+        return GL_FALSE;
     }
-    
-    /* calculate model width, height, and depth */
-    w = glmAbs(maxx) + glmAbs(minx);
-    h = glmAbs(maxy) + glmAbs(miny);
-    d = glmAbs(maxz) + glmAbs(minz);
-    
-    /* calculate center of the model */
-    cx = (maxx + minx) / 2.0f;
-    cy = (maxy + miny) / 2.0f;
-    cz = (maxz + minz) / 2.0f;
-    
-    /* calculate unitizing scale factor */
-    scale = 2.0f / glmMax(glmMax(w, h), d);
-    
-    /* translate around center then scale */
-    for (i = 1; i <= model->numvertices; i++) {
-        model->vertices[3 * i + 0] -= cx;
-        model->vertices[3 * i + 1] -= cy;
-        model->vertices[3 * i + 2] -= cz;
-        model->vertices[3 * i + 0] *= scale;
-        model->vertices[3 * i + 1] *= scale;
-        model->vertices[3 * i + 2] *= scale;
+
+    file->data = NULL;
+    file->size = (size_t)st.st_size;
+    file->mapped = GL_FALSE;
+
+    /* mmap() refuses zero length mappings */
+    if (file->size > 0) {
+        data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            return GL_FALSE;
+        }
+#ifdef MADV_SEQUENTIAL
+        madvise(data, file->size, MADV_SEQUENTIAL);
+#endif
+        file->data = (const char*)data;
+        file->mapped = GL_TRUE;
     }
-    
-    return scale;
+
+    /* the mapping stays valid after the descriptor is closed */
+    close(fd);
+    return GL_TRUE;
+#else
+    FILE* fp;
+    char* data;
+    long size;
+
+    fp = fopen(filename, "rb");
+    if (!fp)
+        return GL_FALSE;
+
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fseek(fp, 0, SEEK_SET);
+
+    data = (char*)malloc(size > 0 ? size : 1);
+    file->size = fread(data, 1, size, fp);
+    file->data = data;
+    file->mapped = GL_FALSE;
+    fclose(fp);
+    return GL_TRUE;
+#endif
 }
 
-/* glmDimensions: Calculates the dimensions (width, height, depth) of
- * a model.
+/* glmUnmapFile: release the memory held by glmMapFile()
  *
- * model   - initialized GLMmodel structure
- * dimensions - array of 3 GLfloats (GLfloat dimensions[3])
+ * file - GLMfile structure filled in by glmMapFile()
  */
-GLvoid
-glmDimensions(GLMmodel* model, GLfloat* dimensions)
+static GLvoid
+glmUnmapFile(GLMfile* file)
 {
-    GLuint i;
-    GLfloat maxx, minx, maxy, miny, maxz, minz;
-    
-    assert(model);
-    assert(model->vertices);
-    assert(dimensions);
-    
-    /* get the max/mins */
-    maxx = minx = model->vertices[3 + 0];
-    maxy = miny = model->vertices[3 + 1];
-    maxz = minz = model->vertices[3 + 2];
-    for (i = 1; i <= model->numvertices; i++) {
-        if (maxx < model->vertices[3 * i + 0])
-            maxx = model->vertices[3 * i + 0];
-        if (minx > model->vertices[3 * i + 0])
-            minx = model->vertices[3 * i + 0];
-        
-        if (maxy < model->vertices[3 * i + 1])
-            maxy = model->vertices[3 * i + 1];
-        if (miny > model->vertices[3 * i + 1])
-            miny = model->vertices[3 * i + 1];
-        
-        if (maxz < model->vertices[3 * i + 2])
-            maxz = model->vertices[3 * i + 2];
-        if (minz > model->vertices[3 * i + 2])
-            minz = model->vertices[3 * i + 2];
-    }
-    
-    /* calculate model width, height, and depth */
-    dimensions[0] = glmAbs(maxx) + glmAbs(minx);
-    dimensions[1] = glmAbs(maxy) + glmAbs(miny);
-    dimensions[2] = glmAbs(maxz) + glmAbs(minz);
+#if GLM_HAVE_MMAP
+    if (file->mapped)
+        munmap((void*)file->data, file->size);
+#else
+    free((void*)file->data);
+#endif
+    file->data = NULL;
+    file->size = 0;
 }
 
-/* glmScale: Scales a model by a given amount.
- * 
- * model - properly initialized GLMmodel structure
- * scale - scalefactor (0.5 = half as large, 2.0 = twice as large)
+/* glmGrow: make sure an array has room for at least needed elements,
+ * doubling its capacity as required.  Returns the (possibly moved)
+ * array.
+ *
+ * array    - array to grow, may be NULL
+ * capacity - number of elements the array has room for, updated
+ * needed   - number of elements required
+ * size     - size of one element in bytes
  */
-GLvoid
-glmScale(GLMmodel* model, GLfloat scale)
+static GLvoid*
+glmGrow(GLvoid* array, GLuint* capacity, GLuint needed, size_t size)
 {
-    GLuint i;
-    
-    for (i = 1; i <= model->numvertices; i++) {
-        model->vertices[3 * i + 0] *= scale;
-        model->vertices[3 * i + 1] *= scale;
-        model->vertices[3 * i + 2] *= scale;
+    GLuint newcapacity;
+
+    if (needed <= *capacity)
+        return array;
+
+    newcapacity = *capacity ? *capacity : 64;
+    while (newcapacity < needed)
+        newcapacity *= 2;
+
+    array = realloc(array, size * newcapacity);
+    if (!array) {
+        fprintf(stderr, "glmGrow() failed: out of memory.\n");
+        exit(1);
     }
+    *capacity = newcapacity;
+    return array;
 }
 
-/* glmReverseWinding: Reverse the polygon winding for all polygons in
- * this model.   Default winding is counter-clockwise.  Also changes
- * the direction of the normals.
- * 
- * model - properly initialized GLMmodel structure 
- */
-GLvoid
-glmReverseWinding(GLMmodel* model)
+/* glmSkipBlanks: skip spaces and tabs, stopping at the end of a line */
+static const char*
+glmSkipBlanks(const char* p, const char* end)
 {
-    GLuint i, swap;
-    
-    assert(model);
-    
-    for (i = 0; i < model->numtriangles; i++) {
-        swap = T(i).vindices[0];
-        T(i).vindices[0] = T(i).vindices[2];
-        T(i).vindices[2] = swap;
-        
-        if (model->numnormals) {
-            swap = T(i).nindices[0];
-            T(i).nindices[0] = T(i).nindices[2];
-            T(i).nindices[2] = swap;
-        }
-        
-        if (model->numtexcoords) {
-            swap = T(i).tindices[0];
-            T(i).tindices[0] = T(i).tindices[2];
-            T(i).tindices[2] = swap;
-        }
-    }
-    
-    /* reverse facet normals */
-    for (i = 1; i <= model->numfacetnorms; i++) {
-        model->facetnorms[3 * i + 0] = -model->facetnorms[3 * i + 0];
-        model->facetnorms[3 * i + 1] = -model->facetnorms[3 * i + 1];
-        model->facetnorms[3 * i + 2] = -model->facetnorms[3 * i + 2];
-    }
-    
-    /* reverse vertex normals */
-    for (i = 1; i <= model->numnormals; i++) {
-        model->normals[3 * i + 0] = -model->normals[3 * i + 0];
-        model->normals[3 * i + 1] = -model->normals[3 * i + 1];
-        model->normals[3 * i + 2] = -model->normals[3 * i + 2];
-    }
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+        p++;
+    return p;
 }
 
-/* glmFacetNormals: Generates facet normals for a model (by taking the
- * cross product of the two vectors derived from the sides of each
- * triangle).  Assumes a counter-clockwise winding.
- *
- * model - initialized GLMmodel structure
- */
-GLvoid
-glmFacetNormals(GLMmodel* model)
+/* glmSkipLine: skip past the end of the current line */
+static const char*
+glmSkipLine(const char* p, const char* end)
+{
+    const char* newline;
+
+    newline = (const char*)memchr(p, '\n', end - p);
+    return newline ? newline + 1 : end;
+}
+
+/* glmParseWord: copy the next whitespace delimited word into buf.
+ * Words longer than the buffer are truncated.
+ */
+static const char*
+glmParseWord(const char* p, const char* end, char* buf, size_t size)
+{
+    size_t n = 0;
+
+    p = glmSkipBlanks(p, end);
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n') {
+        if (n + 1 < size)
+            buf[n++] = *p;
+        p++;
+    }
+    buf[n] = '\0';
+    return p;
+}
+
+/* glmParseName: copy the rest of the line into buf, without leading
+ * or trailing blanks.  Names longer than the buffer are truncated.
+ */
+static const char*
+glmParseName(const char* p, const char* end, char* buf, size_t size)
+{
+    const char* eol;
+    size_t n;
+
+    p = glmSkipBlanks(p, end);
+    eol = (const char*)memchr(p, '\n', end - p);
+    if (!eol)
+        eol = end;
+
+    n = eol - p;
+    while (n > 0 && (p[n-1] == ' ' || p[n-1] == '\t' || p[n-1] == '\r'))
+        n--;
+    if (n >= size)
+        n = size - 1;
+    memcpy(buf, p, n);
+    buf[n] = '\0';
+
+    return eol;
+}
+
+/* glmParseInt: parse a signed decimal integer.  Returns NULL if there
+ * are no digits at p.
+ */
+static const char*
+glmParseInt(const char* p, const char* end, int* value)
+{
+    int negative = 0;
+    int v = 0;
+    const char* start;
+
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = (*p == '-');
+        p++;
+    }
+
+    start = p;
+    while (p < end && (unsigned)(*p - '0') < 10) {
+        v = v * 10 + (*p - '0');
+        p++;
+    }
+    if (p == start)
+        return NULL;
+
+    *value = negative ? -v : v;
+    return p;
+}
+
+/* powers of ten that are exactly representable as doubles */
+static const double glmPow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+/* glmParseFloat: parse a floating point number of the form
+ * [+-]digits[.digits][(e|E)[+-]digits].  Anything else (nan, inf,
+ * hex floats) is handed off to strtod().  Leading blanks are skipped.
+ */
+static const char*
+glmParseFloat(const char* p, const char* end, GLfloat* value)
+{
+    unsigned long long mantissa = 0;
+    int exponent = 0;
+    int digits = 0;
+    int seen = 0;
+    int negative = 0;
+    int e;
+    double v;
+    const char* start;
+
+    p = glmSkipBlanks(p, end);
+    start = p;
+
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = (*p == '-');
+        p++;
+    }
+
+    /* only the first 19 significant digits fit in the mantissa, the
+       rest just shift the exponent */
+    for (; p < end && (unsigned)(*p - '0') < 10; p++, seen = 1) {
+        if (digits < 19) {
+            mantissa = mantissa * 10 + (*p - '0');
+            if (mantissa)
+                digits++;
+        } else {
+            exponent++;
+        }
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && (unsigned)(*p - '0') < 10; p++, seen = 1) {
+            if (digits < 19) {
+                mantissa = mantissa * 10 + (*p - '0');
+                if (mantissa)
+                    digits++;
+                exponent--;
+            }
+        }
+    }
+
+    if (!seen) {
+        char buf[64];
+        char* stop;
+        size_t n = 0;
+
+        while (start + n < end && n + 1 < sizeof(buf) &&
+               start[n] != ' ' && start[n] != '\t' &&
+               start[n] != '\r' && start[n] != '\n') {
+            buf[n] = start[n];
+            n++;
+        }
+        buf[n] = '\0';
+        *value = (GLfloat)strtod(buf, &stop);
+        return start + (stop - buf);
+    }
+
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char* q = glmParseInt(p + 1, end, &e);
+        if (q) {
+            exponent += e;
+            p = q;
+        }
+    }
+
+    v = (double)mantissa;
+    if (exponent < 0) {
+        if (exponent >= -22)
+            v /= glmPow10[-exponent];
+        else
+            v /= pow(10.0, -exponent);
+    } else if (exponent > 0) {
+        if (exponent <= 22)
+            v *= glmPow10[exponent];
+        else
+            v *= pow(10.0, exponent);
+    }
+
+    *value = (GLfloat)(negative ? -v : v);
+    return p;
+}
+
+/* GLMcorner: one v/t/n reference of a face */
+typedef struct _GLMcorner {
+    GLuint v, t, n;
+    GLuint relative;            /* GLM_RELATIVE_* bits of negative indices */
+} GLMcorner;
+
+#define GLM_RELATIVE_V (1 << 0)
+#define GLM_RELATIVE_T (1 << 1)
+#define GLM_RELATIVE_N (1 << 2)
+
+/* glmParseCorner: parse a face vertex of the form v, v/t, v//n or
+ * v/t/n.  Negative (relative) indices are resolved against the number
+ * of vertices, texcoords and normals read so far and flagged in
+ * corner->relative.  Returns NULL if there is no vertex index at p.
+ */
+static const char*
+glmParseCorner(const char* p, const char* end, GLMcorner* corner,
+               GLuint numvertices, GLuint numtexcoords, GLuint numnormals)
+{
+    int v, t = 0, n = 0;
+
+    p = glmParseInt(p, end, &v);
+    if (!p)
+        return NULL;
+
+    if (p < end && *p == '/') {
+        p++;
+        if (p < end && *p != '/') {
+            const char* q = glmParseInt(p, end, &t);
+            if (q)
+                p = q;
+        }
+        if (p < end && *p == '/') {
+            const char* q = glmParseInt(p + 1, end, &n);
+            p = q ? q : p + 1;
+        }
+    }
+
+    corner->relative = 0;
+    if (v < 0) corner->relative |= GLM_RELATIVE_V;
+    if (t < 0) corner->relative |= GLM_RELATIVE_T;
+    if (n < 0) corner->relative |= GLM_RELATIVE_N;
+
+    corner->v = (GLuint)(v < 0 ? v + (int)numvertices : v);
+    corner->t = (GLuint)(t < 0 ? t + (int)numtexcoords : t);
+    corner->n = (GLuint)(n < 0 ? n + (int)numnormals : n);
+
+    return p;
+}
+
+/* GLMevent: a group, usemtl or mtllib statement seen while parsing a
+ * chunk of a file.  They need the model's group and material lists,
+ * so they are replayed in file order when the chunks are merged.
+ */
+#define GLM_EVENT_GROUP    0
+#define GLM_EVENT_MATERIAL 1
+#define GLM_EVENT_MTLLIB   2
+
+typedef struct _GLMevent {
+    GLuint type;                /* one of GLM_EVENT_* */
+    GLuint triangle;            /* triangles in the chunk before the event */
+    char*  name;                /* group, material or library name */
+} GLMevent;
+
+/* GLMfixup: a triangle index that was relative (negative) in the file.
+ * Chunks resolve these against their own counts, so the number of
+ * vectors in all preceding chunks has to be added when merging.
+ */
+typedef struct _GLMfixup {
+    GLuint triangle;            /* triangle in the chunk */
+    GLuint slot;                /* 0-2 vindices, 3-5 nindices, 6-8 tindices */
+} GLMfixup;
+
+/* GLMchunk: the data read from a range of lines of an OBJ file.
+ * Arrays are 1-based like those in GLMmodel so that a single chunk
+ * can be handed over to the model without copying.
+ */
+typedef struct _GLMchunk {
+    const char*  begin;         /* first byte of the chunk */
+    const char*  end;           /* one past the last byte of the chunk */
+
+    GLuint       numvertices, maxvertices;
+    GLfloat*     vertices;
+    GLuint       numnormals, maxnormals;
+    GLfloat*     normals;
+    GLuint       numtexcoords, maxtexcoords;
+    GLfloat*     texcoords;
+    GLuint       numtriangles, maxtriangles;
+    GLMtriangle* triangles;
+
+    GLuint       numfixups, maxfixups;
+    GLMfixup*    fixups;
+    GLuint       numevents, maxevents;
+    GLMevent*    events;
+} GLMchunk;
+
+/* GLMspan: a run of consecutive triangles that belong to one group */
+typedef struct _GLMspan {
+    GLuint    group;        /* index of the group in grouppool */
+    GLuint    first;
+    GLuint    count;
+} GLMspan;
+
+/* smallest chunk worth handing to a thread */
+#ifndef GLM_MIN_CHUNK
+#define GLM_MIN_CHUNK (1 << 20)
+#endif
+
+/* glmTriangleIndex: index slot of a triangle, as used by GLMfixup */
+static GLuint*
+glmTriangleIndex(GLMtriangle* triangle, GLuint slot)
+{
+    if (slot < 3)
+        return &triangle->vindices[slot];
+    if (slot < 6)
+        return &triangle->nindices[slot - 3];
+    return &triangle->tindices[slot - 6];
+}
+
+/* glmAddFixups: remember the relative indices of a triangle corner */
+static GLvoid
+glmAddFixups(GLMchunk* chunk, GLMcorner* corner, GLuint k)
+{
+    GLuint slots[3];
+    GLuint n = 0, i;
+
+    if (corner->relative & GLM_RELATIVE_V) slots[n++] = k;
+    if (corner->relative & GLM_RELATIVE_N) slots[n++] = 3 + k;
+    if (corner->relative & GLM_RELATIVE_T) slots[n++] = 6 + k;
+
+    chunk->fixups = (GLMfixup*)glmGrow(chunk->fixups, &chunk->maxfixups,
+        chunk->numfixups + n, sizeof(GLMfixup));
+    for (i = 0; i < n; i++) {
+        chunk->fixups[chunk->numfixups].triangle = chunk->numtriangles;
+        chunk->fixups[chunk->numfixups].slot = slots[i];
+        chunk->numfixups++;
+    }
+}
+
+/* glmAddEvent: remember a group, usemtl or mtllib statement */
+static GLvoid
+glmAddEvent(GLMchunk* chunk, GLuint type, const char* name)
+{
+    chunk->events = (GLMevent*)glmGrow(chunk->events, &chunk->maxevents,
+        chunk->numevents + 1, sizeof(GLMevent));
+    chunk->events[chunk->numevents].type = type;
+    chunk->events[chunk->numevents].triangle = chunk->numtriangles;
+    chunk->events[chunk->numevents].name = strdup(name);
+    chunk->numevents++;
+}
+
+/* glmParseChunk: single pass over a range of lines of a Wavefront OBJ
+ * file held in memory.  Vertex, normal, texcoord and triangle arrays
+ * are grown as needed.  Only touches the chunk, so chunks can be
+ * parsed concurrently.
+ *
+ * chunk - chunk with begin and end set, everything else zeroed
+ */
+static GLvoid
+glmParseChunk(GLMchunk* chunk)
+{
+    const char* p = chunk->begin;
+    const char* end = chunk->end;
+    GLMcorner first = { 0 }, prev = { 0 }, cur;
+    GLMtriangle* triangle;
+    GLuint corners;
+    char buf[256];
+
+    /* element 0 of the vector arrays is unused, as in GLMmodel */
+    chunk->numvertices = chunk->numnormals = chunk->numtexcoords = 1;
+
+    /* guess at the array sizes from the size of the chunk, a vertex
+       line is rarely shorter than 24 bytes */
+    chunk->vertices = (GLfloat*)glmGrow(chunk->vertices, &chunk->maxvertices,
+        (GLuint)((end - p) / 24) + 1, 3 * sizeof(GLfloat));
+
+    while (p < end) {
+        p = glmSkipBlanks(p, end);
+        if (p >= end)
+            break;
+
+        switch (*p) {
+        case 'v':               /* v, vn, vt */
+            if (p + 1 < end && (p[1] == ' ' || p[1] == '\t')) {
+                GLfloat* v;
+                if (chunk->numvertices >= chunk->maxvertices)
+                    chunk->vertices = (GLfloat*)glmGrow(chunk->vertices,
+                        &chunk->maxvertices, chunk->numvertices + 1,
+                        3 * sizeof(GLfloat));
+                v = &chunk->vertices[3 * chunk->numvertices++];
+                p = glmParseFloat(p + 1, end, &v[0]);
+                p = glmParseFloat(p, end, &v[1]);
+                p = glmParseFloat(p, end, &v[2]);
+            } else if (p + 1 < end && p[1] == 'n') {
+                GLfloat* n;
+                if (chunk->numnormals >= chunk->maxnormals)
+                    chunk->normals = (GLfloat*)glmGrow(chunk->normals,
+                        &chunk->maxnormals, chunk->numnormals + 1,
+                        3 * sizeof(GLfloat));
+                n = &chunk->normals[3 * chunk->numnormals++];
+                p = glmParseFloat(p + 2, end, &n[0]);
+                p = glmParseFloat(p, end, &n[1]);
+                p = glmParseFloat(p, end, &n[2]);
+            } else if (p + 1 < end && p[1] == 't') {
+                GLfloat* t;
+                if (chunk->numtexcoords >= chunk->maxtexcoords)
+                    chunk->texcoords = (GLfloat*)glmGrow(chunk->texcoords,
+                        &chunk->maxtexcoords, chunk->numtexcoords + 1,
+                        2 * sizeof(GLfloat));
+                t = &chunk->texcoords[2 * chunk->numtexcoords++];
+                p = glmParseFloat(p + 2, end, &t[0]);
+                p = glmParseFloat(p, end, &t[1]);
+            }
+            break;
+
+        case 'f':               /* face */
+            p++;
+            corners = 0;
+            for (;;) {
+                const char* q;
+
+                p = glmSkipBlanks(p, end);
+                q = glmParseCorner(p, end, &cur, chunk->numvertices,
+                    chunk->numtexcoords, chunk->numnormals);
+                if (!q)
+                    break;
+                p = q;
+
+                if (corners == 0) {
+                    first = cur;
+                } else if (corners >= 2) {
+                    /* triangulate the polygon as a fan around the
+                       first vertex */
+                    if (chunk->numtriangles >= chunk->maxtriangles)
+                        chunk->triangles = (GLMtriangle*)glmGrow(
+                            chunk->triangles, &chunk->maxtriangles,
+                            chunk->numtriangles + 1, sizeof(GLMtriangle));
+
+                    if (first.relative | prev.relative | cur.relative) {
+                        glmAddFixups(chunk, &first, 0);
+                        glmAddFixups(chunk, &prev, 1);
+                        glmAddFixups(chunk, &cur, 2);
+                    }
+
+                    triangle = &chunk->triangles[chunk->numtriangles++];
+                    triangle->vindices[0] = first.v;
+                    triangle->tindices[0] = first.t;
+                    triangle->nindices[0] = first.n;
+                    triangle->vindices[1] = prev.v;
+                    triangle->tindices[1] = prev.t;
+                    triangle->nindices[1] = prev.n;
+                    triangle->vindices[2] = cur.v;
+                    triangle->tindices[2] = cur.t;
+                    triangle->nindices[2] = cur.n;
+                    triangle->findex = 0;
+                }
+                prev = cur;
+                corners++;
+            }
+            break;
+
+        case 'm':               /* mtllib */
+            p = glmParseWord(p, end, buf, sizeof(buf));
+            if (!strcmp(buf, "mtllib")) {
+                p = glmParseWord(p, end, buf, sizeof(buf));
+                glmAddEvent(chunk, GLM_EVENT_MTLLIB, buf);
+            }
+            break;
+
+        case 'u':               /* usemtl */
+            p = glmParseWord(p, end, buf, sizeof(buf));
+            if (!strcmp(buf, "usemtl")) {
+                p = glmParseWord(p, end, buf, sizeof(buf));
+                glmAddEvent(chunk, GLM_EVENT_MATERIAL, buf);
+            }
+            break;
+
+        case 'g':               /* group */
+            p = glmParseName(p + 1, end, buf, sizeof(buf));
+            glmAddEvent(chunk, GLM_EVENT_GROUP, buf);
+            break;
+
+        default:
+            /* comments and anything we don't understand */
+            break;
+        }
+
+        p = glmSkipLine(p, end);
+    }
+
+    /* don't count the unused element 0 */
+    chunk->numvertices--;
+    chunk->numnormals--;
+    chunk->numtexcoords--;
+}
+
+/* glmSplitChunks: split a file into chunks at line boundaries
+ *
+ * chunks    - array of numchunks zeroed chunks
+ * numchunks - number of chunks to split into
+ * begin     - first byte of the file
+ * end       - one past the last byte of the file
+ */
+static GLvoid
+glmSplitChunks(GLMchunk* chunks, GLuint numchunks,
+               const char* begin, const char* end)
+{
+    const char* p = begin;
+    GLuint i;
+
+    for (i = 0; i < numchunks; i++) {
+        chunks[i].begin = p;
+        if (i + 1 == numchunks) {
+            p = end;
+        } else {
+            const char* split = begin + (end - begin) / numchunks * (i + 1);
+            if (split > p)
+                p = glmSkipLine(split, end);
+        }
+        chunks[i].end = p;
+    }
+}
+
+/* glmAddSpan: remember that count triangles starting at first belong
+ * to group */
+static GLvoid
+glmAddSpan(GLMspan** spans, GLuint* numspans, GLuint* maxspans,
+           GLuint group, GLuint first, GLuint count)
+{
+    if (count == 0)
+        return;
+    *spans = (GLMspan*)glmGrow(*spans, maxspans, *numspans + 1, sizeof(GLMspan));
+    (*spans)[*numspans].group = group;
+    (*spans)[*numspans].first = first;
+    (*spans)[*numspans].count = count;
+    (*numspans)++;
+}
+
+/* glmMergeChunks: move the data from parsed chunks into a model.
+ * Vectors and triangles are copied in parallel at offsets given by a
+ * prefix sum over the chunk sizes, relative indices are fixed up, then
+ * group, usemtl and mtllib statements are replayed in file order.
+ *
+ * model     - properly initialized GLMmodel structure
+ * chunks    - parsed chunks, freed on return
+ * numchunks - number of chunks
+ * numthreads - number of threads to copy with
+ */
+static GLvoid
+glmMergeChunks(GLMmodel* model, GLMchunk* chunks, GLuint numchunks,
+               GLuint numthreads)
+{
+    GLuint* vbase;
+    GLuint* nbase;
+    GLuint* tbase;
+    GLuint* tribase;
+    GLMspan* spans = NULL;
+    GLuint numspans = 0, maxspans = 0;
+    GLMgroup* group;
+    GLuint material;
+    GLuint c, e, i, pos;
+
+    /* where each chunk's data starts in the model's arrays */
+    vbase   = (GLuint*)malloc(sizeof(GLuint) * 4 * numchunks);
+    nbase   = vbase + numchunks;
+    tbase   = nbase + numchunks;
+    tribase = tbase + numchunks;
+
+    model->numvertices = model->numnormals = model->numtexcoords = 0;
+    model->numtriangles = 0;
+    for (c = 0; c < numchunks; c++) {
+        vbase[c]   = model->numvertices;
+        nbase[c]   = model->numnormals;
+        tbase[c]   = model->numtexcoords;
+        tribase[c] = model->numtriangles;
+        model->numvertices  += chunks[c].numvertices;
+        model->numnormals   += chunks[c].numnormals;
+        model->numtexcoords += chunks[c].numtexcoords;
+        model->numtriangles += chunks[c].numtriangles;
+    }
+
+    if (numchunks == 1) {
+        /* nothing to move, just hand the arrays over */
+        model->vertices = (GLfloat*)realloc(chunks[0].vertices,
+            sizeof(GLfloat) * 3 * (model->numvertices + 1));
+        model->normals = chunks[0].normals;
+        model->texcoords = chunks[0].texcoords;
+        model->triangles = chunks[0].triangles;
+        if (model->normals)
+            model->normals = (GLfloat*)realloc(model->normals,
+                sizeof(GLfloat) * 3 * (model->numnormals + 1));
+        if (model->texcoords)
+            model->texcoords = (GLfloat*)realloc(model->texcoords,
+                sizeof(GLfloat) * 2 * (model->numtexcoords + 1));
+        model->triangles = (GLMtriangle*)realloc(model->triangles,
+            sizeof(GLMtriangle) * (model->numtriangles ? model->numtriangles : 1));
+        chunks[0].vertices = chunks[0].normals = chunks[0].texcoords = NULL;
+        chunks[0].triangles = NULL;
+    } else {
+        model->vertices = (GLfloat*)malloc(sizeof(GLfloat) *
+            3 * (model->numvertices + 1));
+        if (model->numnormals)
+            model->normals = (GLfloat*)malloc(sizeof(GLfloat) *
+                3 * (model->numnormals + 1));
+        if (model->numtexcoords)
+            model->texcoords = (GLfloat*)malloc(sizeof(GLfloat) *
+                2 * (model->numtexcoords + 1));
+        model->triangles = (GLMtriangle*)malloc(sizeof(GLMtriangle) *
+            (model->numtriangles ? model->numtriangles : 1));
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) num_threads(numthreads)
+#endif
+        for (c = 0; c < numchunks; c++) {
+            GLMchunk* chunk = &chunks[c];
+            GLMtriangle* triangles = &model->triangles[tribase[c]];
+            GLuint f;
+
+            if (chunk->numvertices)
+                memcpy(&model->vertices[3 * (vbase[c] + 1)], &chunk->vertices[3],
+                    sizeof(GLfloat) * 3 * chunk->numvertices);
+            if (chunk->numnormals)
+                memcpy(&model->normals[3 * (nbase[c] + 1)], &chunk->normals[3],
+                    sizeof(GLfloat) * 3 * chunk->numnormals);
+            if (chunk->numtexcoords)
+                memcpy(&model->texcoords[2 * (tbase[c] + 1)], &chunk->texcoords[2],
+                    sizeof(GLfloat) * 2 * chunk->numtexcoords);
+            if (chunk->numtriangles)
+                memcpy(triangles, chunk->triangles,
+                    sizeof(GLMtriangle) * chunk->numtriangles);
+
+            /* relative indices were resolved against this chunk's
+               counts, add the counts of the chunks before it */
+            for (f = 0; f < chunk->numfixups; f++) {
+                GLuint slot = chunk->fixups[f].slot;
+                GLuint base = slot < 3 ? vbase[c] : slot < 6 ? nbase[c] : tbase[c];
+                *glmTriangleIndex(&triangles[chunk->fixups[f].triangle], slot) += base;
+            }
+
+            free(chunk->vertices);
+            free(chunk->normals);
+            free(chunk->texcoords);
+            free(chunk->triangles);
+            chunk->vertices = chunk->normals = chunk->texcoords = NULL;
+            chunk->triangles = NULL;
+        }
+    }
+
+    /* replay the group and material statements in file order, keeping
+       track of which runs of triangles go in which group */
+    group = glmAddGroup(model, "default");
+    material = 0;
+    for (c = 0; c < numchunks; c++) {
+        pos = 0;
+        for (e = 0; e < chunks[c].numevents; e++) {
+            GLMevent* event = &chunks[c].events[e];
+
+            glmAddSpan(&spans, &numspans, &maxspans,
+                (GLuint)(group - model->grouppool), tribase[c] + pos,
+                event->triangle - pos);
+            pos = event->triangle;
+
+            switch (event->type) {
+            case GLM_EVENT_GROUP:
+                group = glmAddGroup(model, event->name);
+                group->material = material;
+                break;
+            case GLM_EVENT_MATERIAL:
+                group->material = material = glmFindMaterial(model, event->name);
+                break;
+            case GLM_EVENT_MTLLIB:
+                if (model->mtllibname)
+                    free(model->mtllibname);
+                model->mtllibname = strdup(event->name);
+                glmReadMTL(model, event->name);
+                break;
+            }
+            free(event->name);
+        }
+        glmAddSpan(&spans, &numspans, &maxspans,
+            (GLuint)(group - model->grouppool), tribase[c] + pos,
+            chunks[c].numtriangles - pos);
+
+        free(chunks[c].events);
+        free(chunks[c].fixups);
+    }
+
+    /* now that each group knows how many triangles it has, hand out
+       the triangle indices in file order */
+    for (i = 0; i < numspans; i++)
+        model->grouppool[spans[i].group].numtriangles += spans[i].count;
+    for (group = model->groups; group; group = group->next) {
+        group->triangles = (GLuint*)malloc(sizeof(GLuint) * group->numtriangles);
+        group->numtriangles = 0;
+    }
+    for (i = 0; i < numspans; i++) {
+        group = &model->grouppool[spans[i].group];
+        for (pos = 0; pos < spans[i].count; pos++)
+            group->triangles[group->numtriangles++] = spans[i].first + pos;
+    }
+
+    free(spans);
+    free(vbase);
+}
+
+/* glmParseOBJ: read a Wavefront OBJ file held in memory.  The file is
+ * split into chunks at line boundaries which are parsed concurrently,
+ * then merged.  A single thread parses the whole file as one chunk;
+ * the resulting model is the same for any number of threads.
+ *
+ * model      - properly initialized GLMmodel structure
+ * begin      - first byte of the file
+ * end        - one past the last byte of the file
+ * numthreads - number of threads to parse with
+ */
+static GLvoid
+glmParseOBJ(GLMmodel* model, const char* begin, const char* end,
+            GLuint numthreads)
+{
+    GLMchunk* chunks;
+    GLuint numchunks;
+    GLuint c;
+
+    /* a few chunks per thread evens out the load */
+    numchunks = numthreads > 1 ? 4 * numthreads : 1;
+    if ((size_t)(end - begin) / GLM_MIN_CHUNK < numchunks)
+        numchunks = (GLuint)((end - begin) / GLM_MIN_CHUNK);
+    if (numchunks < 1)
+        numchunks = 1;
+
+    chunks = (GLMchunk*)calloc(numchunks, sizeof(GLMchunk));
+    glmSplitChunks(chunks, numchunks, begin, end);
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic) num_threads(numthreads)
+#endif
+    for (c = 0; c < numchunks; c++)
+        glmParseChunk(&chunks[c]);
+
+    glmMergeChunks(model, chunks, numchunks, numthreads);
+
+    free(chunks);
+}
+
+
+/* GLM_LANES: floats in a SIMD register.  GLM_LANES points stored as
+ * x y z x y z ... fill exactly three registers, so each lane of each
+ * of the three always holds the same component and the sweeps below
+ * need no shuffles. */
+#if defined(GLM_AVX)
+#define GLM_LANES 8
+typedef __m256 GLMlanes;
+#define GLM_LOAD(p)     _mm256_loadu_ps(p)
+#define GLM_STORE(p, v) _mm256_storeu_ps(p, v)
+#define GLM_SET(f)      _mm256_set1_ps(f)
+#define GLM_VMIN(a, b)  _mm256_min_ps(a, b)
+#define GLM_VMAX(a, b)  _mm256_max_ps(a, b)
+#define GLM_VADD(a, b)  _mm256_add_ps(a, b)
+#define GLM_VSUB(a, b)  _mm256_sub_ps(a, b)
+#define GLM_VMUL(a, b)  _mm256_mul_ps(a, b)
+#elif defined(GLM_SSE)
+#define GLM_LANES 4
+typedef __m128 GLMlanes;
+#define GLM_LOAD(p)     _mm_loadu_ps(p)
+#define GLM_STORE(p, v) _mm_storeu_ps(p, v)
+#define GLM_SET(f)      _mm_set1_ps(f)
+#define GLM_VMIN(a, b)  _mm_min_ps(a, b)
+#define GLM_VMAX(a, b)  _mm_max_ps(a, b)
+#define GLM_VADD(a, b)  _mm_add_ps(a, b)
+#define GLM_VSUB(a, b)  _mm_sub_ps(a, b)
+#define GLM_VMUL(a, b)  _mm_mul_ps(a, b)
+#endif
+
+/* GLM_MIN_SWEEP: fewest points worth handing to a thread in the
+ * bounds and transform sweeps */
+#define GLM_MIN_SWEEP 65536
+
+/* glmSweepChunks: number of pieces to split a sweep over count points
+ * into, one per thread */
+static GLuint
+glmSweepChunks(GLuint count)
+{
+#ifdef _OPENMP
+    GLuint numchunks = (GLuint)omp_get_max_threads();
+    
+    if (count / GLM_MIN_SWEEP < numchunks)
+        numchunks = count / GLM_MIN_SWEEP;
+    return numchunks > 1 ? numchunks : 1;
+#else
+    return 1;
+#endif
+}
+
+/* glmBoundsRange: bounds of a run of points on this thread
+ *
+ * points - first point
+ * stride - GLfloats from one point to the next
+ * count  - number of points
+ * lo, hi - set to the smallest and largest of each component, lo is
+ *          above hi if there are no points
+ */
+static GLvoid
+glmBoundsRange(const GLfloat* points, GLuint stride, GLuint count,
+               GLfloat* lo, GLfloat* hi)
+{
+    const GLfloat* p;
+    GLuint i, k, done;
+    
+    lo[0] = lo[1] = lo[2] = FLT_MAX;
+    hi[0] = hi[1] = hi[2] = -FLT_MAX;
+    done = 0;
+    
+#ifdef GLM_LANES
+    if (stride == 3 && count >= GLM_LANES) {
+        GLMlanes mn[3], mx[3], v;
+        GLfloat lanes[2][3 * GLM_LANES];
+        
+        for (k = 0; k < 3; k++)
+            mn[k] = mx[k] = GLM_LOAD(points + k * GLM_LANES);
+        for (done = GLM_LANES; done + GLM_LANES <= count; done += GLM_LANES) {
+            p = points + 3 * (size_t)done;
+            for (k = 0; k < 3; k++) {
+                /* the new value first, so a NaN is passed over */
+                v = GLM_LOAD(p + k * GLM_LANES);
+                mn[k] = GLM_VMIN(v, mn[k]);
+                mx[k] = GLM_VMAX(v, mx[k]);
+            }
+        }
+        
+        for (k = 0; k < 3; k++) {
+            GLM_STORE(&lanes[0][k * GLM_LANES], mn[k]);
+            GLM_STORE(&lanes[1][k * GLM_LANES], mx[k]);
+        }
+        for (k = 0; k < 3 * GLM_LANES; k++) {
+            if (lanes[0][k] < lo[k % 3])
+                lo[k % 3] = lanes[0][k];
+            if (lanes[1][k] > hi[k % 3])
+                hi[k % 3] = lanes[1][k];
+        }
+    }
+#endif
+    
+    for (i = done; i < count; i++) {
+        p = points + (size_t)i * stride;
+        for (k = 0; k < 3; k++) {
+            if (p[k] < lo[k])
+                lo[k] = p[k];
+            if (p[k] > hi[k])
+                hi[k] = p[k];
+        }
+    }
+}
+
+/* glmRadiusRange: largest squared distance from a point to center in
+ * a run of points, on this thread */
+static GLfloat
+glmRadiusRange(const GLfloat* points, GLuint stride, GLuint count,
+               const GLfloat* center)
+{
+    const GLfloat* p;
+    GLfloat d[3], d2, radius2;
+    GLuint i, k, done;
+    
+    radius2 = 0;
+    done = 0;
+    
+#ifdef GLM_LANES
+    if (stride == 3) {
+        GLMlanes c[3], v;
+        GLfloat lanes[3 * GLM_LANES];
+        GLuint j;
+        
+        /* the center repeated in the same pattern as the points */
+        for (k = 0; k < 3 * GLM_LANES; k++)
+            lanes[k] = center[k % 3];
+        for (k = 0; k < 3; k++)
+            c[k] = GLM_LOAD(lanes + k * GLM_LANES);
+        
+        for (; done + GLM_LANES <= count; done += GLM_LANES) {
+            p = points + 3 * (size_t)done;
+            for (k = 0; k < 3; k++) {
+                v = GLM_VSUB(GLM_LOAD(p + k * GLM_LANES), c[k]);
+                GLM_STORE(lanes + k * GLM_LANES, GLM_VMUL(v, v));
+            }
+            for (j = 0; j < GLM_LANES; j++) {
+                d2 = lanes[3 * j] + lanes[3 * j + 1] + lanes[3 * j + 2];
+                if (d2 > radius2)
+                    radius2 = d2;
+            }
+        }
+    }
+#endif
+    
+    for (i = done; i < count; i++) {
+        p = points + (size_t)i * stride;
+        for (k = 0; k < 3; k++)
+            d[k] = p[k] - center[k];
+        d2 = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+        if (d2 > radius2)
+            radius2 = d2;
+    }
+    return radius2;
+}
+
+/* glmTranslateScaleRange: move and scale a run of points on this
+ * thread */
+static GLvoid
+glmTranslateScaleRange(GLfloat* points, GLuint stride, GLuint count,
+                       const GLfloat* translate, GLfloat scale)
+{
+    GLfloat* p;
+    GLuint i, k, done;
+    
+    done = 0;
+    
+#ifdef GLM_LANES
+    if (stride == 3) {
+        GLMlanes t[3], s, v;
+        GLfloat lanes[3 * GLM_LANES];
+        
+        for (k = 0; k < 3 * GLM_LANES; k++)
+            lanes[k] = translate[k % 3];
+        for (k = 0; k < 3; k++)
+            t[k] = GLM_LOAD(lanes + k * GLM_LANES);
+        s = GLM_SET(scale);
+        
+        for (; done + GLM_LANES <= count; done += GLM_LANES) {
+            p = points + 3 * (size_t)done;
+            for (k = 0; k < 3; k++) {
+                v = GLM_LOAD(p + k * GLM_LANES);
+                GLM_STORE(p + k * GLM_LANES, GLM_VMUL(GLM_VADD(v, t[k]), s));
+            }
+        }
+    }
+#endif
+    
+    for (i = done; i < count; i++) {
+        p = points + (size_t)i * stride;
+        for (k = 0; k < 3; k++)
+            p[k] = (p[k] + translate[k]) * scale;
+    }
+}
+
+
+/* public functions */
+
+
+/* glmBounds: axis aligned bounding box of an array of points.  Packed
+ * points are swept with SSE or AVX, large arrays are split across
+ * threads.
+ *
+ * points - first point
+ * stride - GLfloats from one point to the next, 3 for packed points
+ * count  - number of points
+ * min    - array of 3 GLfloats, set to the smallest of each component
+ * max    - array of 3 GLfloats, set to the largest of each component
+ */
+GLvoid
+glmBounds(const GLfloat* points, GLuint stride, GLuint count,
+          GLfloat* min, GLfloat* max)
+{
+    GLfloat* bounds;
+    GLuint numchunks, c, k;
+    
+    assert(points || count == 0);
+    assert(min && max);
+    
+    numchunks = glmSweepChunks(count);
+    if (numchunks == 1) {
+        glmBoundsRange(points, stride, count, min, max);
+        return;
+    }
+    
+    bounds = (GLfloat*)malloc(sizeof(GLfloat) * 6 * numchunks);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) num_threads(numchunks)
+#endif
+    for (c = 0; c < numchunks; c++) {
+        GLuint first = (GLuint)((size_t)count * c / numchunks);
+        GLuint last = (GLuint)((size_t)count * (c + 1) / numchunks);
+        glmBoundsRange(points + (size_t)first * stride, stride, last - first,
+                       &bounds[6 * c], &bounds[6 * c + 3]);
+    }
+    
+    for (k = 0; k < 3; k++) {
+        min[k] = bounds[k];
+        max[k] = bounds[3 + k];
+    }
+    for (c = 1; c < numchunks; c++) {
+        for (k = 0; k < 3; k++) {
+            if (bounds[6 * c + k] < min[k])
+                min[k] = bounds[6 * c + k];
+            if (bounds[6 * c + 3 + k] > max[k])
+                max[k] = bounds[6 * c + 3 + k];
+        }
+    }
+    free(bounds);
+}
+
+/* glmBoundingSphere: sphere around the center of the bounding box of
+ * an array of points, large enough to hold them all.  Returns the
+ * radius.
+ *
+ * points - first point
+ * stride - GLfloats from one point to the next, 3 for packed points
+ * count  - number of points
+ * center - array of 3 GLfloats, set to the center of the sphere
+ */
+GLfloat
+glmBoundingSphere(const GLfloat* points, GLuint stride, GLuint count,
+                  GLfloat* center)
+{
+    GLfloat lo[3], hi[3], radius2;
+    GLfloat* radii;
+    GLuint numchunks, c, k;
+    
+    assert(center);
+    
+    if (count == 0) {
+        center[0] = center[1] = center[2] = 0;
+        return 0;
+    }
+    
+    glmBounds(points, stride, count, lo, hi);
+    for (k = 0; k < 3; k++)
+        center[k] = 0.5f * (lo[k] + hi[k]);
+    
+    numchunks = glmSweepChunks(count);
+    if (numchunks == 1)
+        return (GLfloat)sqrt(glmRadiusRange(points, stride, count, center));
+    
+    radii = (GLfloat*)malloc(sizeof(GLfloat) * numchunks);
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) num_threads(numchunks)
+#endif
+    for (c = 0; c < numchunks; c++) {
+        GLuint first = (GLuint)((size_t)count * c / numchunks);
+        GLuint last = (GLuint)((size_t)count * (c + 1) / numchunks);
+        radii[c] = glmRadiusRange(points + (size_t)first * stride, stride,
+                                  last - first, center);
+    }
+    
+    radius2 = 0;
+    for (c = 0; c < numchunks; c++)
+        radius2 = glmMax(radius2, radii[c]);
+    free(radii);
+    return (GLfloat)sqrt(radius2);
+}
+
+/* glmTranslateScale: move then scale an array of points in one pass,
+ * point = (point + translate) * scale.
+ *
+ * points    - first point
+ * stride    - GLfloats from one point to the next, 3 for packed points
+ * count     - number of points
+ * translate - array of 3 GLfloats added to each point
+ * scale     - scalefactor applied after the translation
+ */
+GLvoid
+glmTranslateScale(GLfloat* points, GLuint stride, GLuint count,
+                  const GLfloat* translate, GLfloat scale)
+{
+    GLuint numchunks, c;
+    
+    assert(points || count == 0);
+    assert(translate);
+    
+    numchunks = glmSweepChunks(count);
+    if (numchunks == 1) {
+        glmTranslateScaleRange(points, stride, count, translate, scale);
+        return;
+    }
+    
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) num_threads(numchunks)
+#endif
+    for (c = 0; c < numchunks; c++) {
+        GLuint first = (GLuint)((size_t)count * c / numchunks);
+        GLuint last = (GLuint)((size_t)count * (c + 1) / numchunks);
+        glmTranslateScaleRange(points + (size_t)first * stride, stride,
+                               last - first, translate, scale);
+    }
+}
+
+/* glmUnitize: "unitize" a model by translating it to the origin and
+ * scaling it to fit in a unit cube around the origin.   Returns the
+ * scalefactor used.
+ *
+ * model - properly initialized GLMmodel structure 
+ */
+GLfloat
+glmUnitize(GLMmodel* model)
+{
+    GLfloat lo[3], hi[3], center[3];
+    GLfloat w, h, d;
+    GLfloat scale;
+    
+    assert(model);
+    assert(model->vertices);
+    
+    /* get the max/mins */
+    glmBounds(&model->vertices[3], 3, model->numvertices, lo, hi);
+    
+    /* calculate model width, height, and depth */
+    w = glmAbs(hi[0]) + glmAbs(lo[0]);
+    h = glmAbs(hi[1]) + glmAbs(lo[1]);
+    d = glmAbs(hi[2]) + glmAbs(lo[2]);
+    
+    /* calculate center of the model */
+    center[0] = -(hi[0] + lo[0]) / 2.0f;
+    center[1] = -(hi[1] + lo[1]) / 2.0f;
+    center[2] = -(hi[2] + lo[2]) / 2.0f;
+    
+    /* calculate unitizing scale factor */
+    scale = 2.0f / glmMax(glmMax(w, h), d);
+    
+    /* translate around center then scale, in one pass */
+    glmTranslateScale(&model->vertices[3], 3, model->numvertices, center, scale);
+    
+    return scale;
+}
+
+/* glmDimensions: Calculates the dimensions (width, height, depth) of
+ * a model.
+ *
+ * model   - initialized GLMmodel structure
+ * dimensions - array of 3 GLfloats (GLfloat dimensions[3])
+ */
+GLvoid
+glmDimensions(GLMmodel* model, GLfloat* dimensions)
+{
+    GLfloat lo[3], hi[3];
+    
+    assert(model);
+    assert(model->vertices);
+    assert(dimensions);
+    
+    /* get the max/mins */
+    glmBounds(&model->vertices[3], 3, model->numvertices, lo, hi);
+    
+    /* calculate model width, height, and depth */
+    dimensions[0] = glmAbs(hi[0]) + glmAbs(lo[0]);
+    dimensions[1] = glmAbs(hi[1]) + glmAbs(lo[1]);
+    dimensions[2] = glmAbs(hi[2]) + glmAbs(lo[2]);
+}
+
+/* glmScale: Scales a model by a given amount.
+ * 
+ * model - properly initialized GLMmodel structure
+ * scale - scalefactor (0.5 = half as large, 2.0 = twice as large)
+ */
+GLvoid
+glmScale(GLMmodel* model, GLfloat scale)
+{
+    GLuint i;
+    
+    for (i = 1; i <= model->numvertices; i++) {
+        model->vertices[3 * i + 0] *= scale;
+        model->vertices[3 * i + 1] *= scale;
+        model->vertices[3 * i + 2] *= scale;
+    }
+}
+
+/* glmReverseWinding: Reverse the polygon winding for all polygons in
+ * this model.   Default winding is counter-clockwise.  Also changes
+ * the direction of the normals.
+ * 
+ * model - properly initialized GLMmodel structure 
+ */
+GLvoid
+glmReverseWinding(GLMmodel* model)
+{
+    GLuint i, swap;
+    
+    assert(model);
+    
+    for (i = 0; i < model->numtriangles; i++) {
+        swap = T(i).vindices[0];
+        T(i).vindices[0] = T(i).vindices[2];
+        T(i).vindices[2] = swap;
+        
+        if (model->numnormals) {
+            swap = T(i).nindices[0];
+            T(i).nindices[0] = T(i).nindices[2];
+            T(i).nindices[2] = swap;
+        }
+        
+        if (model->numtexcoords) {
+            swap = T(i).tindices[0];
+            T(i).tindices[0] = T(i).tindices[2];
+            T(i).tindices[2] = swap;
+        }
+    }
+    
+    /* reverse facet normals */
+    for (i = 1; i <= model->numfacetnorms; i++) {
+        model->facetnorms[3 * i + 0] = -model->facetnorms[3 * i + 0];
+        model->facetnorms[3 * i + 1] = -model->facetnorms[3 * i + 1];
+        model->facetnorms[3 * i + 2] = -model->facetnorms[3 * i + 2];
+    }
+    
+    /* reverse vertex normals */
+    for (i = 1; i <= model->numnormals; i++) {
+        model->normals[3 * i + 0] = -model->normals[3 * i + 0];
+        model->normals[3 * i + 1] = -model->normals[3 * i + 1];
+        model->normals[3 * i + 2] = -model->normals[3 * i + 2];
+    }
+}
+
+/* glmFacetNormalsScalar: Generates facet normals for a model one
+ * triangle at a time.  The reference for glmFacetNormals().
+ *
+ * model - initialized GLMmodel structure
+ */
+GLvoid
+glmFacetNormalsScalar(GLMmodel* model)
 {
     GLuint  i;
     GLfloat u[3];
@@ -988,6 +2393,369 @@ glmFacetNormals(GLMmodel* model)
     }
 }
 
+/* glmFacetNormal: facet normal of triangle i, the same way
+ * glmFacetNormalsScalar() does it */
+static GLvoid
+glmFacetNormal(GLMmodel* model, GLuint i)
+{
+    GLfloat* v0 = &model->vertices[3 * T(i).vindices[0]];
+    GLfloat* v1 = &model->vertices[3 * T(i).vindices[1]];
+    GLfloat* v2 = &model->vertices[3 * T(i).vindices[2]];
+    GLfloat u[3];
+    GLfloat v[3];
+    
+    u[0] = v1[0] - v0[0];
+    u[1] = v1[1] - v0[1];
+    u[2] = v1[2] - v0[2];
+    
+    v[0] = v2[0] - v0[0];
+    v[1] = v2[1] - v0[1];
+    v[2] = v2[2] - v0[2];
+    
+    T(i).findex = i + 1;
+    glmCross(u, v, &model->facetnorms[3 * (i + 1)]);
+    glmNormalize(&model->facetnorms[3 * (i + 1)]);
+}
+
+/* GLM_BLOCK: number of triangles whose normals are computed together.
+ * The corners of a block are gathered into SIMD registers in structure
+ * of arrays form, so one register holds the x (or y, or z) component
+ * of every triangle in the block. */
+#if defined(GLM_AVX)
+#define GLM_BLOCK 8
+#define GLM_GATHER(p, c) _mm256_setr_ps(p[0][c], p[1][c], p[2][c], p[3][c], \
+                                        p[4][c], p[5][c], p[6][c], p[7][c])
+#elif defined(GLM_SSE)
+#define GLM_BLOCK 4
+#define GLM_GATHER(p, c) _mm_setr_ps(p[0][c], p[1][c], p[2][c], p[3][c])
+#else
+#define GLM_BLOCK 4
+#endif
+
+#if defined(GLM_AVX) || defined(GLM_SSE)
+/* glmFacetNormalsBlock: facet normals of the GLM_BLOCK triangles
+ * starting at first */
+static GLvoid
+glmFacetNormalsBlock(GLMmodel* model, GLuint first)
+{
+    const GLfloat* p0[GLM_BLOCK];
+    const GLfloat* p1[GLM_BLOCK];
+    const GLfloat* p2[GLM_BLOCK];
+    GLfloat nx[GLM_BLOCK], ny[GLM_BLOCK], nz[GLM_BLOCK];
+    GLfloat* n;
+    GLuint k;
+    
+    for (k = 0; k < GLM_BLOCK; k++) {
+        GLMtriangle* t = &T(first + k);
+        p0[k] = &model->vertices[3 * t->vindices[0]];
+        p1[k] = &model->vertices[3 * t->vindices[1]];
+        p2[k] = &model->vertices[3 * t->vindices[2]];
+        t->findex = first + k + 1;
+    }
+    
+    {
+#if defined(GLM_AVX)
+    __m256 x0 = GLM_GATHER(p0, 0);
+    __m256 y0 = GLM_GATHER(p0, 1);
+    __m256 z0 = GLM_GATHER(p0, 2);
+    __m256 ux = _mm256_sub_ps(GLM_GATHER(p1, 0), x0);
+    __m256 uy = _mm256_sub_ps(GLM_GATHER(p1, 1), y0);
+    __m256 uz = _mm256_sub_ps(GLM_GATHER(p1, 2), z0);
+    __m256 vx = _mm256_sub_ps(GLM_GATHER(p2, 0), x0);
+    __m256 vy = _mm256_sub_ps(GLM_GATHER(p2, 1), y0);
+    __m256 vz = _mm256_sub_ps(GLM_GATHER(p2, 2), z0);
+    __m256 cx = _mm256_sub_ps(_mm256_mul_ps(uy, vz), _mm256_mul_ps(uz, vy));
+    __m256 cy = _mm256_sub_ps(_mm256_mul_ps(uz, vx), _mm256_mul_ps(ux, vz));
+    __m256 cz = _mm256_sub_ps(_mm256_mul_ps(ux, vy), _mm256_mul_ps(uy, vx));
+    __m256 l2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(cx, cx),
+        _mm256_mul_ps(cy, cy)), _mm256_mul_ps(cz, cz));
+    __m256 r = _mm256_rsqrt_ps(l2);
+    __m256 mask;
+    
+    /* rsqrt is good to 12 bits, one Newton-Raphson step takes it to
+       nearly full precision: r = r * (1.5 - 0.5 * l2 * r * r) */
+    r = _mm256_mul_ps(r, _mm256_sub_ps(_mm256_set1_ps(1.5f),
+        _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(0.5f), l2),
+        _mm256_mul_ps(r, r))));
+    
+    /* rsqrt flushes denormals to zero, use a real square root for
+       the (nearly) degenerate triangles */
+    mask = _mm256_cmp_ps(l2, _mm256_set1_ps(FLT_MIN), _CMP_LT_OQ);
+    if (_mm256_movemask_ps(mask))
+        r = _mm256_blendv_ps(r, _mm256_div_ps(_mm256_set1_ps(1.0f),
+            _mm256_sqrt_ps(l2)), mask);
+    
+    _mm256_storeu_ps(nx, _mm256_mul_ps(cx, r));
+    _mm256_storeu_ps(ny, _mm256_mul_ps(cy, r));
+    _mm256_storeu_ps(nz, _mm256_mul_ps(cz, r));
+#else
+    __m128 x0 = GLM_GATHER(p0, 0);
+    __m128 y0 = GLM_GATHER(p0, 1);
+    __m128 z0 = GLM_GATHER(p0, 2);
+    __m128 ux = _mm_sub_ps(GLM_GATHER(p1, 0), x0);
+    __m128 uy = _mm_sub_ps(GLM_GATHER(p1, 1), y0);
+    __m128 uz = _mm_sub_ps(GLM_GATHER(p1, 2), z0);
+    __m128 vx = _mm_sub_ps(GLM_GATHER(p2, 0), x0);
+    __m128 vy = _mm_sub_ps(GLM_GATHER(p2, 1), y0);
+    __m128 vz = _mm_sub_ps(GLM_GATHER(p2, 2), z0);
+    __m128 cx = _mm_sub_ps(_mm_mul_ps(uy, vz), _mm_mul_ps(uz, vy));
+    __m128 cy = _mm_sub_ps(_mm_mul_ps(uz, vx), _mm_mul_ps(ux, vz));
+    __m128 cz = _mm_sub_ps(_mm_mul_ps(ux, vy), _mm_mul_ps(uy, vx));
+    __m128 l2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, cx),
+        _mm_mul_ps(cy, cy)), _mm_mul_ps(cz, cz));
+    __m128 r = _mm_rsqrt_ps(l2);
+    __m128 mask;
+    
+    /* rsqrt is good to 12 bits, one Newton-Raphson step takes it to
+       nearly full precision: r = r * (1.5 - 0.5 * l2 * r * r) */
+    r = _mm_mul_ps(r, _mm_sub_ps(_mm_set1_ps(1.5f),
+        _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(0.5f), l2), _mm_mul_ps(r, r))));
+    
+    /* rsqrt flushes denormals to zero, use a real square root for
+       the (nearly) degenerate triangles */
+    mask = _mm_cmplt_ps(l2, _mm_set1_ps(FLT_MIN));
+    if (_mm_movemask_ps(mask))
+        r = _mm_or_ps(_mm_andnot_ps(mask, r), _mm_and_ps(mask,
+            _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(l2))));
+    
+    _mm_storeu_ps(nx, _mm_mul_ps(cx, r));
+    _mm_storeu_ps(ny, _mm_mul_ps(cy, r));
+    _mm_storeu_ps(nz, _mm_mul_ps(cz, r));
+#endif
+    }
+    
+    /* scatter the normals back into the array of structures */
+    n = &model->facetnorms[3 * (first + 1)];
+    for (k = 0; k < GLM_BLOCK; k++) {
+        n[3 * k + 0] = nx[k];
+        n[3 * k + 1] = ny[k];
+        n[3 * k + 2] = nz[k];
+    }
+}
+#endif
+
+/* glmFacetNormals: Generates facet normals for a model (by taking the
+ * cross product of the two vectors derived from the sides of each
+ * triangle).  Assumes a counter-clockwise winding.
+ *
+ * GLM_BLOCK triangles at a time are gathered into SIMD registers and
+ * their normals computed with SSE or AVX where available.  Blocks are
+ * spread across threads with OpenMP.
+ *
+ * model - initialized GLMmodel structure
+ */
+GLvoid
+glmFacetNormals(GLMmodel* model)
+{
+    GLint numblocks, block;
+    
+    assert(model);
+    assert(model->vertices);
+    
+    /* reuse the old facet normals if there is one per triangle,
+       otherwise clobber them */
+    if (!model->facetnorms || model->numfacetnorms != model->numtriangles) {
+        if (model->facetnorms)
+            free(model->facetnorms);
+        
+        /* allocate memory for the new facet normals */
+        model->numfacetnorms = model->numtriangles;
+        model->facetnorms = (GLfloat*)malloc(sizeof(GLfloat) *
+                           3 * (model->numfacetnorms + 1));
+    }
+    
+    numblocks = (GLint)((model->numtriangles + GLM_BLOCK - 1) / GLM_BLOCK);
+    
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+    for (block = 0; block < numblocks; block++) {
+        GLuint first = (GLuint)block * GLM_BLOCK;
+        GLuint i;
+        
+#if defined(GLM_AVX) || defined(GLM_SSE)
+        if (first + GLM_BLOCK <= model->numtriangles) {
+            glmFacetNormalsBlock(model, first);
+            continue;
+        }
+#endif
+        /* a partial block at the end, or no SIMD */
+        for (i = first; i < first + GLM_BLOCK && i < model->numtriangles; i++)
+            glmFacetNormal(model, i);
+    }
+}
+
+/* glmBuildAdjacency: Builds the list of triangles each vertex is in.
+ * The lists are packed back to back in one array (compressed sparse
+ * row form) with a counting pass, so only one block of memory is
+ * allocated.  Each list is in descending triangle order.
+ *
+ * model     - initialized GLMmodel structure
+ * adjacency - structure to fill in, free with glmDeleteAdjacency()
+ */
+GLvoid
+glmBuildAdjacency(GLMmodel* model, GLMadjacency* adjacency)
+{
+    GLuint* offsets;
+    GLuint* triangles;
+    GLuint i, j, v;
+    
+    assert(model);
+    assert(adjacency);
+    
+    /* offsets has numvertices + 2 entries: element 0 is unused as
+       vertices are 1-based, and the last one marks the end of the
+       last list */
+    offsets = (GLuint*)malloc(sizeof(GLuint) *
+        (model->numvertices + 2 + 3 * model->numtriangles));
+    triangles = offsets + model->numvertices + 2;
+    
+    /* count the triangles each vertex is in */
+    memset(offsets, 0, sizeof(GLuint) * (model->numvertices + 2));
+    for (i = 0; i < model->numtriangles; i++) {
+        offsets[T(i).vindices[0]]++;
+        offsets[T(i).vindices[1]]++;
+        offsets[T(i).vindices[2]]++;
+    }
+    
+    /* turn the counts into the end of each list */
+    for (v = 1; v <= model->numvertices; v++)
+        offsets[v] += offsets[v - 1];
+    offsets[model->numvertices + 1] = offsets[model->numvertices];
+    
+    /* fill the lists from the back, which leaves offsets[v] at the
+       start of the list of vertex v */
+    for (i = 0; i < model->numtriangles; i++) {
+        for (j = 0; j < 3; j++) {
+            v = T(i).vindices[j];
+            triangles[--offsets[v]] = i;
+        }
+    }
+    
+    adjacency->numvertices = model->numvertices;
+    adjacency->offsets = offsets;
+    adjacency->triangles = triangles;
+}
+
+/* glmDeleteAdjacency: Frees the lists built by glmBuildAdjacency().
+ *
+ * adjacency - structure filled in by glmBuildAdjacency()
+ */
+GLvoid
+glmDeleteAdjacency(GLMadjacency* adjacency)
+{
+    assert(adjacency);
+    
+    free(adjacency->offsets);
+    adjacency->numvertices = 0;
+    adjacency->offsets = NULL;
+    adjacency->triangles = NULL;
+}
+
+/* glmSetNormalIndex: point the corner of a triangle that uses vertex
+ * at a normal */
+static GLvoid
+glmSetNormalIndex(GLMtriangle* triangle, GLuint vertex, GLuint normal)
+{
+    if (triangle->vindices[0] == vertex)
+        triangle->nindices[0] = normal;
+    else if (triangle->vindices[1] == vertex)
+        triangle->nindices[1] = normal;
+    else if (triangle->vindices[2] == vertex)
+        triangle->nindices[2] = normal;
+}
+
+/* glmSmoothVertex: Generates the normals of one vertex for
+ * glmVertexNormalsAdjacency().  Returns the number of normals the
+ * vertex needs: one for the average, if any triangle was averaged,
+ * plus one for every triangle that wasn't.
+ *
+ * model     - initialized GLMmodel structure
+ * adjacency - triangles each vertex is in
+ * vertex    - index of the vertex
+ * cos_angle - cosine of the maximum angle to smooth across
+ * normal    - index of the first normal to write
+ * write     - GL_FALSE to only count the normals
+ */
+static GLuint
+glmSmoothVertex(GLMmodel* model, const GLMadjacency* adjacency,
+                GLuint vertex, GLfloat cos_angle, GLuint normal,
+                GLboolean write)
+{
+    const GLuint* members;
+    GLfloat* facetnorm;
+    GLfloat* first;
+    GLfloat average[3];
+    GLfloat dot;
+    GLuint numnormals = normal;
+    GLuint j, count, avg;
+    
+    members = &adjacency->triangles[adjacency->offsets[vertex]];
+    count = adjacency->offsets[vertex + 1] - adjacency->offsets[vertex];
+    if (!count) {
+        if (write)
+            fprintf(stderr, "glmVertexNormals(): vertex w/o a triangle\n");
+        return 0;
+    }
+    
+    /* calculate an average normal for this vertex by averaging the
+    facet normal of every triangle this vertex is in */
+    first = &model->facetnorms[3 * T(members[0]).findex];
+    average[0] = 0.0; average[1] = 0.0; average[2] = 0.0;
+    avg = 0;
+    for (j = 0; j < count; j++) {
+    /* only average if the dot product of the angle between the two
+    facet normals is greater than the cosine of the threshold
+    angle -- or, said another way, the angle between the two
+        facet normals is less than (or equal to) the threshold angle */
+        facetnorm = &model->facetnorms[3 * T(members[j]).findex];
+        dot = glmDot(facetnorm, first);
+        if (dot > cos_angle) {
+            average[0] += facetnorm[0];
+            average[1] += facetnorm[1];
+            average[2] += facetnorm[2];
+            avg = 1;            /* we averaged at least one normal! */
+        } else if (!write) {
+            numnormals++;
+        }
+    }
+    
+    if (!write)
+        return numnormals - normal + avg;
+    
+    if (avg) {
+        /* normalize the averaged normal */
+        glmNormalize(average);
+        
+        /* add the normal to the vertex normals list */
+        model->normals[3 * numnormals + 0] = average[0];
+        model->normals[3 * numnormals + 1] = average[1];
+        model->normals[3 * numnormals + 2] = average[2];
+        avg = numnormals;
+        numnormals++;
+    }
+    
+    /* set the normal of this vertex in each triangle it is in, the
+       dot products are the same as above */
+    for (j = 0; j < count; j++) {
+        facetnorm = &model->facetnorms[3 * T(members[j]).findex];
+        dot = glmDot(facetnorm, first);
+        if (dot > cos_angle) {
+            /* if this triangle was averaged, use the average normal */
+            glmSetNormalIndex(&T(members[j]), vertex, avg);
+        } else {
+            /* if this triangle wasn't averaged, use the facet normal */
+            model->normals[3 * numnormals + 0] = facetnorm[0];
+            model->normals[3 * numnormals + 1] = facetnorm[1];
+            model->normals[3 * numnormals + 2] = facetnorm[2];
+            glmSetNormalIndex(&T(members[j]), vertex, numnormals);
+            numnormals++;
+        }
+    }
+    
+    return numnormals - normal;
+}
+
 /* glmVertexNormals: Generates smooth vertex normals for a model.
  * First builds a list of all the triangles each vertex is in.   Then
  * loops through each vertex in the the list averaging all the facet
@@ -1007,17 +2775,36 @@ glmFacetNormals(GLMmodel* model)
 GLvoid
 glmVertexNormals(GLMmodel* model, GLfloat angle)
 {
-    GLMnode* node;
-    GLMnode* tail;
-    GLMnode** members;
-    GLfloat* normals;
+    GLMadjacency adjacency;
+    
+    glmBuildAdjacency(model, &adjacency);
+    glmVertexNormalsAdjacency(model, angle, &adjacency);
+    glmDeleteAdjacency(&adjacency);
+}
+
+/* glmVertexNormalsAdjacency: Same as glmVertexNormals(), using lists
+ * of triangles built beforehand with glmBuildAdjacency().  On a single
+ * thread the only memory allocated is the normals array.  With OpenMP
+ * the vertices are split across threads: a first pass counts the
+ * normals of each vertex, and a prefix sum over the counts tells each
+ * vertex where to write, so the normals come out in the same order.
+ *
+ * model     - initialized GLMmodel structure
+ * angle     - maximum angle (in degrees) to smooth across
+ * adjacency - triangles each vertex is in
+ */
+GLvoid
+glmVertexNormalsAdjacency(GLMmodel* model, GLfloat angle,
+                          const GLMadjacency* adjacency)
+{
+    GLfloat cos_angle;
     GLuint numnormals;
-    GLfloat average[3];
-    GLfloat dot, cos_angle;
-    GLuint i, avg;
+    GLuint i;
     
     assert(model);
     assert(model->facetnorms);
+    assert(adjacency);
+    assert(adjacency->numvertices == model->numvertices);
     
     /* calculate the cosine of the angle (in degrees) */
     cos_angle = cos(angle * M_PI / 180.0f);
@@ -1030,127 +2817,47 @@ glmVertexNormals(GLMmodel* model, GLfloat angle)
     model->numnormals = model->numtriangles * 3; /* 3 normals per triangle */
     model->normals = (GLfloat*)malloc(sizeof(GLfloat)* 3* (model->numnormals+1));
     
-    /* allocate a structure that will hold a linked list of triangle
-    indices for each vertex */
-    members = (GLMnode**)malloc(sizeof(GLMnode*) * (model->numvertices + 1));
-    for (i = 1; i <= model->numvertices; i++)
-        members[i] = NULL;
-    
-    /* for every triangle, create a node for each vertex in it */
-    for (i = 0; i < model->numtriangles; i++) {
-        node = (GLMnode*)malloc(sizeof(GLMnode));
-        node->index = i;
-        node->next  = members[T(i).vindices[0]];
-        members[T(i).vindices[0]] = node;
-        
-        node = (GLMnode*)malloc(sizeof(GLMnode));
-        node->index = i;
-        node->next  = members[T(i).vindices[1]];
-        members[T(i).vindices[1]] = node;
-        
-        node = (GLMnode*)malloc(sizeof(GLMnode));
-        node->index = i;
-        node->next  = members[T(i).vindices[2]];
-        members[T(i).vindices[2]] = node;
-    }
-    
     /* calculate the average normal for each vertex */
     numnormals = 1;
-    for (i = 1; i <= model->numvertices; i++) {
-    /* calculate an average normal for this vertex by averaging the
-        facet normal of every triangle this vertex is in */
-        node = members[i];
-        if (!node)
-            fprintf(stderr, "glmVertexNormals(): vertex w/o a triangle\n");
-        average[0] = 0.0; average[1] = 0.0; average[2] = 0.0;
-        avg = 0;
-        while (node) {
-        /* only average if the dot product of the angle between the two
-        facet normals is greater than the cosine of the threshold
-        angle -- or, said another way, the angle between the two
-            facet normals is less than (or equal to) the threshold angle */
-            dot = glmDot(&model->facetnorms[3 * T(node->index).findex],
-                &model->facetnorms[3 * T(members[i]->index).findex]);
-            if (dot > cos_angle) {
-                node->averaged = GL_TRUE;
-                average[0] += model->facetnorms[3 * T(node->index).findex + 0];
-                average[1] += model->facetnorms[3 * T(node->index).findex + 1];
-                average[2] += model->facetnorms[3 * T(node->index).findex + 2];
-                avg = 1;            /* we averaged at least one normal! */
-            } else {
-                node->averaged = GL_FALSE;
-            }
-            node = node->next;
-        }
+#ifdef _OPENMP
+    if (omp_get_max_threads() > 1) {
+        GLuint* first;
+        GLint vertex;
         
-        if (avg) {
-            /* normalize the averaged normal */
-            glmNormalize(average);
-            
-            /* add the normal to the vertex normals list */
-            model->normals[3 * numnormals + 0] = average[0];
-            model->normals[3 * numnormals + 1] = average[1];
-            model->normals[3 * numnormals + 2] = average[2];
-            avg = numnormals;
-            numnormals++;
-        }
+        /* first[i] is the first normal of vertex i */
+        first = (GLuint*)malloc(sizeof(GLuint) * (model->numvertices + 2));
+        first[0] = 0;
+        first[1] = 1;
         
-        /* set the normal of this vertex in each triangle it is in */
-        node = members[i];
-        while (node) {
-            if (node->averaged) {
-                /* if this node was averaged, use the average normal */
-                if (T(node->index).vindices[0] == i)
-                    T(node->index).nindices[0] = avg;
-                else if (T(node->index).vindices[1] == i)
-                    T(node->index).nindices[1] = avg;
-                else if (T(node->index).vindices[2] == i)
-                    T(node->index).nindices[2] = avg;
-            } else {
-                /* if this node wasn't averaged, use the facet normal */
-                model->normals[3 * numnormals + 0] = 
-                    model->facetnorms[3 * T(node->index).findex + 0];
-                model->normals[3 * numnormals + 1] = 
-                    model->facetnorms[3 * T(node->index).findex + 1];
-                model->normals[3 * numnormals + 2] = 
-                    model->facetnorms[3 * T(node->index).findex + 2];
-                if (T(node->index).vindices[0] == i)
-                    T(node->index).nindices[0] = numnormals;
-                else if (T(node->index).vindices[1] == i)
-                    T(node->index).nindices[1] = numnormals;
-                else if (T(node->index).vindices[2] == i)
-                    T(node->index).nindices[2] = numnormals;
-                numnormals++;
-            }
-            node = node->next;
-        }
-    }
+#pragma omp parallel for schedule(static)
+        for (vertex = 1; vertex <= (GLint)model->numvertices; vertex++)
+            first[vertex + 1] = glmSmoothVertex(model, adjacency, vertex,
+                cos_angle, 0, GL_FALSE);
+        
+        for (i = 1; i <= model->numvertices; i++)
+            first[i + 1] += first[i];
+        
+#pragma omp parallel for schedule(static)
+        for (vertex = 1; vertex <= (GLint)model->numvertices; vertex++)
+            glmSmoothVertex(model, adjacency, vertex, cos_angle,
+                first[vertex], GL_TRUE);
+        
+        numnormals = first[model->numvertices + 1];
+        free(first);
+    } else
+#endif
+    for (i = 1; i <= model->numvertices; i++)
+        numnormals += glmSmoothVertex(model, adjacency, i, cos_angle,
+            numnormals, GL_TRUE);
     
     model->numnormals = numnormals - 1;
     
-    /* free the member information */
-    for (i = 1; i <= model->numvertices; i++) {
-        node = members[i];
-        while (node) {
-            tail = node;
-            node = node->next;
-            free(tail);
-        }
-    }
-    free(members);
-    
     /* pack the normals array (we previously allocated the maximum
     number of normals that could possibly be created (numtriangles *
     3), so get rid of some of them (usually alot unless none of the
     facet normals were averaged)) */
-    normals = model->normals;
-    model->normals = (GLfloat*)malloc(sizeof(GLfloat)* 3* (model->numnormals+1));
-    for (i = 1; i <= model->numnormals; i++) {
-        model->normals[3 * i + 0] = normals[3 * i + 0];
-        model->normals[3 * i + 1] = normals[3 * i + 1];
-        model->normals[3 * i + 2] = normals[3 * i + 2];
-    }
-    free(normals);
+    model->normals = (GLfloat*)realloc(model->normals,
+        sizeof(GLfloat)* 3* (model->numnormals+1));
 }
 
 
@@ -1292,39 +2999,26 @@ glmDelete(GLMmodel* model)
             free(model->materials[i].name);
     }
     free(model->materials);
-    while(model->groups) {
-        group = model->groups;
-        model->groups = model->groups->next;
+    glmFreeNames(&model->materialnames);
+    for (group = model->groups; group; group = group->next) {
         free(group->name);
         free(group->triangles);
-        free(group);
     }
+    free(model->grouppool);
+    glmFreeNames(&model->groupnames);
     
     free(model);
 }
 
-/* glmReadOBJ: Reads a model description from a Wavefront .OBJ file.
- * Returns a pointer to the created object which should be free'd with
- * glmDelete().
+/* glmNewModel: allocate an empty model
  *
- * filename - name of the file containing the Wavefront .OBJ format data.  
+ * filename - name of the file the model is read from
  */
-GLMmodel* 
-glmReadOBJ(const char* filename)
+static GLMmodel*
+glmNewModel(const char* filename)
 {
     GLMmodel* model;
-    FILE* file;
-    
-    /* open the file */
-    file = fopen(filename, "r");
-    if (!file) {
-        fprintf(stderr, "glmReadOBJ() failed: can't open data file \"%s\".\n",
-            filename);
-       fprintf(stderr, "error: %s\n", strerror(errno));
-        exit(1);
-    }
-    
-    /* allocate a new model */
+
     model = (GLMmodel*)malloc(sizeof(GLMmodel));
     model->pathname    = strdup(filename);
     model->mtllibname    = NULL;
@@ -1342,9 +3036,92 @@ glmReadOBJ(const char* filename)
     model->materials       = NULL;
     model->numgroups       = 0;
     model->groups      = NULL;
+    model->grouppool     = NULL;
+    model->maxgroups     = 0;
+    memset(&model->materialnames, 0, sizeof(GLMnametable));
+    memset(&model->groupnames, 0, sizeof(GLMnametable));
     model->position[0]   = 0.0;
     model->position[1]   = 0.0;
     model->position[2]   = 0.0;
+
+    return model;
+}
+
+/* glmReadOBJ: Reads a model description from a Wavefront .OBJ file.
+ * Returns a pointer to the created object which should be free'd with
+ * glmDelete().
+ *
+ * The file is mapped into memory and read in a single pass.
+ *
+ * filename - name of the file containing the Wavefront .OBJ format data.  
+ */
+GLMmodel* 
+glmReadOBJ(const char* filename)
+{
+    return glmReadOBJThreaded(filename, 1);
+}
+
+/* glmReadOBJThreaded: Reads a model description from a Wavefront .OBJ
+ * file, splitting it into chunks that are parsed on several threads.
+ * The model is the same as the one read by glmReadOBJ().
+ *
+ * filename   - name of the file containing the Wavefront .OBJ format data.
+ * numthreads - number of threads to use, 0 for as many as available
+ */
+GLMmodel*
+glmReadOBJThreaded(const char* filename, GLuint numthreads)
+{
+    GLMmodel* model;
+    GLMfile file;
+    
+    /* map the file */
+    if (!glmMapFile(filename, &file)) {
+        fprintf(stderr, "glmReadOBJ() failed: can't open data file \"%s\".\n",
+            filename);
+       fprintf(stderr, "error: %s\n", strerror(errno));
+        exit(1);
+    }
+
+#ifdef _OPENMP
+    if (numthreads == 0)
+        numthreads = omp_get_max_threads();
+#else
+    numthreads = 1;
+#endif
+    
+    /* allocate a new model */
+    model = glmNewModel(filename);
+    
+    glmParseOBJ(model, file.data, file.data + file.size, numthreads);
+    
+    glmUnmapFile(&file);
+    
+    return model;
+}
+
+/* glmReadOBJTwoPass: Reads a model description from a Wavefront .OBJ
+ * file using the original two pass fscanf() reader.  Slower than
+ * glmReadOBJ(), kept around to compare against.
+ *
+ * filename - name of the file containing the Wavefront .OBJ format data.  
+ */
+GLMmodel* 
+glmReadOBJTwoPass(const char* filename)
+{
+    GLMmodel* model;
+    FILE* file;
+    
+    /* open the file */
+    file = fopen(filename, "r");
+    if (!file) {
+        fprintf(stderr, "glmReadOBJ() failed: can't open data file \"%s\".\n",
+            filename);
+       fprintf(stderr, "error: %s\n", strerror(errno));
+        exit(1);
+    }
+    
+    /* allocate a new model */
+    model = glmNewModel(filename);
     
     /* make a first pass through the file to get a count of the number
     of vertices, normals, texcoords & triangles */
@@ -1716,6 +3493,43 @@ glmList(GLMmodel* model, GLuint mode)
 }
 #endif
 
+/* glmWeldIndices: weld one of the vector arrays of a model and point
+ * the triangles at the kept vectors
+ *
+ * vectors    - pointer to the model's array, replaced on return
+ * numvectors - pointer to the model's count, updated on return
+ * size       - number of components per vector, 2 or 3
+ * epsilon    - maximum difference between vectors
+ * model      - model the triangles are in
+ * offset     - offset of the index array in GLMtriangle
+ */
+static GLvoid
+glmWeldIndices(GLfloat** vectors, GLuint* numvectors, GLuint size,
+               GLfloat epsilon, GLMmodel* model, size_t offset)
+{
+    GLfloat* copies;
+    GLuint* remap;
+    GLuint* indices;
+    GLuint i;
+    
+    remap = (GLuint*)malloc(sizeof(GLuint) * (*numvectors + 1));
+    copies = glmWeldArray(*vectors, size, numvectors, epsilon, remap);
+    
+    for (i = 0; i < model->numtriangles; i++) {
+        indices = (GLuint*)((char*)&T(i) + offset);
+        indices[0] = remap[indices[0]];
+        indices[1] = remap[indices[1]];
+        indices[2] = remap[indices[2]];
+    }
+    
+    /* trim the copies down to the vectors that were kept */
+    free(*vectors);
+    *vectors = (GLfloat*)realloc(copies,
+        sizeof(GLfloat) * size * (*numvectors + 1));
+    
+    free(remap);
+}
+
 /* glmWeld: eliminate (weld) vectors that are within an epsilon of
  * each other.
  *
@@ -1726,6 +3540,48 @@ glmList(GLMmodel* model, GLuint mode)
  */
 GLvoid
 glmWeld(GLMmodel* model, GLfloat epsilon)
+{
+    glmWeldModel(model, epsilon, GLM_NONE);
+}
+
+/* glmWeldModel: eliminate (weld) vertices, and optionally normals and
+ * texture coordinates, that are within an epsilon of each other.
+ *
+ * model   - initialized GLMmodel structure
+ * epsilon - maximum difference between vectors
+ * mode    - a bitwise OR of values describing what is welded
+ *           GLM_NONE    -  weld only vertices
+ *           GLM_SMOOTH  -  weld normals
+ *           GLM_TEXTURE -  weld texture coords
+ */
+GLvoid
+glmWeldModel(GLMmodel* model, GLfloat epsilon, GLuint mode)
+{
+    assert(model);
+    
+    glmWeldIndices(&model->vertices, &model->numvertices, 3, epsilon,
+        model, offsetof(GLMtriangle, vindices));
+    
+    if ((mode & GLM_SMOOTH) && model->normals)
+        glmWeldIndices(&model->normals, &model->numnormals, 3, epsilon,
+            model, offsetof(GLMtriangle, nindices));
+    
+    if ((mode & GLM_TEXTURE) && model->texcoords)
+        glmWeldIndices(&model->texcoords, &model->numtexcoords, 2, epsilon,
+            model, offsetof(GLMtriangle, tindices));
+}
+
+/* glmWeldBruteForce: eliminate (weld) vertices that are within an
+ * epsilon of each other by comparing every vertex against every
+ * other.  Gives the same result as glmWeld().
+ *
+ * model   - initialized GLMmodel structure
+ * epsilon     - maximum difference between vertices
+ *               ( 0.00001 is a good start for a unitized model)
+ *
+ */
+GLvoid
+glmWeldBruteForce(GLMmodel* model, GLfloat epsilon)
 {
     GLfloat* vectors;
     GLfloat* copies;
@@ -1735,7 +3591,7 @@ glmWeld(GLMmodel* model, GLfloat epsilon)
     /* vertices */
     numvectors = model->numvertices;
     vectors  = model->vertices;
-    copies = glmWeldVectors(vectors, &numvectors, epsilon);
+    copies = glmWeldVectorsBruteForce(vectors, &numvectors, epsilon);
     
 #if 0
     printf("glmWeld(): %d redundant vertices.\n", 
@@ -65,6 +65,34 @@ typedef struct _GLMgroup {
   struct _GLMgroup* next;           /* pointer to next group in model */
 } GLMgroup;
 
+/* GLMname: A slot of a GLMnametable.
+ */
+typedef struct _GLMname {
+  const char* name;             /* the name, NULL if the slot is empty */
+  GLuint      hash;             /* hash of the name */
+  GLuint      index;            /* index of the group or material named */
+} GLMname;
+
+/* GLMnametable: Open addressing hash table from names to indices, so
+ * groups and materials are found by name in constant time.  The names
+ * are not copied, they belong to the group or material.
+ */
+typedef struct _GLMnametable {
+  GLuint   size;                /* number of slots, a power of 2 or 0 */
+  GLuint   count;               /* number of names held */
+  GLMname* slots;               /* array of slots */
+} GLMnametable;
+
+/* GLMadjacency: Structure that lists the triangles each vertex of a
+ * model is in.  The triangles of vertex v are triangles[offsets[v]]
+ * up to (but not including) triangles[offsets[v + 1]].
+ */
+typedef struct _GLMadjacency {
+  GLuint  numvertices;          /* number of vertices in model */
+  GLuint* offsets;              /* start of each vertex's triangles */
+  GLuint* triangles;            /* array of triangle indices */
+} GLMadjacency;
+
 /* GLMmodel: Structure that defines a model.
  */
 typedef struct _GLMmodel {
@@ -88,9 +116,13 @@ typedef struct _GLMmodel {
 
   GLuint       nummaterials;    /* number of materials in model */
   GLMmaterial* materials;       /* array of materials */
+  GLMnametable materialnames;   /* material names, for lookup */
 
   GLuint       numgroups;       /* number of groups in model */
-  GLMgroup*    groups;          /* linked list of groups */
+  GLMgroup*    groups;          /* linked list of groups, newest first */
+  GLMgroup*    grouppool;       /* array of the groups, oldest first */
+  GLuint       maxgroups;       /* number of groups grouppool has room for */
+  GLMnametable groupnames;      /* group names, for lookup */
 
   GLfloat position[3];          /* position of the model */
 
@@ -115,6 +147,46 @@ glmUnitize(GLMmodel* model);
 GLvoid
 glmDimensions(GLMmodel* model, GLfloat* dimensions);
 
+/* glmBounds: axis aligned bounding box of an array of points.  Packed
+ * points are swept with SSE or AVX, large arrays are split across
+ * threads.
+ *
+ * points - first point
+ * stride - GLfloats from one point to the next, 3 for packed points
+ * count  - number of points
+ * min    - array of 3 GLfloats, set to the smallest of each component
+ * max    - array of 3 GLfloats, set to the largest of each component
+ */
+GLvoid
+glmBounds(const GLfloat* points, GLuint stride, GLuint count,
+          GLfloat* min, GLfloat* max);
+
+/* glmBoundingSphere: sphere around the center of the bounding box of
+ * an array of points, large enough to hold them all.  Returns the
+ * radius.
+ *
+ * points - first point
+ * stride - GLfloats from one point to the next, 3 for packed points
+ * count  - number of points
+ * center - array of 3 GLfloats, set to the center of the sphere
+ */
+GLfloat
+glmBoundingSphere(const GLfloat* points, GLuint stride, GLuint count,
+                  GLfloat* center);
+
+/* glmTranslateScale: move then scale an array of points in one pass,
+ * point = (point + translate) * scale.
+ *
+ * points    - first point
+ * stride    - GLfloats from one point to the next, 3 for packed points
+ * count     - number of points
+ * translate - array of 3 GLfloats added to each point
+ * scale     - scalefactor applied after the translation
+ */
+GLvoid
+glmTranslateScale(GLfloat* points, GLuint stride, GLuint count,
+                  const GLfloat* translate, GLfloat scale);
+
 /* glmScale: Scales a model by a given amount.
  * 
  * model - properly initialized GLMmodel structure
@@ -136,11 +208,23 @@ glmReverseWinding(GLMmodel* model);
  * cross product of the two vectors derived from the sides of each
  * triangle).  Assumes a counter-clockwise winding.
  *
+ * Triangles are processed in blocks with SSE or AVX (when compiled
+ * with -mavx) and spread across threads with OpenMP.  Define
+ * GLM_NO_SIMD to use plain C.
+ *
  * model - initialized GLMmodel structure
  */
 GLvoid
 glmFacetNormals(GLMmodel* model);
 
+/* glmFacetNormalsScalar: Generates facet normals one triangle at a
+ * time.  glmFacetNormals() matches it to within a few ulps.
+ *
+ * model - initialized GLMmodel structure
+ */
+GLvoid
+glmFacetNormalsScalar(GLMmodel* model);
+
 /* glmVertexNormals: Generates smooth vertex normals for a model.
  * First builds a list of all the triangles each vertex is in.  Then
  * loops through each vertex in the the list averaging all the facet
@@ -160,6 +244,34 @@ glmFacetNormals(GLMmodel* model);
 GLvoid
 glmVertexNormals(GLMmodel* model, GLfloat angle);
 
+/* glmBuildAdjacency: Builds the list of triangles each vertex is in,
+ * packed into one array.  The lists can be reused until the vertices
+ * or triangles of the model change.
+ *
+ * model     - initialized GLMmodel structure
+ * adjacency - structure to fill in, free with glmDeleteAdjacency()
+ */
+GLvoid
+glmBuildAdjacency(GLMmodel* model, GLMadjacency* adjacency);
+
+/* glmDeleteAdjacency: Frees the lists built by glmBuildAdjacency().
+ *
+ * adjacency - structure filled in by glmBuildAdjacency()
+ */
+GLvoid
+glmDeleteAdjacency(GLMadjacency* adjacency);
+
+/* glmVertexNormalsAdjacency: Same as glmVertexNormals(), using lists
+ * of triangles built beforehand with glmBuildAdjacency().
+ *
+ * model     - initialized GLMmodel structure
+ * angle     - maximum angle (in degrees) to smooth across
+ * adjacency - triangles each vertex is in
+ */
+GLvoid
+glmVertexNormalsAdjacency(GLMmodel* model, GLfloat angle,
+                          const GLMadjacency* adjacency);
+
 /* glmLinearTexture: Generates texture coordinates according to a
  * linear projection of the texture map.  It generates these by
  * linearly mapping the vertices onto a square.
@@ -194,11 +306,33 @@ glmDelete(GLMmodel* model);
  * Returns a pointer to the created object which should be free'd with
  * glmDelete().
  *
- * filename - name of the file containing the Wavefront .OBJ format data.  
+ * The file is mapped into memory and read in a single pass.
+ *
+ * filename - name of the file containing the Wavefront .OBJ format data.
  */
-GLMmodel* 
+GLMmodel*
 glmReadOBJ(const char* filename);
 
+/* glmReadOBJThreaded: Reads a model description from a Wavefront .OBJ
+ * file, splitting it at line boundaries into chunks that are parsed
+ * on several threads and then merged.  The model is identical to the
+ * one read by glmReadOBJ().  Without OpenMP a single thread is used.
+ *
+ * filename   - name of the file containing the Wavefront .OBJ format data.
+ * numthreads - number of threads to use, 0 for as many as available
+ */
+GLMmodel*
+glmReadOBJThreaded(const char* filename, GLuint numthreads);
+
+/* glmReadOBJTwoPass: Reads a model description from a Wavefront .OBJ
+ * file using the original two pass fscanf() reader.  Slower than
+ * glmReadOBJ(), kept around to compare against.
+ *
+ * filename - name of the file containing the Wavefront .OBJ format data.
+ */
+GLMmodel*
+glmReadOBJTwoPass(const char* filename);
+
 /* glmWriteOBJ: Writes a model description in Wavefront .OBJ format to
  * a file.
  *
@@ -255,6 +389,32 @@ glmList(GLMmodel* model, GLuint mode);
 GLvoid
 glmWeld(GLMmodel* model, GLfloat epsilon);
 
+/* glmWeldModel: eliminate (weld) vertices, and optionally normals and
+ * texture coordinates, that are within an epsilon of each other.
+ * Vectors are hashed into a grid of epsilon sized cells so welding
+ * takes expected linear time.  glmWeld() is glmWeldModel() with
+ * GLM_NONE.
+ *
+ * model      - initialized GLMmodel structure
+ * epsilon    - maximum difference between vectors
+ * mode       - a bitwise OR of values describing what is welded
+ *              GLM_NONE    -  weld only vertices
+ *              GLM_SMOOTH  -  weld normals
+ *              GLM_TEXTURE -  weld texture coords
+ */
+GLvoid
+glmWeldModel(GLMmodel* model, GLfloat epsilon, GLuint mode);
+
+/* glmWeldBruteForce: eliminate (weld) vertices that are within an
+ * epsilon of each other by comparing every pair.  O(n^2), kept around
+ * to compare against glmWeld().
+ *
+ * model      - initialized GLMmodel structure
+ * epsilon    - maximum difference between vertices
+ */
+GLvoid
+glmWeldBruteForce(GLMmodel* model, GLfloat epsilon);
+
 /* glmReadPPM: read a PPM raw (type P6) file.  The PPM file has a header
  * that should look something like:
  *
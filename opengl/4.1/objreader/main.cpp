@@ -12,6 +12,9 @@
 #include <fstream>
 #include <vector>
 #include <utility>
+#include <algorithm>
+#include <thread>
+#include <mutex>
 
 #define _USE_MATH_DEFINES
 #include <math.h>
@@ -48,17 +51,70 @@ using std::string;
 #include <GLFW/glfw3.h>
 #include "config.h"
 #include "objmodel.h"
+#include "meshcache.h"
+#include "meshlet.h"
+#include "bvh.h"
+#include "filewatch.h"
+#include "streamupload.h"
 
 enum BUFFER_OBJECTS_ENUM
 {
    VERTEX_BUFFER = 0,
    NORMAL_BUFFER,
    TEXCOORD_BUFFER,
+   OBJ_INDEX_BUFFER,
    BUFFER_OBJECTS_NUM
 };
 
+// Buffers of each MeshObjects
+enum MESH_BUFFERS_ENUM
+{
+   LOD_VERTEX_BUFFER = 0,
+   LOD_INDEX_BUFFER,
+   BATCH_VERTEX_BUFFER,
+   BATCH_INDEX_BUFFER,
+   MESH_BUFFERS_NUM
+};
+
+//----------------------------------------------------------------------
+// What is built on the CPU from an OBJ file, see buildMesh(). Built
+// on the reload thread when the file changes and handed to the render
+// thread whole.
+//----------------------------------------------------------------------
+struct MeshData
+{
+   CachedMesh*                    lodMesh;      //< Vertices the levels of detail share, mapped from the mesh cache and released after upload
+   OBJIndexedBuffers              lodBuffers;   //< Layout of lodMesh's vertices
+   OBJLodChain                    lod;          //< Levels of detail of the model
+   std::vector<Meshlet::Clusters> clusters;     //< Clusters of each level of detail
+   BVH*                           bvh;          //< Hierarchy over the finest level, for picking
+   OBJIndexedBuffers              batchBuffers; //< Vertices and indices sorted by material, the vertices are released after upload
+   vector<OBJBatch>               batches;      //< Range of the indices drawn with each material
+   vector<glm::vec3>              batchColors;  //< Diffuse color of each batch
+   double                         saved;        //< When the file was saved, on FileWatcher::now()'s clock
+   double                         built;        //< When building finished
+
+   MeshData() : lodMesh(NULL), bvh(NULL), saved(0.0), built(0.0) {}
+   ~MeshData() { delete lodMesh; delete bvh; }
+
+private:
+   MeshData(const MeshData&);
+   MeshData& operator=(const MeshData&);
+};
+
+//----------------------------------------------------------------------
+// GL objects a MeshData is drawn from
+//----------------------------------------------------------------------
+struct MeshObjects
+{
+   GLuint lodVao;                    //< Array object for the levels of detail
+   GLuint batchVao;                  //< Array object for the vertices sorted by material
+   GLuint buffers[MESH_BUFFERS_NUM]; //< See MESH_BUFFERS_ENUM
+};
+
 // Global variables have an underscore prefix.
 GL::Program*        _program;        //< GLSL program
+GL::State&          _state = GL::State::current(); //< Skips binds and state changes that are already current
 GLuint              _vao;            //< Array object for the vertices
 std::vector<GLuint> _buffer;         //< List of OpenGL buffers
 bool                _running;        //< true if the program is running, false if it is time to terminate
@@ -69,6 +125,44 @@ vector<vec2>        _tcData;         //< Texture coordinate data
 std::string         _vertexFile;     //< Name of the vertex shader file
 std::string         _fragFile;       //< Name of the fragment shader file
 glm::mat4           _projection;     //< Camera projection matrix
+float               _distance;       //< Distance from the camera to the origin
+
+// The model as drawn, see buildMesh() and uploadMesh()
+MeshData*           _mesh;           //< Levels of detail, meshlets, batches and picking hierarchy
+MeshObjects         _objects[2];     //< Drawn from and uploaded into in turn, see swapMesh()
+int                 _front;          //< Index of the objects drawn from
+
+// Levels of detail
+GLuint              _lodLevel;       //< Level drawn last frame
+bool                _drawPoints;     //< Draw the assimp vertices as points too
+
+// Meshlets, see buildMesh()
+Meshlet::DrawList   _lodDrawList;    //< Clusters left after culling, rebuilt every frame
+bool                _cull;           //< True to skip clusters that are off screen or facing away
+GLuint              _culled;         //< Triangles culled since the last report
+GLuint              _drawn;          //< Triangles in the levels drawn since the last report
+double              _cullReportTime; //< Time of the last report
+
+// Material batches
+bool                _drawBatches;    //< Draw the full detail model by material rather than the levels of detail
+
+// Streaming, see initStream()
+size_t              _streamBudget;   //< Host memory for --stream in bytes, 0 to draw the model as loaded
+GLuint              _streamVao;      //< Array object for the streamed positions and indices
+GLuint              _streamBuffers[2]; //< Streamed positions, then indices
+GLuint              _streamIndices;  //< Number of streamed indices
+glm::vec3           _streamScale;    //< Fits the streamed positions in the unit cube, as unitize() does
+glm::vec3           _streamOffset;   //< Added after _streamScale
+
+// Reloading, see reload()
+std::string         _objFile;        //< The OBJ file drawn
+FileWatcher*        _watcher;        //< Watches the OBJ file and its material library
+std::thread         _reloader;       //< Runs reload()
+std::mutex          _reloadMutex;    //< Guards _reloaded
+MeshData*           _reloaded;       //< Built from the file saved last, waiting for a frame boundary
+MeshData*           _shown;          //< Swapped in and drawn, waiting for the GPU to finish the frame
+GLsync              _shownFence;     //< Fence after the first frame that drew _shown
+double              _uploadTime;     //< Seconds uploading _shown took
 
 // Window size
 int                 _winWidth;       //< Width of the window
@@ -104,14 +198,45 @@ void logException(const std::runtime_error& exception)
  */
 void terminate(int exitCode)
 {
-   // Delete vertex buffer objects
-   glDeleteBuffers(_buffer.size(), &_buffer[0]);
+   // Stop reloading before anything it hands over is deleted
+   if(_watcher)
+   {
+      _watcher->stop();
+      if(_reloader.joinable())
+      {
+         _reloader.join();
+      }
+      delete _watcher;
+      _watcher = NULL;
+   }
 
-   // Delete vertex array object
+   // Delete vertex buffer objects and vertex array objects
    if(_vao)
    {
-      glDeleteVertexArrays(1, &_vao);
+      glDeleteBuffers(_buffer.size(), &_buffer[0]);
+      _state.deleteVertexArrays(1, &_vao);
    }
+   for(int i = 0; i < 2; ++i)
+   {
+      if(_objects[i].lodVao)
+      {
+         _state.deleteVertexArrays(1, &_objects[i].lodVao);
+         _state.deleteVertexArrays(1, &_objects[i].batchVao);
+         glDeleteBuffers(MESH_BUFFERS_NUM, _objects[i].buffers);
+      }
+   }
+   if(_shownFence)
+   {
+      glDeleteSync(_shownFence);
+   }
+   if(_streamVao)
+   {
+      _state.deleteVertexArrays(1, &_streamVao);
+      glDeleteBuffers(2, _streamBuffers);
+   }
+
+   delete _mesh;
+   delete _reloaded;
    
    glfwTerminate();
 
@@ -139,66 +264,157 @@ void initGLEW(void)
 
 std::vector<aiVector3D> _objPos;
 std::vector<aiVector3D> _objNormals;
+std::vector<GLuint>     _objIndices;
 std::pair<aiVector3D, aiVector3D> _objBoundingBox;
-void addObjVertices(const aiScene* scene, const aiNode* node)
+
+/**
+ * A mesh placed in the scene by a node, and where its vertices and
+ * indices start in the flattened arrays
+ */
+struct ObjInstance
+{
+   const aiMesh* mesh;
+   aiMatrix4x4   transform;
+   GLuint        firstVertex;
+   GLuint        firstIndex;
+};
+
+/**
+ * Walk the node tree, counting vertices and indices, and note each mesh
+ * a node places along with its transform
+ *
+ * @param scene       The assimp scene
+ * @param node        Node to start at
+ * @param parent      Transform of the node's parent
+ * @param triangles   Number of triangles in each of the scene's meshes
+ * @param instances   Added to, one per mesh placed
+ * @param numVertices Added to, vertices in the meshes placed
+ * @param numIndices  Added to, indices in the meshes placed
+ */
+void countObjVertices(const aiScene* scene, const aiNode* node, const aiMatrix4x4& parent,
+                      const std::vector<GLuint>& triangles, std::vector<ObjInstance>& instances,
+                      GLuint& numVertices, GLuint& numIndices)
 {
-   for(int m = 0; m < node->mNumMeshes; m++)
+   aiMatrix4x4 transform = parent * node->mTransformation;
+   for(unsigned int m = 0; m < node->mNumMeshes; m++)
    {
-      const aiMesh* mesh = scene->mMeshes[node->mMeshes[m]];
-      
-      for(int f = 0; f < mesh->mNumFaces; f++)
-      {
-         const aiFace* face = &mesh->mFaces[f];
-         for(int i = 0; i < face->mNumIndices; i++)
-         {
-            int index = face->mIndices[i];
-            const aiVector3D& pos = mesh->mVertices[index];
-            const aiVector3D& normal = mesh->mNormals[index];
-            _objPos.push_back(pos);
-            _objNormals.push_back(normal);
-            
-            if(_objPos.size() == 1)
-            {
-               _objBoundingBox.first = pos;
-               _objBoundingBox.second = pos;
-            }
-            else
-            {
-               _objBoundingBox.first.x = _objBoundingBox.first.x > pos.x ? pos.x : _objBoundingBox.first.x;
-               _objBoundingBox.first.y = _objBoundingBox.first.y > pos.y ? pos.y : _objBoundingBox.first.y;
-               _objBoundingBox.first.z = _objBoundingBox.first.z > pos.z ? pos.z : _objBoundingBox.first.z;
+      ObjInstance instance;
+      instance.mesh = scene->mMeshes[node->mMeshes[m]];
+      instance.transform = transform;
+      instance.firstVertex = numVertices;
+      instance.firstIndex = numIndices;
+      instances.push_back(instance);
 
-               _objBoundingBox.second.x = _objBoundingBox.second.x < pos.x ? pos.x : _objBoundingBox.second.x;
-               _objBoundingBox.second.y = _objBoundingBox.second.y < pos.y ? pos.y : _objBoundingBox.second.y;
-               _objBoundingBox.second.z = _objBoundingBox.second.z < pos.z ? pos.z : _objBoundingBox.second.z;
-            }
-         }
+      numVertices += instance.mesh->mNumVertices;
+      numIndices += 3 * triangles[node->mMeshes[m]];
+   }
+
+   for(unsigned int n = 0; n < node->mNumChildren; n++)
+   {
+      countObjVertices(scene, node->mChildren[n], transform, triangles, instances,
+                       numVertices, numIndices);
+   }
+}
+
+/**
+ * Copy one placed mesh into its ranges of the flattened arrays, moving
+ * the positions by its transform and the normals by the inverse
+ * transpose. Points and lines are left out of the indices.
+ *
+ * @param instance The mesh, its transform and where it goes
+ */
+void addObjVertices(const ObjInstance& instance)
+{
+   const aiMesh* mesh = instance.mesh;
+   aiMatrix3x3 normalTransform = aiMatrix3x3(instance.transform).Inverse().Transpose();
+
+   for(unsigned int v = 0; v < mesh->mNumVertices; v++)
+   {
+      _objPos[instance.firstVertex + v] = instance.transform * mesh->mVertices[v];
+      if(mesh->mNormals)
+      {
+         aiVector3D normal = normalTransform * mesh->mNormals[v];
+         _objNormals[instance.firstVertex + v] = normal.Normalize();
       }
    }
-   
-   for(int n = 0; n < node->mNumChildren; n++)
+
+   // A mesh with no triangles at the end starts one past the last index
+   GLuint* index = _objIndices.data() + instance.firstIndex;
+   for(unsigned int f = 0; f < mesh->mNumFaces; f++)
    {
-      addObjVertices(scene, node->mChildren[n]);
+      const aiFace& face = mesh->mFaces[f];
+      if(face.mNumIndices == 3)
+      {
+         *index++ = instance.firstVertex + face.mIndices[0];
+         *index++ = instance.firstVertex + face.mIndices[1];
+         *index++ = instance.firstVertex + face.mIndices[2];
+      }
    }
 }
 
-aiNode
 void readObj(const std::string& filename)
 {
+   double start = glfwGetTime();
    _aiScene = aiImportFile(filename.c_str(), aiProcessPreset_TargetRealtime_MaxQuality);
 
    if(_aiScene == NULL)
    {
       std::cerr << "assimp fail" << std::endl;
+      return;
    }
-   
+   double imported = glfwGetTime();
 
    const aiNode* rootNode = _aiScene->mRootNode;
    
    std::cout << "Num meshes: " << rootNode->mNumMeshes << std::endl;
    std::cout << "Num children: " << rootNode->mNumChildren << std::endl;
    
-   addObjVertices(_aiScene, rootNode);
+   // Count everything first so each array is allocated once
+   std::vector<GLuint> triangles(_aiScene->mNumMeshes, 0);
+   for(unsigned int m = 0; m < _aiScene->mNumMeshes; m++)
+   {
+      const aiMesh* mesh = _aiScene->mMeshes[m];
+      for(unsigned int f = 0; f < mesh->mNumFaces; f++)
+      {
+         triangles[m] += mesh->mFaces[f].mNumIndices == 3 ? 1 : 0;
+      }
+   }
+
+   std::vector<ObjInstance> instances;
+   GLuint numVertices = 0;
+   GLuint numIndices = 0;
+   countObjVertices(_aiScene, rootNode, aiMatrix4x4(), triangles, instances,
+                    numVertices, numIndices);
+   _objPos.assign(numVertices, aiVector3D());
+   _objNormals.assign(numVertices, aiVector3D());
+   _objIndices.assign(numIndices, 0);
+
+   // Then fill, each mesh writing to its own ranges
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+   for(int i = 0; i < int(instances.size()); i++)
+   {
+      addObjVertices(instances[i]);
+   }
+
+   double flattened = glfwGetTime();
+   size_t bytes = numVertices * 2 * sizeof(aiVector3D) + numIndices * sizeof(GLuint);
+   std::cout << "assimp: " << numVertices << " vertices, " << numIndices / 3 << " triangles in "
+             << instances.size() << " meshes, " << bytes / 1024 << " KB ("
+             << numIndices * 2 * sizeof(aiVector3D) / 1024 << " KB unindexed), imported in "
+             << 1e3 * (imported - start) << " ms, flattened in "
+             << 1e3 * (flattened - imported) << " ms" << std::endl;
+
+   // Bounds of all the vertices in one sweep, aiVector3D is 3 packed floats
+   GLfloat lo[3] = { 0.0f, 0.0f, 0.0f };
+   GLfloat hi[3] = { 0.0f, 0.0f, 0.0f };
+   if(!_objPos.empty())
+   {
+      glmBounds(&_objPos[0].x, 3, GLuint(_objPos.size()), lo, hi);
+   }
+   _objBoundingBox.first = aiVector3D(lo[0], lo[1], lo[2]);
+   _objBoundingBox.second = aiVector3D(hi[0], hi[1], hi[2]);
    
    float sizeX = _objBoundingBox.second.x - _objBoundingBox.first.x;
    float sizeY = _objBoundingBox.second.y - _objBoundingBox.first.y;
@@ -211,10 +427,473 @@ void readObj(const std::string& filename)
    
    scale = 1.0f / scale;
    
-   for(int i = 0; i < _objPos.size(); i++)
+   if(!_objPos.empty())
+   {
+      const GLfloat none[3] = { 0.0f, 0.0f, 0.0f };
+      glmTranslateScale(&_objPos[0].x, 3, GLuint(_objPos.size()), none, scale);
+   }
+}
+
+/**
+ * Point the vertex attributes of the bound vertex array object at
+ * interleaved indexed buffers, already in the bound array buffer
+ *
+ * @param buffers
+ *    The buffers' layout
+ */
+void setIndexedAttributes(const OBJIndexedBuffers& buffers)
+{
+   int attribLoc = _program->getAttribLocation("vertex");
+   if(attribLoc >= 0)
+   {
+      glVertexAttribPointer(attribLoc, 3, GL_FLOAT, GL_FALSE, buffers.stride, 0);
+      glEnableVertexAttribArray(attribLoc);
+   }
+
+   attribLoc = _program->getAttribLocation("normal");
+   if(attribLoc >= 0 && buffers.normalOffset >= 0)
+   {
+      glVertexAttribPointer(attribLoc, 3, GL_FLOAT, GL_FALSE, buffers.stride,
+                            (const GLvoid*) (size_t) buffers.normalOffset);
+      glEnableVertexAttribArray(attribLoc);
+   }
+
+   attribLoc = _program->getAttribLocation("tc");
+   if(attribLoc >= 0 && buffers.texcoordOffset >= 0)
+   {
+      glVertexAttribPointer(attribLoc, 2, GL_FLOAT, GL_FALSE, buffers.stride,
+                            (const GLvoid*) (size_t) buffers.texcoordOffset);
+      glEnableVertexAttribArray(attribLoc);
+   }
+   GL_ERR_CHECK();
+}
+
+/**
+ * Build levels of detail and material batches for the model. Touches
+ * no GL state, so it runs on the reload thread as well.
+ *
+ * Every level of detail shares one vertex buffer, the levels are
+ * ranges of one index buffer. The shared vertices come through the
+ * mesh cache, so they are only processed again when the file changes,
+ * and are uploaded straight from the mapped entry. Each level is split
+ * into meshlets for culling. The batches hold the full detail model
+ * sorted by material, so that each material is drawn with one call.
+ *
+ * @param filename
+ *    The OBJ file
+ * @param model
+ *    The model read from it, already unitized, for the batches
+ * @param mesh
+ *    Filled with what uploadMesh() and the draw functions need
+ */
+void buildMesh(const std::string& filename, OBJModel& model, MeshData& mesh)
+{
+   OBJMeshOptions options;
+   options.mode = GLM_SMOOTH | GLM_TEXTURE;
+   options.weldEpsilon = 1e-5f;
+   options.unitize = true;
+
+   mesh.lodMesh = OBJModel::load(filename, options, std::string(PROJECT_BINARY_DIR) + "/meshcache");
+   const CachedMesh& cached = *mesh.lodMesh;
+
+   // Only the layout, the vertices stay in the mapping
+   OBJIndexedBuffers& buffers = mesh.lodBuffers;
+   const MeshCacheAttribute* normal = cached.attribute(MeshCacheHeader::NORMAL);
+   const MeshCacheAttribute* texcoord = cached.attribute(MeshCacheHeader::TEXCOORD);
+   buffers.indexType = cached.indexType();
+   buffers.numVertices = cached.numVertices();
+   buffers.numIndices = cached.numIndices();
+   buffers.stride = cached.stride();
+   buffers.normalOffset = normal ? GLint(normal->offset) : -1;
+   buffers.texcoordOffset = texcoord ? GLint(texcoord->offset) : -1;
+
+   vector<GLuint> indices(cached.numIndices());
+   for(GLuint i = 0; i < cached.numIndices(); ++i)
+   {
+      indices[i] = cached.indexType() == GL_UNSIGNED_SHORT
+                 ? static_cast<const GLushort*>(cached.indices())[i]
+                 : static_cast<const GLuint*>(cached.indices())[i];
+   }
+
+   vector<GLfloat> ratios;
+   ratios.push_back(0.5f);
+   ratios.push_back(0.25f);
+   ratios.push_back(0.125f);
+   OBJLodChain& lod = mesh.lod;
+   const GLfloat* positions = static_cast<const GLfloat*>(cached.vertices());
+   OBJModel::createLodChain(positions, cached.stride(), cached.numVertices(), indices, ratios, lod);
+
+   // The batches are indexed from the model, with the normals the cache
+   // entry was built with
+   model.weld(options.weldEpsilon);
+   model.facetNormals();
+   model.vertexNormals(options.smoothAngle);
+
+   // Split each level into meshlets and put its triangles back in
+   // cluster order, so the clusters are ranges of the index buffer
+   mesh.clusters.resize(lod.levels.size());
+   for(size_t i = 0; i < lod.levels.size(); ++i)
+   {
+      const OBJLodLevel& level = lod.levels[i];
+      vector<GLuint> indices(lod.indices.begin() + level.firstIndex,
+                             lod.indices.begin() + level.firstIndex + level.numIndices);
+
+      Meshlet::Clusters& clusters = mesh.clusters[i];
+      Meshlet::build(positions, buffers.stride, buffers.numVertices, indices, clusters);
+      std::copy(clusters.indices.begin(), clusters.indices.end(), lod.indices.begin() + level.firstIndex);
+      vector<GLuint>().swap(clusters.indices);
+
+      std::cout << "LOD " << i << ": " << clusters.clusters.size() << " meshlets" << std::endl;
+   }
+
+   // Picking casts rays against the finest level
+   const OBJLodLevel& finest = lod.levels[0];
+   vector<GLuint> finestIndices(lod.indices.begin() + finest.firstIndex,
+                                lod.indices.begin() + finest.firstIndex + finest.numIndices);
+   mesh.bvh = new BVH(positions, buffers.stride, finestIndices);
+
+   double start = FileWatcher::now();
+   model.createBatches(GLM_SMOOTH | GLM_TEXTURE, mesh.batchBuffers, mesh.batches);
+   OBJModel::optimizeIndexedBuffers(mesh.batchBuffers, mesh.batches);
+   std::cout << "Batches built in " << 1e3 * (FileWatcher::now() - start) << " ms" << std::endl;
+
+   for(size_t i = 0; i < mesh.batches.size(); ++i)
+   {
+      // Without a material library every group uses the color the
+      // levels of detail are drawn in
+      const GLMmaterial* material = model.material(mesh.batches[i].material);
+      mesh.batchColors.push_back(material ? glm::vec3(material->diffuse[0], material->diffuse[1],
+                                                      material->diffuse[2])
+                                          : glm::vec3(0.9f, 0.6f, 0.5f));
+      std::cout << "  " << (material ? material->name : "default") << ": "
+                << mesh.batches[i].numIndices / 3 << " triangles" << std::endl;
+   }
+}
+
+/**
+ * Load a mesh into a set of GL objects, creating them the first time.
+ * The buffers are respecified rather than updated, so the driver can
+ * give them new storage instead of waiting for frames still reading
+ * the old contents.
+ *
+ * @param mesh
+ *    Built by buildMesh(), its vertices and indices are released
+ * @param objects
+ *    The objects to load into, not the ones being drawn from
+ */
+void uploadMesh(MeshData& mesh, MeshObjects& objects)
+{
+   if(!objects.lodVao)
+   {
+      glGenVertexArrays(1, &objects.lodVao);
+      glGenVertexArrays(1, &objects.batchVao);
+      glGenBuffers(MESH_BUFFERS_NUM, objects.buffers);
+   }
+
+   _state.bindVertexArray(objects.lodVao);
+
+   glBindBuffer(GL_ARRAY_BUFFER, objects.buffers[LOD_VERTEX_BUFFER]);
+   glBufferData(GL_ARRAY_BUFFER, mesh.lodMesh->vertexBytes(), mesh.lodMesh->vertices(),
+                GL_STATIC_DRAW);
+
+   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, objects.buffers[LOD_INDEX_BUFFER]);
+   glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.lod.indices.size() * sizeof(GLuint),
+                &mesh.lod.indices[0], GL_STATIC_DRAW);
+
+   setIndexedAttributes(mesh.lodBuffers);
+
+   _state.bindVertexArray(objects.batchVao);
+
+   glBindBuffer(GL_ARRAY_BUFFER, objects.buffers[BATCH_VERTEX_BUFFER]);
+   glBufferData(GL_ARRAY_BUFFER, mesh.batchBuffers.vertices.size() * sizeof(GLfloat),
+                &mesh.batchBuffers.vertices[0], GL_STATIC_DRAW);
+
+   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, objects.buffers[BATCH_INDEX_BUFFER]);
+   glBufferData(GL_ELEMENT_ARRAY_BUFFER, mesh.batchBuffers.indices.size(),
+                &mesh.batchBuffers.indices[0], GL_STATIC_DRAW);
+
+   setIndexedAttributes(mesh.batchBuffers);
+
+   // Only the layouts and the level ranges are needed from here on
+   delete mesh.lodMesh;
+   mesh.lodMesh = NULL;
+   vector<GLuint>().swap(mesh.lod.indices);
+   vector<GLfloat>().swap(mesh.batchBuffers.vertices);
+   vector<GLubyte>().swap(mesh.batchBuffers.indices);
+
+   _state.bindVertexArray(_vao);
+   GL_ERR_CHECK();
+}
+
+/**
+ * Reload thread. Waits for the OBJ file or its material library to be
+ * saved, then reads and builds the model again and leaves it in
+ * _reloaded for the render thread to swap in.
+ */
+void reload(void)
+{
+   double saved;
+   while(_watcher->wait(saved))
+   {
+      // glm exits rather than fail, so skip files that went away
+      // between the save and the read
+      if(!std::ifstream(_objFile.c_str()))
+      {
+         std::cerr << "Can't reload " << _objFile << std::endl;
+         continue;
+      }
+
+      MeshData* mesh = new MeshData;
+      mesh->saved = saved;
+      {
+         OBJModel model(_objFile);
+         model.unitize();
+         buildMesh(_objFile, model, *mesh);
+
+         // A save may have named another material library
+         vector<string> files(1, _objFile);
+         if(!model.materialLibrary().empty())
+         {
+            files.push_back(model.materialLibrary());
+         }
+         _watcher->watch(files);
+      }
+      mesh->built = FileWatcher::now();
+      std::cout << "Reloaded " << _objFile << " in " << 1e3 * (mesh->built - saved)
+                << " ms after the save" << std::endl;
+
+      // A mesh still waiting is out of date
+      std::lock_guard<std::mutex> lock(_reloadMutex);
+      delete _reloaded;
+      _reloaded = mesh;
+   }
+}
+
+/**
+ * Swap in a reloaded mesh, at the start of a frame. The mesh is loaded
+ * into the objects not drawn from, so the frames the GPU is still
+ * working through keep their buffers.
+ */
+void swapMesh(void)
+{
+   MeshData* mesh;
+   {
+      std::lock_guard<std::mutex> lock(_reloadMutex);
+      mesh = _reloaded;
+      _reloaded = NULL;
+   }
+   if(!mesh)
+   {
+      return;
+   }
+
+   double start = FileWatcher::now();
+   uploadMesh(*mesh, _objects[1 - _front]);
+   _uploadTime = FileWatcher::now() - start;
+   _front = 1 - _front;
+
+   delete _mesh;
+   _mesh = mesh;
+   _lodLevel = 0;
+
+   // Time the swap from the first frame that draws it, a swap that
+   // has not been seen yet is superseded
+   if(_shownFence)
+   {
+      glDeleteSync(_shownFence);
+      _shownFence = 0;
+   }
+   _shown = mesh;
+}
+
+/**
+ * After a frame is submitted, fence the first frame drawing a swapped
+ * in mesh and report once the GPU has passed the fence. The fence is
+ * polled, never waited on.
+ */
+void reportReload(void)
+{
+   if(!_shown)
+   {
+      return;
+   }
+   if(!_shownFence)
+   {
+      _shownFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      return;
+   }
+
+   GLenum status = glClientWaitSync(_shownFence, 0, 0);
+   if(status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED)
+   {
+      double shown = FileWatcher::now();
+      std::cout << "Reload: parsed and built " << 1e3 * (_shown->built - _shown->saved)
+                << " ms, uploaded " << 1e3 * _uploadTime << " ms, on screen "
+                << 1e3 * (shown - _shown->saved) << " ms after the save" << std::endl;
+      glDeleteSync(_shownFence);
+      _shownFence = 0;
+      _shown = NULL;
+   }
+}
+
+/**
+ * Stream the positions and triangles of an OBJ file straight into GL
+ * buffers, holding no more than _streamBudget bytes of it in memory,
+ * and set up an array object to draw them
+ *
+ * @param objFile
+ *    Name of the OBJ file
+ */
+void initStream(const std::string& objFile)
+{
+   GLfloat bounds[6];
+   _streamIndices = OBJStreamUploader::upload(objFile, _streamBudget, _streamBuffers[0],
+                                              _streamBuffers[1], bounds);
+
+   // Center and scale the model as glmUnitize() does to the one the
+   // other modes draw, so both come out the same size
+   glm::vec3 low(bounds[0], bounds[1], bounds[2]);
+   glm::vec3 high(bounds[3], bounds[4], bounds[5]);
+   glm::vec3 size(fabs(high.x) + fabs(low.x), fabs(high.y) + fabs(low.y),
+                  fabs(high.z) + fabs(low.z));
+   float largest = std::max(size.x, std::max(size.y, size.z));
+   _streamScale = glm::vec3(largest > 0.0f ? 2.0f / largest : 1.0f);
+   _streamOffset = -0.5f * (low + high) * _streamScale;
+
+   glGenVertexArrays(1, &_streamVao);
+   _state.bindVertexArray(_streamVao);
+   glBindBuffer(GL_ARRAY_BUFFER, _streamBuffers[0]);
+   int attribLoc = _program->getAttribLocation("vertex");
+   if(attribLoc >= 0)
+   {
+      glVertexAttribPointer(attribLoc, 3, GL_FLOAT, GL_FALSE, 0, 0);
+      glEnableVertexAttribArray(attribLoc);
+   }
+   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _streamBuffers[1]);
+
+   // Only positions are streamed, so every vertex gets the normal the
+   // model faces the camera with when unrotated
+   attribLoc = _program->getAttribLocation("normal");
+   if(attribLoc >= 0)
+   {
+      glVertexAttrib4f(attribLoc, 0.0f, 0.0f, 1.0f, 0.0f);
+   }
+   _state.bindVertexArray(_vao);
+   GL_ERR_CHECK();
+}
+
+/**
+ * Read the whole OBJ file and set up everything the level of detail,
+ * material and point modes draw from, then watch the file for saves
+ *
+ * @param objFile
+ *    Name of the OBJ file
+ */
+void initModel(const std::string& objFile)
+{
+   int attribLoc;
+
+   OBJModel* model = new OBJModel(objFile);
+   model->unitize();
+   
+   readObj(objFile);
+   
+   
+   GLuint mode = GLM_SMOOTH | GLM_TEXTURE;
+   
+   model->createBuffers(mode, _vertexData, _normalData, _tcData);
+
+   // Generate a single handle for a vertex array. Only one vertex
+   // array is needed
+   glGenVertexArrays(1, &_vao);
+   _buffer.resize(BUFFER_OBJECTS_NUM);
+   glGenBuffers(BUFFER_OBJECTS_NUM, &_buffer[0]);
+
+   // Bind that vertex array
+   _state.bindVertexArray(_vao);
+   
+   attribLoc = _program->getAttribLocation("vertex");
+   if(attribLoc >= 0)
+   {
+      // Make that vbo the current array buffer. Subsequent array buffer operations
+      // will affect this vbo
+      //
+      // It is possible to place all data into a single buffer object and use
+      // offsets to tell OpenGL where the data for a vertex array or any other
+      // attribute may reside.
+      glBindBuffer(GL_ARRAY_BUFFER, _buffer[VERTEX_BUFFER]);
+      GL_ERR_CHECK();
+   
+      // Set the data for the vbo. This will load it onto the GPU
+      glBufferData(GL_ARRAY_BUFFER, _vertexData.size() * sizeof(glm::vec4),
+                   &_vertexData[0], GL_STATIC_DRAW);
+   
+      glBufferData(GL_ARRAY_BUFFER, _objPos.size() * sizeof(aiVector3D), &_objPos[0], GL_STATIC_DRAW);
+      
+      // Specify the location and data format of the array of generic vertex attributes
+      glVertexAttribPointer(attribLoc,  // Attribute location in the shader program
+                            3,          // Number of components per attribute
+                            GL_FLOAT,   // Data type of attribute
+                            GL_FALSE,   // GL_TRUE / GL_FALSE: values are normalized true/false
+                            0,          // Stride
+                            0);         // Offset into currently bound array buffer for this data
+   
+      // Enable the generic vertex attribute array
+      glEnableVertexAttribArray(attribLoc);
+      GL_ERR_CHECK();
+   }
+
+   attribLoc = _program->getAttribLocation("normal");
+   if(attribLoc >= 0)
+   {
+      // Set up normal attribute
+      glBindBuffer(GL_ARRAY_BUFFER, _buffer[NORMAL_BUFFER]);
+   
+      glBufferData(GL_ARRAY_BUFFER, _normalData.size() * sizeof(glm::vec4),
+                   &_normalData[0], GL_STATIC_DRAW);
+   
+      glBufferData(GL_ARRAY_BUFFER, _objNormals.size() * sizeof(aiVector3D), &_objNormals[0], GL_STATIC_DRAW);
+      glVertexAttribPointer(attribLoc, 3, GL_FLOAT, GL_FALSE, 0, 0);
+      glEnableVertexAttribArray(attribLoc);
+      GL_ERR_CHECK();
+   }
+
+   attribLoc = _program->getAttribLocation("tc");
+   if(attribLoc >= 0)
+   {
+      // Set up texture attribute
+      glBindBuffer(GL_ARRAY_BUFFER, _buffer[TEXCOORD_BUFFER]);
+   
+      glBufferData(GL_ARRAY_BUFFER, _tcData.size() * sizeof(glm::vec2),
+                   &_tcData[0], GL_STATIC_DRAW);
+   
+      glVertexAttribPointer(_program->getAttribLocation("tc"), 2, GL_FLOAT, GL_FALSE, 0, 0);
+      glEnableVertexAttribArray(_program->getAttribLocation("tc"));
+      GL_ERR_CHECK();
+   }
+
+   // The assimp indices, so its triangles share vertices
+   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _buffer[OBJ_INDEX_BUFFER]);
+   glBufferData(GL_ELEMENT_ARRAY_BUFFER, _objIndices.size() * sizeof(GLuint),
+                _objIndices.empty() ? NULL : &_objIndices[0], GL_STATIC_DRAW);
+   GL_ERR_CHECK();
+
+   _mesh = new MeshData;
+   buildMesh(objFile, *model, *_mesh);
+   uploadMesh(*_mesh, _objects[_front]);
+
+   // Reload when the model or its materials are saved again. The
+   // assimp vertices drawn as points are not reloaded.
+   vector<string> files(1, objFile);
+   if(!model->materialLibrary().empty())
    {
-      _objPos[i] *= scale;
+      files.push_back(model->materialLibrary());
    }
+   _watcher = new FileWatcher(files);
+   _reloader = std::thread(reload);
+   std::cout << "Watching " << objFile << (_watcher->notified() ? " with inotify" : " by polling")
+             << std::endl;
+   delete model;
 }
 
 /**
@@ -226,93 +905,27 @@ void init(void)
    try {
       initGLEW();
       
-      int attribLoc;
-
-      
       std::string objFile = std::string(SOURCE_DIR) + std::string("/frank_mesh_smooth.obj");
       //std::string objFile = std::string(SOURCE_DIR) + std::string("/teapot.obj");
+      _objFile = objFile;
       
-      OBJModel* model = new OBJModel(objFile);
-      model->unitize();
-      
-      readObj(objFile);
-      
-      
-      GLuint mode = GLM_SMOOTH | GLM_TEXTURE;
-      
-      model->createBuffers(mode, _vertexData, _normalData, _tcData);
       _vertexFile = std::string(SOURCE_DIR) + "/vertex.c";
       _fragFile   = std::string(SOURCE_DIR) + "/fragment.c";
       
+      // After the first run the programs load from binaries kept here
+      GL::Program::setBinaryCache(std::string(PROJECT_BINARY_DIR) + "/program_cache");
       _program = new GL::Program(_vertexFile, _fragFile);
-      
-      // Generate a single handle for a vertex array. Only one vertex
-      // array is needed
-      glGenVertexArrays(1, &_vao);
-      _buffer.resize(BUFFER_OBJECTS_NUM);
-      glGenBuffers(BUFFER_OBJECTS_NUM, &_buffer[0]);
-
-      // Bind that vertex array
-      glBindVertexArray(_vao);
-      
-      attribLoc = _program->getAttribLocation("vertex");
-      if(attribLoc >= 0)
-      {
-         // Make that vbo the current array buffer. Subsequent array buffer operations
-         // will affect this vbo
-         //
-         // It is possible to place all data into a single buffer object and use
-         // offsets to tell OpenGL where the data for a vertex array or any other
-         // attribute may reside.
-         glBindBuffer(GL_ARRAY_BUFFER, _buffer[VERTEX_BUFFER]);
-         GL_ERR_CHECK();
-      
-         // Set the data for the vbo. This will load it onto the GPU
-         glBufferData(GL_ARRAY_BUFFER, _vertexData.size() * sizeof(glm::vec4),
-                      &_vertexData[0], GL_STATIC_DRAW);
-      
-         glBufferData(GL_ARRAY_BUFFER, _objPos.size() * sizeof(aiVector3D), &_objPos[0], GL_STATIC_DRAW);
-         
-         // Specify the location and data format of the array of generic vertex attributes
-         glVertexAttribPointer(attribLoc,  // Attribute location in the shader program
-                               3,          // Number of components per attribute
-                               GL_FLOAT,   // Data type of attribute
-                               GL_FALSE,   // GL_TRUE / GL_FALSE: values are normalized true/false
-                               0,          // Stride
-                               0);         // Offset into currently bound array buffer for this data
-      
-         // Enable the generic vertex attribute array
-         glEnableVertexAttribArray(attribLoc);
-         GL_ERR_CHECK();
-      }
+      std::cout << GL::Program::cacheReport() << std::endl;
 
-      attribLoc = _program->getAttribLocation("normal");
-      if(attribLoc >= 0)
+      // A streamed model is never held whole, so it is drawn on its own
+      // and the other modes are not set up
+      if(_streamBudget)
       {
-         // Set up normal attribute
-         glBindBuffer(GL_ARRAY_BUFFER, _buffer[NORMAL_BUFFER]);
-      
-         glBufferData(GL_ARRAY_BUFFER, _normalData.size() * sizeof(glm::vec4),
-                      &_normalData[0], GL_STATIC_DRAW);
-      
-         glBufferData(GL_ARRAY_BUFFER, _objNormals.size() * sizeof(aiVector3D), &_objNormals[0], GL_STATIC_DRAW);
-         glVertexAttribPointer(attribLoc, 3, GL_FLOAT, GL_FALSE, 0, 0);
-         glEnableVertexAttribArray(attribLoc);
-         GL_ERR_CHECK();
+         initStream(objFile);
       }
-
-      attribLoc = _program->getAttribLocation("tc");
-      if(attribLoc >= 0)
+      else
       {
-         // Set up texture attribute
-         glBindBuffer(GL_ARRAY_BUFFER, _buffer[TEXCOORD_BUFFER]);
-      
-         glBufferData(GL_ARRAY_BUFFER, _tcData.size() * sizeof(glm::vec2),
-                      &_tcData[0], GL_STATIC_DRAW);
-      
-         glVertexAttribPointer(_program->getAttribLocation("tc"), 2, GL_FLOAT, GL_FALSE, 0, 0);
-         glEnableVertexAttribArray(_program->getAttribLocation("tc"));
-         GL_ERR_CHECK();
+         initModel(objFile);
       }
 
       // Set the clear color
@@ -322,7 +935,7 @@ void init(void)
       glClearDepth(1.0f);
       
       // Enable depth test
-      glEnable(GL_DEPTH_TEST);
+      _state.enable(GL_DEPTH_TEST);
    } 
    catch (std::runtime_error exception)
    {
@@ -358,7 +971,7 @@ void resize(GLFWwindow* window, int width, int height)
    {
       // Set the affine transform of (x,y) from normalized device coordinates to
       // window coordinates. In this case, (-1,1) -> (0, width) and (-1,1) -> (0, height)
-      glViewport(0, 0, width, height);
+      _state.viewport(0, 0, width, height);
       GL_ERR_CHECK();
       
       _winWidth = width;
@@ -377,6 +990,60 @@ void resize(GLFWwindow* window, int width, int height)
    }
 }
 
+/**
+ * Cast a ray through the cursor and report the triangle under it
+ *
+ * @param x
+ *    Cursor x position in window coordinates
+ * @param y
+ *    Cursor y position in window coordinates
+ */
+void pick(double x, double y)
+{
+   // Only the whole model has a picking hierarchy
+   if(!_mesh)
+   {
+      return;
+   }
+
+   // The camera and model matrices that render() uses
+   glm::mat4 view = glm::lookAt(glm::vec3(0, 0, _distance), glm::vec3(0, 0, 0), glm::vec3(0, 1, 0));
+   glm::mat4 model = glm::mat4_cast(_objRot);
+   glm::mat4 toModel = glm::inverse(_projection * view * model);
+
+   // The points under the cursor on the near and far planes, in model space
+   float ndcX = float(2.0 * x / _winWidth - 1.0);
+   float ndcY = float(1.0 - 2.0 * y / _winHeight);
+   glm::vec4 nearPoint = toModel * glm::vec4(ndcX, ndcY, -1.0f, 1.0f);
+   glm::vec4 farPoint = toModel * glm::vec4(ndcX, ndcY, 1.0f, 1.0f);
+   glm::vec3 from = glm::vec3(nearPoint) / nearPoint.w;
+   glm::vec3 to = glm::vec3(farPoint) / farPoint.w;
+
+   BVH::Ray ray;
+   for(int k = 0; k < 3; ++k)
+   {
+      ray.origin[k] = from[k];
+      ray.direction[k] = to[k] - from[k];
+   }
+   ray.tmax = 1.0f;
+
+   BVH::Hit hit;
+   double start = glfwGetTime();
+   bool found = _mesh->bvh->intersect(ray, hit);
+   double elapsed = glfwGetTime() - start;
+
+   if(found)
+   {
+      glm::vec3 p = from + (to - from) * hit.t;
+      std::cout << "Picked triangle " << hit.triangle << " at (" << p.x << ", " << p.y << ", " << p.z
+                << ") in " << elapsed * 1e6 << " us" << std::endl;
+   }
+   else
+   {
+      std::cout << "Nothing under the cursor" << std::endl;
+   }
+}
+
 /**
  *  Mouse click callback
  *
@@ -400,6 +1067,12 @@ void mouseButton(GLFWwindow* window, int button, int action, int mods)
          _tracking = false;
       }
    }
+   else if(button == GLFW_MOUSE_BUTTON_2 && action == GLFW_PRESS)
+   {
+      double x, y;
+      glfwGetCursorPos(window, &x, &y);
+      pick(x, y);
+   }
 }
 
 /**
@@ -437,6 +1110,40 @@ void keypress(GLFWwindow* window, int key, int scancode, int state, int mods)
          case GLFW_KEY_ESCAPE:
             glfwSetWindowShouldClose(window, GL_TRUE);
             break;
+
+         // Move the camera in and out to change the level of detail
+         case GLFW_KEY_UP:
+            _distance = _distance * 0.8f > 0.5f ? _distance * 0.8f : 0.5f;
+            break;
+
+         case GLFW_KEY_DOWN:
+            _distance = _distance * 1.25f < 80.0f ? _distance * 1.25f : 80.0f;
+            break;
+
+         case GLFW_KEY_P:
+            _drawPoints = !_drawPoints;
+            break;
+
+         case GLFW_KEY_C:
+            _cull = !_cull;
+            std::cout << "Meshlet culling " << (_cull ? "on" : "off") << std::endl;
+            break;
+
+         case GLFW_KEY_M:
+            if(!_mesh)
+            {
+               break;
+            }
+            _drawBatches = !_drawBatches;
+            if(_drawBatches)
+            {
+               std::cout << "Drawing by material, " << _mesh->batches.size() << " draw calls" << std::endl;
+            }
+            else
+            {
+               std::cout << "Drawing levels of detail" << std::endl;
+            }
+            break;
       }
    }
 }
@@ -448,6 +1155,90 @@ void close(GLFWwindow* window)
 {
    glfwSetWindowShouldClose(window, GL_TRUE);
 }
+/**
+ * Draw the level of detail that suits the model's size on screen,
+ * leaving out the meshlets that can't be seen
+ *
+ * @param eye    Camera position
+ * @param model  Model matrix
+ * @param mvp    Model, view, projection matrix
+ */
+void drawLod(const glm::vec3& eye, const glm::mat4& model, const glm::mat4& mvp)
+{
+   // The levels of detail have no materials
+   _program->setUniform("diffuse", glm::vec3(0.9f, 0.6f, 0.5f));
+
+   const OBJLodChain& chain = _mesh->lod;
+
+   // Pick the level of detail from the size of the bounding sphere
+   // on screen
+   glm::vec4 center = model * glm::vec4(chain.center[0], chain.center[1], chain.center[2], 1.0f);
+   float distance = glm::length(eye - glm::vec3(center));
+   float radius = OBJLodChain::projectedRadius(chain.radius, distance, _projection[1][1],
+                                               float(_winHeight));
+   GLuint level = chain.select(radius);
+   if(level != _lodLevel)
+   {
+      std::cout << "LOD " << level << ": " << chain.levels[level].numIndices / 3
+                << " triangles, " << radius << " pixel radius" << std::endl;
+      _lodLevel = level;
+   }
+
+   // Draw the triangles, leaving out the meshlets that are off screen
+   // or facing away. Culling happens in model space.
+   const OBJLodLevel& lod = chain.levels[level];
+   _state.bindVertexArray(_objects[_front].lodVao);
+   if(_cull)
+   {
+      glm::vec4 modelEye = glm::inverse(model) * glm::vec4(eye, 1.0f);
+      GLfloat eyeModel[3] = { modelEye.x, modelEye.y, modelEye.z };
+      Meshlet::CullStats stats = Meshlet::cull(_mesh->clusters[level], glm::value_ptr(mvp), eyeModel,
+                                               lod.firstIndex, _lodDrawList);
+      _lodDrawList.draw();
+      _culled += stats.culled();
+   }
+   else
+   {
+      glDrawElements(GL_TRIANGLES, lod.numIndices, GL_UNSIGNED_INT,
+                     (const GLvoid*) (lod.firstIndex * sizeof(GLuint)));
+   }
+   _drawn += lod.numIndices / 3;
+   _state.bindVertexArray(_vao);
+}
+
+/**
+ * Draw the full detail model one material at a time
+ */
+void drawBatches(void)
+{
+   const MeshData& mesh = *_mesh;
+   _state.bindVertexArray(_objects[_front].batchVao);
+   for(size_t i = 0; i < mesh.batches.size(); ++i)
+   {
+      _program->setUniform("diffuse", mesh.batchColors[i]);
+      glDrawElements(GL_TRIANGLES, mesh.batches[i].numIndices, mesh.batchBuffers.indexType,
+                     (const GLvoid*) (size_t(mesh.batches[i].firstIndex) * mesh.batchBuffers.indexSize()));
+   }
+   _state.bindVertexArray(_vao);
+}
+
+/**
+ * Draw the positions and triangles streamed by initStream()
+ */
+void drawStream(void)
+{
+   _program->setUniform("diffuse", glm::vec3(0.9f, 0.6f, 0.5f));
+   _program->setUniform("positionScale", _streamScale);
+   _program->setUniform("positionOffset", _streamOffset);
+   _state.bindVertexArray(_streamVao);
+   glDrawElements(GL_TRIANGLES, _streamIndices, GL_UNSIGNED_INT, 0);
+
+   // The other modes draw unitized float positions
+   _program->setUniform("positionScale", glm::vec3(1.0f));
+   _program->setUniform("positionOffset", glm::vec3(0.0f));
+   _state.bindVertexArray(_vao);
+}
+
 /**
  * Main loop
  * @param time    time elapsed in seconds since the start of the program
@@ -460,7 +1251,8 @@ void render(double time)
      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
       // Camera matrix
-     glm::mat4 view       = glm::lookAt(glm::vec3(0,0,5), // Camera position is at (4,3,3), in world space
+     glm::vec3 eye        = glm::vec3(0, 0, _distance);
+     glm::mat4 view       = glm::lookAt(eye,              // Camera position, in world space
                                         glm::vec3(0,0,0), // and looks at the origin
                                         glm::vec3(0,1,0)  // Head is up (set to 0,-1,0 to look upside-down)
                                        );
@@ -483,11 +1275,40 @@ void render(double time)
      // Set the inverse transpose uniform
      _program->setUniform("invTP", invTP);
 
-     // Draw the triangles
-      //     glDrawArrays(GL_TRIANGLES, 0, _vertexData.size());
-     glDrawArrays(GL_POINTS, 0, _objPos.size());
+     if(_streamBudget)
+     {
+        drawStream();
+     }
+     else if(_drawBatches)
+     {
+        drawBatches();
+     }
+     else
+     {
+        drawLod(eye, model, mvp);
+     }
+
+     // Report the share culled about once a second
+     if(time - _cullReportTime >= 1.0)
+     {
+        if(_cull && _drawn)
+        {
+           std::cout << "Meshlets: culled " << _culled << " of " << _drawn << " triangles ("
+                     << 100.0 * _culled / _drawn << "%)" << std::endl;
+        }
+        std::cout << _state.report() << std::endl;
+        _culled = 0;
+        _drawn = 0;
+        _cullReportTime = time;
+     }
+
+     if(_drawPoints && _vao)
+     {
+        glDrawArrays(GL_POINTS, 0, _objPos.size());
+     }
       
      GL_ERR_CHECK();
+     _state.endFrame();
    }
    catch(std::runtime_error err)
    {
@@ -505,6 +1326,19 @@ int main(int argc, char* argv[])
    int width = 1024; // Initial window width
    int height = 768; // Initial window height
    _sensitivity = float(M_PI) / 360.0f;
+   _distance = 5.0f;
+   _cull = true;
+
+   // --stream=<KB> draws the model as streamed to the GPU within that
+   // much host memory, instead of the levels of detail or batches
+   for(int i = 1; i < argc; ++i)
+   {
+      std::string arg(argv[i]);
+      if(arg.compare(0, 9, "--stream=") == 0)
+      {
+         _streamBudget = size_t(atol(arg.c_str() + 9)) * 1024;
+      }
+   }
    
    // Open up the log file
    std::string logFile = std::string(PROJECT_BINARY_DIR) + "/log.txt";
@@ -560,11 +1394,15 @@ int main(int argc, char* argv[])
    // Loop until the user closes the window
    while(!glfwWindowShouldClose(window))
    {
+      // Swap in a reloaded model between frames
+      swapMesh();
+
       // Render scene
       render(glfwGetTime());
       
       // Swap front and back buffers
       glfwSwapBuffers(window);
+      reportReload();
       
       // Poll for and process events
       glfwPollEvents();
@@ -0,0 +1,327 @@
+//----------------------------------------------------------------------
+// meshcache.cpp
+//
+// Reading and writing of binary mesh cache files
+//----------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <iostream>
+#include <vector>
+
+#if !defined(_WIN32) && !defined(_WIN64)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#define MESH_CACHE_HAVE_MMAP 1
+#else
+#include <direct.h>
+#include <process.h>
+#define getpid _getpid
+#endif
+
+#include "meshcache.h"
+#include "objmodel.h"
+
+//----------------------------------------------------------------------
+// Round a byte offset up to the array alignment
+//----------------------------------------------------------------------
+static uint64_t alignOffset(uint64_t offset)
+{
+   return (offset + MESH_CACHE_ALIGN - 1) & ~uint64_t(MESH_CACHE_ALIGN - 1);
+}
+
+CachedMesh::CachedMesh(const char* data, size_t size, bool mapped)
+   : _data(data), _size(size), _mapped(mapped),
+     _header(reinterpret_cast<const MeshCacheHeader*>(data))
+{
+}
+
+CachedMesh::~CachedMesh()
+{
+#if MESH_CACHE_HAVE_MMAP
+   if(_mapped)
+   {
+      munmap((void*)_data, _size);
+      return;
+   }
+#endif
+   free((void*)_data);
+}
+
+CachedMesh* CachedMesh::open(const std::string& filename, uint64_t key)
+{
+   const char* data = NULL;
+   size_t size = 0;
+   bool mapped = false;
+
+#if MESH_CACHE_HAVE_MMAP
+   int fd = ::open(filename.c_str(), O_RDONLY);
+   if(fd < 0)
+   {
+      return NULL;
+   }
+
+   struct stat st;
+   if(fstat(fd, &st) < 0 || size_t(st.st_size) < sizeof(MeshCacheHeader))
+   {
+      close(fd);
+      return NULL;
+   }
+
+   size = size_t(st.st_size);
+   void* map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if(map == MAP_FAILED)
+   {
+      return NULL;
+   }
+   data = static_cast<const char*>(map);
+   mapped = true;
+#else
+   FILE* file = fopen(filename.c_str(), "rb");
+   if(!file)
+   {
+      return NULL;
+   }
+   fseek(file, 0, SEEK_END);
+   long length = ftell(file);
+   fseek(file, 0, SEEK_SET);
+   if(length < long(sizeof(MeshCacheHeader)))
+   {
+      fclose(file);
+      return NULL;
+   }
+
+   char* buffer = (char*) malloc(length);
+   size = fread(buffer, 1, length, file);
+   fclose(file);
+   data = buffer;
+#endif
+
+   CachedMesh* mesh = new CachedMesh(data, size, mapped);
+   const MeshCacheHeader& h = mesh->header();
+
+   GLuint indexSize = h.indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+   bool valid = memcmp(h.magic, "OBJM", 4) == 0
+             && h.version == MESH_CACHE_VERSION
+             && h.key == key
+             && h.numAttributes <= MESH_CACHE_MAX_ATTRIBUTES
+             && h.vertexBytes == uint64_t(h.numVertices) * h.stride
+             && h.indexBytes == uint64_t(h.numIndices) * indexSize
+             && h.vertexOffset % MESH_CACHE_ALIGN == 0
+             && h.indexOffset % MESH_CACHE_ALIGN == 0
+             && h.vertexOffset + h.vertexBytes <= size
+             && h.indexOffset + h.indexBytes <= size;
+
+   if(!valid)
+   {
+      delete mesh;
+      return NULL;
+   }
+   return mesh;
+}
+
+const MeshCacheAttribute* CachedMesh::attribute(uint32_t semantic) const
+{
+   for(uint32_t i = 0; i < _header->numAttributes; ++i)
+   {
+      if(_header->attributes[i].semantic == semantic)
+      {
+         return &_header->attributes[i];
+      }
+   }
+   return NULL;
+}
+
+MeshCache::MeshCache(const std::string& directory)
+   : _directory(directory)
+{
+}
+
+uint64_t MeshCache::hash(const void* data, size_t size, uint64_t seed)
+{
+   const unsigned char* bytes = static_cast<const unsigned char*>(data);
+   uint64_t h = seed;
+   for(size_t i = 0; i < size; ++i)
+   {
+      h ^= bytes[i];
+      h *= 1099511628211ull;
+   }
+   return h;
+}
+
+bool MeshCache::key(const std::string& source, uint64_t options,
+                    uint64_t& key, MeshCacheHeader* header)
+{
+   struct stat st;
+   if(stat(source.c_str(), &st) < 0)
+   {
+      return false;
+   }
+
+   // The same file reached through a different relative path should
+   // find the same entry
+   std::string path = source;
+#if !defined(_WIN32) && !defined(_WIN64)
+   char resolved[PATH_MAX];
+   if(realpath(source.c_str(), resolved))
+   {
+      path = resolved;
+   }
+#endif
+
+   int64_t time = int64_t(st.st_mtime);
+   uint64_t size = uint64_t(st.st_size);
+   uint32_t version = MESH_CACHE_VERSION;
+
+   key = hash(path.c_str(), path.length());
+   key = hash(&time, sizeof(time), key);
+#if defined(__linux__)
+   // Catch saves within the same second
+   int64_t nanoseconds = int64_t(st.st_mtim.tv_nsec);
+   key = hash(&nanoseconds, sizeof(nanoseconds), key);
+#endif
+   key = hash(&size, sizeof(size), key);
+   key = hash(&options, sizeof(options), key);
+   key = hash(&version, sizeof(version), key);
+
+   if(header)
+   {
+      header->key = key;
+      header->sourceTime = time;
+      header->sourceSize = size;
+   }
+   return true;
+}
+
+std::string MeshCache::path(uint64_t key) const
+{
+   char name[32];
+   snprintf(name, sizeof(name), "%016llx.mesh", (unsigned long long) key);
+   return _directory + "/" + name;
+}
+
+CachedMesh* CachedMesh::create(const MeshCacheHeader& source,
+                               const OBJIndexedBuffers& buffers)
+{
+   MeshCacheHeader header;
+   memset(&header, 0, sizeof(header));
+   memcpy(header.magic, "OBJM", 4);
+   header.version = MESH_CACHE_VERSION;
+   header.key = source.key;
+   header.sourceTime = source.sourceTime;
+   header.sourceSize = source.sourceSize;
+   header.numVertices = buffers.numVertices;
+   header.numIndices = buffers.numIndices;
+   header.indexType = buffers.indexType;
+   header.stride = buffers.stride;
+
+   MeshCacheAttribute* attribute = header.attributes;
+   attribute->semantic = MeshCacheHeader::POSITION;
+   attribute->components = 3;
+   attribute->type = GL_FLOAT;
+   attribute->offset = 0;
+   attribute++;
+   if(buffers.normalOffset >= 0)
+   {
+      attribute->semantic = MeshCacheHeader::NORMAL;
+      attribute->components = 3;
+      attribute->type = GL_FLOAT;
+      attribute->offset = buffers.normalOffset;
+      attribute++;
+   }
+   if(buffers.texcoordOffset >= 0)
+   {
+      attribute->semantic = MeshCacheHeader::TEXCOORD;
+      attribute->components = 2;
+      attribute->type = GL_FLOAT;
+      attribute->offset = buffers.texcoordOffset;
+      attribute++;
+   }
+   header.numAttributes = uint32_t(attribute - header.attributes);
+
+   GLuint floats = buffers.stride / sizeof(GLfloat);
+   for(GLuint i = 0; i < 3; ++i)
+   {
+      header.boundsMin[i] = buffers.numVertices ? buffers.vertices[i] : 0.0f;
+      header.boundsMax[i] = header.boundsMin[i];
+   }
+   for(GLuint v = 0; v < buffers.numVertices; ++v)
+   {
+      const GLfloat* p = &buffers.vertices[v * floats];
+      for(GLuint i = 0; i < 3; ++i)
+      {
+         header.boundsMin[i] = p[i] < header.boundsMin[i] ? p[i] : header.boundsMin[i];
+         header.boundsMax[i] = p[i] > header.boundsMax[i] ? p[i] : header.boundsMax[i];
+      }
+   }
+
+   header.vertexOffset = alignOffset(sizeof(MeshCacheHeader));
+   header.vertexBytes = uint64_t(buffers.numVertices) * buffers.stride;
+   header.indexOffset = alignOffset(header.vertexOffset + header.vertexBytes);
+   header.indexBytes = buffers.indices.size();
+
+   // The image is laid out exactly as the file, padding included
+   size_t size = size_t(header.indexOffset + header.indexBytes);
+   char* data = (char*) calloc(size, 1);
+   memcpy(data, &header, sizeof(header));
+   if(header.vertexBytes)
+   {
+      memcpy(data + header.vertexOffset, &buffers.vertices[0], header.vertexBytes);
+   }
+   if(header.indexBytes)
+   {
+      memcpy(data + header.indexOffset, &buffers.indices[0], header.indexBytes);
+   }
+   return new CachedMesh(data, size, false);
+}
+
+bool MeshCache::write(const CachedMesh& mesh) const
+{
+#if !defined(_WIN32) && !defined(_WIN64)
+   if(mkdir(_directory.c_str(), 0755) < 0 && errno != EEXIST)
+#else
+   if(_mkdir(_directory.c_str()) < 0 && errno != EEXIST)
+#endif
+   {
+      std::cerr << "Could not create mesh cache directory " << _directory << std::endl;
+      return false;
+   }
+
+   // Every writer has a temporary of its own, so processes or threads
+   // missing the same key at once never write into one file
+   static std::atomic<unsigned> writes(0);
+   char suffix[64];
+   snprintf(suffix, sizeof(suffix), ".%ld.%u.tmp", long(getpid()), writes++);
+
+   std::string filename = path(mesh.header().key);
+   std::string temporary = filename + suffix;
+   FILE* file = fopen(temporary.c_str(), "wb");
+   if(!file)
+   {
+      std::cerr << "Could not open " << temporary << " for writing" << std::endl;
+      return false;
+   }
+
+   bool ok = fwrite(mesh.data(), 1, mesh.size(), file) == mesh.size();
+   ok = fclose(file) == 0 && ok;
+
+#if defined(_WIN32) || defined(_WIN64)
+   // rename() won't replace an existing file on Windows
+   remove(filename.c_str());
+#endif
+   if(!ok || rename(temporary.c_str(), filename.c_str()) != 0)
+   {
+      std::cerr << "Could not write mesh cache file " << filename << std::endl;
+      remove(temporary.c_str());
+      return false;
+   }
+   return true;
+}
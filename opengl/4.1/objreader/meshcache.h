@@ -0,0 +1,228 @@
+//----------------------------------------------------------------------
+// meshcache.h
+//
+// Binary cache of processed meshes. Each entry holds indexed vertex
+// data ready for glBufferData and is mapped straight into memory when
+// it is read back, so nothing is parsed or copied on a cache hit.
+//
+// Author: Jeff Bowles <jbowles@riskybacon.com>
+//----------------------------------------------------------------------
+
+#ifndef _meshcache_h
+#define _meshcache_h
+
+#include <stdint.h>
+#include <string>
+
+#if defined(__APPLE_CC__)
+#include <OpenGL/gl3.h>
+#else
+#include <GL/glew.h>
+#include <GL/gl.h>
+#endif
+
+struct OBJIndexedBuffers;
+
+/// Bump whenever the layout of a cache file or the processing that
+/// produces it changes. Older files are then ignored and rewritten.
+#define MESH_CACHE_VERSION 1
+
+/// Vertex and index arrays start on multiples of this many bytes
+#define MESH_CACHE_ALIGN 64
+
+/// Most attributes a vertex can have
+#define MESH_CACHE_MAX_ATTRIBUTES 4
+
+//----------------------------------------------------------------------
+/// One vertex attribute, as passed to glVertexAttribPointer
+//----------------------------------------------------------------------
+struct MeshCacheAttribute
+{
+   /// What the attribute is, see MeshCacheHeader::Semantic
+   uint32_t semantic;
+
+   /// Number of components, 1 to 4
+   uint32_t components;
+
+   /// GL data type of each component, e.g. GL_FLOAT
+   uint32_t type;
+
+   /// GL_TRUE if integer components are normalized
+   uint32_t normalized;
+
+   /// Byte offset within a vertex
+   uint32_t offset;
+};
+
+//----------------------------------------------------------------------
+/// Start of every cache file. The vertex and index arrays follow at the
+/// offsets given, each aligned to MESH_CACHE_ALIGN bytes.
+//----------------------------------------------------------------------
+struct MeshCacheHeader
+{
+   enum Semantic
+   {
+      POSITION,
+      NORMAL,
+      TEXCOORD
+   };
+
+   /// "OBJM"
+   char magic[4];
+
+   /// MESH_CACHE_VERSION of the writer
+   uint32_t version;
+
+   /// Hash of the source path, modification time, size and processing
+   /// options the entry was made from
+   uint64_t key;
+
+   /// Modification time of the source file, seconds since the epoch
+   int64_t sourceTime;
+
+   /// Size of the source file in bytes
+   uint64_t sourceSize;
+
+   uint32_t numVertices;
+   uint32_t numIndices;
+
+   /// GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+   uint32_t indexType;
+
+   /// Bytes from one vertex to the next
+   uint32_t stride;
+
+   uint32_t numAttributes;
+   MeshCacheAttribute attributes[MESH_CACHE_MAX_ATTRIBUTES];
+
+   /// Axis aligned bounding box of the positions
+   float boundsMin[3];
+   float boundsMax[3];
+
+   /// Where the arrays are, in bytes from the start of the file
+   uint64_t vertexOffset;
+   uint64_t vertexBytes;
+   uint64_t indexOffset;
+   uint64_t indexBytes;
+};
+
+//----------------------------------------------------------------------
+/// A cache file mapped into memory. The vertex and index pointers can
+/// be handed straight to glBufferData.
+//----------------------------------------------------------------------
+class CachedMesh
+{
+public:
+   ///
+   /// Map a cache file
+   ///
+   /// \param filename Cache file to map
+   /// \param key Key the entry must have been written with
+   /// \return the mesh, or NULL if the file is missing, truncated, from
+   ///         another version or has a different key
+   ///
+   static CachedMesh* open(const std::string& filename, uint64_t key);
+
+   ///
+   /// Build a mesh in memory, laid out as it would be in a file
+   ///
+   /// \param header Key and source fields filled in by MeshCache::key()
+   /// \param buffers Vertices and indices to store
+   ///
+   static CachedMesh* create(const MeshCacheHeader& header,
+                             const OBJIndexedBuffers& buffers);
+
+   ///
+   /// Unmaps the file
+   ///
+   ~CachedMesh();
+
+   const MeshCacheHeader& header(void) const { return *_header; }
+
+   const void* vertices(void) const { return _data + _header->vertexOffset; }
+   GLsizeiptr vertexBytes(void) const { return GLsizeiptr(_header->vertexBytes); }
+
+   const void* indices(void) const { return _data + _header->indexOffset; }
+   GLsizeiptr indexBytes(void) const { return GLsizeiptr(_header->indexBytes); }
+
+   GLuint numVertices(void) const { return _header->numVertices; }
+   GLuint numIndices(void) const { return _header->numIndices; }
+   GLenum indexType(void) const { return _header->indexType; }
+   GLsizei stride(void) const { return _header->stride; }
+
+   ///
+   /// \return the attribute with the given semantic, or NULL
+   ///
+   const MeshCacheAttribute* attribute(uint32_t semantic) const;
+
+   ///
+   /// \return the whole image: header, arrays and padding
+   ///
+   const char* data(void) const { return _data; }
+   size_t size(void) const { return _size; }
+
+private:
+   CachedMesh(const char* data, size_t size, bool mapped);
+
+   const char*            _data;
+   size_t                 _size;
+   bool                   _mapped;
+   const MeshCacheHeader* _header;
+};
+
+//----------------------------------------------------------------------
+/// Directory of cache files, named after their keys
+//----------------------------------------------------------------------
+class MeshCache
+{
+public:
+   ///
+   /// \param directory Where the cache files live. Created when the
+   ///                  first entry is written.
+   ///
+   MeshCache(const std::string& directory);
+
+   ///
+   /// Compute the key of a source file
+   ///
+   /// \param source Source file name
+   /// \param options Hash of the processing options applied to it
+   /// \param key Set to the key
+   /// \param header If not NULL, sourceTime and sourceSize are filled in
+   /// \return false if the source can't be found
+   ///
+   static bool key(const std::string& source, uint64_t options,
+                   uint64_t& key, MeshCacheHeader* header = NULL);
+
+   ///
+   /// \return the name of the cache file for a key
+   ///
+   std::string path(uint64_t key) const;
+
+   ///
+   /// Map the entry for a key
+   ///
+   /// \return the mesh, or NULL if there is no valid entry
+   ///
+   CachedMesh* open(uint64_t key) const { return CachedMesh::open(path(key), key); }
+
+   ///
+   /// Write a mesh to the cache under its key. The file is written under
+   /// a temporary name unique to the writer and renamed, so readers never
+   /// see a partial file and concurrent writers never share one.
+   ///
+   /// \return false if the file could not be written
+   ///
+   bool write(const CachedMesh& mesh) const;
+
+   ///
+   /// 64 bit FNV-1a hash, for building keys
+   ///
+   static uint64_t hash(const void* data, size_t size,
+                        uint64_t seed = 14695981039346656037ull);
+
+private:
+   std::string _directory;
+};
+
+#endif
@@ -4,10 +4,16 @@
 // Wrapper for Nate Robbin's glm code to read in Wavefront OBJ files
 //----------------------------------------------------------------------
 
+#include <math.h>
+#include <algorithm>
 #include <iostream>
+#include <stdexcept>
 #include <stdlib.h>
 #include <string.h>
 #include "objmodel.h"
+#include "vertexcache.h"
+#include "meshcache.h"
+#include "simplify.h"
 
 using std::cout;
 using std::endl;
@@ -17,7 +23,7 @@ using std::endl;
 //----------------------------------------------------------------------
 // Constructor
 //----------------------------------------------------------------------
-OBJModel::OBJModel(const std::string& filename)
+OBJModel::OBJModel(const std::string& filename, GLuint threads)
 {
    //------------------------------------------------------------------
    
@@ -30,8 +36,12 @@ OBJModel::OBJModel(const std::string& filename)
    filename.copy(fn, length, 0);
    fn[length] = '\0'; // Add NULL terminator to the string
    cout << "Reading OBJ file " << fn << endl;
-   _model = glmReadOBJ(fn);
+   _model = glmReadOBJThreaded(fn, threads);
    free(fn);
+
+   _adjacency.numvertices = 0;
+   _adjacency.offsets = NULL;
+   _adjacency.triangles = NULL;
    
    cout << "done reading obj model" << endl;
 }
@@ -46,57 +56,402 @@ void OBJModel::createBuffers(GLuint mode,
 {
    GLuint i;
    GLuint j;
-   GLMgroup* group = _model->groups;
+   GLMgroup* group;
    GLMtriangle* triangle;
    
    vertices.clear();
    normals.clear();
    texcoords.clear();
    
-   for (i = 0; i < group->numtriangles; i++) {
-      triangle = &T(group->triangles[i]);
-      GLfloat* ptr;
-      if (mode & GLM_FLAT)
-      {
-         // glNormal3fv(&model->facetnorms[3 * triangle->findex]);
-         ptr = &_model->facetnorms[3 * triangle->findex];
-         for(j = 0; j < 3; ++j)
+   // Every group, leaving out attributes the model doesn't have
+   for (group = _model->groups; group; group = group->next) {
+      for (i = 0; i < group->numtriangles; i++) {
+         triangle = &T(group->triangles[i]);
+         GLfloat* ptr;
+         if ((mode & GLM_FLAT) && _model->facetnorms)
          {
-            normals.push_back(glm::vec4(*ptr, *(ptr + 1), *(ptr + 2), 0.0f));
+            // glNormal3fv(&model->facetnorms[3 * triangle->findex]);
+            ptr = &_model->facetnorms[3 * triangle->findex];
+            for(j = 0; j < 3; ++j)
+            {
+               normals.push_back(glm::vec4(*ptr, *(ptr + 1), *(ptr + 2), 0.0f));
+            }
+         }
+      
+         if ((mode & GLM_SMOOTH) && _model->normals)
+         {
+            //         glNormal3fv(&model->normals[3 * triangle->nindices[0]]);
+            for(j = 0; j < 3; ++j)
+            {
+               ptr = &_model->normals[3 * triangle->nindices[j]];
+               normals.push_back(glm::vec4(*ptr, *(ptr + 1), *(ptr + 2), 0.0f));
+            }
+         }
+         if ((mode & GLM_TEXTURE) && _model->texcoords)
+         {
+            //         glTexCoord2fv(&model->texcoords[2 * triangle->tindices[0]]);
+            for(j = 0; j < 3; ++j)
+            {
+               ptr = &_model->texcoords[2 * triangle->tindices[j]];
+               texcoords.push_back(glm::vec2(*ptr, *(ptr + 1)));
+            }
          }
-      }
       
-      if (mode & GLM_SMOOTH)
-      {
-         //         glNormal3fv(&model->normals[3 * triangle->nindices[0]]);
          for(j = 0; j < 3; ++j)
          {
-            ptr = &_model->normals[3 * triangle->nindices[j]];
-            normals.push_back(glm::vec4(*ptr, *(ptr + 1), *(ptr + 2), 0.0f));
+            //      glVertex3fv(&model->vertices[3 * triangle->vindices[0]]);
+            ptr = &_model->vertices[3 * triangle->vindices[j]];
+            vertices.push_back(glm::vec4(*ptr,
+                                         *(ptr + 1),
+                                         *(ptr + 2),
+                                         1.0f));
          }
       }
-      if (mode & GLM_TEXTURE)
+   }
+}
+
+void OBJModel::createIndexedBuffers(GLuint mode, OBJIndexedBuffers& buffers)
+{
+   std::vector<GLMgroup*> groups;
+   for(GLMgroup* group = _model->groups; group; group = group->next)
+   {
+      groups.push_back(group);
+   }
+   indexGroups(mode, groups, buffers);
+}
+
+namespace
+{
+   bool materialLess(const GLMgroup* a, const GLMgroup* b)
+   {
+      return a->material < b->material;
+   }
+}
+
+void OBJModel::createBatches(GLuint mode, OBJIndexedBuffers& buffers,
+                             std::vector<OBJBatch>& batches)
+{
+   // Groups sharing a material end up next to each other, otherwise in
+   // file order
+   std::vector<GLMgroup*> groups;
+   for(GLMgroup* group = _model->groups; group; group = group->next)
+   {
+      if(group->numtriangles)
+      {
+         groups.push_back(group);
+      }
+   }
+   std::stable_sort(groups.begin(), groups.end(), materialLess);
+   indexGroups(mode, groups, buffers);
+
+   batches.clear();
+   GLuint first = 0;
+   for(size_t i = 0; i < groups.size(); ++i)
+   {
+      GLuint count = 3 * groups[i]->numtriangles;
+      if(!batches.empty() && batches.back().material == groups[i]->material)
+      {
+         batches.back().numIndices += count;
+      }
+      else
+      {
+         OBJBatch batch = { groups[i]->material, first, count };
+         batches.push_back(batch);
+      }
+      first += count;
+   }
+
+   cout << "Batches: " << groups.size() << " groups, " << batches.size()
+        << " materials drawn" << endl;
+}
+
+void OBJModel::indexGroups(GLuint mode, const std::vector<GLMgroup*>& groups,
+                           OBJIndexedBuffers& buffers)
+{
+   GLuint i;
+   GLuint j;
+   GLMtriangle* triangle;
+
+   // Leave out attributes the model doesn't have rather than reading
+   // through a NULL array
+   GLfloat* normals = NULL;
+   if((mode & GLM_FLAT) && _model->facetnorms)
+   {
+      normals = _model->facetnorms;
+   }
+   else if((mode & GLM_SMOOTH) && _model->normals)
+   {
+      normals = _model->normals;
+   }
+   GLfloat* texcoords = (mode & GLM_TEXTURE) ? _model->texcoords : NULL;
+
+   GLuint floats = 3;
+   buffers.normalOffset = -1;
+   buffers.texcoordOffset = -1;
+   if(normals)
+   {
+      buffers.normalOffset = floats * sizeof(GLfloat);
+      floats += 3;
+   }
+   if(texcoords)
+   {
+      buffers.texcoordOffset = floats * sizeof(GLfloat);
+      floats += 2;
+   }
+   buffers.stride = floats * sizeof(GLfloat);
+
+   GLuint corners = 0;
+   for(size_t g = 0; g < groups.size(); ++g)
+   {
+      corners += 3 * groups[g]->numtriangles;
+   }
+
+   // The corners are bucketed on their vertex index. Each bucket is a
+   // chain of the unique vertices made from that position, which
+   // rarely holds more than a handful of normal/texcoord combinations.
+   const GLuint end = ~0u;
+   std::vector<GLuint> head(_model->numvertices + 1, end);
+   std::vector<GLuint> next;
+   std::vector<GLuint> keys;
+   next.reserve(corners);
+   keys.reserve(2 * corners);
+
+   std::vector<GLuint> indices(corners);
+   buffers.vertices.resize(floats * corners);
+   GLfloat* out = corners ? &buffers.vertices[0] : NULL;
+
+   GLuint numVertices = 0;
+   GLuint corner = 0;
+   for(size_t g = 0; g < groups.size(); ++g)
+   {
+      const GLMgroup* group = groups[g];
+      for(i = 0; i < group->numtriangles; i++)
       {
-         //         glTexCoord2fv(&model->texcoords[2 * triangle->tindices[0]]);
+         triangle = &T(group->triangles[i]);
          for(j = 0; j < 3; ++j)
          {
-            ptr = &_model->texcoords[2 * triangle->tindices[j]];
-            texcoords.push_back(glm::vec2(*ptr, *(ptr + 1)));
+            GLuint v = triangle->vindices[j];
+            GLuint n = 0;
+            GLuint t = texcoords ? triangle->tindices[j] : 0;
+            if(normals)
+            {
+               n = normals == _model->facetnorms ? triangle->findex : triangle->nindices[j];
+            }
+
+            GLuint id = head[v];
+            while(id != end && (keys[2 * id] != n || keys[2 * id + 1] != t))
+            {
+               id = next[id];
+            }
+
+            if(id == end)
+            {
+               id = numVertices++;
+               next.push_back(head[v]);
+               head[v] = id;
+               keys.push_back(n);
+               keys.push_back(t);
+
+               GLfloat* ptr = &_model->vertices[3 * v];
+               *out++ = ptr[0];
+               *out++ = ptr[1];
+               *out++ = ptr[2];
+               if(normals)
+               {
+                  ptr = &normals[3 * n];
+                  *out++ = ptr[0];
+                  *out++ = ptr[1];
+                  *out++ = ptr[2];
+               }
+               if(texcoords)
+               {
+                  ptr = &texcoords[2 * t];
+                  *out++ = ptr[0];
+                  *out++ = ptr[1];
+               }
+            }
+            indices[corner++] = id;
          }
       }
-      
-      for(j = 0; j < 3; ++j)
+   }
+   buffers.vertices.resize(floats * numVertices);
+
+   buffers.numVertices = numVertices;
+
+   buffers.setIndices(indices, numVertices);
+
+   cout << "Indexed buffers: " << corners << " corners, "
+        << numVertices << " vertices, dedup ratio " << buffers.dedupRatio()
+        << ", " << 8 * buffers.indexSize() << " bit indices" << endl;
+}
+
+void OBJModel::optimizeIndexedBuffers(OBJIndexedBuffers& buffers,
+                                      GLuint cacheSize)
+{
+   OBJBatch all = { 0, 0, buffers.numIndices };
+   optimizeIndexedBuffers(buffers, std::vector<OBJBatch>(1, all), cacheSize);
+}
+
+void OBJModel::optimizeIndexedBuffers(OBJIndexedBuffers& buffers,
+                                      const std::vector<OBJBatch>& batches,
+                                      GLuint cacheSize)
+{
+   std::vector<GLuint> indices;
+   buffers.getIndices(indices);
+
+   VertexCache::Stats fifo = VertexCache::simulate(indices, buffers.numVertices,
+                                                   cacheSize, VertexCache::FIFO);
+   VertexCache::Stats lru = VertexCache::simulate(indices, buffers.numVertices,
+                                                  cacheSize, VertexCache::LRU);
+   cout << "Vertex cache before: ACMR " << fifo.acmr << " FIFO, " << lru.acmr
+        << " LRU; ATVR " << fifo.atvr << " FIFO, " << lru.atvr << " LRU" << endl;
+
+   // Each batch on its own, vertices shared between batches are
+   // renumbered once below
+   std::vector<GLuint> range;
+   for(size_t b = 0; b < batches.size(); ++b)
+   {
+      std::vector<GLuint>::iterator first = indices.begin() + batches[b].firstIndex;
+      range.assign(first, first + batches[b].numIndices);
+      VertexCache::optimize(range, buffers.numVertices, cacheSize);
+      std::copy(range.begin(), range.end(), first);
+   }
+   buffers.numVertices = VertexCache::reorderVertices(indices, buffers.vertices,
+                                                      buffers.stride / sizeof(GLfloat));
+   buffers.setIndices(indices, buffers.numVertices);
+
+   fifo = VertexCache::simulate(indices, buffers.numVertices, cacheSize, VertexCache::FIFO);
+   lru = VertexCache::simulate(indices, buffers.numVertices, cacheSize, VertexCache::LRU);
+   cout << "Vertex cache after:  ACMR " << fifo.acmr << " FIFO, " << lru.acmr
+        << " LRU; ATVR " << fifo.atvr << " FIFO, " << lru.atvr << " LRU" << endl;
+}
+
+void OBJModel::createLodChain(const OBJIndexedBuffers& buffers,
+                              const std::vector<GLfloat>& ratios,
+                              OBJLodChain& chain,
+                              GLfloat maxError)
+{
+   std::vector<GLuint> indices;
+   buffers.getIndices(indices);
+   createLodChain(buffers.numVertices ? &buffers.vertices[0] : NULL, buffers.stride,
+                  buffers.numVertices, indices, ratios, chain, maxError);
+}
+
+void OBJModel::createLodChain(const GLfloat* vertices, GLsizei stride,
+                              GLuint numVertices,
+                              const std::vector<GLuint>& indices,
+                              const std::vector<GLfloat>& ratios,
+                              OBJLodChain& chain,
+                              GLfloat maxError)
+{
+   GLuint floats = stride / sizeof(GLfloat);
+   GLuint numIndices = GLuint(indices.size());
+
+   // Bounding sphere around the center of the bounding box
+   chain.radius = glmBoundingSphere(numVertices ? vertices : NULL, floats,
+                                    numVertices, chain.center);
+
+   chain.indices = indices;
+   chain.levels.clear();
+   OBJLodLevel full = { 0, numIndices, 0.0f };
+   chain.levels.push_back(full);
+   cout << "LOD 0: " << numIndices / 3 << " triangles" << endl;
+
+   if(numIndices == 0)
+   {
+      return;
+   }
+
+   // Each level carries on from the one before, so errors are always
+   // measured against the full mesh
+   Simplifier simplifier(vertices, stride, numVertices, chain.indices);
+   for(size_t i = 0; i < ratios.size(); ++i)
+   {
+      GLuint target = GLuint(numIndices / 3 * ratios[i]) * 3;
+      GLuint previous = chain.levels.back().numIndices;
+      GLuint count = simplifier.simplify(target, maxError);
+      if(count >= previous)
       {
-         //      glVertex3fv(&model->vertices[3 * triangle->vindices[0]]);
-         ptr = &_model->vertices[3 * triangle->vindices[j]];
-         vertices.push_back(glm::vec4(*ptr,
-                                      *(ptr + 1),
-                                      *(ptr + 2),
-                                      1.0f));
+         cout << "LOD " << i + 1 << ": stopped at " << count / 3 << " triangles" << endl;
+         break;
       }
+
+      // The quadric error is only an estimate, so measure the distance
+      // select() relies on
+      OBJLodLevel level = { GLuint(chain.indices.size()), count, simplifier.distance() };
+      const std::vector<GLuint>& levelIndices = simplifier.indices();
+      chain.indices.insert(chain.indices.end(), levelIndices.begin(), levelIndices.end());
+      chain.levels.push_back(level);
+
+      cout << "LOD " << chain.levels.size() - 1 << ": " << count / 3 << " triangles, target "
+           << target / 3 << ", quadric error " << simplifier.error() << ", error "
+           << level.error << " ("
+           << (chain.radius > 0.0f ? 100.0f * level.error / chain.radius : 0.0f)
+           << "% of radius)" << endl;
    }
 }
 
+GLuint OBJLodChain::select(GLfloat projectedRadius, GLfloat maxPixelError) const
+{
+   // The error on screen scales with the sphere
+   GLfloat pixelsPerUnit = radius > 0.0f ? projectedRadius / radius : 0.0f;
+   GLuint level = 0;
+   for(GLuint i = 1; i < levels.size(); ++i)
+   {
+      if(levels[i].error * pixelsPerUnit <= maxPixelError)
+      {
+         level = i;
+      }
+   }
+   return level;
+}
+
+GLfloat OBJLodChain::projectedRadius(GLfloat radius, GLfloat distance,
+                                     GLfloat projectionScale, GLfloat viewportHeight)
+{
+   // Inside the sphere it covers the screen
+   if(distance <= radius)
+   {
+      return FLT_MAX;
+   }
+   return 0.5f * viewportHeight * projectionScale * radius / distance;
+}
+
+void OBJIndexedBuffers::getIndices(std::vector<GLuint>& out) const
+{
+   out.resize(numIndices);
+   for(GLuint i = 0; i < numIndices; ++i)
+   {
+      out[i] = index(i);
+   }
+}
+
+void OBJIndexedBuffers::setIndices(const std::vector<GLuint>& in, GLuint vertices)
+{
+   numIndices = GLuint(in.size());
+
+   // Use 16 bit indices when they can address every vertex, halving the
+   // size of the index buffer
+   if(vertices <= 65536)
+   {
+      indexType = GL_UNSIGNED_SHORT;
+      indices.resize(numIndices * sizeof(GLushort));
+      GLushort* out = reinterpret_cast<GLushort*>(numIndices ? &indices[0] : NULL);
+      for(GLuint i = 0; i < numIndices; ++i)
+      {
+         out[i] = GLushort(in[i]);
+      }
+   }
+   else
+   {
+      indexType = GL_UNSIGNED_INT;
+      indices.resize(numIndices * sizeof(GLuint));
+      if(numIndices)
+      {
+         memcpy(&indices[0], &in[0], numIndices * sizeof(GLuint));
+      }
+   }
+}
 
 void OBJModel::facetNormals(void)
 {
@@ -105,10 +460,118 @@ void OBJModel::facetNormals(void)
 
 void OBJModel::vertexNormals(float angle)
 {
-   glmVertexNormals(_model, angle);
+   glmVertexNormalsAdjacency(_model, angle, &adjacency());
+}
+
+const GLMadjacency& OBJModel::adjacency(void)
+{
+   if(!_adjacency.offsets)
+   {
+      glmBuildAdjacency(_model, &_adjacency);
+   }
+   return _adjacency;
+}
+
+uint64_t OBJMeshOptions::hash(void) const
+{
+   uint64_t h = MeshCache::hash(&mode, sizeof(mode));
+   h = MeshCache::hash(&weldEpsilon, sizeof(weldEpsilon), h);
+   h = MeshCache::hash(&smoothAngle, sizeof(smoothAngle), h);
+   h = MeshCache::hash(&unitize, sizeof(unitize), h);
+   return MeshCache::hash(&optimize, sizeof(optimize), h);
+}
+
+void OBJModel::weld(GLfloat epsilon)
+{
+   // Welding renumbers the vertices
+   if(_adjacency.offsets)
+   {
+      glmDeleteAdjacency(&_adjacency);
+   }
+   glmWeld(_model, epsilon);
+}
+
+void OBJModel::process(const OBJMeshOptions& options, OBJIndexedBuffers& buffers)
+{
+   if(options.weldEpsilon > 0.0f)
+   {
+      weld(options.weldEpsilon);
+   }
+   if(options.unitize)
+   {
+      unitize();
+   }
+
+   if(options.mode & (GLM_FLAT | GLM_SMOOTH))
+   {
+      facetNormals();
+   }
+   if((options.mode & GLM_SMOOTH) && options.smoothAngle > 0.0f)
+   {
+      vertexNormals(options.smoothAngle);
+   }
+
+   createIndexedBuffers(options.mode, buffers);
+   if(options.optimize)
+   {
+      optimizeIndexedBuffers(buffers);
+   }
+}
+
+CachedMesh* OBJModel::load(const std::string& filename,
+                           const OBJMeshOptions& options,
+                           const std::string& cacheDir,
+                           GLuint threads)
+{
+   MeshCacheHeader header;
+   uint64_t key;
+   if(!MeshCache::key(filename, options.hash(), key, &header))
+   {
+      throw std::runtime_error("Could not find OBJ file " + filename);
+   }
+
+   MeshCache cache(cacheDir);
+   CachedMesh* mesh = cache.open(key);
+   if(mesh)
+   {
+      cout << "Loaded " << filename << " from " << cache.path(key) << endl;
+      return mesh;
+   }
+
+   OBJIndexedBuffers buffers;
+   {
+      OBJModel model(filename, threads);
+      model.process(options, buffers);
+   }
+
+   // Still usable from memory if the cache can't be written
+   mesh = CachedMesh::create(header, buffers);
+   if(cache.write(*mesh))
+   {
+      cout << "Wrote " << cache.path(key) << endl;
+   }
+   return mesh;
+}
+
+std::string OBJModel::materialLibrary(void) const
+{
+   if(!_model->mtllibname)
+   {
+      return std::string();
+   }
+
+   // glmReadMTL() looks beside the OBJ file
+   std::string path(_model->pathname);
+   size_t slash = path.find_last_of("/\\");
+   std::string dir = slash == std::string::npos ? std::string() : path.substr(0, slash + 1);
+   return dir + _model->mtllibname;
 }
 
 OBJModel::~OBJModel()
 {
+   if(_adjacency.offsets)
+   {
+      glmDeleteAdjacency(&_adjacency);
+   }
    glmDelete(_model);
 }
\ No newline at end of file
@@ -7,6 +7,8 @@
 #ifndef _OBJModel_h
 #define _OBJModel_h
 
+#include <float.h>
+#include <stdint.h>
 #include <ostream>
 #include <string>
 #include <vector>
@@ -24,6 +26,183 @@ extern "C" {
 #include "glm.h"
 }
 
+//----------------------------------------------------------------------
+/// Vertex and index data for glDrawElements. Each unique combination of
+/// vertex, normal and texture coordinate index in the model becomes one
+/// vertex. Attributes are interleaved: position (3 floats), then the
+/// normal (3 floats) and texture coordinate (2 floats) when present.
+//----------------------------------------------------------------------
+struct OBJIndexedBuffers
+{
+   /// Interleaved vertex attributes
+   std::vector<GLfloat> vertices;
+
+   /// Indices, GLushort or GLuint depending on indexType
+   std::vector<GLubyte> indices;
+
+   /// GL_UNSIGNED_SHORT if every vertex fits in 16 bits, else GL_UNSIGNED_INT
+   GLenum indexType;
+
+   /// Number of unique vertices
+   GLuint numVertices;
+
+   /// Number of indices, three per triangle
+   GLuint numIndices;
+
+   /// Bytes from one vertex to the next
+   GLsizei stride;
+
+   /// Byte offset of the normal in a vertex, -1 if there are none
+   GLint normalOffset;
+
+   /// Byte offset of the texture coordinate in a vertex, -1 if there are none
+   GLint texcoordOffset;
+
+   ///
+   /// \return the size of one index in bytes
+   ///
+   GLuint indexSize(void) const
+   {
+      return indexType == GL_UNSIGNED_SHORT ? sizeof(GLushort) : sizeof(GLuint);
+   }
+
+   ///
+   /// \return index i, whatever its width
+   ///
+   GLuint index(GLuint i) const
+   {
+      if(indexType == GL_UNSIGNED_SHORT)
+      {
+         return reinterpret_cast<const GLushort*>(&indices[0])[i];
+      }
+      return reinterpret_cast<const GLuint*>(&indices[0])[i];
+   }
+
+   ///
+   /// Copy the indices out, widened to GLuint
+   ///
+   void getIndices(std::vector<GLuint>& out) const;
+
+   ///
+   /// Replace the indices, stored 16 bit if that can address every vertex
+   ///
+   void setIndices(const std::vector<GLuint>& in, GLuint vertices);
+
+   ///
+   /// \return triangle corners per unique vertex. 1 means nothing was
+   /// shared, a closed triangle mesh approaches 6.
+   ///
+   double dedupRatio(void) const
+   {
+      return numVertices ? double(numIndices) / double(numVertices) : 0.0;
+   }
+};
+
+//----------------------------------------------------------------------
+/// A range of the index buffer drawn with one material
+//----------------------------------------------------------------------
+struct OBJBatch
+{
+   /// Index into the model's materials
+   GLuint material;
+
+   /// First index of the range
+   GLuint firstIndex;
+
+   /// Number of indices, three per triangle
+   GLuint numIndices;
+};
+
+//----------------------------------------------------------------------
+/// How OBJModel::load() turns an OBJ file into indexed buffers. Every
+/// field is part of the mesh cache key.
+//----------------------------------------------------------------------
+struct OBJMeshOptions
+{
+   /// GLM_FLAT or GLM_SMOOTH, optionally OR'd with GLM_TEXTURE
+   GLuint mode;
+
+   /// Vertices closer than this are welded first, 0 to keep them all
+   GLfloat weldEpsilon;
+
+   /// Crease angle for generated vertex normals with GLM_SMOOTH. 0 keeps
+   /// the normals in the file.
+   GLfloat smoothAngle;
+
+   /// Translate to the origin and scale to fit a unit cube
+   bool unitize;
+
+   /// Reorder for the vertex cache
+   bool optimize;
+
+   OBJMeshOptions()
+      : mode(GLM_SMOOTH), weldEpsilon(0.0f), smoothAngle(90.0f),
+        unitize(false), optimize(true)
+   {
+   }
+
+   ///
+   /// \return a hash of the options, for the mesh cache key
+   ///
+   uint64_t hash(void) const;
+};
+
+//----------------------------------------------------------------------
+/// One level of detail in an OBJLodChain
+//----------------------------------------------------------------------
+struct OBJLodLevel
+{
+   /// First index of the level in OBJLodChain::indices
+   GLuint firstIndex;
+
+   /// Number of indices, three per triangle
+   GLuint numIndices;
+
+   /// Largest distance from a vertex of the full detail mesh to the
+   /// triangles of this level, measured after simplifying, in model
+   /// units. See Simplifier::distance().
+   GLfloat error;
+};
+
+//----------------------------------------------------------------------
+/// Levels of detail over one vertex buffer, finest first. Every level
+/// indexes the vertices of the OBJIndexedBuffers it was built from, so
+/// switching levels only changes the range passed to glDrawElements.
+//----------------------------------------------------------------------
+struct OBJLodChain
+{
+   /// Indices of every level, one after the other
+   std::vector<GLuint> indices;
+
+   std::vector<OBJLodLevel> levels;
+
+   /// Bounding sphere of the vertices
+   GLfloat center[3];
+   GLfloat radius;
+
+   ///
+   /// Pick a level for the bounding sphere's size on screen
+   ///
+   /// \param projectedRadius Radius of the bounding sphere in pixels
+   /// \param maxPixelError Largest error allowed on screen, in pixels
+   /// \return the coarsest level whose error stays below maxPixelError
+   ///
+   GLuint select(GLfloat projectedRadius, GLfloat maxPixelError = 1.0f) const;
+
+   ///
+   /// \param radius Radius of the bounding sphere
+   /// \param distance Distance from the eye to the center of the sphere
+   /// \param projectionScale Element [1][1] of the projection matrix,
+   ///                        1 / tan(fovy / 2)
+   /// \param viewportHeight Height of the viewport in pixels
+   /// \return the radius of the sphere on screen, in pixels
+   ///
+   static GLfloat projectedRadius(GLfloat radius, GLfloat distance,
+                                  GLfloat projectionScale, GLfloat viewportHeight);
+};
+
+class CachedMesh;
+
 //----------------------------------------------------------------------
 /// Wrapper class for Nate Robbin's glm OBJ file handling library. Adds
 /// the ability to find seams in a model.
@@ -54,14 +233,38 @@ public:
    /// Constructor
    /// 
    /// \param filename Name of the OBJ file
+   /// \param threads Number of threads to parse with, 0 for all available
    ///
-   OBJModel(const std::string&);
+   OBJModel(const std::string&, GLuint threads = 0);
    
    ///
    /// Destructor
    ///
    ~OBJModel();
 
+   ///
+   /// Load indexed buffers for an OBJ file through the mesh cache. If
+   /// the cache holds an entry for the file's current contents and the
+   /// same options it is mapped, otherwise the file is read, processed
+   /// and written to the cache first.
+   ///
+   /// \param filename Name of the OBJ file
+   /// \param options Processing to apply
+   /// \param cacheDir Directory holding the cache files
+   /// \param threads Number of threads to parse with, 0 for all available
+   /// \return the mapped mesh, delete when done. Throws
+   ///         std::runtime_error if the file can't be read.
+   ///
+   static CachedMesh* load(const std::string& filename,
+                           const OBJMeshOptions& options,
+                           const std::string& cacheDir,
+                           GLuint threads = 0);
+
+   ///
+   /// Process the model as load() does, without the cache
+   ///
+   void process(const OBJMeshOptions& options, OBJIndexedBuffers& buffers);
+
    ///
    /// Create buffers for use in glDrawArrays
    void createBuffers(GLuint mode,
@@ -69,6 +272,95 @@ public:
                       std::vector<glm::vec4>& normals,
                       std::vector<glm::vec2>& texcoords);
 
+   ///
+   /// Create buffers for use in glDrawElements. Triangle corners that
+   /// share the same vertex, normal and texture coordinate indices are
+   /// stored once. Every group of the model is included, in order.
+   ///
+   /// \param mode GLM_NONE, GLM_FLAT or GLM_SMOOTH, optionally OR'd with
+   ///             GLM_TEXTURE
+   /// \param buffers Filled in with the vertices and indices
+   ///
+   void createIndexedBuffers(GLuint mode, OBJIndexedBuffers& buffers);
+
+   ///
+   /// Create buffers for use in glDrawElements as createIndexedBuffers()
+   /// does, with the groups sorted by material. Groups that share a
+   /// material become one range of the indices, so the model draws with
+   /// one material change and one draw call per material.
+   ///
+   /// \param mode As for createIndexedBuffers()
+   /// \param buffers Filled in with the vertices and indices
+   /// \param batches Filled in with a range per material used, in order
+   ///                of the material's index
+   ///
+   void createBatches(GLuint mode, OBJIndexedBuffers& buffers,
+                      std::vector<OBJBatch>& batches);
+
+   ///
+   /// Reorder the triangles of indexed buffers for the post-transform
+   /// vertex cache, then the vertices in the order they are first used.
+   /// Prints the simulated FIFO and LRU cache miss ratios before and
+   /// after. Works on buffers from any model.
+   ///
+   /// \param buffers Buffers from createIndexedBuffers(), reordered in place
+   /// \param cacheSize Number of vertices in the cache to optimise for
+   ///
+   static void optimizeIndexedBuffers(OBJIndexedBuffers& buffers,
+                                      GLuint cacheSize = 32);
+
+   ///
+   /// Reorder as optimizeIndexedBuffers() does, moving triangles only
+   /// within their batch so the batches stay valid
+   ///
+   /// \param buffers Buffers from createBatches(), reordered in place
+   /// \param batches Batches from createBatches()
+   /// \param cacheSize Number of vertices in the cache to optimise for
+   ///
+   static void optimizeIndexedBuffers(OBJIndexedBuffers& buffers,
+                                      const std::vector<OBJBatch>& batches,
+                                      GLuint cacheSize = 32);
+
+   ///
+   /// Build levels of detail by quadric edge collapse, see Simplifier.
+   /// Level 0 is the full mesh, each ratio adds a level with about that
+   /// fraction of its triangles. A level stops short of its ratio if
+   /// the quadric error would pass maxError or seams and borders block
+   /// further collapses; a level that removes nothing is left out.
+   /// Prints each level.
+   ///
+   /// \param buffers Buffers from createIndexedBuffers(), best welded
+   ///                so that the surface is connected
+   /// \param ratios Triangle fractions, decreasing
+   /// \param chain Filled in with the levels
+   /// \param maxError Largest quadric error allowed, Simplifier::error(),
+   ///                 in model units. The measured error of a level can
+   ///                 be larger.
+   ///
+   static void createLodChain(const OBJIndexedBuffers& buffers,
+                              const std::vector<GLfloat>& ratios,
+                              OBJLodChain& chain,
+                              GLfloat maxError = FLT_MAX);
+
+   ///
+   /// Build levels of detail over vertices that aren't in an
+   /// OBJIndexedBuffers, such as a CachedMesh's mapped vertices
+   ///
+   /// \param vertices First position, 3 floats
+   /// \param stride Bytes from one vertex to the next
+   /// \param numVertices Number of vertices
+   /// \param indices The full detail triangles, three indices each
+   /// \param ratios Triangle fractions, decreasing
+   /// \param chain Filled in with the levels
+   /// \param maxError Largest quadric error allowed, in model units
+   ///
+   static void createLodChain(const GLfloat* vertices, GLsizei stride,
+                              GLuint numVertices,
+                              const std::vector<GLuint>& indices,
+                              const std::vector<GLfloat>& ratios,
+                              OBJLodChain& chain,
+                              GLfloat maxError = FLT_MAX);
+
    ///
    /// Generate normals for each facet. Use this if the model does not
    /// have any normals. This will result in a flat shaded model as there
@@ -81,6 +373,12 @@ public:
    /// for creating a smoothly shaded model when no normals are provided.
    ///
    void vertexNormals(float angle);
+
+   ///
+   /// Lists of the triangles each vertex is in. Built on first use and
+   /// kept until the topology changes.
+   ///
+   const GLMadjacency& adjacency(void);
    
    ///
    /// Unitize a model by translating it to the origin and
@@ -90,16 +388,50 @@ public:
    GLfloat unitize(void) { return glmUnitize(_model); }
    
    void reverseWinding(void) { glmReverseWinding(_model); } 
+
+   ///
+   /// Weld vertices closer than epsilon to each other
+   ///
+   void weld(GLfloat epsilon);
+
+   /// \return the number of materials, 0 if the file has no library
+   GLuint numMaterials(void) const { return _model->nummaterials; }
+
+   ///
+   /// \return material i, such as OBJBatch::material, or NULL if the
+   /// file has no library
+   ///
+   const GLMmaterial* material(GLuint i) const
+   {
+      return i < _model->nummaterials ? &_model->materials[i] : NULL;
+   }
+
+   ///
+   /// \return the path of the material library, beside the OBJ file,
+   /// or an empty string if the file names none
+   ///
+   std::string materialLibrary(void) const;
    
    //------------------------------------------------------------------
    // Helper functions for finding seams
    //------------------------------------------------------------------
    
 private:
+
+   ///
+   /// Index the triangles of the given groups, in that order, as
+   /// createIndexedBuffers() describes
+   ///
+   void indexGroups(GLuint mode, const std::vector<GLMgroup*>& groups,
+                    OBJIndexedBuffers& buffers);
    
    ///
    /// Point to the wrapped model.
    GLMmodel* _model;
+
+   ///
+   /// Triangles each vertex is in, empty until adjacency() is called
+   GLMadjacency _adjacency;
 };
 
 #endif
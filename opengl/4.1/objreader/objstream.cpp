@@ -0,0 +1,256 @@
+//----------------------------------------------------------------------
+// objstream.cpp
+//
+// Streaming OBJ parser
+//----------------------------------------------------------------------
+
+#include <stdlib.h>
+#include <string.h>
+#include <sstream>
+#include <stdexcept>
+#include "objstream.h"
+
+/// Smallest memory budget OBJStreamProducer accepts
+static const size_t minimumBudget = 64 * 1024;
+
+OBJStreamProducer::OBJStreamProducer(const std::string& filename, size_t budget)
+   : _filename(filename)
+{
+   budget = budget < minimumBudget ? minimumBudget : budget;
+
+   // A quarter of the budget reads the file, the rest is split evenly
+   // between vertices and indices
+   size_t batch = (budget - budget / 4) / 2;
+   _read.resize(budget / 4 + 1);
+   _vertexBatch = GLuint(batch / (3 * sizeof(GLfloat)));
+   _indexBatch = GLuint(batch / (3 * sizeof(GLuint))) * 3;
+   _vertices.resize(3 * _vertexBatch);
+   _indices.resize(_indexBatch);
+
+   _file = fopen(filename.c_str(), "rb");
+   if(!_file)
+   {
+      throw std::runtime_error("Could not open OBJ file " + filename);
+   }
+}
+
+OBJStreamProducer::~OBJStreamProducer()
+{
+   fclose(_file);
+}
+
+size_t OBJStreamProducer::bytes(void) const
+{
+   return _read.size()
+        + _vertices.size() * sizeof(GLfloat)
+        + _indices.size() * sizeof(GLuint);
+}
+
+void OBJStreamProducer::count(GLuint& numVertices, GLuint& numIndices)
+{
+   parse(NULL);
+   numVertices = _numVertices;
+   numIndices = _numIndices;
+}
+
+void OBJStreamProducer::run(OBJStreamSink& sink)
+{
+   parse(&sink);
+}
+
+void OBJStreamProducer::parse(OBJStreamSink* sink)
+{
+   _numVertices = 0;
+   _numIndices = 0;
+   _lineNumber = 0;
+   _firstVertex = 0;
+   _firstIndex = 0;
+   _vertexFill = 0;
+   _indexFill = 0;
+   rewind(_file);
+
+   char* buffer = &_read[0];
+   size_t capacity = _read.size() - 1;
+   size_t carry = 0;
+   bool eof = false;
+
+   while(!eof || carry)
+   {
+      size_t n = eof ? 0 : fread(buffer + carry, 1, capacity - carry, _file);
+      eof = eof || n < capacity - carry;
+      size_t end = carry + n;
+
+      // Stops strtod() on a last line without a newline
+      buffer[end] = '\0';
+
+      // Only whole lines are parsed, the piece of a line at the end of
+      // the buffer is moved to the front and finished by the next read.
+      // At the end of the file the last line needs no newline.
+      size_t last = end;
+      if(!eof)
+      {
+         while(last > 0 && buffer[last - 1] != '\n')
+         {
+            --last;
+         }
+         if(last == 0)
+         {
+            std::ostringstream msg;
+            msg << _filename << ": line " << _lineNumber + 1
+                << " is longer than the read buffer (" << capacity << " bytes)";
+            throw std::runtime_error(msg.str());
+         }
+      }
+
+      const char* line = buffer;
+      const char* stop = buffer + last;
+      while(line < stop)
+      {
+         const char* next = static_cast<const char*>(memchr(line, '\n', stop - line));
+         next = next ? next : stop;
+         _lineNumber++;
+         parseLine(line, next, sink);
+         line = next + 1;
+      }
+
+      carry = end - last;
+      memmove(buffer, buffer + last, carry);
+      if(eof && carry == 0)
+      {
+         break;
+      }
+   }
+
+   if(sink)
+   {
+      flushVertices(sink);
+      flushIndices(sink);
+   }
+}
+
+void OBJStreamProducer::parseLine(const char* line, const char* end, OBJStreamSink* sink)
+{
+   while(line < end && (*line == ' ' || *line == '\t'))
+   {
+      ++line;
+   }
+   if(end - line < 2 || (line[1] != ' ' && line[1] != '\t'))
+   {
+      return;
+   }
+
+   if(line[0] == 'v')
+   {
+      if(sink)
+      {
+         // strtod() stops at the newline, or the terminator after the
+         // last line of the file
+         char* p = const_cast<char*>(line + 2);
+         GLfloat* v = &_vertices[3 * _vertexFill];
+         v[0] = GLfloat(strtod(p, &p));
+         v[1] = GLfloat(strtod(p, &p));
+         v[2] = GLfloat(strtod(p, &p));
+         if(++_vertexFill == _vertexBatch)
+         {
+            flushVertices(sink);
+         }
+      }
+      _numVertices++;
+   }
+   else if(line[0] == 'f')
+   {
+      const char* p = line + 2;
+      GLuint corners = 0;
+      GLuint first = 0;
+      GLuint previous = 0;
+
+      while(p < end)
+      {
+         while(p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+         {
+            ++p;
+         }
+         if(p == end)
+         {
+            break;
+         }
+
+         // v, v/t, v//n or v/t/n: only the position index is kept
+         char* after;
+         long index = strtol(p, &after, 10);
+         if(after == p)
+         {
+            std::ostringstream msg;
+            msg << _filename << ": bad face on line " << _lineNumber;
+            throw std::runtime_error(msg.str());
+         }
+         p = after;
+         while(p < end && *p != ' ' && *p != '\t' && *p != '\r')
+         {
+            ++p;
+         }
+
+         // Negative indices count back from the last vertex read
+         GLuint vertex = index < 0 ? GLuint(long(_numVertices) + index) : GLuint(index - 1);
+
+         if(corners == 0)
+         {
+            first = vertex;
+         }
+         else if(corners >= 2)
+         {
+            if(sink)
+            {
+               if(_indexFill + 3 > _indexBatch)
+               {
+                  flushIndices(sink);
+               }
+               _indices[_indexFill++] = first;
+               _indices[_indexFill++] = previous;
+               _indices[_indexFill++] = vertex;
+            }
+            _numIndices += 3;
+         }
+         previous = vertex;
+         corners++;
+      }
+   }
+}
+
+void OBJStreamProducer::flushVertices(OBJStreamSink* sink)
+{
+   if(_vertexFill == 0)
+   {
+      return;
+   }
+
+   OBJStreamBatch batch;
+   batch.type = OBJStreamBatch::VERTICES;
+   batch.first = _firstVertex;
+   batch.count = GLuint(_vertexFill);
+   batch.data = &_vertices[0];
+   batch.bytes = GLsizeiptr(3 * _vertexFill * sizeof(GLfloat));
+   sink->consume(batch);
+
+   _firstVertex += batch.count;
+   _vertexFill = 0;
+}
+
+void OBJStreamProducer::flushIndices(OBJStreamSink* sink)
+{
+   if(_indexFill == 0)
+   {
+      return;
+   }
+
+   OBJStreamBatch batch;
+   batch.type = OBJStreamBatch::INDICES;
+   batch.first = _firstIndex;
+   batch.count = GLuint(_indexFill);
+   batch.data = &_indices[0];
+   batch.bytes = GLsizeiptr(_indexFill * sizeof(GLuint));
+   sink->consume(batch);
+
+   _firstIndex += batch.count;
+   _indexFill = 0;
+}
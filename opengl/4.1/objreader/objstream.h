@@ -0,0 +1,155 @@
+//----------------------------------------------------------------------
+// objstream.h
+//
+// Reads an OBJ file in fixed size pieces and hands out batches of
+// vertex positions and triangle indices as they are finished, so a
+// mesh larger than memory can be uploaded to the GPU a batch at a time.
+// No OpenGL calls are made here; see streamupload.h for the GL side.
+//
+// Author: Jeff Bowles <jbowles@riskybacon.com>
+//----------------------------------------------------------------------
+
+#ifndef _objstream_h
+#define _objstream_h
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#if defined(__APPLE_CC__)
+#include <OpenGL/gl3.h>
+#else
+#include <GL/glew.h>
+#include <GL/gl.h>
+#endif
+
+//----------------------------------------------------------------------
+/// A run of finished vertices or indices. The data is only valid during
+/// the call to OBJStreamSink::consume().
+//----------------------------------------------------------------------
+struct OBJStreamBatch
+{
+   enum Type
+   {
+      VERTICES, ///< 3 GLfloats per vertex
+      INDICES   ///< GLuint, 3 per triangle, 0 based
+   };
+
+   Type type;
+
+   /// First vertex or index of the batch within the whole mesh
+   GLuint first;
+
+   /// Number of vertices or indices in the batch
+   GLuint count;
+
+   const void* data;
+
+   /// Size of data in bytes
+   GLsizeiptr bytes;
+
+   /// \return byte offset of the batch within the whole array
+   GLintptr offset(void) const
+   {
+      return GLintptr(first) * (type == VERTICES ? 3 * sizeof(GLfloat) : sizeof(GLuint));
+   }
+};
+
+//----------------------------------------------------------------------
+/// Receives batches from OBJStreamProducer::run()
+//----------------------------------------------------------------------
+class OBJStreamSink
+{
+public:
+   virtual ~OBJStreamSink() {}
+
+   ///
+   /// Called for each finished batch, in file order
+   ///
+   virtual void consume(const OBJStreamBatch& batch) = 0;
+};
+
+//----------------------------------------------------------------------
+/// Streaming OBJ parser. Only positions and faces are read: texture
+/// coordinates and normals have their own indices in an OBJ file, and
+/// pairing them with positions needs the whole file in memory. Faces
+/// with more than three vertices are split into a fan, as glm.c does.
+///
+/// \code
+/// OBJStreamProducer producer("big.obj", 64 << 20);
+/// GLuint vertices, indices;
+/// producer.count(vertices, indices);
+/// // ... size buffers
+/// producer.run(sink);
+/// \endcode
+//----------------------------------------------------------------------
+class OBJStreamProducer
+{
+public:
+   ///
+   /// Constructor. Throws std::runtime_error if the file can't be opened.
+   ///
+   /// \param filename Name of the OBJ file
+   /// \param budget Most bytes of host memory to use: a quarter for
+   ///               reading the file, the rest split between the vertex
+   ///               and index batches. At least 64KB.
+   ///
+   OBJStreamProducer(const std::string& filename, size_t budget);
+
+   ~OBJStreamProducer();
+
+   ///
+   /// Count the vertices and indices run() will produce, reading the
+   /// file in the same fixed size pieces
+   ///
+   void count(GLuint& numVertices, GLuint& numIndices);
+
+   ///
+   /// Parse the file, passing each batch to the sink as it fills up
+   ///
+   void run(OBJStreamSink& sink);
+
+   ///
+   /// \return bytes of host memory held for reading and batching
+   ///
+   size_t bytes(void) const;
+
+   ///
+   /// \return vertices in a full batch
+   ///
+   GLuint vertexBatchSize(void) const { return _vertexBatch; }
+
+   ///
+   /// \return indices in a full batch
+   ///
+   GLuint indexBatchSize(void) const { return _indexBatch; }
+
+private:
+   /// Parse one line. Without a sink, only counts.
+   void parseLine(const char* line, const char* end, OBJStreamSink* sink);
+
+   /// Read the whole file, calling parseLine() on every line
+   void parse(OBJStreamSink* sink);
+
+   void flushVertices(OBJStreamSink* sink);
+   void flushIndices(OBJStreamSink* sink);
+
+   std::string          _filename;
+   FILE*                _file;
+   std::vector<char>    _read;
+   std::vector<GLfloat> _vertices;
+   std::vector<GLuint>  _indices;
+   GLuint               _vertexBatch;
+   GLuint               _indexBatch;
+
+   // Progress through the file
+   GLuint _numVertices;
+   GLuint _numIndices;
+   GLuint _lineNumber;
+   GLuint _firstVertex;
+   GLuint _firstIndex;
+   size_t _vertexFill;
+   size_t _indexFill;
+};
+
+#endif
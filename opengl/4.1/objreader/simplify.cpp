@@ -0,0 +1,857 @@
+//----------------------------------------------------------------------
+// simplify.cpp
+//
+// Edge collapse runs in passes. Each pass finds every collapse the
+// vertex kinds allow, sorts them by quadric error and performs the
+// cheapest ones, skipping any that touch a vertex an earlier collapse
+// in the same pass has already changed. The triangles are then
+// rewritten and the next pass starts from fresh adjacency.
+//----------------------------------------------------------------------
+
+#include <math.h>
+#include <stdint.h>
+#include <algorithm>
+#include "simplify.h"
+
+namespace
+{
+   /// Weight of the planes that hold borders and seams in place,
+   /// relative to the squared length of the edge
+   const double boundaryWeight = 2.0;
+
+   /// Each pass performs collapses up to this multiple of the error of
+   /// the collapse that would just reach the target
+   const float passErrorScale = 1.5f;
+
+   inline uint64_t edgeKey(GLuint a, GLuint b)
+   {
+      return (uint64_t(a) << 32) | b;
+   }
+
+   inline bool hasEdge(const std::vector<uint64_t>& edges, GLuint a, GLuint b)
+   {
+      return std::binary_search(edges.begin(), edges.end(), edgeKey(a, b));
+   }
+
+   inline void cross(const double* a, const double* b, double* out)
+   {
+      out[0] = a[1] * b[2] - a[2] * b[1];
+      out[1] = a[2] * b[0] - a[0] * b[2];
+      out[2] = a[0] * b[1] - a[1] * b[0];
+   }
+
+   inline double dot(const double* a, const double* b)
+   {
+      return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+   }
+
+   /// Unnormalized normal of the triangle p0, p1, p2
+   inline void triangleNormal(const GLfloat* p0, const GLfloat* p1, const GLfloat* p2,
+                              double* n)
+   {
+      double e1[3] = { double(p1[0]) - p0[0], double(p1[1]) - p0[1], double(p1[2]) - p0[2] };
+      double e2[3] = { double(p2[0]) - p0[0], double(p2[1]) - p0[1], double(p2[2]) - p0[2] };
+      cross(e1, e2, n);
+   }
+
+   /// Squared distance from p to the triangle a, b, c, by Voronoi
+   /// region as in Ericson's Real-Time Collision Detection
+   double pointTriangleDistance2(const GLfloat* p, const GLfloat* a, const GLfloat* b,
+                                 const GLfloat* c)
+   {
+      double ab[3], ac[3], ap[3], bp[3], cp[3];
+      for(int k = 0; k < 3; ++k)
+      {
+         ab[k] = double(b[k]) - a[k];
+         ac[k] = double(c[k]) - a[k];
+         ap[k] = double(p[k]) - a[k];
+         bp[k] = double(p[k]) - b[k];
+         cp[k] = double(p[k]) - c[k];
+      }
+      double d1 = dot(ab, ap);
+      double d2 = dot(ac, ap);
+      double d3 = dot(ab, bp);
+      double d4 = dot(ac, bp);
+      double d5 = dot(ab, cp);
+      double d6 = dot(ac, cp);
+
+      double v, w;
+      double va = d3 * d6 - d5 * d4;
+      double vb = d5 * d2 - d1 * d6;
+      double vc = d1 * d4 - d3 * d2;
+      if(d1 <= 0.0 && d2 <= 0.0)
+      {
+         v = 0.0; w = 0.0;
+      }
+      else if(d3 >= 0.0 && d4 <= d3)
+      {
+         v = 1.0; w = 0.0;
+      }
+      else if(d6 >= 0.0 && d5 <= d6)
+      {
+         v = 0.0; w = 1.0;
+      }
+      else if(vc <= 0.0 && d1 >= 0.0 && d3 <= 0.0)
+      {
+         v = d1 / (d1 - d3); w = 0.0;
+      }
+      else if(vb <= 0.0 && d2 >= 0.0 && d6 <= 0.0)
+      {
+         v = 0.0; w = d2 / (d2 - d6);
+      }
+      else if(va <= 0.0 && d4 - d3 >= 0.0 && d5 - d6 >= 0.0)
+      {
+         w = (d4 - d3) / ((d4 - d3) + (d5 - d6));
+         v = 1.0 - w;
+      }
+      else
+      {
+         double denom = 1.0 / (va + vb + vc);
+         v = vb * denom;
+         w = vc * denom;
+      }
+
+      double distance2 = 0.0;
+      for(int k = 0; k < 3; ++k)
+      {
+         double d = ap[k] - v * ab[k] - w * ac[k];
+         distance2 += d * d;
+      }
+      return distance2;
+   }
+
+   /// Hash of a grid cell, from Teschner et al., "Optimized Spatial
+   /// Hashing for Collision Detection of Deformable Objects"
+   inline size_t cellHash(int x, int y, int z)
+   {
+      return (size_t(x) * 73856093u) ^ (size_t(y) * 19349663u) ^ (size_t(z) * 83492791u);
+   }
+
+   //-------------------------------------------------------------------
+   // Orders vertices by position so that equal positions are adjacent
+   //-------------------------------------------------------------------
+   struct PositionLess
+   {
+      const GLfloat* positions;
+
+      bool operator()(GLuint a, GLuint b) const
+      {
+         const GLfloat* pa = positions + 3 * a;
+         const GLfloat* pb = positions + 3 * b;
+         if(pa[0] != pb[0]) return pa[0] < pb[0];
+         if(pa[1] != pb[1]) return pa[1] < pb[1];
+         if(pa[2] != pb[2]) return pa[2] < pb[2];
+         return a < b;
+      }
+   };
+}
+
+void Simplifier::Quadric::addPlane(const double* n, double d, double w)
+{
+   a00 += w * n[0] * n[0];
+   a11 += w * n[1] * n[1];
+   a22 += w * n[2] * n[2];
+   a01 += w * n[0] * n[1];
+   a02 += w * n[0] * n[2];
+   a12 += w * n[1] * n[2];
+   b0  += w * n[0] * d;
+   b1  += w * n[1] * d;
+   b2  += w * n[2] * d;
+   c   += w * d * d;
+   weight += w;
+}
+
+void Simplifier::Quadric::add(const Quadric& q)
+{
+   a00 += q.a00; a11 += q.a11; a22 += q.a22;
+   a01 += q.a01; a02 += q.a02; a12 += q.a12;
+   b0  += q.b0;  b1  += q.b1;  b2  += q.b2;
+   c   += q.c;
+   weight += q.weight;
+}
+
+double Simplifier::Quadric::error(const GLfloat* p) const
+{
+   double x = p[0];
+   double y = p[1];
+   double z = p[2];
+
+   double e = a00 * x * x + a11 * y * y + a22 * z * z
+            + 2.0 * (a01 * x * y + a02 * x * z + a12 * y * z)
+            + 2.0 * (b0 * x + b1 * y + b2 * z)
+            + c;
+
+   return weight > 0.0 && e > 0.0 ? e / weight : 0.0;
+}
+
+Simplifier::Simplifier(const GLfloat* vertices, GLsizei stride, GLuint numVertices,
+                       const std::vector<GLuint>& indices)
+   : _positions(3 * size_t(numVertices)),
+     _indices(indices),
+     _remap(numVertices),
+     _wedge(numVertices),
+     _kind(numVertices, MANIFOLD),
+     _quadrics(numVertices),
+     _collapse(numVertices),
+     _live(numVertices, false),
+     _error(0.0f)
+{
+   const char* base = reinterpret_cast<const char*>(vertices);
+   for(GLuint v = 0; v < numVertices; ++v)
+   {
+      const GLfloat* p = reinterpret_cast<const GLfloat*>(base + size_t(v) * stride);
+      _positions[3 * v + 0] = p[0];
+      _positions[3 * v + 1] = p[1];
+      _positions[3 * v + 2] = p[2];
+      _collapse[v] = v;
+   }
+
+   Quadric zero = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
+   std::fill(_quadrics.begin(), _quadrics.end(), zero);
+
+   classify();
+}
+
+// g++ 12.2 at -O3 hits an internal compiler error vectorizing this
+// function (in vect_get_vec_defs_for_operand, tree-vect-stmts.cc:1509)
+#if defined(__GNUC__) && !defined(__clang__)
+__attribute__((optimize("no-tree-vectorize")))
+#endif
+void Simplifier::classify(void)
+{
+   GLuint numVertices = GLuint(_remap.size());
+
+   // Vertices with the same position, whatever their other attributes,
+   // collapse as one. Each group becomes a ring through _wedge, and the
+   // first vertex in the ring stands for the position.
+   std::vector<GLuint> order(numVertices);
+   for(GLuint v = 0; v < numVertices; ++v)
+   {
+      order[v] = v;
+   }
+   PositionLess less = { &_positions[0] };
+   std::sort(order.begin(), order.end(), less);
+
+   for(GLuint i = 0; i < numVertices; )
+   {
+      GLuint j = i + 1;
+      const GLfloat* p = position(order[i]);
+      while(j < numVertices && position(order[j])[0] == p[0] &&
+            position(order[j])[1] == p[1] && position(order[j])[2] == p[2])
+      {
+         j++;
+      }
+      for(GLuint k = i; k < j; ++k)
+      {
+         _remap[order[k]] = order[i];
+         _wedge[order[k]] = order[k + 1 < j ? k + 1 : i];
+      }
+      i = j;
+   }
+
+   // Triangles with two corners in the same place have no area and no
+   // edges worth keeping
+   size_t kept = 0;
+   for(size_t t = 0; t < _indices.size(); t += 3)
+   {
+      GLuint a = _indices[t + 0];
+      GLuint b = _indices[t + 1];
+      GLuint c = _indices[t + 2];
+      if(_remap[a] != _remap[b] && _remap[b] != _remap[c] && _remap[a] != _remap[c])
+      {
+         _indices[kept++] = a;
+         _indices[kept++] = b;
+         _indices[kept++] = c;
+      }
+   }
+   _indices.resize(kept);
+   size_t numIndices = kept;
+
+   // Directed edges, between positions and between vertices. A position
+   // edge with no reverse is an open border; a vertex edge with no
+   // reverse on an edge that isn't a border is a seam.
+   std::vector<uint64_t> positionEdges(numIndices);
+   std::vector<uint64_t> vertexEdges(numIndices);
+   for(size_t t = 0; t < numIndices; t += 3)
+   {
+      for(int k = 0; k < 3; ++k)
+      {
+         GLuint a = _indices[t + k];
+         GLuint b = _indices[t + (k + 1) % 3];
+         positionEdges[t + k] = edgeKey(_remap[a], _remap[b]);
+         vertexEdges[t + k] = edgeKey(a, b);
+      }
+   }
+   std::sort(positionEdges.begin(), positionEdges.end());
+   std::sort(vertexEdges.begin(), vertexEdges.end());
+
+   std::vector<GLuint> openOut(numVertices, 0);
+   std::vector<GLuint> openIn(numVertices, 0);
+
+   for(size_t t = 0; t < numIndices; t += 3)
+   {
+      const GLfloat* p[3];
+      for(int k = 0; k < 3; ++k)
+      {
+         p[k] = position(_indices[t + k]);
+         _live[_indices[t + k]] = true;
+      }
+
+      double n[3];
+      triangleNormal(p[0], p[1], p[2], n);
+      double length = sqrt(dot(n, n));
+      if(length == 0.0)
+      {
+         continue;
+      }
+      n[0] /= length;
+      n[1] /= length;
+      n[2] /= length;
+
+      double origin[3] = { p[0][0], p[0][1], p[0][2] };
+      for(int k = 0; k < 3; ++k)
+      {
+         _quadrics[_remap[_indices[t + k]]].addPlane(n, -dot(n, origin), 0.5 * length);
+      }
+
+      for(int k = 0; k < 3; ++k)
+      {
+         GLuint a = _indices[t + k];
+         GLuint b = _indices[t + (k + 1) % 3];
+         GLuint pa = _remap[a];
+         GLuint pb = _remap[b];
+
+         bool open = !hasEdge(positionEdges, pb, pa);
+         if(open)
+         {
+            openOut[pa]++;
+            openIn[pb]++;
+         }
+         else if(hasEdge(vertexEdges, b, a))
+         {
+            continue;
+         }
+
+         // A plane through the border or seam edge, perpendicular to
+         // the triangle, keeps the edge from drifting sideways
+         const GLfloat* qa = position(a);
+         const GLfloat* qb = position(b);
+         double e[3] = { double(qb[0]) - qa[0], double(qb[1]) - qa[1], double(qb[2]) - qa[2] };
+         double m[3];
+         cross(e, n, m);
+         double ml = sqrt(dot(m, m));
+         if(ml == 0.0)
+         {
+            continue;
+         }
+         m[0] /= ml;
+         m[1] /= ml;
+         m[2] /= ml;
+
+         double start[3] = { qa[0], qa[1], qa[2] };
+         double w = boundaryWeight * dot(e, e);
+         _quadrics[pa].addPlane(m, -dot(m, start), w);
+         _quadrics[pb].addPlane(m, -dot(m, start), w);
+      }
+   }
+   _original = _live;
+
+   for(GLuint v = 0; v < numVertices; ++v)
+   {
+      if(_remap[v] != v)
+      {
+         continue;
+      }
+
+      GLuint wedges = 0;
+      GLuint w = v;
+      do
+      {
+         wedges += _live[w] ? 1 : 0;
+         w = _wedge[w];
+      } while(w != v);
+
+      Kind kind;
+      if(openOut[v] || openIn[v])
+      {
+         kind = openOut[v] == 1 && openIn[v] == 1 && wedges == 1 ? BORDER : LOCKED;
+      }
+      else
+      {
+         kind = wedges == 1 ? MANIFOLD : (wedges == 2 ? SEAM : LOCKED);
+      }
+      _kind[v] = GLubyte(kind);
+   }
+}
+
+void Simplifier::buildAdjacency(void)
+{
+   GLuint numVertices = GLuint(_remap.size());
+   GLuint numTriangles = GLuint(_indices.size() / 3);
+
+   _adjacencyOffset.assign(numVertices + 1, 0);
+   for(size_t i = 0; i < _indices.size(); ++i)
+   {
+      _adjacencyOffset[_remap[_indices[i]] + 1]++;
+   }
+   for(GLuint v = 0; v < numVertices; ++v)
+   {
+      _adjacencyOffset[v + 1] += _adjacencyOffset[v];
+   }
+
+   std::vector<GLuint> fill(_adjacencyOffset.begin(), _adjacencyOffset.end() - 1);
+   _adjacency.resize(_indices.size());
+   std::fill(_live.begin(), _live.end(), false);
+   for(GLuint t = 0; t < numTriangles; ++t)
+   {
+      for(int k = 0; k < 3; ++k)
+      {
+         GLuint v = _indices[3 * t + k];
+         _adjacency[fill[_remap[v]]++] = t;
+         _live[v] = true;
+      }
+   }
+}
+
+bool Simplifier::canCollapse(GLuint u, GLuint v)
+{
+   // Where each copy of u goes, found from the triangles on the edge.
+   // A seam vertex has two copies, anything else one.
+   GLuint from[2];
+   GLuint to[2];
+   GLuint mapped = 0;
+   GLuint shared = 0;
+
+   for(GLuint i = _adjacencyOffset[u]; i < _adjacencyOffset[u + 1]; ++i)
+   {
+      const GLuint* triangle = &_indices[3 * _adjacency[i]];
+      int cu = -1;
+      int cv = -1;
+      for(int k = 0; k < 3; ++k)
+      {
+         GLuint p = _remap[triangle[k]];
+         cu = p == u ? k : cu;
+         cv = p == v ? k : cv;
+      }
+
+      if(cv >= 0)
+      {
+         // This triangle goes away. Its copy of v is where its copy of u
+         // goes, and every triangle on the edge has to agree.
+         shared++;
+         GLuint a = triangle[cu];
+         GLuint b = triangle[cv];
+         GLuint j = 0;
+         while(j < mapped && from[j] != a)
+         {
+            j++;
+         }
+         if(j < mapped)
+         {
+            if(to[j] != b)
+            {
+               return false;
+            }
+         }
+         else
+         {
+            if(mapped == 2)
+            {
+               return false;
+            }
+            from[mapped] = a;
+            to[mapped] = b;
+            mapped++;
+         }
+         continue;
+      }
+
+      // This triangle stays. Moving u must not flip it over.
+      const GLfloat* p[3];
+      for(int k = 0; k < 3; ++k)
+      {
+         p[k] = position(triangle[k]);
+      }
+      double before[3];
+      triangleNormal(p[0], p[1], p[2], before);
+      p[cu] = position(v);
+      double after[3];
+      triangleNormal(p[0], p[1], p[2], after);
+      if(dot(before, after) <= 0.0)
+      {
+         return false;
+      }
+   }
+
+   // Along a border means along an edge with only one triangle
+   if(shared == 0 || (_kind[u] == BORDER && shared != 1))
+   {
+      return false;
+   }
+
+   // Link condition: u and v may only have in common the neighbours of
+   // the triangles on the edge, otherwise the collapse pinches the
+   // surface into a fin or a duplicate triangle
+   _ring.clear();
+   for(GLuint i = _adjacencyOffset[u]; i < _adjacencyOffset[u + 1]; ++i)
+   {
+      const GLuint* triangle = &_indices[3 * _adjacency[i]];
+      for(int k = 0; k < 3; ++k)
+      {
+         _ring.push_back(_remap[triangle[k]]);
+      }
+   }
+   std::sort(_ring.begin(), _ring.end());
+   size_t ringSize = std::unique(_ring.begin(), _ring.end()) - _ring.begin();
+
+   _ring.resize(ringSize);
+   for(GLuint i = _adjacencyOffset[v]; i < _adjacencyOffset[v + 1]; ++i)
+   {
+      const GLuint* triangle = &_indices[3 * _adjacency[i]];
+      for(int k = 0; k < 3; ++k)
+      {
+         GLuint p = _remap[triangle[k]];
+         if(p != u && p != v && std::binary_search(_ring.begin(), _ring.begin() + ringSize, p))
+         {
+            _ring.push_back(p);
+         }
+      }
+   }
+   std::sort(_ring.begin() + ringSize, _ring.end());
+   size_t common = std::unique(_ring.begin() + ringSize, _ring.end()) - (_ring.begin() + ringSize);
+   if(common != shared)
+   {
+      return false;
+   }
+
+   // Every copy of u needs somewhere to go. A seam vertex moving off
+   // the seam only has a destination for one of its copies.
+   GLuint w = u;
+   do
+   {
+      if(_live[w] && !(from[0] == w || (mapped > 1 && from[1] == w)))
+      {
+         return false;
+      }
+      w = _wedge[w];
+   } while(w != u);
+
+   for(GLuint j = 0; j < mapped; ++j)
+   {
+      _collapse[from[j]] = to[j];
+   }
+   return true;
+}
+
+GLuint Simplifier::simplify(GLuint targetIndices, GLfloat maxError)
+{
+   double maxCost = maxError < FLT_MAX ? double(maxError) * maxError : DBL_MAX;
+   GLuint numVertices = GLuint(_remap.size());
+   std::vector<bool> touched(numVertices);
+   std::vector<Collapse> collapses;
+   bool exhaustive = false;
+
+   while(_indices.size() > targetIndices)
+   {
+      buildAdjacency();
+
+      // Every directed edge is a candidate for moving its start onto its
+      // end. The reverse comes from the triangle on the other side.
+      collapses.clear();
+      for(size_t i = 0; i < _indices.size(); ++i)
+      {
+         GLuint u = _remap[_indices[i]];
+         GLuint v = _remap[_indices[i % 3 == 2 ? i - 2 : i + 1]];
+         Kind ku = Kind(_kind[u]);
+         Kind kv = Kind(_kind[v]);
+         if(ku == LOCKED || (ku == BORDER && kv != BORDER) || (ku == SEAM && kv != SEAM))
+         {
+            continue;
+         }
+
+         double cost = _quadrics[u].error(position(v));
+         if(cost <= maxCost)
+         {
+            Collapse collapse = { GLfloat(cost), u, v };
+            collapses.push_back(collapse);
+         }
+      }
+      if(collapses.empty())
+      {
+         break;
+      }
+
+      // Most collapses remove two triangles. Only the cheapest collapses,
+      // up to a little past the one that would reach the target, are
+      // sorted and tried this pass. If none of those can be done, the
+      // next pass tries them all.
+      GLuint triangles = GLuint(_indices.size() / 3);
+      GLuint needed = triangles - targetIndices / 3;
+      size_t count = collapses.size();
+      if(!exhaustive)
+      {
+         size_t goal = std::min(count, size_t(needed + 1) / 2) - 1;
+         std::nth_element(collapses.begin(), collapses.begin() + goal, collapses.end());
+         GLfloat limit = collapses[goal].cost * passErrorScale;
+         count = std::partition(collapses.begin() + goal + 1, collapses.end(),
+                                [limit](const Collapse& c) { return c.cost <= limit; })
+               - collapses.begin();
+      }
+      std::sort(collapses.begin(), collapses.begin() + count);
+
+      std::fill(touched.begin(), touched.end(), false);
+      GLuint removed = 0;
+      GLuint performed = 0;
+      for(size_t i = 0; i < count && removed < needed; ++i)
+      {
+         GLuint u = collapses[i].u;
+         GLuint v = collapses[i].v;
+         if(touched[u] || touched[v] || !canCollapse(u, v))
+         {
+            continue;
+         }
+
+         // Everything around u changes, so nothing there collapses again
+         // until the next pass
+         for(GLuint j = _adjacencyOffset[u]; j < _adjacencyOffset[u + 1]; ++j)
+         {
+            const GLuint* triangle = &_indices[3 * _adjacency[j]];
+            bool degenerate = false;
+            for(int k = 0; k < 3; ++k)
+            {
+               GLuint p = _remap[triangle[k]];
+               touched[p] = true;
+               degenerate = degenerate || p == v;
+            }
+            removed += degenerate ? 1 : 0;
+         }
+
+         _quadrics[v].add(_quadrics[u]);
+         _error = std::max(_error, GLfloat(sqrt(collapses[i].cost)));
+         performed++;
+      }
+
+      if(performed == 0)
+      {
+         if(exhaustive || count == collapses.size())
+         {
+            break;
+         }
+         exhaustive = true;
+         continue;
+      }
+      exhaustive = false;
+
+      // Point the triangles at the new vertices and drop the ones that
+      // lost an edge
+      size_t kept = 0;
+      for(size_t t = 0; t < _indices.size(); t += 3)
+      {
+         GLuint a = _collapse[_indices[t + 0]];
+         GLuint b = _collapse[_indices[t + 1]];
+         GLuint c = _collapse[_indices[t + 2]];
+         if(_remap[a] != _remap[b] && _remap[b] != _remap[c] && _remap[a] != _remap[c])
+         {
+            _indices[kept++] = a;
+            _indices[kept++] = b;
+            _indices[kept++] = c;
+         }
+      }
+      _indices.resize(kept);
+   }
+
+   return GLuint(_indices.size());
+}
+
+GLfloat Simplifier::distance(void) const
+{
+   GLuint numVertices = GLuint(_remap.size());
+   if(_indices.empty())
+   {
+      // Nothing left to measure to, unless there was nothing to start with
+      bool any = std::find(_original.begin(), _original.end(), true) != _original.end();
+      return any ? FLT_MAX : 0.0f;
+   }
+
+   // Bin the triangles into a grid with cells about as large as an
+   // edge, so the nearest triangle is usually in the cell of the vertex
+   // or the ones next to it. Long triangles land in every cell their box touches. Cells
+   // are hashed into about two buckets per triangle, so the grid costs
+   // the same however fine it is; cells sharing a bucket only cost a
+   // few extra distance tests.
+   GLfloat lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+   GLfloat hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+   for(GLuint v = 0; v < numVertices; ++v)
+   {
+      for(int k = 0; k < 3; ++k)
+      {
+         lo[k] = std::min(lo[k], position(v)[k]);
+         hi[k] = std::max(hi[k], position(v)[k]);
+      }
+   }
+   double edges = 0.0;
+   for(size_t i = 0; i < _indices.size(); ++i)
+   {
+      const GLfloat* a = position(_indices[i]);
+      const GLfloat* b = position(_indices[i % 3 == 2 ? i - 2 : i + 1]);
+      double e[3] = { double(b[0]) - a[0], double(b[1]) - a[1], double(b[2]) - a[2] };
+      edges += sqrt(dot(e, e));
+   }
+   double extent = std::max(hi[0] - lo[0], std::max(hi[1] - lo[1], hi[2] - lo[2]));
+   double cell = std::max(edges / _indices.size(), extent / 1e6) * 1.0001 + 1e-12;
+   int dims[3];
+   for(int k = 0; k < 3; ++k)
+   {
+      dims[k] = int((hi[k] - lo[k]) / cell) + 1;
+   }
+
+   auto cellOf = [&](const GLfloat* p, int* c)
+   {
+      for(int k = 0; k < 3; ++k)
+      {
+         c[k] = std::min(dims[k] - 1, std::max(0, int((p[k] - lo[k]) / cell)));
+      }
+   };
+
+   size_t cells = 1;
+   while(cells < 2 * _indices.size() / 3)
+   {
+      cells <<= 1;
+   }
+
+   // Triangles in each bucket, as offsets into one array
+   std::vector<GLuint> offsets(cells + 1, 0);
+   std::vector<GLuint> binned;
+   for(int pass = 0; pass < 2; ++pass)
+   {
+      std::vector<GLuint> fill(offsets.begin(), offsets.end() - 1);
+      for(size_t t = 0; t < _indices.size(); t += 3)
+      {
+         int c0[3] = { dims[0], dims[1], dims[2] };
+         int c1[3] = { -1, -1, -1 };
+         for(int corner = 0; corner < 3; ++corner)
+         {
+            int c[3];
+            cellOf(position(_indices[t + corner]), c);
+            for(int k = 0; k < 3; ++k)
+            {
+               c0[k] = std::min(c0[k], c[k]);
+               c1[k] = std::max(c1[k], c[k]);
+            }
+         }
+         for(int z = c0[2]; z <= c1[2]; ++z)
+         {
+            for(int y = c0[1]; y <= c1[1]; ++y)
+            {
+               for(int x = c0[0]; x <= c1[0]; ++x)
+               {
+                  size_t id = cellHash(x, y, z) & (cells - 1);
+                  if(pass == 0)
+                  {
+                     offsets[id + 1]++;
+                  }
+                  else
+                  {
+                     binned[fill[id]++] = GLuint(t);
+                  }
+               }
+            }
+         }
+      }
+      if(pass == 0)
+      {
+         for(size_t id = 0; id < cells; ++id)
+         {
+            offsets[id + 1] += offsets[id];
+         }
+         binned.resize(offsets[cells]);
+      }
+   }
+
+   // Vertices are measured independently, each thread keeps its own
+   // largest distance
+   double largest = 0.0;
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+   {
+      double local = 0.0;
+
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 1024) nowait
+#endif
+      for(int i = 0; i < int(numVertices); ++i)
+      {
+         GLuint v = GLuint(i);
+
+         // Copies of a position are measured once
+         if(_remap[v] != v)
+         {
+            continue;
+         }
+         GLuint w = v;
+         while(!_original[w] && _wedge[w] != v)
+         {
+            w = _wedge[w];
+         }
+         if(!_original[w])
+         {
+            continue;
+         }
+
+         // Widen the search until the nearest triangle found is closer than
+         // anything outside the cells searched could be
+         const GLfloat* p = position(v);
+         int c[3];
+         cellOf(p, c);
+         double best = 1e30;
+         for(int r = 0; ; ++r)
+         {
+            for(int z = std::max(0, c[2] - r); z <= std::min(dims[2] - 1, c[2] + r); ++z)
+            {
+               for(int y = std::max(0, c[1] - r); y <= std::min(dims[1] - 1, c[1] + r); ++y)
+               {
+                  for(int x = std::max(0, c[0] - r); x <= std::min(dims[0] - 1, c[0] + r); ++x)
+                  {
+                     size_t id = cellHash(x, y, z) & (cells - 1);
+                     for(GLuint j = offsets[id]; j < offsets[id + 1]; ++j)
+                     {
+                        const GLuint* t = &_indices[binned[j]];
+                        best = std::min(best, pointTriangleDistance2(p, position(t[0]),
+                                                                     position(t[1]),
+                                                                     position(t[2])));
+                     }
+                  }
+               }
+            }
+
+            // Distance to the nearest side of the searched block with cells
+            // beyond it
+            double reach = DBL_MAX;
+            for(int k = 0; k < 3; ++k)
+            {
+               double q = double(p[k]) - lo[k];
+               if(c[k] - r > 0)
+               {
+                  reach = std::min(reach, q - (c[k] - r) * cell);
+               }
+               if(c[k] + r < dims[k] - 1)
+               {
+                  reach = std::min(reach, (c[k] + r + 1) * cell - q);
+               }
+            }
+            if(reach == DBL_MAX || best <= reach * reach)
+            {
+               break;
+            }
+         }
+         local = std::max(local, sqrt(best));
+      }
+
+#ifdef _OPENMP
+#pragma omp critical
+#endif
+      largest = std::max(largest, local);
+   }
+   return GLfloat(largest);
+}
@@ -0,0 +1,176 @@
+//----------------------------------------------------------------------
+// simplify.h
+//
+// Mesh simplification by quadric error edge collapse, for building
+// level of detail chains over indexed buffers.
+//
+// Author: Jeff Bowles <jbowles@riskybacon.com>
+//----------------------------------------------------------------------
+
+#ifndef _simplify_h
+#define _simplify_h
+
+#include <float.h>
+#include <vector>
+
+#if defined(__APPLE_CC__)
+#include <OpenGL/gl3.h>
+#else
+#include <GL/glew.h>
+#include <GL/gl.h>
+#endif
+
+//----------------------------------------------------------------------
+/// Simplifies an indexed triangle mesh by collapsing edges in order of
+/// quadric error (Garland and Heckbert). Collapses are half-edge: a
+/// vertex moves onto a neighbour and disappears, so every level of
+/// detail indexes the original vertex buffer.
+///
+/// Vertices that share a position but not their other attributes form
+/// a seam, a UV border or a crease. Seams are kept intact: a seam
+/// vertex only moves along the seam, and all of its copies move
+/// together. Open borders are kept the same way. A vertex on more than
+/// one seam, on a border and a seam, or on a non-manifold border never
+/// moves.
+///
+/// \code
+/// Simplifier simplifier(vertices, stride, numVertices, indices);
+/// simplifier.simplify(indices.size() / 2);
+/// half = simplifier.indices();
+/// simplifier.simplify(indices.size() / 4);
+/// quarter = simplifier.indices();
+/// \endcode
+//----------------------------------------------------------------------
+class Simplifier
+{
+public:
+   ///
+   /// How a vertex may move
+   ///
+   enum Kind
+   {
+      MANIFOLD, ///< Inside a single attribute region, moves anywhere
+      BORDER,   ///< On an open border, moves along the border
+      SEAM,     ///< On an attribute seam, moves along the seam
+      LOCKED    ///< Never moves
+   };
+
+   ///
+   /// Constructor
+   ///
+   /// \param vertices First position, 3 floats. Only positions are read.
+   /// \param stride Bytes from one vertex to the next
+   /// \param numVertices Number of vertices
+   /// \param indices Three indices per triangle
+   ///
+   Simplifier(const GLfloat* vertices, GLsizei stride, GLuint numVertices,
+              const std::vector<GLuint>& indices);
+
+   ///
+   /// Collapse edges until no more than targetIndices indices remain,
+   /// the next collapse would move the surface by more than maxError,
+   /// or no collapse is allowed. Can be called again with a smaller
+   /// target to continue from where the last call stopped.
+   ///
+   /// \return the number of indices left
+   ///
+   GLuint simplify(GLuint targetIndices, GLfloat maxError = FLT_MAX);
+
+   ///
+   /// \return the current triangles, three indices each
+   ///
+   const std::vector<GLuint>& indices(void) const { return _indices; }
+
+   ///
+   /// \return the largest collapse error so far, the square root of a
+   /// mean squared distance to the original planes. It steers the
+   /// collapses and the maxError limit, but is an estimate: the surface
+   /// can move further. Errors accumulate from the original mesh, not
+   /// from the previous call.
+   ///
+   GLfloat error(void) const { return _error; }
+
+   ///
+   /// Measure how far the current triangles are from the original mesh.
+   /// Collapsed vertices land on original vertices, so the distance is
+   /// taken the other way, from every original vertex to the nearest
+   /// current triangle.
+   ///
+   /// \return the largest distance, in model units
+   ///
+   GLfloat distance(void) const;
+
+private:
+   //-------------------------------------------------------------------
+   /// Sum of squared distances to a set of planes, weighted by area
+   //-------------------------------------------------------------------
+   struct Quadric
+   {
+      double a00, a11, a22, a01, a02, a12;
+      double b0, b1, b2;
+      double c;
+      double weight;
+
+      void addPlane(const double* n, double d, double w);
+      void add(const Quadric& q);
+
+      /// \return the weighted mean squared distance of p to the planes
+      double error(const GLfloat* p) const;
+   };
+
+   //-------------------------------------------------------------------
+   /// An edge collapse: u moves onto v
+   //-------------------------------------------------------------------
+   struct Collapse
+   {
+      GLfloat cost;
+      GLuint  u;
+      GLuint  v;
+
+      bool operator<(const Collapse& other) const { return cost < other.cost; }
+   };
+
+   /// Position of vertex v
+   const GLfloat* position(GLuint v) const { return &_positions[3 * v]; }
+
+   /// Sort out seams, borders and the starting quadrics
+   void classify(void);
+
+   /// Index the current triangles by position
+   void buildAdjacency(void);
+
+   /// Check a collapse and work out where each copy of u goes
+   bool canCollapse(GLuint u, GLuint v);
+
+   std::vector<GLfloat> _positions;
+   std::vector<GLuint>  _indices;
+
+   /// First vertex with the same position
+   std::vector<GLuint>  _remap;
+
+   /// Next vertex with the same position, a ring
+   std::vector<GLuint>  _wedge;
+
+   std::vector<GLubyte> _kind;
+   std::vector<Quadric> _quadrics;
+
+   /// Vertex each vertex was collapsed into, itself if not collapsed
+   std::vector<GLuint>  _collapse;
+
+   /// Triangles around each position, rebuilt every pass
+   std::vector<GLuint>  _adjacencyOffset;
+   std::vector<GLuint>  _adjacency;
+
+   /// True for vertices some triangle uses, rebuilt every pass
+   std::vector<bool>    _live;
+
+   /// True for vertices the original triangles use
+   std::vector<bool>    _original;
+
+   /// Scratch space for canCollapse()
+   std::vector<GLuint>  _ring;
+
+   GLfloat _error;
+};
+
+#endif
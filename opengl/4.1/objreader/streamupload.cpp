@@ -0,0 +1,219 @@
+//----------------------------------------------------------------------
+// streamupload.cpp
+//
+// GL side of the streaming OBJ reader
+//----------------------------------------------------------------------
+
+#include <string.h>
+#include <chrono>
+#include <iostream>
+#include "streamupload.h"
+#include "shader.h"
+
+using std::cout;
+using std::endl;
+
+// Persistent mapping needs GL 4.4 or ARB_buffer_storage, which OS X
+// doesn't have
+#if defined(GL_MAP_PERSISTENT_BIT) && !defined(__APPLE__)
+#define STREAM_HAVE_BUFFER_STORAGE 1
+#endif
+
+namespace
+{
+   //-------------------------------------------------------------------
+   // Grows a bounding box over the vertex batches on their way to
+   // another sink
+   //-------------------------------------------------------------------
+   class BoundsSink : public OBJStreamSink
+   {
+   public:
+      BoundsSink(OBJStreamSink& next, GLfloat* bounds)
+         : _next(next), _bounds(bounds)
+      {
+         for(int i = 0; i < 3; ++i)
+         {
+            _bounds[i] = 1e30f;
+            _bounds[i + 3] = -1e30f;
+         }
+      }
+
+      virtual void consume(const OBJStreamBatch& batch)
+      {
+         if(batch.type == OBJStreamBatch::VERTICES)
+         {
+            const GLfloat* p = static_cast<const GLfloat*>(batch.data);
+            for(GLuint v = 0; v < batch.count; ++v, p += 3)
+            {
+               for(int i = 0; i < 3; ++i)
+               {
+                  _bounds[i] = p[i] < _bounds[i] ? p[i] : _bounds[i];
+                  _bounds[i + 3] = p[i] > _bounds[i + 3] ? p[i] : _bounds[i + 3];
+               }
+            }
+         }
+         _next.consume(batch);
+      }
+
+   private:
+      OBJStreamSink& _next;
+      GLfloat*       _bounds;
+   };
+}
+
+OBJStreamUploader::OBJStreamUploader(GLuint vertexBuffer, GLuint indexBuffer,
+                                     GLsizeiptr segmentBytes, GLuint segments,
+                                     bool persistent)
+   : _vertexBuffer(vertexBuffer),
+     _indexBuffer(indexBuffer),
+     _staging(0),
+     _segmentBytes(segmentBytes),
+     _next(0),
+     _stalls(0),
+     _mapped(NULL),
+     _fences(segments, (GLsync) 0)
+{
+#if STREAM_HAVE_BUFFER_STORAGE
+   if(persistent && GLEW_ARB_buffer_storage && GLEW_ARB_copy_buffer)
+   {
+      const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+      glGenBuffers(1, &_staging);
+      glBindBuffer(GL_COPY_READ_BUFFER, _staging);
+      glBufferStorage(GL_COPY_READ_BUFFER, segments * segmentBytes, NULL, flags);
+      _mapped = static_cast<char*>(glMapBufferRange(GL_COPY_READ_BUFFER, 0,
+                                                    segments * segmentBytes, flags));
+      if(!_mapped)
+      {
+         glDeleteBuffers(1, &_staging);
+         _staging = 0;
+      }
+      GL_ERR_CHECK();
+   }
+#endif
+}
+
+OBJStreamUploader::~OBJStreamUploader()
+{
+   finish();
+   if(_staging)
+   {
+      glBindBuffer(GL_COPY_READ_BUFFER, _staging);
+      glUnmapBuffer(GL_COPY_READ_BUFFER);
+      glDeleteBuffers(1, &_staging);
+   }
+}
+
+void OBJStreamUploader::wait(GLuint segment)
+{
+   GLsync fence = _fences[segment];
+   if(!fence)
+   {
+      return;
+   }
+
+   GLenum status = glClientWaitSync(fence, 0, 0);
+   if(status == GL_TIMEOUT_EXPIRED)
+   {
+      _stalls++;
+      while(status == GL_TIMEOUT_EXPIRED)
+      {
+         status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000);
+      }
+   }
+   glDeleteSync(fence);
+   _fences[segment] = 0;
+}
+
+void OBJStreamUploader::consume(const OBJStreamBatch& batch)
+{
+   GLuint buffer = batch.type == OBJStreamBatch::VERTICES ? _vertexBuffer : _indexBuffer;
+   glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+
+   if(!_mapped)
+   {
+      glBufferSubData(GL_COPY_WRITE_BUFFER, batch.offset(), batch.bytes, batch.data);
+      GL_ERR_CHECK();
+      return;
+   }
+
+   // Batches larger than a segment are split across several
+   glBindBuffer(GL_COPY_READ_BUFFER, _staging);
+   const char* data = static_cast<const char*>(batch.data);
+   for(GLsizeiptr done = 0; done < batch.bytes; done += _segmentBytes)
+   {
+      GLsizeiptr size = batch.bytes - done;
+      size = size < _segmentBytes ? size : _segmentBytes;
+
+      GLuint segment = _next;
+      _next = (_next + 1) % GLuint(_fences.size());
+      wait(segment);
+
+      GLintptr offset = GLintptr(segment) * _segmentBytes;
+      memcpy(_mapped + offset, data + done, size);
+      glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+                          offset, batch.offset() + done, size);
+      _fences[segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+   }
+   GL_ERR_CHECK();
+}
+
+void OBJStreamUploader::finish(void)
+{
+   for(GLuint i = 0; i < _fences.size(); ++i)
+   {
+      wait(i);
+   }
+}
+
+GLuint OBJStreamUploader::upload(const std::string& filename, size_t budget,
+                                 GLuint& vertexBuffer, GLuint& indexBuffer,
+                                 GLfloat* bounds)
+{
+   using namespace std::chrono;
+   steady_clock::time_point start = steady_clock::now();
+
+   OBJStreamProducer producer(filename, budget);
+   GLuint numVertices;
+   GLuint numIndices;
+   producer.count(numVertices, numIndices);
+
+   glGenBuffers(1, &vertexBuffer);
+   glGenBuffers(1, &indexBuffer);
+   glBindBuffer(GL_COPY_WRITE_BUFFER, vertexBuffer);
+   glBufferData(GL_COPY_WRITE_BUFFER, GLsizeiptr(numVertices) * 3 * sizeof(GLfloat),
+                NULL, GL_STATIC_DRAW);
+   glBindBuffer(GL_COPY_WRITE_BUFFER, indexBuffer);
+   glBufferData(GL_COPY_WRITE_BUFFER, GLsizeiptr(numIndices) * sizeof(GLuint),
+                NULL, GL_STATIC_DRAW);
+   GL_ERR_CHECK();
+
+   GLsizeiptr vertexBytes = GLsizeiptr(producer.vertexBatchSize()) * 3 * sizeof(GLfloat);
+   GLsizeiptr indexBytes = GLsizeiptr(producer.indexBatchSize()) * sizeof(GLuint);
+   GLuint stalls;
+   bool persistent;
+   {
+      OBJStreamUploader uploader(vertexBuffer, indexBuffer,
+                                 vertexBytes > indexBytes ? vertexBytes : indexBytes);
+      if(bounds)
+      {
+         BoundsSink sink(uploader, bounds);
+         producer.run(sink);
+      }
+      else
+      {
+         producer.run(uploader);
+      }
+      uploader.finish();
+      stalls = uploader.stalls();
+      persistent = uploader.persistent();
+   }
+
+   double seconds = duration<double>(steady_clock::now() - start).count();
+   cout << "Streamed " << filename << ": " << numVertices << " vertices, "
+        << numIndices / 3 << " triangles in " << seconds << " s using "
+        << producer.bytes() / 1024 << " KB of host memory, "
+        << (persistent ? "persistent ring" : "glBufferSubData")
+        << ", " << stalls << " stalls" << endl;
+
+   return numIndices;
+}
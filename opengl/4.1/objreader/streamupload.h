@@ -0,0 +1,98 @@
+//----------------------------------------------------------------------
+// streamupload.h
+//
+// Uploads batches from OBJStreamProducer into GL buffers as they are
+// produced.
+//
+// Author: Jeff Bowles <jbowles@riskybacon.com>
+//----------------------------------------------------------------------
+
+#ifndef _streamupload_h
+#define _streamupload_h
+
+#include <string>
+#include <vector>
+#include "objstream.h"
+
+//----------------------------------------------------------------------
+/// Copies batches into a vertex and an index buffer. With
+/// ARB_buffer_storage the batches go through a ring of segments in a
+/// persistently mapped staging buffer and are copied on the GPU with
+/// glCopyBufferSubData; a fence per segment keeps a segment from being
+/// overwritten before its copy has run. Without it each batch is
+/// uploaded with glBufferSubData.
+///
+/// The destination buffers must already be large enough for the whole
+/// mesh, see upload().
+//----------------------------------------------------------------------
+class OBJStreamUploader : public OBJStreamSink
+{
+public:
+   ///
+   /// Constructor
+   ///
+   /// \param vertexBuffer Buffer to receive the positions
+   /// \param indexBuffer Buffer to receive the indices
+   /// \param segmentBytes Size of each staging segment, normally the
+   ///                     largest batch the producer makes
+   /// \param segments Number of segments in the ring
+   /// \param persistent Use a persistently mapped ring if available
+   ///
+   OBJStreamUploader(GLuint vertexBuffer, GLuint indexBuffer,
+                     GLsizeiptr segmentBytes, GLuint segments = 3,
+                     bool persistent = true);
+
+   ///
+   /// Unmaps and deletes the staging buffer, waiting for copies first
+   ///
+   ~OBJStreamUploader();
+
+   virtual void consume(const OBJStreamBatch& batch);
+
+   ///
+   /// Wait until every batch consumed so far has reached its buffer
+   ///
+   void finish(void);
+
+   ///
+   /// \return true if batches go through a persistently mapped ring
+   ///
+   bool persistent(void) const { return _mapped != NULL; }
+
+   ///
+   /// \return number of times a segment had to wait for the GPU
+   ///
+   GLuint stalls(void) const { return _stalls; }
+
+   ///
+   /// Stream an OBJ file into new buffers. Host memory stays within the
+   /// budget whatever the size of the file.
+   ///
+   /// \param filename Name of the OBJ file
+   /// \param budget Bytes of host memory the parser may use
+   /// \param vertexBuffer Set to a new buffer of 3 float positions
+   /// \param indexBuffer Set to a new buffer of GLuint triangle indices
+   /// \param bounds If not NULL, set to the smallest x, y and z of the
+   ///               positions, then the largest
+   /// \return the number of indices
+   ///
+   static GLuint upload(const std::string& filename, size_t budget,
+                        GLuint& vertexBuffer, GLuint& indexBuffer,
+                        GLfloat* bounds = NULL);
+
+private:
+   /// Wait for the fence of a segment, if it has one
+   void wait(GLuint segment);
+
+   GLuint     _vertexBuffer;
+   GLuint     _indexBuffer;
+   GLuint     _staging;
+   GLsizeiptr _segmentBytes;
+   GLuint     _next;
+   GLuint     _stalls;
+   char*      _mapped;
+
+   std::vector<GLsync> _fences;
+};
+
+#endif
@@ -8,10 +8,47 @@ out vec4 inFragColor;
 uniform mat4 mvp;
 uniform mat4 invTP;
 
+// Quantised positions are decoded with position * scale + offset. The
+// defaults leave float positions unchanged.
+uniform vec3 positionScale = vec3(1.0);
+uniform vec3 positionOffset = vec3(0.0);
+
+// How the normal is stored: 0 float, 1 octahedral in two shorts,
+// 2 10_10_10_2
+uniform int normalEncoding = 0;
+
+// Diffuse color of the material being drawn
+uniform vec3 diffuse = vec3(0.9, 0.6, 0.5);
+
+vec4 decodePosition(void)
+{
+   return vec4(vertex.xyz * positionScale + positionOffset, 1.0);
+}
+
+vec4 decodeNormal(void)
+{
+   if(normalEncoding == 0)
+   {
+      return normal;
+   }
+
+   vec3 n = normal.xyz / 511.0;
+   if(normalEncoding == 1)
+   {
+      vec2 e = normal.xy / 32767.0;
+      n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+      if(n.z < 0.0)
+      {
+         n.xy = (1.0 - abs(n.yx)) * vec2(n.x < 0.0 ? -1.0 : 1.0, n.y < 0.0 ? -1.0 : 1.0);
+      }
+   }
+   return vec4(normalize(n), 0.0);
+}
+
 void main(void)
 {
    // Transform vertex into view volume
-   gl_Position = mvp * vertex;
+   gl_Position = mvp * decodePosition();
  
    // Set the light position, this should be a uniform variable
    // and passed in.
@@ -23,10 +60,10 @@ void main(void)
    
    // Use inverse transpose of model/view/projection matrix
    // to transform normals
-   vec4 rotNormal = invTP * normal;
+   vec4 rotNormal = invTP * decodeNormal();
    
    // Get the diffuse lighting for the model
-   vec3 dp = dot(lightDir, rotNormal.xyz) * vec3(0.9, 0.6, 0.5);
+   vec3 dp = dot(lightDir, rotNormal.xyz) * diffuse;
    
    // Output the fragment color.
    inFragColor = vec4(dp, 1.0);
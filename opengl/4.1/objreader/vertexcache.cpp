@@ -0,0 +1,315 @@
+//----------------------------------------------------------------------
+// vertexcache.cpp
+//
+// The triangle order follows "Linear-Speed Vertex Cache Optimisation"
+// by Tom Forsyth: every vertex gets a score from its position in a
+// simulated LRU cache and from how many triangles still need it, and
+// the next triangle drawn is the one with the highest total score
+// among those touching the cache.
+//----------------------------------------------------------------------
+
+#include <math.h>
+#include <string.h>
+#include "vertexcache.h"
+
+namespace
+{
+   // Scoring constants from the paper
+   const float cacheDecayPower   = 1.5f;
+   const float lastTriScore      = 0.75f;
+   const float valenceBoostScale = 2.0f;
+   const float valenceBoostPower = 0.5f;
+
+   // Valence scores are tabulated up to this many triangles
+   const GLuint maxValence = 64;
+
+   const GLuint none = ~0u;
+
+   //-------------------------------------------------------------------
+   // Score tables, filled in once per call to optimize()
+   //-------------------------------------------------------------------
+   struct Scores
+   {
+      std::vector<float> cache;   // by cache position
+      std::vector<float> valence; // by remaining triangles
+
+      Scores(GLuint cacheSize)
+         : cache(cacheSize), valence(maxValence + 1)
+      {
+         for(GLuint i = 0; i < cacheSize; ++i)
+         {
+            if(i < 3)
+            {
+               // The vertices of the triangle just drawn all get the same
+               // score, so the next triangle doesn't favour any one edge
+               cache[i] = lastTriScore;
+            }
+            else
+            {
+               float scale = 1.0f / float(cacheSize - 3);
+               cache[i] = powf(1.0f - float(i - 3) * scale, cacheDecayPower);
+            }
+         }
+
+         valence[0] = 0.0f;
+         for(GLuint i = 1; i <= maxValence; ++i)
+         {
+            valence[i] = valenceBoostScale * powf(float(i), -valenceBoostPower);
+         }
+      }
+
+      float operator()(GLuint position, GLuint remaining) const
+      {
+         if(remaining == 0)
+         {
+            // No triangles left, the vertex doesn't matter any more
+            return -1.0f;
+         }
+
+         float score = position == none ? 0.0f : cache[position];
+         if(remaining <= maxValence)
+         {
+            return score + valence[remaining];
+         }
+         return score + valenceBoostScale * powf(float(remaining), -valenceBoostPower);
+      }
+   };
+}
+
+VertexCache::Stats VertexCache::simulate(const std::vector<GLuint>& indices,
+                                         GLuint numVertices,
+                                         GLuint cacheSize, Policy policy)
+{
+   Stats stats;
+   stats.misses = 0;
+
+   if(policy == FIFO)
+   {
+      // A vertex is in the cache if fewer than cacheSize misses have
+      // happened since it was loaded
+      std::vector<GLuint> loaded(numVertices, 0);
+      GLuint time = cacheSize + 1;
+      for(size_t i = 0; i < indices.size(); ++i)
+      {
+         GLuint v = indices[i];
+         if(time - loaded[v] > cacheSize)
+         {
+            loaded[v] = time++;
+            stats.misses++;
+         }
+      }
+   }
+   else
+   {
+      // Most recently used first
+      std::vector<GLuint> cache;
+      cache.reserve(cacheSize + 1);
+      for(size_t i = 0; i < indices.size(); ++i)
+      {
+         GLuint v = indices[i];
+         std::vector<GLuint>::iterator it = cache.begin();
+         while(it != cache.end() && *it != v)
+         {
+            ++it;
+         }
+
+         if(it == cache.end())
+         {
+            stats.misses++;
+            cache.insert(cache.begin(), v);
+            if(cache.size() > cacheSize)
+            {
+               cache.pop_back();
+            }
+         }
+         else
+         {
+            cache.erase(it);
+            cache.insert(cache.begin(), v);
+         }
+      }
+   }
+
+   GLuint triangles = GLuint(indices.size() / 3);
+   stats.acmr = triangles ? double(stats.misses) / triangles : 0.0;
+   stats.atvr = numVertices ? double(stats.misses) / numVertices : 0.0;
+   return stats;
+}
+
+void VertexCache::optimize(std::vector<GLuint>& indices, GLuint numVertices,
+                           GLuint cacheSize)
+{
+   GLuint numTriangles = GLuint(indices.size() / 3);
+   if(numTriangles == 0 || cacheSize < 4)
+   {
+      return;
+   }
+
+   Scores score(cacheSize);
+   GLuint i;
+   GLuint j;
+
+   // Triangles each vertex is in. The first remaining[v] entries of a
+   // vertex's list are the triangles that haven't been drawn yet.
+   std::vector<GLuint> remaining(numVertices, 0);
+   for(i = 0; i < 3 * numTriangles; ++i)
+   {
+      remaining[indices[i]]++;
+   }
+
+   std::vector<GLuint> offsets(numVertices + 1);
+   offsets[0] = 0;
+   for(i = 0; i < numVertices; ++i)
+   {
+      offsets[i + 1] = offsets[i] + remaining[i];
+   }
+
+   std::vector<GLuint> fill(offsets.begin(), offsets.end() - 1);
+   std::vector<GLuint> adjacency(3 * numTriangles);
+   for(i = 0; i < 3 * numTriangles; ++i)
+   {
+      adjacency[fill[indices[i]]++] = i / 3;
+   }
+
+   std::vector<GLuint> position(numVertices, none);
+   std::vector<float> vertexScore(numVertices);
+   for(i = 0; i < numVertices; ++i)
+   {
+      vertexScore[i] = score(none, remaining[i]);
+   }
+
+   std::vector<float> triangleScore(numTriangles);
+   std::vector<bool> drawn(numTriangles, false);
+   GLuint best = 0;
+   for(i = 0; i < numTriangles; ++i)
+   {
+      const GLuint* tri = &indices[3 * i];
+      triangleScore[i] = vertexScore[tri[0]] + vertexScore[tri[1]] + vertexScore[tri[2]];
+      if(triangleScore[i] > triangleScore[best])
+      {
+         best = i;
+      }
+   }
+
+   // The cache is cacheSize entries, plus room for the 3 vertices of
+   // the triangle being added before the oldest ones fall out
+   std::vector<GLuint> cache;
+   std::vector<GLuint> newCache;
+   cache.reserve(cacheSize + 3);
+   newCache.reserve(cacheSize + 3);
+
+   std::vector<GLuint> output(3 * numTriangles);
+   GLuint scan = 0;
+
+   for(GLuint emitted = 0; emitted < numTriangles; ++emitted)
+   {
+      if(best == none)
+      {
+         // Nothing in the cache has triangles left. Start again from the
+         // next triangle in the original order that hasn't been drawn,
+         // which keeps this linear instead of searching every triangle.
+         while(drawn[scan])
+         {
+            ++scan;
+         }
+         best = scan;
+      }
+
+      const GLuint* tri = &indices[3 * best];
+      memcpy(&output[3 * emitted], tri, 3 * sizeof(GLuint));
+      drawn[best] = true;
+
+      // Take the triangle off its vertices' lists of triangles left
+      for(j = 0; j < 3; ++j)
+      {
+         GLuint v = tri[j];
+         GLuint* list = &adjacency[offsets[v]];
+         GLuint k = 0;
+         while(list[k] != best)
+         {
+            ++k;
+         }
+         list[k] = list[--remaining[v]];
+         list[remaining[v]] = best;
+      }
+
+      // Move the triangle's vertices to the front of the cache
+      newCache.assign(tri, tri + 3);
+      for(i = 0; i < cache.size(); ++i)
+      {
+         GLuint v = cache[i];
+         if(v != tri[0] && v != tri[1] && v != tri[2])
+         {
+            newCache.push_back(v);
+         }
+      }
+      cache.swap(newCache);
+
+      // Rescore everything in the cache, and whatever just fell out of
+      // it, passing the change on to their remaining triangles
+      for(i = 0; i < cache.size(); ++i)
+      {
+         GLuint v = cache[i];
+         position[v] = i < cacheSize ? i : none;
+
+         float updated = score(position[v], remaining[v]);
+         float delta = updated - vertexScore[v];
+         vertexScore[v] = updated;
+
+         const GLuint* list = &adjacency[offsets[v]];
+         for(j = 0; j < remaining[v]; ++j)
+         {
+            triangleScore[list[j]] += delta;
+         }
+      }
+      if(cache.size() > cacheSize)
+      {
+         cache.resize(cacheSize);
+      }
+
+      // The next triangle is the best one touching the cache
+      best = none;
+      float bestScore = -1e30f;
+      for(i = 0; i < cache.size(); ++i)
+      {
+         GLuint v = cache[i];
+         const GLuint* list = &adjacency[offsets[v]];
+         for(j = 0; j < remaining[v]; ++j)
+         {
+            if(triangleScore[list[j]] > bestScore)
+            {
+               best = list[j];
+               bestScore = triangleScore[list[j]];
+            }
+         }
+      }
+   }
+
+   indices.swap(output);
+}
+
+GLuint VertexCache::reorderVertices(std::vector<GLuint>& indices,
+                                    std::vector<GLfloat>& vertices, GLuint floats)
+{
+   GLuint numVertices = GLuint(vertices.size() / floats);
+   std::vector<GLuint> remap(numVertices, none);
+   std::vector<GLfloat> reordered(vertices.size());
+
+   GLuint next = 0;
+   for(size_t i = 0; i < indices.size(); ++i)
+   {
+      GLuint v = indices[i];
+      if(remap[v] == none)
+      {
+         remap[v] = next;
+         memcpy(&reordered[next * floats], &vertices[v * floats],
+                floats * sizeof(GLfloat));
+         next++;
+      }
+      indices[i] = remap[v];
+   }
+
+   reordered.resize(next * floats);
+   vertices.swap(reordered);
+   return next;
+}
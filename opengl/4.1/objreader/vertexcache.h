@@ -0,0 +1,87 @@
+//----------------------------------------------------------------------
+// vertexcache.h
+//
+// Triangle and vertex reordering for the post-transform vertex cache,
+// and a simulator to measure how well an index buffer uses it.
+//
+// Author: Jeff Bowles <jbowles@riskybacon.com>
+//----------------------------------------------------------------------
+
+#ifndef _vertexcache_h
+#define _vertexcache_h
+
+#include <vector>
+
+#if defined(__APPLE_CC__)
+#include <OpenGL/gl3.h>
+#else
+#include <GL/glew.h>
+#include <GL/gl.h>
+#endif
+
+namespace VertexCache
+{
+   //-------------------------------------------------------------------
+   /// Result of running an index buffer through a simulated cache
+   //-------------------------------------------------------------------
+   struct Stats
+   {
+      /// Vertices transformed, one per cache miss
+      GLuint misses;
+
+      /// Average cache miss ratio: transformed vertices per triangle.
+      /// 3 is the worst case, 0.5 the best a large closed mesh can do.
+      double acmr;
+
+      /// Average transform to vertex ratio: transformed vertices per
+      /// unique vertex. 1 is ideal.
+      double atvr;
+   };
+
+   ///
+   /// Replacement policies for simulate()
+   ///
+   enum Policy
+   {
+      FIFO, ///< Oldest vertex leaves first, hits don't refresh (most GPUs)
+      LRU   ///< Least recently used vertex leaves first
+   };
+
+   ///
+   /// Count the vertices a cache of the given size would transform
+   ///
+   /// \param indices Three indices per triangle
+   /// \param numVertices Number of vertices the indices refer to
+   /// \param cacheSize Number of entries in the cache
+   /// \param policy FIFO or LRU replacement
+   ///
+   Stats simulate(const std::vector<GLuint>& indices, GLuint numVertices,
+                  GLuint cacheSize, Policy policy);
+
+   ///
+   /// Reorder triangles to make the best use of an LRU cache, using Tom
+   /// Forsyth's linear-speed vertex cache optimisation. Triangles keep
+   /// their winding.
+   ///
+   /// \param indices Three indices per triangle, reordered in place
+   /// \param numVertices Number of vertices the indices refer to
+   /// \param cacheSize Size of the cache to optimise for
+   ///
+   void optimize(std::vector<GLuint>& indices, GLuint numVertices,
+                 GLuint cacheSize = 32);
+
+   ///
+   /// Renumber vertices in the order the indices first use them so that
+   /// vertex fetches walk through memory. Run after optimize().
+   ///
+   /// \param indices Three indices per triangle, renumbered in place
+   /// \param vertices Interleaved vertices, reordered in place. Vertices
+   ///                 no triangle uses are dropped.
+   /// \param floats Floats per vertex
+   /// \return the number of vertices left
+   ///
+   GLuint reorderVertices(std::vector<GLuint>& indices,
+                          std::vector<GLfloat>& vertices, GLuint floats);
+}
+
+#endif
@@ -5,10 +5,139 @@
 //
 // Authors: Jeff Bowles <jbowles@cs.unm.edu>
 //--------------------------------------------------------------------------------
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <chrono>
 #include <iostream>
 #include <fstream>
 #include "shader.h"
 
+#if defined(_WIN32) || defined(_WIN64)
+#include <direct.h>
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+
+namespace
+{
+   std::string               _binaryCacheDir; //< Program binary directory, empty when off
+   GL::Program::CacheStats   _cacheStats = { 0, 0, 0, 0.0, 0.0 };
+
+   // What GL::State holds for state that wasn't set through it
+   const GLuint UNKNOWN = GLuint(-1);
+
+   //-------------------------------------------------------------------
+   // Header of a program binary cache file, followed by the binary
+   //-------------------------------------------------------------------
+   struct BinaryHeader
+   {
+      char     magic[4]; // "GLPB"
+      uint32_t format;   // Format from glGetProgramBinary
+      uint64_t key;      // Hash the file is named after
+      uint32_t length;   // Bytes of binary that follow
+      uint32_t pad;
+   };
+
+   double now(void)
+   {
+      using namespace std::chrono;
+      return duration<double>(steady_clock::now().time_since_epoch()).count();
+   }
+
+   //-------------------------------------------------------------------
+   // 64 bit FNV-1a over a string and its length, so that consecutive
+   // strings can't run into each other
+   //-------------------------------------------------------------------
+   uint64_t hash(const std::string& text, uint64_t h)
+   {
+      uint64_t length = text.length();
+      const unsigned char* bytes = reinterpret_cast<const unsigned char*>(&length);
+      for(size_t i = 0; i < sizeof(length); ++i)
+      {
+         h = (h ^ bytes[i]) * 1099511628211ull;
+      }
+      for(size_t i = 0; i < text.length(); ++i)
+      {
+         h = (h ^ (unsigned char) text[i]) * 1099511628211ull;
+      }
+      return h;
+   }
+
+   std::string glString(GLenum name)
+   {
+      const GLubyte* value = glGetString(name);
+      return value ? std::string((const char*) value) : std::string();
+   }
+
+   //-------------------------------------------------------------------
+   // Source with the defines after its #version line, followed by a
+   // #line directive so compile errors report the file's line numbers
+   //-------------------------------------------------------------------
+   std::string insertDefines(const std::string& source, const GL::Program::Defines& defines)
+   {
+      if(defines.empty())
+      {
+         return source;
+      }
+
+      size_t start = 0;
+      int version = 110;
+      size_t directive = source.find("#version");
+      if(directive != std::string::npos)
+      {
+         version = atoi(source.c_str() + directive + 8);
+         start = source.find('\n', directive);
+         start = start == std::string::npos ? source.length() : start + 1;
+      }
+
+      int line = 1;
+      for(size_t i = 0; i < start; ++i)
+      {
+         line += source[i] == '\n';
+      }
+
+      std::stringstream out;
+      out << source.substr(0, start);
+      GL::Program::Defines::const_iterator define;
+      for(define = defines.begin(); define != defines.end(); ++define)
+      {
+         out << "#define " << define->first << " " << define->second << "\n";
+      }
+      // Before GLSL 3.30 #line names the line it is on, not the next one
+      out << "#line " << (version < 330 ? line - 1 : line) << "\n";
+      out << source.substr(start);
+      return out.str();
+   }
+
+   //-------------------------------------------------------------------
+   // Can programs be stored and loaded here? Asked once per process,
+   // with a single warning if not.
+   //-------------------------------------------------------------------
+   bool binariesSupported(void)
+   {
+      static int formats = -1;
+      if(formats < 0)
+      {
+         formats = 0;
+         glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+         if(formats <= 0)
+         {
+            std::cerr << "The driver has no program binary formats, "
+                      << "the program cache is off" << std::endl;
+         }
+      }
+      return formats > 0;
+   }
+}
+
 namespace GL
 {
    std::string errorString(GLenum error)
@@ -82,6 +211,242 @@ namespace GL
       
       return errorString;
    }
+
+   State::State()
+   {
+      _lastFrame.issued = _lastFrame.skipped = 0;
+      _frame = _lastFrame;
+      invalidate();
+   }
+
+   State& State::current(void)
+   {
+      static State state;
+      return state;
+   }
+
+   void State::invalidate(void)
+   {
+      _program = UNKNOWN;
+      _vao = UNKNOWN;
+      _activeTexture = UNKNOWN;
+      _textures.clear();
+      _caps.clear();
+      _blendFunc = std::make_pair(GLenum(UNKNOWN), GLenum(UNKNOWN));
+      _depthFunc = UNKNOWN;
+      _depthMask = -1;
+      _drawFramebuffer = UNKNOWN;
+      _readFramebuffer = UNKNOWN;
+      _viewport[0] = _viewport[1] = 0;
+      _viewport[2] = _viewport[3] = -1;
+   }
+
+   void State::useProgram(GLuint program)
+   {
+      if(changed(_program, program))
+      {
+         glUseProgram(program);
+      }
+   }
+
+   void State::bindVertexArray(GLuint vao)
+   {
+      if(changed(_vao, vao))
+      {
+         glBindVertexArray(vao);
+      }
+   }
+
+   void State::bindTexture(GLuint unit, GLenum target, GLuint texture)
+   {
+      // Only a bind that is issued needs the unit active
+      TextureBinding binding(unit, target);
+      std::map<TextureBinding, GLuint>::const_iterator bound = _textures.find(binding);
+      if(bound != _textures.end() && bound->second == texture)
+      {
+         _frame.skipped++;
+         return;
+      }
+      if(changed(_activeTexture, unit))
+      {
+         glActiveTexture(GL_TEXTURE0 + unit);
+      }
+      _textures[binding] = texture;
+      _frame.issued++;
+      glBindTexture(target, texture);
+   }
+
+   void State::bindTexture(GLenum target, GLuint texture)
+   {
+      if(_activeTexture == UNKNOWN)
+      {
+         GLint unit = 0;
+         glGetIntegerv(GL_ACTIVE_TEXTURE, &unit);
+         _activeTexture = GLuint(unit - GL_TEXTURE0);
+      }
+      bindTexture(_activeTexture, target, texture);
+   }
+
+   void State::enable(GLenum cap, bool on)
+   {
+      std::map<GLenum, bool>::iterator known = _caps.find(cap);
+      if(known != _caps.end() && known->second == on)
+      {
+         _frame.skipped++;
+         return;
+      }
+      _caps[cap] = on;
+      _frame.issued++;
+      if(on)
+      {
+         glEnable(cap);
+      }
+      else
+      {
+         glDisable(cap);
+      }
+   }
+
+   void State::blendFunc(GLenum source, GLenum destination)
+   {
+      if(changed(_blendFunc, std::make_pair(source, destination)))
+      {
+         glBlendFunc(source, destination);
+      }
+   }
+
+   void State::depthFunc(GLenum func)
+   {
+      if(changed(_depthFunc, func))
+      {
+         glDepthFunc(func);
+      }
+   }
+
+   void State::depthMask(GLboolean write)
+   {
+      if(changed(_depthMask, GLint(write != GL_FALSE)))
+      {
+         glDepthMask(write);
+      }
+   }
+
+   void State::bindFramebuffer(GLenum target, GLuint framebuffer)
+   {
+      bool issue;
+      switch(target)
+      {
+         case GL_DRAW_FRAMEBUFFER:
+            issue = changed(_drawFramebuffer, framebuffer);
+            break;
+
+         case GL_READ_FRAMEBUFFER:
+            issue = changed(_readFramebuffer, framebuffer);
+            break;
+
+         default:
+            // Count it once, issued unless both already match
+            issue = _drawFramebuffer != framebuffer || _readFramebuffer != framebuffer;
+            _drawFramebuffer = _readFramebuffer = framebuffer;
+            if(issue)
+            {
+               _frame.issued++;
+            }
+            else
+            {
+               _frame.skipped++;
+            }
+            break;
+      }
+      if(issue)
+      {
+         glBindFramebuffer(target, framebuffer);
+      }
+   }
+
+   void State::viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+   {
+      if(_viewport[0] == x && _viewport[1] == y && _viewport[2] == width && _viewport[3] == height)
+      {
+         _frame.skipped++;
+         return;
+      }
+      _viewport[0] = x;
+      _viewport[1] = y;
+      _viewport[2] = width;
+      _viewport[3] = height;
+      _frame.issued++;
+      glViewport(x, y, width, height);
+   }
+
+   void State::deleteProgram(GLuint program)
+   {
+      // A program deleted while in use stays in use, but its name may
+      // come back once it is replaced
+      if(_program == program)
+      {
+         _program = UNKNOWN;
+      }
+      glDeleteProgram(program);
+   }
+
+   void State::deleteVertexArrays(GLsizei count, const GLuint* vaos)
+   {
+      for(GLsizei i = 0; i < count; ++i)
+      {
+         if(_vao == vaos[i])
+         {
+            _vao = 0;
+         }
+      }
+      glDeleteVertexArrays(count, vaos);
+   }
+
+   void State::deleteTextures(GLsizei count, const GLuint* textures)
+   {
+      std::map<TextureBinding, GLuint>::iterator bound;
+      for(bound = _textures.begin(); bound != _textures.end(); ++bound)
+      {
+         for(GLsizei i = 0; i < count; ++i)
+         {
+            if(bound->second == textures[i])
+            {
+               bound->second = 0;
+            }
+         }
+      }
+      glDeleteTextures(count, textures);
+   }
+
+   void State::deleteFramebuffers(GLsizei count, const GLuint* framebuffers)
+   {
+      for(GLsizei i = 0; i < count; ++i)
+      {
+         if(_drawFramebuffer == framebuffers[i])
+         {
+            _drawFramebuffer = 0;
+         }
+         if(_readFramebuffer == framebuffers[i])
+         {
+            _readFramebuffer = 0;
+         }
+      }
+      glDeleteFramebuffers(count, framebuffers);
+   }
+
+   void State::endFrame(void)
+   {
+      _lastFrame = _frame;
+      _frame.issued = _frame.skipped = 0;
+   }
+
+   std::string State::report(void) const
+   {
+      std::stringstream report;
+      report << "GL state: " << _lastFrame.issued << " calls issued, "
+             << _lastFrame.skipped << " skipped as redundant last frame";
+      return report.str();
+   }
    
    /**
     * Creates a string by reading a text file.
@@ -118,8 +483,26 @@ namespace GL
     */
    Shader::Shader(const std::string& filename, GLenum shaderType)
    : _handle   (0)
+   , _name     (filename)
+   {
+      compile(shaderType, readTextFile(filename));
+      check();
+   }
+
+   Shader::Shader(const std::string& name, GLenum shaderType, const std::string& source,
+                  bool wait)
+   : _handle   (0)
+   , _name     (name)
+   {
+      compile(shaderType, source);
+      if(wait)
+      {
+         check();
+      }
+   }
+
+   void Shader::compile(GLenum shaderType, const std::string& source)
    {
-      std::string source = readTextFile(filename);
       const GLchar* sourcePtr0 = source.c_str();
       const GLchar** sourcePtr = &sourcePtr0;
       
@@ -132,11 +515,14 @@ namespace GL
       
       glCompileShader(_handle);
       GL_ERR_CHECK();
-      
+   }
+
+   void Shader::check(void) const
+   {
       if(!getCompileStatus())
       {
          std::stringstream err;
-         err << "Failed to compile shader file: " << filename << std::endl;
+         err << "Failed to compile shader file: " << _name << std::endl;
          err << getLog() << std::endl;
          throw std::runtime_error(err.str());
       }
@@ -185,34 +571,39 @@ namespace GL
    :  _vertexShader   (NULL)
    ,  _fragmentShader (NULL)
    ,  _geometryShader (NULL)
+   ,  _cached         (false)
+   ,  _pending        (false)
+   ,  _rejected       (false)
+   ,  _cacheKey       (0)
+   ,  _submitSeconds  (0.0)
    {
-      _handle = glCreateProgram();
-      GL_ERR_CHECK();
-      
-      _vertexShader   = new Shader(vShaderFile, GL_VERTEX_SHADER);
-      _fragmentShader = new Shader(fShaderFile, GL_FRAGMENT_SHADER);
-      
-      glAttachShader(_handle, _vertexShader->getHandle());
-      GL_ERR_CHECK();
-      
-      glAttachShader(_handle, _fragmentShader->getHandle());
-      GL_ERR_CHECK();
-      
-      // Link the program
-      glLinkProgram(_handle);
-      GL_ERR_CHECK();
-      
-      // Check for linker errors
-      if(!getLinkStatus())
-      {
-         std::stringstream err;
-         err << "GLSL program failed to link:" << std::endl;
-         err << getLog() << std::endl;
-         throw std::runtime_error(err.str());
-      }
-      bind();
-      mapUniformNamesToIndices();
-      mapAttributeNamesToIndices();
+      std::vector<std::string> files;
+      std::vector<GLenum> types;
+      files.push_back(vShaderFile);
+      types.push_back(GL_VERTEX_SHADER);
+      files.push_back(fShaderFile);
+      types.push_back(GL_FRAGMENT_SHADER);
+      create(files, types, Defines(), true);
+   }
+
+   Program::Program(const std::string& vShaderFile, const std::string& fShaderFile,
+                    const Defines& defines)
+   :  _vertexShader   (NULL)
+   ,  _fragmentShader (NULL)
+   ,  _geometryShader (NULL)
+   ,  _cached         (false)
+   ,  _pending        (false)
+   ,  _rejected       (false)
+   ,  _cacheKey       (0)
+   ,  _submitSeconds  (0.0)
+   {
+      std::vector<std::string> files;
+      std::vector<GLenum> types;
+      files.push_back(vShaderFile);
+      types.push_back(GL_VERTEX_SHADER);
+      files.push_back(fShaderFile);
+      types.push_back(GL_FRAGMENT_SHADER);
+      create(files, types, defines, true);
    }
 
 #ifdef OPENGL3
@@ -221,27 +612,169 @@ namespace GL
    :  _vertexShader   (NULL)
    ,  _fragmentShader (NULL)
    ,  _geometryShader (NULL)
+   ,  _cached         (false)
+   ,  _pending        (false)
+   ,  _rejected       (false)
+   ,  _cacheKey       (0)
+   ,  _submitSeconds  (0.0)
+   {
+      std::vector<std::string> files;
+      std::vector<GLenum> types;
+      files.push_back(vShaderFile);
+      types.push_back(GL_VERTEX_SHADER);
+      files.push_back(fShaderFile);
+      types.push_back(GL_FRAGMENT_SHADER);
+      files.push_back(gShaderFile);
+      types.push_back(GL_GEOMETRY_SHADER);
+      create(files, types, Defines(), true);
+   }
+#endif
+
+   Program::Program(const std::vector<std::string>& files, const std::vector<GLenum>& types,
+                    const Defines& defines)
+   :  _vertexShader   (NULL)
+   ,  _fragmentShader (NULL)
+   ,  _geometryShader (NULL)
+   ,  _cached         (false)
+   ,  _pending        (false)
+   ,  _rejected       (false)
+   ,  _cacheKey       (0)
+   ,  _submitSeconds  (0.0)
+   {
+      create(files, types, defines, false);
+   }
+   
+   Program::~Program()
+   {
+      if(_handle > 0)
+      {
+         delete _vertexShader;
+         delete _fragmentShader;
+         delete _geometryShader;
+         State::current().deleteProgram(_handle);
+      }
+   }
+
+   void Program::create(const std::vector<std::string>& files,
+                        const std::vector<GLenum>& types, const Defines& defines, bool wait)
    {
+      double start = now();
+      std::vector<std::string> sources;
+      for(size_t i = 0; i < files.size(); ++i)
+      {
+         sources.push_back(insertDefines(readTextFile(files[i]), defines));
+      }
+
       _handle = glCreateProgram();
       GL_ERR_CHECK();
-      
-      _vertexShader   = new Shader(vShaderFile, GL_VERTEX_SHADER);
-      _fragmentShader = new Shader(fShaderFile, GL_FRAGMENT_SHADER);
-      _geometryShader = new Shader(gShaderFile, GL_GEOMETRY_SHADER);
-      
-      glAttachShader(_handle, _vertexShader->getHandle());
-      GL_ERR_CHECK();
-      
-      glAttachShader(_handle, _fragmentShader->getHandle());
-      GL_ERR_CHECK();
-      
-      glAttachShader(_handle, _geometryShader->getHandle());
-      GL_ERR_CHECK();
-      
+
+      // The key covers everything the driver's output depends on. The
+      // defines are already part of the sources.
+      std::string filename;
+      uint64_t key = 14695981039346656037ull;
+      if(!_binaryCacheDir.empty() && binariesSupported())
+      {
+         for(size_t i = 0; i < sources.size(); ++i)
+         {
+            std::stringstream type;
+            type << types[i];
+            key = hash(type.str(), key);
+            key = hash(sources[i], key);
+         }
+         key = hash(glString(GL_VENDOR), key);
+         key = hash(glString(GL_RENDERER), key);
+         key = hash(glString(GL_VERSION), key);
+
+         char name[32];
+         snprintf(name, sizeof(name), "%016llx.bin", (unsigned long long) key);
+         filename = _binaryCacheDir + "/" + name;
+
+         if(loadBinary(filename, key, _rejected))
+         {
+            _cached = true;
+            mapUniformNamesToIndices();
+            mapAttributeNamesToIndices();
+            _cacheStats.hits++;
+            _cacheStats.hitSeconds += now() - start;
+            if(wait)
+            {
+               bind();
+            }
+            return;
+         }
+      }
+
+      // Nothing below waits for the driver, the statuses are asked for
+      // in finish()
+      for(size_t i = 0; i < files.size(); ++i)
+      {
+         Shader* shader = new Shader(files[i], types[i], sources[i], false);
+         switch(types[i])
+         {
+            case GL_VERTEX_SHADER:   _vertexShader = shader;   break;
+            case GL_FRAGMENT_SHADER: _fragmentShader = shader; break;
+            default:                 _geometryShader = shader; break;
+         }
+         glAttachShader(_handle, shader->getHandle());
+         GL_ERR_CHECK();
+      }
+
+      if(!filename.empty())
+      {
+         glProgramParameteri(_handle, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+         GL_ERR_CHECK();
+      }
+
       // Link the program
       glLinkProgram(_handle);
       GL_ERR_CHECK();
-      
+
+      _cacheFile = filename;
+      _cacheKey = key;
+      _submitSeconds = now() - start;
+      _pending = true;
+      if(wait)
+      {
+         finish();
+         bind();
+      }
+   }
+
+   bool Program::isComplete(void) const
+   {
+      if(!_pending || !ProgramBatch::parallel())
+      {
+         return true;
+      }
+#ifdef GL_KHR_parallel_shader_compile
+      GLint complete = GL_TRUE;
+      glGetProgramiv(_handle, GL_COMPLETION_STATUS_KHR, &complete);
+      GL_ERR_CHECK();
+      return complete == GL_TRUE;
+#else
+      return true;
+#endif
+   }
+
+   void Program::finish(void)
+   {
+      if(!_pending)
+      {
+         return;
+      }
+      double start = now();
+
+      // A compile error names its file, the link log would only say
+      // that a shader didn't compile
+      Shader* shaders[] = { _vertexShader, _fragmentShader, _geometryShader };
+      for(int i = 0; i < 3; ++i)
+      {
+         if(shaders[i])
+         {
+            shaders[i]->check();
+         }
+      }
+
       // Check for linker errors
       if(!getLinkStatus())
       {
@@ -250,20 +783,146 @@ namespace GL
          err << getLog() << std::endl;
          throw std::runtime_error(err.str());
       }
-      bind();
+      _pending = false;
       mapUniformNamesToIndices();
       mapAttributeNamesToIndices();
+
+      if(!_cacheFile.empty())
+      {
+         saveBinary(_cacheFile, _cacheKey);
+      }
+      _cacheStats.misses++;
+      _cacheStats.rejected += _rejected;
+      _cacheStats.missSeconds += _submitSeconds + now() - start;
    }
+
+   bool Program::loadBinary(const std::string& filename, uint64_t key, bool& rejected)
+   {
+      FILE* file = fopen(filename.c_str(), "rb");
+      if(!file)
+      {
+         return false;
+      }
+
+      BinaryHeader header;
+      std::vector<char> binary;
+      bool ok = fread(&header, sizeof(header), 1, file) == 1 &&
+                memcmp(header.magic, "GLPB", 4) == 0 && header.key == key;
+      if(ok)
+      {
+         binary.resize(header.length);
+         ok = header.length > 0 && fread(&binary[0], 1, binary.size(), file) == binary.size();
+      }
+      fclose(file);
+
+      if(ok)
+      {
+         glProgramBinary(_handle, header.format, &binary[0], GLsizei(binary.size()));
+
+         // A format the driver no longer knows is an error rather than
+         // a failed link, neither should reach the next GL_ERR_CHECK()
+         while(glGetError() != GL_NO_ERROR)
+         {
+         }
+         ok = getLinkStatus();
+      }
+      if(ok)
+      {
+         return true;
+      }
+
+      // Start over with a fresh program, the old one may be half made
+      std::cerr << "Program binary " << filename << " was rejected, compiling" << std::endl;
+      rejected = true;
+      glDeleteProgram(_handle);
+      _handle = glCreateProgram();
+      GL_ERR_CHECK();
+      return false;
+   }
+
+   void Program::saveBinary(const std::string& filename, uint64_t key) const
+   {
+#if !defined(_WIN32) && !defined(_WIN64)
+      if(mkdir(_binaryCacheDir.c_str(), 0755) < 0 && errno != EEXIST)
+#else
+      if(_mkdir(_binaryCacheDir.c_str()) < 0 && errno != EEXIST)
 #endif
-   
-   Program::~Program()
+      {
+         std::cerr << "Could not create program cache directory " << _binaryCacheDir << std::endl;
+         return;
+      }
+
+      GLint length = 0;
+      glGetProgramiv(_handle, GL_PROGRAM_BINARY_LENGTH, &length);
+      GL_ERR_CHECK();
+      if(length <= 0)
+      {
+         return;
+      }
+
+      BinaryHeader header;
+      memset(&header, 0, sizeof(header));
+      memcpy(header.magic, "GLPB", 4);
+      std::vector<char> binary(length);
+      GLenum format = 0;
+      glGetProgramBinary(_handle, length, &length, &format, &binary[0]);
+      GL_ERR_CHECK();
+      header.format = format;
+      header.key = key;
+      header.length = uint32_t(length);
+
+      // Written aside and renamed, so another instance never reads half
+      // a file. Each writer has a temporary of its own, so instances
+      // saving the same program at once never write into one file.
+      static std::atomic<unsigned> writes(0);
+      char suffix[64];
+      snprintf(suffix, sizeof(suffix), ".%ld.%u.tmp", long(getpid()), writes++);
+      std::string temporary = filename + suffix;
+      FILE* file = fopen(temporary.c_str(), "wb");
+      if(!file)
+      {
+         std::cerr << "Could not open " << temporary << " for writing" << std::endl;
+         return;
+      }
+      bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                fwrite(&binary[0], 1, header.length, file) == header.length;
+      ok = fclose(file) == 0 && ok;
+
+#if defined(_WIN32) || defined(_WIN64)
+      // rename() won't replace an existing file on Windows
+      remove(filename.c_str());
+#endif
+      if(!ok || rename(temporary.c_str(), filename.c_str()) != 0)
+      {
+         std::cerr << "Could not write program binary " << filename << std::endl;
+         remove(temporary.c_str());
+      }
+   }
+
+   void Program::setBinaryCache(const std::string& directory)
    {
-      if(_handle > 0)
+      _binaryCacheDir = directory;
+   }
+
+   const Program::CacheStats& Program::getCacheStats(void)
+   {
+      return _cacheStats;
+   }
+
+   std::string Program::cacheReport(void)
+   {
+      std::stringstream report;
+      report.precision(1);
+      report << std::fixed << "Programs: "
+             << _cacheStats.hits << " from the binary cache in "
+             << _cacheStats.hitSeconds * 1000.0 << " ms, "
+             << _cacheStats.misses << " compiled in "
+             << _cacheStats.missSeconds * 1000.0 << " ms";
+      if(_cacheStats.rejected)
       {
-         delete _vertexShader;
-         delete _fragmentShader;
-         glDeleteProgram(_handle);
+         report << " (" << _cacheStats.rejected << " rejected binaries)";
       }
+      return report.str();
    }
    
    /**
@@ -349,4 +1008,218 @@ namespace GL
       }
 #endif
    }
+
+   void Program::setUniformBlockBinding(const std::string& block, GLuint binding)
+   {
+      ready();
+      GLuint index = glGetUniformBlockIndex(_handle, block.c_str());
+      if(index == GL_INVALID_INDEX)
+      {
+         throw std::runtime_error("No active uniform block " + block);
+      }
+      glUniformBlockBinding(_handle, index, binding);
+      GL_ERR_CHECK();
+   }
+
+   void Program::checkUniformBlock(const std::string& block, size_t size,
+                                   const BlockMember* members, size_t count)
+   {
+      ready();
+      GLuint index = glGetUniformBlockIndex(_handle, block.c_str());
+      if(index == GL_INVALID_INDEX)
+      {
+         throw std::runtime_error("No active uniform block " + block);
+      }
+
+      std::stringstream err;
+      GLint dataSize = 0;
+      glGetActiveUniformBlockiv(_handle, index, GL_UNIFORM_BLOCK_DATA_SIZE, &dataSize);
+      if(size_t(dataSize) > size)
+      {
+         err << "  block is " << dataSize << " bytes, the C++ struct " << size << std::endl;
+      }
+
+      std::vector<const char*> names(count);
+      std::vector<GLuint> indices(count);
+      for(size_t i = 0; i < count; ++i)
+      {
+         names[i] = members[i].name;
+      }
+      glGetUniformIndices(_handle, GLsizei(count), &names[0], &indices[0]);
+      for(size_t i = 0; i < count; ++i)
+      {
+         // Members the compiler dropped have no offset to check
+         if(indices[i] == GL_INVALID_INDEX)
+         {
+            continue;
+         }
+         GLint offset = -1;
+         glGetActiveUniformsiv(_handle, 1, &indices[i], GL_UNIFORM_OFFSET, &offset);
+         if(size_t(offset) != members[i].offset)
+         {
+            err << "  " << members[i].name << " is at " << offset
+                << ", in the C++ struct at " << members[i].offset << std::endl;
+         }
+      }
+      GL_ERR_CHECK();
+
+      if(!err.str().empty())
+      {
+         throw std::runtime_error("Uniform block " + block + " doesn't match its C++ struct:\n" +
+                                  err.str());
+      }
+   }
+
+   ProgramBatch::ProgramBatch()
+   {
+#ifdef GL_KHR_parallel_shader_compile
+      if(parallel())
+      {
+         // All ones leaves the number of threads to the driver
+         glMaxShaderCompilerThreadsKHR(0xFFFFFFFF);
+         GL_ERR_CHECK();
+      }
+#endif
+   }
+
+   Program* ProgramBatch::add(const std::string& vertexFile, const std::string& fragmentFile,
+                              const Program::Defines& defines)
+   {
+      std::vector<std::string> files;
+      std::vector<GLenum> types;
+      files.push_back(vertexFile);
+      types.push_back(GL_VERTEX_SHADER);
+      files.push_back(fragmentFile);
+      types.push_back(GL_FRAGMENT_SHADER);
+      Program* program = new Program(files, types, defines);
+      _programs.push_back(program);
+      return program;
+   }
+
+   bool ProgramBatch::isComplete(void) const
+   {
+      for(size_t i = 0; i < _programs.size(); ++i)
+      {
+         if(!_programs[i]->isComplete())
+         {
+            return false;
+         }
+      }
+      return true;
+   }
+
+   void ProgramBatch::finish(void)
+   {
+      for(size_t i = 0; i < _programs.size(); ++i)
+      {
+         _programs[i]->finish();
+      }
+   }
+
+   bool ProgramBatch::parallel(void)
+   {
+      static int parallel = -1;
+      if(parallel < 0)
+      {
+         parallel = 0;
+         GLint count = 0;
+         glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+         for(GLint i = 0; i < count && !parallel; ++i)
+         {
+            const GLubyte* name = glGetStringi(GL_EXTENSIONS, GLuint(i));
+            parallel = name && strcmp((const char*) name, "GL_KHR_parallel_shader_compile") == 0;
+         }
+      }
+      return parallel > 0;
+   }
+
+   UniformRing::UniformRing(GLsizeiptr frameSize, int blocks, int frames)
+      : _buffer(0), _frameSize(frameSize), _alignment(256), _fences(frames, GLsync(0)),
+        _frame(-1), _mapped(NULL), _used(0), _stalls(0)
+   {
+      glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &_alignment);
+
+      // Regions start aligned, so offsets within them only need
+      // rounding up as well
+      _frameSize += GLsizeiptr(blocks) * (_alignment - 1);
+      _frameSize = (_frameSize + _alignment - 1) / _alignment * _alignment;
+
+      glGenBuffers(1, &_buffer);
+      glBindBuffer(GL_UNIFORM_BUFFER, _buffer);
+      glBufferData(GL_UNIFORM_BUFFER, _frameSize * frames, NULL, GL_STREAM_DRAW);
+      glBindBuffer(GL_UNIFORM_BUFFER, 0);
+      GL_ERR_CHECK();
+   }
+
+   UniformRing::~UniformRing()
+   {
+      for(size_t i = 0; i < _fences.size(); ++i)
+      {
+         if(_fences[i])
+         {
+            glDeleteSync(_fences[i]);
+         }
+      }
+      glDeleteBuffers(1, &_buffer);
+   }
+
+   void UniformRing::begin(void)
+   {
+      // The last frame's draws are issued, so its region is free once
+      // the GPU passes this point
+      if(_frame >= 0)
+      {
+         _fences[_frame] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      }
+      _frame = (_frame + 1) % int(_fences.size());
+
+      GLsync& fence = _fences[_frame];
+      if(fence)
+      {
+         if(glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+         {
+            _stalls++;
+            while(glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+            {
+            }
+         }
+         glDeleteSync(fence);
+         fence = 0;
+      }
+
+      // The fence already ordered the writes, the driver needn't
+      glBindBuffer(GL_UNIFORM_BUFFER, _buffer);
+      _mapped = (char*) glMapBufferRange(GL_UNIFORM_BUFFER, _frameSize * _frame, _frameSize,
+                                         GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT |
+                                         GL_MAP_UNSYNCHRONIZED_BIT);
+      GL_ERR_CHECK();
+      if(!_mapped)
+      {
+         throw std::runtime_error("Can't map the uniform ring buffer");
+      }
+      _used = 0;
+   }
+
+   GLintptr UniformRing::push(const void* data, GLsizeiptr size)
+   {
+      GLsizeiptr offset = (_used + _alignment - 1) / _alignment * _alignment;
+      if(!_mapped || offset + size > _frameSize)
+      {
+         std::stringstream err;
+         err << "Uniform ring can't take a " << size << " byte block: "
+             << (_mapped ? "frame is full" : "not between begin() and end()");
+         throw std::runtime_error(err.str());
+      }
+      memcpy(_mapped + offset, data, size);
+      _used = offset + size;
+      return _frameSize * _frame + offset;
+   }
+
+   void UniformRing::end(void)
+   {
+      glBindBuffer(GL_UNIFORM_BUFFER, _buffer);
+      glUnmapBuffer(GL_UNIFORM_BUFFER);
+      GL_ERR_CHECK();
+      _mapped = NULL;
+   }
 }
@@ -13,6 +13,7 @@
 #include <map>
 #include <stdexcept>
 #include <vector>
+#include <stdint.h>
 #include <glm/glm.hpp>
 
 #if defined(__APPLE_CC__)
@@ -130,6 +131,202 @@ namespace GL
     */
    std::string errorString(GLenum error);
 
+   /**
+    * Remembers the GL state set through it and skips calls that would set
+    * what is already current: the program, vertex array, textures per
+    * unit, enabled capabilities, blend function, depth function and
+    * mask, framebuffers and viewport. GL::Program::bind() goes through
+    * it, and so should every other call that changes this state, or the
+    * cache has to be told with invalidate(). Objects are deleted through
+    * it as well, since GL unbinds them and may hand their names out again.
+    *
+    * There is one cache, for the one context the demos create. Calling
+    * endFrame() after each frame keeps the counts of the calls issued and
+    * skipped in that frame.
+    *
+    * \code
+    * GL::State& state = GL::State::current();
+    * state.bindVertexArray(vao);
+    * state.bindTexture(0, GL_TEXTURE_2D, texture);
+    * ...
+    * state.endFrame();
+    * std::cout << state.report() << std::endl;
+    * \endcode
+    */
+   class State
+   {
+   public:
+      /**
+       * Calls issued to GL and skipped as redundant
+       */
+      struct Counters
+      {
+         int issued;
+         int skipped;
+      };
+
+      /**
+       * @return the cache of the current context
+       */
+      static State& current(void);
+
+      /**
+       * Forget all state, after GL calls that didn't go through the cache.
+       * The next call of each kind is issued.
+       */
+      void invalidate(void);
+
+      /**
+       * glUseProgram
+       */
+      void useProgram(GLuint program);
+
+      /**
+       * glBindVertexArray
+       */
+      void bindVertexArray(GLuint vao);
+
+      /**
+       * glActiveTexture and glBindTexture, the first only if unit isn't
+       * the active unit already
+       *
+       * @param unit
+       *    Texture unit, 0 for GL_TEXTURE0
+       * @param target
+       *    Texture target, such as GL_TEXTURE_2D
+       * @param texture
+       *    Texture handle
+       */
+      void bindTexture(GLuint unit, GLenum target, GLuint texture);
+
+      /**
+       * glBindTexture on whichever unit is active
+       */
+      void bindTexture(GLenum target, GLuint texture);
+
+      /**
+       * glEnable or glDisable
+       *
+       * @param cap
+       *    Capability, such as GL_BLEND or GL_DEPTH_TEST
+       * @param on
+       *    true to enable it
+       */
+      void enable(GLenum cap, bool on = true);
+
+      /**
+       * glDisable
+       */
+      void disable(GLenum cap)
+      {
+         enable(cap, false);
+      }
+
+      /**
+       * glBlendFunc
+       */
+      void blendFunc(GLenum source, GLenum destination);
+
+      /**
+       * glDepthFunc
+       */
+      void depthFunc(GLenum func);
+
+      /**
+       * glDepthMask
+       */
+      void depthMask(GLboolean write);
+
+      /**
+       * glBindFramebuffer. GL_FRAMEBUFFER sets both the draw and the
+       * read framebuffer.
+       */
+      void bindFramebuffer(GLenum target, GLuint framebuffer);
+
+      /**
+       * glViewport
+       */
+      void viewport(GLint x, GLint y, GLsizei width, GLsizei height);
+
+      /**
+       * glDeleteProgram, forgetting the program if it is in use
+       */
+      void deleteProgram(GLuint program);
+
+      /**
+       * glDeleteVertexArrays, forgetting any that is bound
+       */
+      void deleteVertexArrays(GLsizei count, const GLuint* vaos);
+
+      /**
+       * glDeleteTextures, forgetting them on every unit
+       */
+      void deleteTextures(GLsizei count, const GLuint* textures);
+
+      /**
+       * glDeleteFramebuffers, forgetting any that is bound
+       */
+      void deleteFramebuffers(GLsizei count, const GLuint* framebuffers);
+
+      /**
+       * Finish a frame: its counts become getFrameCounters() and the
+       * next frame counts from zero
+       */
+      void endFrame(void);
+
+      /**
+       * @return the calls issued and skipped in the last frame
+       */
+      const Counters& getFrameCounters(void) const
+      {
+         return _lastFrame;
+      }
+
+      /**
+       * @return the last frame's counts as a line of text
+       */
+      std::string report(void) const;
+
+   private:
+      State();
+
+      /**
+       * Count a call and say whether to issue it
+       *
+       * @param known
+       *    Cached value, updated to value
+       * @return true if value differs from known
+       */
+      template<typename T>
+      bool changed(T& known, const T& value)
+      {
+         if(known == value)
+         {
+            _frame.skipped++;
+            return false;
+         }
+         known = value;
+         _frame.issued++;
+         return true;
+      }
+
+      typedef std::pair<GLuint, GLenum> TextureBinding; //< Unit and target
+
+      GLuint   _program;          //< Program in use
+      GLuint   _vao;              //< Vertex array bound
+      GLuint   _activeTexture;    //< Active unit, 0 for GL_TEXTURE0
+      std::map<TextureBinding, GLuint> _textures; //< Texture bound to each unit and target
+      std::map<GLenum, bool> _caps; //< Capabilities enabled or disabled
+      std::pair<GLenum, GLenum> _blendFunc; //< Source and destination factors
+      GLenum   _depthFunc;        //< Depth comparison
+      GLint    _depthMask;        //< Depth writes, -1 if unknown
+      GLuint   _drawFramebuffer;  //< Framebuffer drawn to
+      GLuint   _readFramebuffer;  //< Framebuffer read from
+      GLint    _viewport[4];      //< x, y, width, height; width -1 if unknown
+      Counters _frame;            //< Counts of the frame being drawn
+      Counters _lastFrame;        //< Counts of the last frame finished
+   };
+
    /**
     * An OpenGL GLSL shader
     */
@@ -144,6 +341,19 @@ namespace GL
        * @param shaderType    The type of shader (GL_VERTEX_SHADER, etc)
        */
       Shader(const std::string& filename, GLenum shaderType);
+
+      /**
+       * Create a shader from source already in memory. Throws
+       * std::runtime_error if it fails to compile
+       *
+       * @param name          Name for error messages, usually the file name
+       * @param shaderType    The type of shader (GL_VERTEX_SHADER, etc)
+       * @param source        GLSL source
+       * @param wait          false to return without asking the driver
+       *                      whether the compile worked; check() does
+       */
+      Shader(const std::string& name, GLenum shaderType, const std::string& source,
+             bool wait = true);
       
       /**
        * Destructor
@@ -157,6 +367,12 @@ namespace GL
        * @return           true if the shader was compiled, false otherwise
        */
       bool getCompileStatus() const;
+
+      /**
+       * Throw std::runtime_error with the log if the shader failed to
+       * compile. Waits for the driver.
+       */
+      void check(void) const;
       
       /**
        * Retrieve a shader log
@@ -174,16 +390,122 @@ namespace GL
       }
 
    private:
-      GLuint _handle; //< OpenGL handle for a GLSL shader
+      /**
+       * Create the shader and start compiling it
+       */
+      void compile(GLenum shaderType, const std::string& source);
+
+      GLuint      _handle; //< OpenGL handle for a GLSL shader
+      std::string _name;   //< File name, for errors
    };
    
    
+   /**
+    * The location of a uniform of type T, looked up once with
+    * Program::getUniform(), so that setting it is a glUniform call with
+    * no name lookup. Like glUniform, set() changes the bound program.
+    * A handle belongs to one linked program: a reloaded program needs
+    * new handles. A default constructed handle has location -1, which
+    * GL ignores.
+    *
+    * \code
+    * GL::Uniform<glm::mat4> mvp = program->getUniform<glm::mat4>("mvp");
+    * ...
+    * program->bind();
+    * mvp.set(modelViewProjection);
+    * \endcode
+    */
+   template<typename T>
+   class Uniform
+   {
+   public:
+      Uniform()
+      : _location (-1)
+      {
+      }
+
+      explicit Uniform(GLint location)
+      : _location (location)
+      {
+      }
+
+      /**
+       * Set the uniform of the bound program
+       */
+      void set(const T& value) const;
+
+      /**
+       * @return the uniform location, -1 if there is none
+       */
+      GLint getLocation(void) const
+      {
+         return _location;
+      }
+
+   private:
+      GLint _location; //< Uniform location in its program
+   };
+
+   template<> inline void Uniform<GLint>::set(const GLint& value) const
+   {
+      glUniform1i(_location, value);
+   }
+
+   template<> inline void Uniform<GLfloat>::set(const GLfloat& value) const
+   {
+      glUniform1f(_location, value);
+   }
+
+   template<> inline void Uniform<glm::vec2>::set(const glm::vec2& value) const
+   {
+      glUniform2fv(_location, 1, &value[0]);
+   }
+
+   template<> inline void Uniform<glm::vec3>::set(const glm::vec3& value) const
+   {
+      glUniform3fv(_location, 1, &value[0]);
+   }
+
+   template<> inline void Uniform<glm::vec4>::set(const glm::vec4& value) const
+   {
+      glUniform4fv(_location, 1, &value[0]);
+   }
+
+   template<> inline void Uniform<glm::mat3>::set(const glm::mat3& value) const
+   {
+      glUniformMatrix3fv(_location, 1, GL_FALSE, &value[0][0]);
+   }
+
+   template<> inline void Uniform<glm::mat4>::set(const glm::mat4& value) const
+   {
+      glUniformMatrix4fv(_location, 1, GL_FALSE, &value[0][0]);
+   }
+   
    /**
     * An OpenGL GLSL program
     */
    class Program
    {
    public:
+      /**
+       * Preprocessor definitions, name to value, inserted after the
+       * #version line of every shader in a program
+       */
+      typedef std::map<std::string, std::string> Defines;
+
+      /**
+       * Counts and wall clock times of program creation, split by
+       * whether the program binary cache had the program
+       */
+      struct CacheStats
+      {
+         int    hits;        //< Programs loaded with glProgramBinary
+         int    misses;      //< Programs compiled and linked from source
+         int    rejected;    //< Cached binaries the driver refused, also misses
+         double hitSeconds;  //< Time spent creating the hits
+         double missSeconds; //< Time spent creating the misses
+      };
+
       /**
        * Create a GLSL program
        *
@@ -194,6 +516,19 @@ namespace GL
        */
       Program(const std::string& vertexFile, const std::string& fragmentFile);
 
+      /**
+       * Create a GLSL program
+       *
+       * @param vertexFile
+       *    The name of the file that contains vertex shader source
+       * @param fragmentFile
+       *    The name of the file that contains the fragment shader source
+       * @param defines
+       *    Preprocessor definitions for both shaders
+       */
+      Program(const std::string& vertexFile, const std::string& fragmentFile,
+              const Defines& defines);
+
       /**
        * Create a GLSL program
        *
@@ -212,6 +547,55 @@ namespace GL
        */
       ~Program();
 
+      /**
+       * Keep linked program binaries in a directory, created if missing,
+       * and load programs from there instead of compiling them. Entries
+       * are keyed by the shader sources, the defines and the
+       * GL_VENDOR, GL_RENDERER and GL_VERSION strings, so an edited
+       * shader or a driver update misses. A binary the driver refuses
+       * is compiled from source and replaced.
+       *
+       * @param directory
+       *    Cache directory, empty to compile every program (the default)
+       */
+      static void setBinaryCache(const std::string& directory);
+
+      /**
+       * @return the program binary cache counts since startup
+       */
+      static const CacheStats& getCacheStats(void);
+
+      /**
+       * @return the cache counts as a line of text, for startup logs
+       */
+      static std::string cacheReport(void);
+
+      /**
+       * Ask whether a program from a ProgramBatch is compiled and
+       * linked, without waiting. Without KHR_parallel_shader_compile
+       * the driver can't answer that, and this is always true.
+       *
+       * @return true if finish() would not wait
+       */
+      bool isComplete(void) const;
+
+      /**
+       * Wait for a program from a ProgramBatch to link, throw
+       * std::runtime_error if a shader failed to compile or the
+       * program to link, and map the uniform and attribute names. Done
+       * on first use by bind() and the attribute and uniform location
+       * calls; does nothing for a program that is ready.
+       */
+      void finish(void);
+
+      /**
+       * @return true if this program was loaded from the binary cache
+       */
+      bool fromBinaryCache(void) const
+      {
+         return _cached;
+      }
+
       /**
        * Map the names of uniforms to indices
        */
@@ -246,6 +630,7 @@ namespace GL
        */
       GLuint getAttribLocation(const std::string& name) const
       {
+         ready();
          return glGetAttribLocation(_handle, name.c_str());
       }
 
@@ -285,6 +670,7 @@ namespace GL
                                   GLsizei stride,
                                   const GLvoid * pointer)
       {
+         ready();
          ASSERT_ATTRIBUTE_EXISTS(name);
          glVertexAttribPointer(_attrib[name], size, type, normalized, stride, pointer);
       }
@@ -297,6 +683,7 @@ namespace GL
        */
       void enableVertexAttribArray(const std::string& name)
       {
+         ready();
          ASSERT_ATTRIBUTE_EXISTS(name);
          glEnableVertexAttribArray(_attrib[name]);
       }
@@ -310,6 +697,7 @@ namespace GL
        */
       GLuint getUniformLocation(const std::string& name) const
       {
+         ready();
          return glGetUniformLocation(_handle, name.c_str());
       }
       
@@ -318,6 +706,7 @@ namespace GL
        */
       GLuint getHandle(void) const
       {
+         ready();
          return _handle;
       }
       
@@ -326,7 +715,8 @@ namespace GL
        */
       void bind(void)
       {
-         glUseProgram(_handle);
+         ready();
+         State::current().useProgram(_handle);
       }
       
       //#ifdef OPENGL3
@@ -335,7 +725,7 @@ namespace GL
        */
       void release(void)
       {
-         glUseProgram(0);
+         State::current().useProgram(0);
       }
       //#endif
       
@@ -416,6 +806,66 @@ namespace GL
          return params;
       }
 
+      /**
+       * One member of a C++ mirror of a uniform block, for
+       * checkUniformBlock()
+       */
+      struct BlockMember
+      {
+         const char* name;   //< Member name in GLSL
+         size_t      offset; //< offsetof() the member in the C++ struct
+      };
+
+      /**
+       * Connect a uniform block to a binding point, where
+       * glBindBufferRange(GL_UNIFORM_BUFFER, binding, ...) supplies its
+       * data. Throws std::runtime_error if the program has no such
+       * active block.
+       *
+       * @param block
+       *    Name of the uniform block
+       * @param binding
+       *    Uniform buffer binding point
+       */
+      void setUniformBlockBinding(const std::string& block, GLuint binding);
+
+      /**
+       * Check a C++ struct against the layout the driver gave a
+       * std140 uniform block: the block size may not exceed the
+       * struct's, and each member's offset must match. Members the
+       * driver reports as inactive are skipped. Throws
+       * std::runtime_error listing every difference.
+       *
+       * @param block
+       *    Name of the uniform block
+       * @param size
+       *    sizeof() the C++ struct
+       * @param members
+       *    Members of the struct to check
+       * @param count
+       *    Number of members
+       */
+      void checkUniformBlock(const std::string& block, size_t size,
+                             const BlockMember* members, size_t count);
+
+      /**
+       * Look up a uniform once, for setting it without its name later.
+       * Finishes a program from a ProgramBatch.
+       *
+       * @param name
+       *    The name of the uniform variable
+       * @return a handle to the uniform, location -1 if the program
+       *    has no such active uniform
+       */
+      template<typename T>
+      Uniform<T> getUniform(const std::string& name)
+      {
+         ready();
+         ASSERT_UNIFORM_EXISTS(name);
+         std::map<std::string, GLuint>::const_iterator uniform = _uniform.find(name);
+         return Uniform<T>(uniform == _uniform.end() ? -1 : GLint(uniform->second));
+      }
+
       //{@ glUniform1i
 #if 0
       void setUniform(const std::string& name, const GLint v0) {
@@ -643,13 +1093,232 @@ namespace GL
       }
 
    private:
+      friend class ProgramBatch;
+
+      /**
+       * Load a program from the binary cache, or start compiling and
+       * linking it, without waiting. For ProgramBatch.
+       */
+      Program(const std::vector<std::string>& files, const std::vector<GLenum>& types,
+              const Defines& defines);
+
+      /**
+       * Load the program from the binary cache, or submit its shaders
+       * and link it, adding it to the cache once finished
+       *
+       * @param files   Shader source files
+       * @param types   Shader type of each file
+       * @param defines Preprocessor definitions for every shader
+       * @param wait    true to finish() before returning
+       */
+      void create(const std::vector<std::string>& files,
+                  const std::vector<GLenum>& types, const Defines& defines, bool wait);
+
+      /**
+       * finish() a deferred program before its first use
+       */
+      void ready(void) const
+      {
+         if(_pending)
+         {
+            const_cast<Program*>(this)->finish();
+         }
+      }
+
+      /**
+       * Replace the program with a cached binary
+       *
+       * @param filename Cache file
+       * @param key      Hash the file must have been written for
+       * @param rejected Set if the file was there but the driver refused it
+       * @return true if the file was there and the driver accepted it
+       */
+      bool loadBinary(const std::string& filename, uint64_t key, bool& rejected);
+
+      /**
+       * Write the linked program to the binary cache
+       */
+      void saveBinary(const std::string& filename, uint64_t key) const;
+
       GLuint                        _handle;         //< OpenGL handle for a GLSL shader
       Shader*                       _vertexShader;   //< Pointer to the fragment shader
       Shader*                       _fragmentShader; //< Pointer to the vertex shader
       Shader*                       _geometryShader; //< Pointer to the geometry shader
+      bool                          _cached;         //< Loaded from the binary cache
+      bool                          _pending;        //< Submitted, not yet finish()ed
+      bool                          _rejected;       //< The cached binary was refused
+      std::string                   _cacheFile;      //< Binary cache entry to write once linked
+      uint64_t                      _cacheKey;       //< Key of _cacheFile
+      double                        _submitSeconds;  //< Time spent submitting the shaders
       std::map<std::string, GLuint> _uniform;        //< Map of uniform names to GLuint indices
       std::map<std::string, GLuint> _attrib;         //< Map of attribute names to GLuint indices
 
    };
+
+   /**
+    * Creates several programs without waiting for any of them. Every
+    * shader is submitted and every program linked before the driver is
+    * asked whether one worked, so a driver with compiler threads
+    * (KHR_parallel_shader_compile, which the batch turns on) builds them
+    * side by side while the caller goes on to load meshes and textures.
+    * Each program finishes on its first use, or all at once with
+    * finish().
+    *
+    * \code
+    * GL::ProgramBatch batch;
+    * _shadow = batch.add(shadowVertex, shadowFragment);
+    * _flat   = batch.add(flatVertex, flatFragment);
+    * ...upload buffers
+    * _shadow->bind();  // Waits for _shadow, throws on errors
+    * \endcode
+    *
+    * The batch doesn't own the programs, delete them as usual.
+    */
+   class ProgramBatch
+   {
+   public:
+      /**
+       * Constructor, asks the driver for as many compiler threads as it
+       * likes where KHR_parallel_shader_compile is there
+       */
+      ProgramBatch();
+
+      /**
+       * Submit a program and return without waiting for it
+       *
+       * @param vertexFile
+       *    The name of the file that contains vertex shader source
+       * @param fragmentFile
+       *    The name of the file that contains the fragment shader source
+       * @param defines
+       *    Preprocessor definitions for both shaders
+       * @return the program, to be deleted by the caller
+       */
+      Program* add(const std::string& vertexFile, const std::string& fragmentFile,
+                   const Program::Defines& defines = Program::Defines());
+
+      /**
+       * @return true if no program in the batch would wait in finish()
+       */
+      bool isComplete(void) const;
+
+      /**
+       * Finish every program, throwing on the first that failed
+       */
+      void finish(void);
+
+      /**
+       * @return true if the driver compiles in threads of its own
+       */
+      static bool parallel(void);
+
+   private:
+      std::vector<Program*> _programs; //< Programs submitted, not owned
+   };
+
+   /**
+    * A uniform buffer that blocks are sub-allocated from, a region per
+    * frame in flight. Each frame begin() maps the next region, push()
+    * copies blocks into it and returns their offsets, end() unmaps it
+    * and the draws bind the blocks with bind(). The region is fenced
+    * when the next frame begins and not written again until the GPU
+    * has passed the fence, so no frame waits for the one before.
+    *
+    * \code
+    * ring.begin();
+    * GLintptr frame = ring.push(frameBlock);
+    * GLintptr object = ring.push(objectBlock);
+    * ring.end();
+    * ring.bind(FRAME_BINDING, frame, sizeof(frameBlock));
+    * ring.bind(OBJECT_BINDING, object, sizeof(objectBlock));
+    * glDrawArrays(...);
+    * \endcode
+    */
+   class UniformRing
+   {
+   public:
+      /**
+       * Constructor
+       *
+       * @param frameSize
+       *    Bytes of blocks pushed per frame
+       * @param blocks
+       *    Most blocks pushed per frame, each of which may need padding
+       *    to GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+       * @param frames
+       *    Frames in flight, each with a region of its own
+       */
+      UniformRing(GLsizeiptr frameSize, int blocks, int frames = 3);
+
+      /**
+       * Destructor
+       */
+      ~UniformRing();
+
+      /**
+       * Fence the last frame's region and map the next one, waiting
+       * for the GPU if it is still reading it
+       */
+      void begin(void);
+
+      /**
+       * Copy a block into the mapped region. Throws std::runtime_error
+       * if the region is full.
+       *
+       * @param data
+       *    Block data, laid out std140
+       * @param size
+       *    Block size in bytes
+       * @return the offset of the block in the buffer, for bind()
+       */
+      GLintptr push(const void* data, GLsizeiptr size);
+
+      /**
+       * Copy a C++ mirror of a block into the mapped region
+       */
+      template<typename T>
+      GLintptr push(const T& block)
+      {
+         return push(&block, sizeof(T));
+      }
+
+      /**
+       * Unmap the region, before drawing with its blocks
+       */
+      void end(void);
+
+      /**
+       * Supply a block pushed this frame to a uniform block binding
+       *
+       * @param binding
+       *    Uniform buffer binding point
+       * @param offset
+       *    Offset push() returned
+       * @param size
+       *    Block size in bytes
+       */
+      void bind(GLuint binding, GLintptr offset, GLsizeiptr size) const
+      {
+         glBindBufferRange(GL_UNIFORM_BUFFER, binding, _buffer, offset, size);
+      }
+
+      /**
+       * @return the number of begin() calls that had to wait for the GPU
+       */
+      int getStalls(void) const
+      {
+         return _stalls;
+      }
+
+   private:
+      GLuint              _buffer;    //< Uniform buffer holding every region
+      GLsizeiptr          _frameSize; //< Bytes per region
+      GLint               _alignment; //< GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+      std::vector<GLsync> _fences;    //< Fence after the last use of each region, or 0
+      int                 _frame;     //< Region being written, -1 before the first begin()
+      char*               _mapped;    //< Mapped region, NULL outside begin() and end()
+      GLsizeiptr          _used;      //< Bytes pushed this frame
+      int                 _stalls;    //< Waits in begin()
+   };
 }
 #endif
@@ -5,6 +5,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <iostream>
 #include <fstream>
 #include <vector>
@@ -37,6 +38,9 @@ using std::string;
 
 #include <shader.h>
 #include <GLFW/glfw3.h>
+#include "quantize.h"
+#include "meshlet.h"
+#include "procedural.h"
 #include "config.h"
 
 // Global variables have an underscore prefix.
@@ -60,8 +64,6 @@ enum BUFFER_OBJECTS
    QUAD_NORMAL,
    QUAD_TC,
    TORUS_POS,
-   TORUS_NORMAL,
-   TORUS_TC,
    TORUS_TRI_IDX,
    TORUS_LINES_IDX,
    NUM_BUFFER_OBJECTS
@@ -80,6 +82,61 @@ std::vector<GLuint> _vao; //< Vertex array object handles
 
 GL::Program* _shadowProgram;       //< Shader program that performs shadow mapping
 GL::Program* _flatProgram;         //< Shader program that performs no shading - all fragment get the same color
+GL::State&   _state = GL::State::current(); //< Skips binds and state changes that are already current
+
+// Uniform blocks of the vertex shaders, laid out std140. init() checks
+// the offsets against the ones the driver reports.
+struct FrameBlock
+{
+   mat4  view;
+   vec4  worldLightPos;
+};
+
+struct ObjectBlock
+{
+   mat4  mvp;
+   mat4  model;
+   mat4  toShadowTex;
+   vec4  positionScale;
+   vec4  positionOffset;
+   GLint normalEncoding;
+   GLint pad[3];                   //< std140 rounds the block up to a vec4
+};
+
+const GL::Program::BlockMember _frameMembers[] =
+{
+   { "view",           offsetof(FrameBlock, view) },
+   { "worldLightPos",  offsetof(FrameBlock, worldLightPos) }
+};
+
+const GL::Program::BlockMember _objectMembers[] =
+{
+   { "mvp",            offsetof(ObjectBlock, mvp) },
+   { "model",          offsetof(ObjectBlock, model) },
+   { "toShadowTex",    offsetof(ObjectBlock, toShadowTex) },
+   { "positionScale",  offsetof(ObjectBlock, positionScale) },
+   { "positionOffset", offsetof(ObjectBlock, positionOffset) },
+   { "normalEncoding", offsetof(ObjectBlock, normalEncoding) }
+};
+
+// Uniform buffer binding points of the blocks
+enum UNIFORM_BINDINGS
+{
+   FRAME_BINDING = 0,
+   OBJECT_BINDING
+};
+
+// Objects drawn each frame, one ObjectBlock each
+enum DRAWS
+{
+   OCCLUDER_DEPTH = 0,
+   RECEIVER_DEPTH,
+   OCCLUDER_SHADED,
+   RECEIVER_SHADED,
+   NUM_DRAWS
+};
+
+GL::UniformRing* _uniformRing;     //< Blocks of the frames in flight
 
 glm::mat4    _projection;          //< Camera projection matrix
 
@@ -104,6 +161,20 @@ int          _numTorusPoints;
 int          _numTorusTriIdx;
 int          _numTorusLinesIdx;
 
+// Quantised torus, see createTorus()
+bool         _quantizeTorus;       //< True to store the torus in compact vertex formats
+Quantize::NormalEncoding _torusNormalEncoding; //< How the quantised torus stores normals
+Quantize::Vertices _torusVertices; //< Quantised torus vertices and decode values
+
+// Torus meshlets, see createTorus() and drawTorus()
+Meshlet::Clusters _torusClusters;  //< Torus triangles split into clusters
+Meshlet::DrawList _torusDrawList;  //< Clusters left after culling, rebuilt for every draw
+bool         _cullTorus;           //< True to skip clusters that are off screen or facing away
+GLuint       _culledShadow;        //< Triangles culled from the shadow pass since the last report
+GLuint       _culledCamera;        //< Triangles culled from the camera pass since the last report
+int          _cullFrames;          //< Frames since the last report
+double       _cullReportTime;      //< Time of the last report
+
 // Window size
 int          _winWidth;            //< Width of the window
 int          _winHeight;           //< Height of the window
@@ -152,8 +223,10 @@ void logException(const std::runtime_error& exception)
  */
 void terminate(int exitCode)
 {
-   glDeleteVertexArrays(NUM_VAO_OBJECTS, &_vao[0]);
+   _state.deleteVertexArrays(NUM_VAO_OBJECTS, &_vao[0]);
    glDeleteBuffers(NUM_BUFFER_OBJECTS, &_buffers[0]);
+   delete _uniformRing;
+   _uniformRing = NULL;
    glfwTerminate();
    
    exit(exitCode);
@@ -236,7 +309,7 @@ void createFBO(void)
       //------------------------------------------------------------------------------------------
       // Set up the RGBA texture for the rendered image
       //------------------------------------------------------------------------------------------
-      glBindTexture(GL_TEXTURE_2D, _fboTextures[RGBA]);
+      _state.bindTexture(GL_TEXTURE_2D, _fboTextures[RGBA]);
       glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, _fboWidth, _fboHeight, 0, GL_RGBA, GL_FLOAT, NULL);
       glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
       glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
@@ -247,7 +320,7 @@ void createFBO(void)
       //------------------------------------------------------------------------------------------
       // Set up the texture to hold depth data
       //------------------------------------------------------------------------------------------
-      glBindTexture(GL_TEXTURE_2D, _fboTextures[DEPTH]);
+      _state.bindTexture(GL_TEXTURE_2D, _fboTextures[DEPTH]);
       glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, _fboWidth, _fboHeight, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
       glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
       glTexParameterf( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
@@ -259,7 +332,7 @@ void createFBO(void)
       // Create the frame buffer object
       //------------------------------------------------------------------------------------------
       glGenFramebuffers(1, &_fbo);
-      glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
+      _state.bindFramebuffer(GL_FRAMEBUFFER, _fbo);
       GL_ERR_CHECK();
       
       //------------------------------------------------------------------------------------------
@@ -274,8 +347,8 @@ void createFBO(void)
       GL_ERR_CHECK();
       
       // Return to default OpenGL state
-      glBindFramebuffer(GL_FRAMEBUFFER, 0);
-      glBindTexture(GL_TEXTURE_2D, 0);
+      _state.bindFramebuffer(GL_FRAMEBUFFER, 0);
+      _state.bindTexture(GL_TEXTURE_2D, 0);
       // Set the drawing buffer
       glDrawBuffer(GL_BACK);
       // Set the reading buffer
@@ -292,167 +365,179 @@ void createFBO(void)
 
 
 /**
- * Create torus vertex array object
- *
- * A torus is a circle of circles. numt defines the number
- * of divisions for the outer circle, numc defines the number
- * of divisions for the inner circles
+ * Point the attributes of the bound vertex array object at the torus
+ * buffers, float or quantised
  *
- * @param numc
- *   The number of circles
-  * @param numt
- *   The number of divisions for each circle
+ * @param program
+ *   The program the vertex array object is drawn with
+ * @param shaded
+ *   True to set up normals and texture coordinates as well
  */
-void createTorus(int numc, int numt, double radiusInner = 2, double radiusOuter = 2.3)
+void setTorusAttributes(GL::Program* program, bool shaded)
 {
-   int i, j;
-   
-   // Radius of the circles
-   double radiusMiddle = abs((radiusOuter - radiusInner) * 0.5);
-   // Distance from center of torus to the center of the circles
-   double distToMiddle = radiusInner + radiusMiddle;
-   
-   // First step is to create a single circle and translate it out along
-   // the x-axis
-   vector<vec4> circlePos;
-   circlePos.reserve(numc);
+   GLint vertex = program->getAttribLocation("vertex");
+   GLint normal = shaded ? program->getAttribLocation("normal") : -1;
+   GLint tc     = shaded ? program->getAttribLocation("tc")     : -1;
 
-   vector<vec4> circleNormal;
-   circleNormal.reserve(numc);
-   
-   for(int i = 0; i < numt; i++)
+   if(_quantizeTorus)
    {
-      double theta = i * 2 * M_PI / numc;
-      double y = sin(theta) * radiusMiddle;
-      double x = cos(theta) * radiusMiddle + distToMiddle;
-      
-      vec4 pos4(x,y,0,1);
-      vec3 normal3 = normalize(vec3(x,y,0));
-      vec4 normal4(normal3.x, normal3.y, normal3.z, 0);
-      
-      circlePos.push_back(pos4);
-      circleNormal.push_back(normal4);
+      glBindBuffer(GL_ARRAY_BUFFER, _buffers[TORUS_POS]);
+      _torusVertices.setAttributes(vertex, normal, tc);
+      return;
    }
 
-   // After the initial circle is created, make numc copies of the circle, but
-   // rotate them about the y-axis
-   vector<vec4> pos;
-   vector<vec4> normals;
-   vector<vec2> tc;
-   pos.reserve(numc * numt);
-   normals.reserve(numc * numt);
-   tc.reserve(numc * numt);
+   // Interleaved Procedural::Vertex
+   GLsizei stride = sizeof(Procedural::Vertex);
+   glBindBuffer(GL_ARRAY_BUFFER, _buffers[TORUS_POS]);
+   glVertexAttribPointer(vertex, 3, GL_FLOAT, GL_FALSE, stride,
+                         (const GLvoid*) offsetof(Procedural::Vertex, position));
+   glEnableVertexAttribArray(vertex);
 
-   for(int j = 0; j < numc; j++)
+   if(shaded)
    {
-      float t = j / float(numc);
-      
-      quat rot(vec3(0.0f, t * 2 * M_PI, 0.0f));
-      
-      for(unsigned int i = 0; i < circlePos.size(); i++)
-      {
-         float s = i / float(circlePos.size());
-         
-         vec4 vPos = circlePos.at(i);
-         vec4 vNormal = circleNormal.at(i);
-         
-         pos.push_back(rot * vPos);
-         normals.push_back(normalize(rot * vNormal));
-         tc.push_back(vec2(s,t));
-      }
+      glVertexAttribPointer(normal, 3, GL_FLOAT, GL_FALSE, stride,
+                            (const GLvoid*) offsetof(Procedural::Vertex, normal));
+      glEnableVertexAttribArray(normal);
+
+      glVertexAttribPointer(tc, 2, GL_FLOAT, GL_FALSE, stride,
+                            (const GLvoid*) offsetof(Procedural::Vertex, texcoord));
+      glEnableVertexAttribArray(tc);
    }
-   
-   // Now that the points, normals and texture coordinates have been created, set up the element indices
-   // to draw the points in the proper order. There are different orders for wireframe and triangle meshes.
-   
-   vector<GLuint> triIdx;
-   vector<GLuint> linesIdx;
-   
-   for(i = 0; i < numc; i++)
-   {
-      int nextCol = i + 1;
-      if(nextCol >= numc)
-      {
-         nextCol = 0;
-      }
+}
 
-      for(j = 0; j <= numt; j++)
-      {
-         // Need to identify the four elements / indices that make
-         // up the quad at this point
+/**
+ * Set the block members the vertex shaders use to decode positions and
+ * normals. Float meshes use the identity.
+ *
+ * @param block
+ *   Block of the object about to be drawn
+ * @param torus
+ *   True for the torus, false for the quad
+ */
+void setVertexDecode(ObjectBlock& block, bool torus)
+{
+   vec3 scale(1.0f);
+   vec3 offset(0.0f);
+   int  normalEncoding = Quantize::NORMAL_FLOAT;
 
-         
-         int nextRow = j + 1;
-         if(nextRow >= numt)
-         {
-            nextRow = 0;
-         }
+   if(torus && _quantizeTorus)
+   {
+      scale  = vec3(_torusVertices.positionScale[0], _torusVertices.positionScale[1], _torusVertices.positionScale[2]);
+      offset = vec3(_torusVertices.positionOffset[0], _torusVertices.positionOffset[1], _torusVertices.positionOffset[2]);
+      normalEncoding = _torusVertices.normalEncoding;
+   }
 
-         GLuint ll = numc * i       + j;       // Lower left index
-         GLuint ul = numc * i       + nextRow; // Upper left index
-         GLuint lr = numc * nextCol + j;       // Lower right index
-         GLuint ur = numc * nextCol + nextRow; // Upper right index
-         
-         triIdx.push_back(ul);
-         triIdx.push_back(ll);
-         triIdx.push_back(lr);
-         
-         triIdx.push_back(lr);
-         triIdx.push_back(ur);
-         triIdx.push_back(ul);
-         
-         
-         linesIdx.push_back(ll);
-         linesIdx.push_back(ul);
+   block.positionScale  = vec4(scale, 0.0f);
+   block.positionOffset = vec4(offset, 0.0f);
+   block.normalEncoding = normalEncoding;
+}
 
-         linesIdx.push_back(ul);
-         linesIdx.push_back(lr);
+/**
+ * Check the uniform blocks against FrameBlock and ObjectBlock, connect
+ * them to their binding points and create the ring buffer render()
+ * fills. The depth map sampler never changes, so it is set here.
+ */
+void setupUniformBlocks(void)
+{
+   _flatProgram->checkUniformBlock("Object", sizeof(ObjectBlock), _objectMembers,
+                                   sizeof(_objectMembers) / sizeof(_objectMembers[0]));
+   _flatProgram->setUniformBlockBinding("Object", OBJECT_BINDING);
+
+   _shadowProgram->checkUniformBlock("Frame", sizeof(FrameBlock), _frameMembers,
+                                     sizeof(_frameMembers) / sizeof(_frameMembers[0]));
+   _shadowProgram->checkUniformBlock("Object", sizeof(ObjectBlock), _objectMembers,
+                                     sizeof(_objectMembers) / sizeof(_objectMembers[0]));
+   _shadowProgram->setUniformBlockBinding("Frame", FRAME_BINDING);
+   _shadowProgram->setUniformBlockBinding("Object", OBJECT_BINDING);
+
+   _shadowProgram->bind();
+   _shadowProgram->getUniform<GLint>("depthMap").set(0);
+
+   _uniformRing = new GL::UniformRing(sizeof(FrameBlock) + NUM_DRAWS * sizeof(ObjectBlock),
+                                      1 + NUM_DRAWS);
+}
 
-         linesIdx.push_back(lr);
-         linesIdx.push_back(ll);
-         
-      }
-   }
-   
-   _numTorusPoints = pos.size();
-   _numTorusTriIdx = triIdx.size();
-   _numTorusLinesIdx = linesIdx.size();
+/**
+ * Create torus vertex array object
+ *
+ * A torus is a circle of circles. numt defines the number
+ * of divisions for the outer circle, numc defines the number
+ * of divisions for the inner circles
+ *
+ * @param numc
+ *   The number of circles
+  * @param numt
+ *   The number of divisions for each circle
+ */
+void createTorus(int numc, int numt, double radiusInner = 2, double radiusOuter = 2.3)
+{
+   // Vertices straight into one interleaved array, indices from the
+   // cache shared by every torus of this resolution
+   double start = glfwGetTime();
+   vector<Procedural::Vertex> vertices(Procedural::numVertices(numc, numt));
+   Procedural::torus(numc, numt, GLfloat(radiusInner), GLfloat(radiusOuter), &vertices[0]);
+   const Procedural::Indices& indices = Procedural::indices(numc, numt);
+   std::cout << "Torus " << numc << " x " << numt << ": " << vertices.size() << " vertices, "
+             << indices.triangles.size() / 3 << " triangles in " << 1e3 * (glfwGetTime() - start) << " ms"
+             << std::endl;
+
+   // Split the triangles into meshlets. The clusters hold the same
+   // triangles in a new order, so their indices replace the cached ones
+   Meshlet::build(vertices[0].position, sizeof(Procedural::Vertex), GLuint(vertices.size()),
+                  indices.triangles, _torusClusters);
+   std::cout << "Torus meshlets: " << _torusClusters.clusters.size() << " clusters of up to 64 vertices and 126 triangles"
+             << std::endl;
+
+   _numTorusPoints = vertices.size();
+   _numTorusTriIdx = indices.triangles.size();
+   _numTorusLinesIdx = indices.lines.size();
 
    //
    // Set up torus buffers for position, normals, texture coordinates, and element array indices
    // for wireframe and triangles
    //
-   glBindBuffer(GL_ARRAY_BUFFER, _buffers[TORUS_POS]);
-   glBufferData(GL_ARRAY_BUFFER, pos.size() * sizeof(glm::vec4), &pos[0], GL_STATIC_DRAW);
-
-   glBindBuffer(GL_ARRAY_BUFFER, _buffers[TORUS_NORMAL]);
-   glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(glm::vec4), &normals[0], GL_STATIC_DRAW);
-
-   glBindBuffer(GL_ARRAY_BUFFER, _buffers[TORUS_TC]);
-   glBufferData(GL_ARRAY_BUFFER, tc.size() * sizeof(glm::vec2), &tc[0], GL_STATIC_DRAW);
+   if(_quantizeTorus)
+   {
+      // 16 bytes a vertex instead of 32
+      GLsizei stride = sizeof(Procedural::Vertex);
+      Quantize::quantize(vertices[0].position, stride, vertices[0].normal, stride, vertices[0].texcoord, stride,
+                         GLuint(vertices.size()), _torusNormalEncoding, _torusVertices);
+
+      const Quantize::Error& error = _torusVertices.error;
+      std::cout << "Quantised torus: " << vertices.size() * sizeof(Procedural::Vertex) << " -> "
+                << _torusVertices.data.size() << " bytes, max position error " << error.position
+                << " (" << error.positionRelative * 100.0f << "% of the diagonal), max normal error "
+                << error.normalDegrees << " degrees, max texture coordinate error " << error.texcoord
+                << std::endl;
+
+      glBindBuffer(GL_ARRAY_BUFFER, _buffers[TORUS_POS]);
+      glBufferData(GL_ARRAY_BUFFER, _torusVertices.data.size(), &_torusVertices.data[0], GL_STATIC_DRAW);
+   }
+   else
+   {
+      glBindBuffer(GL_ARRAY_BUFFER, _buffers[TORUS_POS]);
+      glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Procedural::Vertex), &vertices[0], GL_STATIC_DRAW);
+   }
 
    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _buffers[TORUS_TRI_IDX]);
-   glBufferData(GL_ELEMENT_ARRAY_BUFFER, triIdx.size() * sizeof(GLuint), &triIdx[0], GL_STATIC_DRAW);
+   glBufferData(GL_ELEMENT_ARRAY_BUFFER, _torusClusters.indices.size() * sizeof(GLuint), &_torusClusters.indices[0],
+                GL_STATIC_DRAW);
 
    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _buffers[TORUS_LINES_IDX]);
-   glBufferData(GL_ELEMENT_ARRAY_BUFFER, linesIdx.size() * sizeof(GLuint), &linesIdx[0], GL_STATIC_DRAW);
+   glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.lines.size() * sizeof(GLuint), &indices.lines[0], GL_STATIC_DRAW);
 
    //
    // Point cloud torus
    //
-   glBindVertexArray(_vao[TORUS_POINTS]);
-   glBindBuffer(GL_ARRAY_BUFFER, _buffers[TORUS_POS]);
-   glVertexAttribPointer(_flatProgram->getAttribLocation("vertex"), 4, GL_FLOAT, GL_FALSE, 0, 0);
-   glEnableVertexAttribArray(_flatProgram->getAttribLocation("vertex"));
+   _state.bindVertexArray(_vao[TORUS_POINTS]);
+   setTorusAttributes(_flatProgram, false);
 
    //
    // Wireframe torus
    //
-   glBindVertexArray(_vao[TORUS_LINES]);
+   _state.bindVertexArray(_vao[TORUS_LINES]);
 
-   glBindBuffer(GL_ARRAY_BUFFER, _buffers[TORUS_POS]);
-   glVertexAttribPointer(_flatProgram->getAttribLocation("vertex"), 4, GL_FLOAT, GL_FALSE, 0, 0);
-   glEnableVertexAttribArray(_flatProgram->getAttribLocation("vertex"));
+   setTorusAttributes(_flatProgram, false);
    
    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _buffers[TORUS_LINES_IDX]);
    
@@ -460,30 +545,18 @@ void createTorus(int numc, int numt, double radiusInner = 2, double radiusOuter
    //
    // Shaded torus
    //
-   glBindVertexArray(_vao[TORUS_SHADED]);
+   _state.bindVertexArray(_vao[TORUS_SHADED]);
    
-   glBindBuffer(GL_ARRAY_BUFFER, _buffers[TORUS_POS]);
-   glVertexAttribPointer(_shadowProgram->getAttribLocation("vertex"), 4, GL_FLOAT, GL_FALSE, 0, 0);
-   glEnableVertexAttribArray(_shadowProgram->getAttribLocation("vertex"));
-   
-   glBindBuffer(GL_ARRAY_BUFFER, _buffers[TORUS_NORMAL]);
-   glVertexAttribPointer(_shadowProgram->getAttribLocation("normal"), 4, GL_FLOAT, GL_FALSE, 0, 0);
-   glEnableVertexAttribArray(_shadowProgram->getAttribLocation("normal"));
-   
-   glBindBuffer(GL_ARRAY_BUFFER, _buffers[TORUS_TC]);
-   glVertexAttribPointer(_shadowProgram->getAttribLocation("tc"), 2, GL_FLOAT, GL_FALSE, 0, 0);
-   glEnableVertexAttribArray(_shadowProgram->getAttribLocation("tc"));
+   setTorusAttributes(_shadowProgram, true);
    
    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _buffers[TORUS_TRI_IDX]);
 
    //
    // Flat shaded torus
    //
-   glBindVertexArray(_vao[TORUS_FLAT]);
+   _state.bindVertexArray(_vao[TORUS_FLAT]);
    
-   glBindBuffer(GL_ARRAY_BUFFER, _buffers[TORUS_POS]);
-   glVertexAttribPointer(_flatProgram->getAttribLocation("vertex"), 4, GL_FLOAT, GL_FALSE, 0, 0);
-   glEnableVertexAttribArray(_flatProgram->getAttribLocation("vertex"));
+   setTorusAttributes(_flatProgram, false);
    
    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _buffers[TORUS_TRI_IDX]);
 }
@@ -525,7 +598,7 @@ void createQuad()
    //
    // Set up VAO for flat shaded quads, no texture coords, no normals
    //
-   glBindVertexArray(_vao[QUAD_FLAT]);
+   _state.bindVertexArray(_vao[QUAD_FLAT]);
    
    glBindBuffer(GL_ARRAY_BUFFER, _buffers[QUAD_POS]);
    glVertexAttribPointer(_flatProgram->getAttribLocation("vertex"), 4, GL_FLOAT, GL_FALSE, 0, 0);
@@ -534,7 +607,7 @@ void createQuad()
    //
    // Set up VAO for shaded quads, with texture coords and normals
    //
-   glBindVertexArray(_vao[QUAD_SHADED]);
+   _state.bindVertexArray(_vao[QUAD_SHADED]);
    
    glBindBuffer(GL_ARRAY_BUFFER, _buffers[QUAD_POS]);
    glVertexAttribPointer(_shadowProgram->getAttribLocation("vertex"), 4, GL_FLOAT, GL_FALSE, 0, 0);
@@ -601,8 +674,11 @@ void init(void)
       _flatVertFile     = std::string(SOURCE_DIR) + "/flat.vsh";
       _flatFragFile     = std::string(SOURCE_DIR) + "/flat.fsh";
       
+      // After the first run the programs load from binaries kept here
+      GL::Program::setBinaryCache(std::string(PROJECT_BINARY_DIR) + "/program_cache");
       _shadowProgram = new GL::Program(_shadowVertexFile, _shadowFragFile);
       _flatProgram   = new GL::Program(_flatVertFile,     _flatFragFile);
+      std::cout << GL::Program::cacheReport() << std::endl;
       
       // Generate handles for vertex array objects
       _vao.resize(NUM_VAO_OBJECTS, 0);
@@ -614,6 +690,7 @@ void init(void)
       
       createQuad();
       createTorus(50,50,1, 1.5);
+      setupUniformBlocks();
       
       // Set the clear color
       glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
@@ -622,7 +699,7 @@ void init(void)
       glClearDepth(1.0f);
       
       // Enable depth test
-      glEnable(GL_DEPTH_TEST);
+      _state.enable(GL_DEPTH_TEST);
       GL_ERR_CHECK();
    }
    catch (std::runtime_error exception)
@@ -644,7 +721,7 @@ void resize(GLFWwindow* window, int width, int height)
    {
       // Set the affine transform of (x,y) from normalized device coordinates to
       // window coordinates. In this case, (-1,1) -> (0, width) and (-1,1) -> (0, height)
-      glViewport(0, 0, width, height);
+      _state.viewport(0, 0, width, height);
       GL_ERR_CHECK();
       
       _winWidth = width;
@@ -744,6 +821,10 @@ void keypress(GLFWwindow* window, int key, int scancode, int state, int mods)
          case GLFW_KEY_SPACE:
             _objToRotate = _objToRotate == ROTATE_OCCLUDER ? ROTATE_EYE : ROTATE_OCCLUDER;
             break;
+         case GLFW_KEY_C:
+            _cullTorus = !_cullTorus;
+            std::cout << "Meshlet culling " << (_cullTorus ? "on" : "off") << std::endl;
+            break;
       }
    }
 }
@@ -756,6 +837,64 @@ void close(GLFWwindow* window)
    glfwSetWindowShouldClose(window, GL_TRUE);
 }
 
+/**
+ * Draw the torus with the bound vertex array object, leaving out the
+ * meshlets that are outside the view or facing away from the eye
+ *
+ * @param mvp
+ *    Model, view, projection matrix
+ * @param model
+ *    Model matrix
+ * @param eye
+ *    Eye position in world space
+ * @return the number of triangles culled
+ */
+GLuint drawTorus(const mat4& mvp, const mat4& model, const vec3& eye)
+{
+   if(!_cullTorus)
+   {
+      glDrawElements(GL_TRIANGLES, _numTorusTriIdx, GL_UNSIGNED_INT, NULL);
+      return 0;
+   }
+
+   // The clusters are in model space
+   vec4 modelEye = glm::inverse(model) * vec4(eye, 1.0f);
+   GLfloat eyeModel[3] = { modelEye.x, modelEye.y, modelEye.z };
+
+   Meshlet::CullStats stats = Meshlet::cull(_torusClusters, glm::value_ptr(mvp), eyeModel, 0, _torusDrawList);
+   _torusDrawList.draw();
+   return stats.culled();
+}
+
+/**
+ * Print how many torus triangles were culled and how many GL state calls
+ * the last frame issued and skipped, about once a second
+ *
+ * @param time
+ *    Time elapsed in seconds since the start of the program
+ */
+void reportCulling(double time)
+{
+   _cullFrames++;
+   if(time - _cullReportTime < 1.0)
+   {
+      return;
+   }
+
+   if(_cullTorus)
+   {
+      std::cout << "Meshlets: culled " << _culledShadow / _cullFrames << " of " << _numTorusTriIdx / 3
+                << " torus triangles in the shadow pass, " << _culledCamera / _cullFrames
+                << " in the camera pass, per frame" << std::endl;
+   }
+   std::cout << _state.report() << std::endl;
+
+   _culledShadow = 0;
+   _culledCamera = 0;
+   _cullFrames = 0;
+   _cullReportTime = time;
+}
+
 /**
  * Main loop
  * @param time    time elapsed in seconds since the start of the program
@@ -768,27 +907,21 @@ int render(double time)
       
       mat4 translate;
       mat4 scale;
-      mat4 mvp;
       mat4 rot;
       vec4 lightPos = vec4(0, 10, 0, 1);
-      mat4 toShadowTex0;
-      mat4 toShadowTex1;
       mat4 modelOccluder;
       mat4 modelReceiver;
+      ObjectBlock objects[NUM_DRAWS];
+      FrameBlock  frame;
 
       // Matrix that maps from [-1, 1] -> [0,1], which maps from clip space to texture map space
       mat4 clipToTexture = glm::scale(glm::translate(mat4(1), vec3(0.5, 0.5, 0.5)), vec3(0.5, 0.5, 0.5));
 
       //----------------------------------------------------------------------------------------------------
-      // Draw depth pass from light's point of view.
+      // Fill the uniform blocks of both passes. The draws read them from the ring buffer, which can't
+      // be mapped while they are issued.
       //----------------------------------------------------------------------------------------------------
-      glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
-      glViewport(0, 0, _fboWidth, _fboHeight);
-      
-      // Clear the framebuffer
-      glClearColor(0, 0, 0, 0);
-      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-      
+
       // Set up the light's view and projection matrices
       glm::mat4 lightView = glm::lookAt(vec3(lightPos.x, lightPos.y, lightPos.z), vec3(0, 0, 0), vec3(0, 0, 1));
       glm::mat4 lightProj = glm::perspective(45.0f,                        // 45 degree field of view
@@ -796,92 +929,107 @@ int render(double time)
                                              0.1f,                         // Near clip
                                              1000.0f);                     // Far clip
       
-      //----------------------------------------
-      // Draw the occluding surface, flat shaded
-      // all we care about is the depth
-      //----------------------------------------
-      
       // Set up model, view, projection matrix for occluding surface
       rot           = glm::mat4_cast(_occluderRot);
       translate     = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 3.0f, 0.0f));
       modelOccluder = translate * rot;
-      mvp           = lightProj * lightView * modelOccluder;
-      
-      // Need to keep the mvp for this surface from the light's point of view. This will be used
-      // in the render pass where the shadows are drawn
-      toShadowTex0 = clipToTexture * mvp;
-      
-      // Bind the flat shader program. No need for a fancy shader on this pass, just need the depth
-      _flatProgram->bind();
-      _flatProgram->setUniform("mvp",      mvp);
-      
-      // Draw the occluding surface
-      glBindVertexArray(_vao[TORUS_FLAT]);
-      glDrawElements(GL_TRIANGLES, _numTorusTriIdx, GL_UNSIGNED_INT, NULL);
-      GL_ERR_CHECK();
+      objects[OCCLUDER_DEPTH].mvp = lightProj * lightView * modelOccluder;
+      setVertexDecode(objects[OCCLUDER_DEPTH], true);
       
       // Set up modle, view, projection matrix for the receiving surface
       rot           = glm::mat4_cast(_receiverRot);
       translate     = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -1.0f, 0.0f));
       scale         = glm::scale(glm::mat4(1.0f), glm::vec3(5.0f, 5.0f, 1.0f));
       modelReceiver = translate * rot * scale;
-      mvp           = lightProj * lightView * modelReceiver;
+      objects[RECEIVER_DEPTH].mvp = lightProj * lightView * modelReceiver;
+      setVertexDecode(objects[RECEIVER_DEPTH], false);
+
+      // view = lookat matrix * eye rotation matrix
+      frame.view = glm::lookAt(vec3(0, 0, 10), vec3(0, 0, 0), vec3(0, 1, 0)) * glm::mat4_cast(_eyeRot);
+      frame.worldLightPos = vec4(10, 10, -10, 1);
 
-      // Need to keep the mvp for this surface from the light's point of view. This will be used
+      // Need to keep the mvp of each surface from the light's point of view. This is used
       // in the render pass where the shadows are drawn
-      toShadowTex1 = clipToTexture * mvp;
+      objects[OCCLUDER_SHADED].mvp         = _projection * frame.view * modelOccluder;
+      objects[OCCLUDER_SHADED].model       = modelOccluder;
+      objects[OCCLUDER_SHADED].toShadowTex = clipToTexture * objects[OCCLUDER_DEPTH].mvp;
+      setVertexDecode(objects[OCCLUDER_SHADED], true);
+
+      objects[RECEIVER_SHADED].mvp         = _projection * frame.view * modelReceiver;
+      objects[RECEIVER_SHADED].model       = modelReceiver;
+      objects[RECEIVER_SHADED].toShadowTex = clipToTexture * objects[RECEIVER_DEPTH].mvp;
+      setVertexDecode(objects[RECEIVER_SHADED], false);
+
+      GLintptr objectOffsets[NUM_DRAWS];
+      _uniformRing->begin();
+      GLintptr frameOffset = _uniformRing->push(frame);
+      for(int i = 0; i < NUM_DRAWS; ++i)
+      {
+         objectOffsets[i] = _uniformRing->push(objects[i]);
+      }
+      _uniformRing->end();
+
+      //----------------------------------------------------------------------------------------------------
+      // Draw depth pass from light's point of view.
+      //----------------------------------------------------------------------------------------------------
+      _state.bindFramebuffer(GL_FRAMEBUFFER, _fbo);
+      _state.viewport(0, 0, _fboWidth, _fboHeight);
+      
+      // Clear the framebuffer
+      glClearColor(0, 0, 0, 0);
+      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+      
+      //----------------------------------------
+      // Draw the occluding surface, flat shaded
+      // all we care about is the depth
+      //----------------------------------------
       
-      _flatProgram->setUniform("mvp",      mvp);
+      // Bind the flat shader program. No need for a fancy shader on this pass, just need the depth
+      _flatProgram->bind();
+      _uniformRing->bind(OBJECT_BINDING, objectOffsets[OCCLUDER_DEPTH], sizeof(ObjectBlock));
+      
+      // Draw the occluding surface
+      _state.bindVertexArray(_vao[TORUS_FLAT]);
+      _culledShadow += drawTorus(objects[OCCLUDER_DEPTH].mvp, modelOccluder, vec3(lightPos.x, lightPos.y, lightPos.z));
+      GL_ERR_CHECK();
+      
+      _uniformRing->bind(OBJECT_BINDING, objectOffsets[RECEIVER_DEPTH], sizeof(ObjectBlock));
       
       // Draw occluding surface. Use the same vertex array object as the previous surface - they're both
       // the same shape, just different position, rotation and scale
-      glBindVertexArray(_vao[QUAD_FLAT]);
+      _state.bindVertexArray(_vao[QUAD_FLAT]);
       glDrawArrays(GL_TRIANGLE_STRIP, 0, _posQuad.size());
       GL_ERR_CHECK();
       
       //----------------------------------------------------------------------------------------------------
       // Draw pass from camera's point of view
       //----------------------------------------------------------------------------------------------------
-      glBindFramebuffer(GL_FRAMEBUFFER, 0);
-      glViewport(0, 0, _winWidth, _winHeight);
+      _state.bindFramebuffer(GL_FRAMEBUFFER, 0);
+      _state.viewport(0, 0, _winWidth, _winHeight);
       glClearColor(0.3f, 0.4f, 0.95f, 1.0f);
       glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
       GL_ERR_CHECK();
       
-      // view = lookat matrix * eye rotation matrix
-      glm::mat4 view = glm::lookAt(vec3(0, 0, 10), vec3(0, 0, 0), vec3(0, 1, 0)) * glm::mat4_cast(_eyeRot);
-      
-      lightPos = vec4(10, 10, -10, 1);
-      
-      // Set up model, view, projection matrix for occluding surface
-      mvp        = _projection * view * modelOccluder;
-      
-      glActiveTexture(GL_TEXTURE0);
-      glBindTexture(GL_TEXTURE_2D, _fboTextures[DEPTH]);
+      _state.bindTexture(0, GL_TEXTURE_2D, _fboTextures[DEPTH]);
       
       // Bind the shader program that will draw the shadows and do some simple shading
       _shadowProgram->bind();
-      _shadowProgram->setUniform("mvp",           mvp);
-      _shadowProgram->setUniform("worldLightPos", lightPos);
-      _shadowProgram->setUniform("view",          view);
-      _shadowProgram->setUniform("model",         modelOccluder);
-      _shadowProgram->setUniform("depthMap",      0);
-      _shadowProgram->setUniform("toShadowTex",   toShadowTex0);
-      glBindVertexArray(_vao[TORUS_SHADED]);
-      glDrawElements(GL_TRIANGLES, _numTorusTriIdx, GL_UNSIGNED_INT, NULL);
+      _uniformRing->bind(FRAME_BINDING, frameOffset, sizeof(FrameBlock));
+      _uniformRing->bind(OBJECT_BINDING, objectOffsets[OCCLUDER_SHADED], sizeof(ObjectBlock));
+      _state.bindVertexArray(_vao[TORUS_SHADED]);
+      vec4 eye = glm::inverse(frame.view) * vec4(0.0f, 0.0f, 0.0f, 1.0f);
+      _culledCamera += drawTorus(objects[OCCLUDER_SHADED].mvp, modelOccluder, vec3(eye.x, eye.y, eye.z));
       GL_ERR_CHECK();
       
-      mvp        = _projection * view * modelReceiver;
-
-      _shadowProgram->bind();
-      _shadowProgram->setUniform("mvp",         mvp);
-      _shadowProgram->setUniform("model",       modelReceiver);
-      _shadowProgram->setUniform("toShadowTex", toShadowTex1);
+      _uniformRing->bind(OBJECT_BINDING, objectOffsets[RECEIVER_SHADED], sizeof(ObjectBlock));
       
       // Draw the receiving surface
-      glBindVertexArray(_vao[QUAD_SHADED]);
+      _state.bindVertexArray(_vao[QUAD_SHADED]);
       glDrawArrays(GL_TRIANGLE_STRIP, 0, _posQuad.size());
       GL_ERR_CHECK();
+
+      reportCulling(time);
+      _state.endFrame();
    }
    catch (std::runtime_error exception)
    {
@@ -902,6 +1050,31 @@ int main(int argc, char* argv[])
    _sensitivity = float(M_PI) / 360.0f;
    _objToRotate = ROTATE_OCCLUDER;
    _eye = vec4(0.0f, 0.0f, 2.0f, 1.0f);
+
+   // --quantize stores the torus with octahedral normals,
+   // --quantize=1010102 with 10_10_10_2 normals
+   _quantizeTorus = false;
+   _torusNormalEncoding = Quantize::NORMAL_OCTAHEDRAL;
+
+   // --nocull draws the whole torus every time, C toggles it
+   _cullTorus = true;
+   for(int i = 1; i < argc; ++i)
+   {
+      std::string arg(argv[i]);
+      if(arg == "--quantize" || arg == "--quantize=oct")
+      {
+         _quantizeTorus = true;
+      }
+      else if(arg == "--quantize=1010102")
+      {
+         _quantizeTorus = true;
+         _torusNormalEncoding = Quantize::NORMAL_10_10_10_2;
+      }
+      else if(arg == "--nocull")
+      {
+         _cullTorus = false;
+      }
+   }
    
    // Open up the log file
    std::string logFile = std::string(PROJECT_BINARY_DIR) + "/log.txt";